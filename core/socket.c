@@ -21,6 +21,7 @@
 #include "assert.h"
 #include "socket.h"
 #include "event.h"
+#include "timer.h"
 #include "log.h"
 
 #ifdef _WIN32
@@ -32,13 +33,25 @@
 #   include <sys/socket.h>
 #   include <arpa/inet.h>
 #   include <netinet/in.h>
-#   include <netinet/tcp.h>
+#   ifdef __linux__
+        /* struct tcp_info of the kernel. libc header ends before the newer fields */
+#       include <linux/tcp.h>
+#   else
+#       include <netinet/tcp.h>
+#   endif
 #   ifdef HAVE_NETINET_SCTP_H
 #       include <netinet/sctp.h>
 #   endif
 #   include <netdb.h>
 #endif
 
+#ifdef __linux__
+#   include <sys/ioctl.h>
+#   include <linux/filter.h>
+#   include <linux/sockios.h>
+#   include <linux/sock_diag.h>
+#endif
+
 #ifdef IGMP_EMULATION
 #   define IP_HEADER_SIZE 24
 #   define IGMP_HEADER_SIZE 8
@@ -59,12 +72,19 @@ struct asc_socket_t
     struct sockaddr_in sockaddr; /* recvfrom, sendto, set_sockaddr */
 
     struct ip_mreq mreq;
+    struct in_addr mreq_source; /* source-specific multicast */
 
     /* Callbacks */
     void *arg;
     event_callback_t on_read;      /* data read */
     event_callback_t on_close;     /* error occured (connection closed) */
     event_callback_t on_ready;     /* data send is possible now */
+
+    /* Layer */
+    const asc_socket_layer_t *layer;
+    void *layer_arg;
+    asc_timer_t *layer_timer;      /* on_read for the data buffered in the layer */
+    bool is_send_wait;             /* write event is off until the read event */
 };
 
 /*
@@ -132,6 +152,7 @@ static asc_socket_t * __socket_open(int family, int type, int protocol, void * a
     asc_socket_t *sock = (asc_socket_t *)calloc(1, sizeof(asc_socket_t));
     sock->fd = fd;
     sock->mreq.imr_multiaddr.s_addr = INADDR_NONE;
+    sock->mreq_source.s_addr = INADDR_ANY;
     sock->family = family;
     sock->type = type;
     sock->protocol = protocol;
@@ -195,6 +216,12 @@ void asc_socket_close(asc_socket_t *sock)
     if(sock->event)
         asc_event_close(sock->event);
 
+    if(sock->layer_timer)
+        asc_timer_destroy(sock->layer_timer);
+
+    if(sock->layer)
+        sock->layer->close(sock->layer_arg);
+
     if(sock->fd > 0)
     {
 #ifdef _WIN32
@@ -239,9 +266,40 @@ static void __asc_socket_on_accept(void *arg)
     sock->on_read(sock->arg);
 }
 
+static void __asc_socket_on_ready(void *arg);
+
 static void __asc_socket_on_read(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
+
+    if(sock->is_send_wait)
+    {
+        sock->is_send_wait = false;
+        if(sock->on_ready)
+            asc_event_set_on_write(sock->event, __asc_socket_on_ready);
+
+        if(!sock->on_read)
+        {
+            /* record from the peer is processed by the layer */
+            asc_event_set_on_read(sock->event, NULL);
+            sock->layer->is_ready(sock->layer_arg);
+            return;
+        }
+    }
+
+    if(!sock->on_read)
+        return;
+
+    if(sock->layer && !sock->layer->is_ready(sock->layer_arg))
+        return;
+
+    sock->on_read(sock->arg);
+}
+
+static void __asc_socket_on_layer_pending(void *arg)
+{
+    asc_socket_t *sock = (asc_socket_t *)arg;
+    sock->layer_timer = NULL;
     if(sock->on_read)
         sock->on_read(sock->arg);
 }
@@ -249,6 +307,16 @@ static void __asc_socket_on_read(void *arg)
 static void __asc_socket_on_ready(void *arg)
 {
     asc_socket_t *sock = (asc_socket_t *)arg;
+
+    if(sock->layer && sock->layer->is_send_wait(sock->layer_arg))
+    {
+        /* write is not possible until the peer data is read. resumed in on_read */
+        sock->is_send_wait = true;
+        asc_event_set_on_write(sock->event, NULL);
+        asc_event_set_on_read(sock->event, __asc_socket_on_read);
+        return;
+    }
+
     if(sock->on_ready)
         sock->on_ready(sock->arg);
 }
@@ -270,12 +338,19 @@ static bool __asc_socket_check_event(asc_socket_t *sock)
         {
             asc_event_close(sock->event);
             sock->event = NULL;
+            sock->is_send_wait = false;
         }
     }
 
     return (sock->event != NULL);
 }
 
+/* change the argument of the callbacks. used to pass the socket to another owner */
+void asc_socket_set_arg(asc_socket_t *sock, void *arg)
+{
+    sock->arg = arg;
+}
+
 void asc_socket_set_on_read(asc_socket_t *sock, event_callback_t on_read)
 {
     if(sock->on_read == on_read)
@@ -285,7 +360,7 @@ void asc_socket_set_on_read(asc_socket_t *sock, event_callback_t on_read)
 
     if(__asc_socket_check_event(sock))
     {
-        if(on_read != NULL)
+        if(on_read != NULL || sock->is_send_wait)
             on_read = __asc_socket_on_read;
         asc_event_set_on_read(sock->event, on_read);
     }
@@ -300,7 +375,9 @@ void asc_socket_set_on_ready(asc_socket_t * sock, event_callback_t on_ready)
 
     if(__asc_socket_check_event(sock))
     {
-        if(on_ready != NULL)
+        if(sock->is_send_wait)
+            on_ready = NULL;
+        else if(on_ready != NULL)
             on_ready = __asc_socket_on_ready;
         asc_event_set_on_write(sock->event, on_ready);
     }
@@ -412,6 +489,9 @@ bool asc_socket_accept(asc_socket_t *sock, asc_socket_t **client_ptr, void * arg
         return false;
     }
 
+    client->family = sock->family;
+    client->type = sock->type;
+    client->protocol = sock->protocol;
     client->arg = arg;
     asc_socket_set_nonblock(client, true);
 
@@ -513,6 +593,21 @@ void asc_socket_connect(  asc_socket_t *sock, const char *addr, int port
 
 ssize_t asc_socket_recv(asc_socket_t *sock, void *buffer, size_t size)
 {
+    if(sock->layer)
+    {
+        const ssize_t ret = sock->layer->recv(sock->layer_arg, buffer, size);
+
+        /* socket event is not triggered for the data left in the layer */
+        if(   ret > 0
+           && !sock->layer_timer
+           && sock->layer->pending(sock->layer_arg) > 0)
+        {
+            sock->layer_timer = asc_timer_one_shot(0, __asc_socket_on_layer_pending, sock);
+        }
+
+        return ret;
+    }
+
     return recv(sock->fd, buffer, size, 0);
 }
 
@@ -522,6 +617,82 @@ ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size)
     return recvfrom(sock->fd, buffer, size, 0, (struct sockaddr *)&sock->sockaddr, &slen);
 }
 
+int asc_socket_recv_batch(asc_socket_t *sock, asc_socket_msg_t *msg, int count)
+{
+    if(count > ASC_SOCKET_BATCH_SIZE)
+        count = ASC_SOCKET_BATCH_SIZE;
+
+#ifdef __linux__
+    struct mmsghdr mmsg[ASC_SOCKET_BATCH_SIZE];
+    struct iovec iov[ASC_SOCKET_BATCH_SIZE];
+    uint64_t control[ASC_SOCKET_BATCH_SIZE]
+                    [(  CMSG_SPACE(sizeof(struct timespec))
+                      + CMSG_SPACE(sizeof(uint32_t))
+                      + CMSG_SPACE(sizeof(struct in_pktinfo))) / 8 + 1];
+
+    memset(mmsg, 0, sizeof(struct mmsghdr) * count);
+    for(int i = 0; i < count; ++i)
+    {
+        iov[i].iov_base = msg[i].buffer;
+        iov[i].iov_len = msg[i].size;
+        mmsg[i].msg_hdr.msg_iov = &iov[i];
+        mmsg[i].msg_hdr.msg_iovlen = 1;
+        mmsg[i].msg_hdr.msg_control = control[i];
+        mmsg[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    const int ret = recvmmsg(sock->fd, mmsg, count, MSG_DONTWAIT, NULL);
+    for(int i = 0; i < ret; ++i)
+    {
+        msg[i].length = mmsg[i].msg_len;
+        msg[i].timestamp = 0;
+        msg[i].drops = 0;
+        msg[i].addr = 0;
+
+        struct msghdr *hdr = &mmsg[i].msg_hdr;
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg))
+        {
+            if(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+            {
+                struct in_pktinfo pktinfo;
+                memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+                msg[i].addr = pktinfo.ipi_addr.s_addr;
+                continue;
+            }
+
+            if(cmsg->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if(cmsg->cmsg_type == SCM_TIMESTAMPNS)
+            {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                msg[i].timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            }
+#ifdef SO_RXQ_OVFL
+            else if(cmsg->cmsg_type == SO_RXQ_OVFL)
+                memcpy(&msg[i].drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+#endif
+        }
+    }
+
+    return ret;
+#else
+    int i = 0;
+    for(; i < count; ++i)
+    {
+        const ssize_t ret = recv(sock->fd, msg[i].buffer, msg[i].size, 0);
+        if(ret <= 0)
+            return (i > 0) ? i : ret;
+        msg[i].length = ret;
+        msg[i].timestamp = 0;
+        msg[i].drops = 0;
+        msg[i].addr = 0;
+    }
+    return i;
+#endif
+}
+
 /*
  *  oooooooo8 ooooooooooo oooo   oooo ooooooooo
  * 888         888    88   8888o  88   888    88o
@@ -533,6 +704,9 @@ ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size)
 
 ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size)
 {
+    if(sock->layer)
+        return sock->layer->send(sock->layer_arg, buffer, size);
+
     const ssize_t ret = send(sock->fd, buffer, size, 0);
     if(ret == -1)
     {
@@ -548,12 +722,161 @@ ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size)
     return ret;
 }
 
+#ifndef _WIN32
+ssize_t asc_socket_sendv(asc_socket_t *sock, const struct iovec *iov, int count)
+{
+    if(!asc_socket_is_direct(sock))
+    {
+        ssize_t total = 0;
+        for(int i = 0; i < count; ++i)
+        {
+            const ssize_t ret = asc_socket_send(sock, iov[i].iov_base, iov[i].iov_len);
+            if(ret == -1)
+                return (total > 0) ? total : -1;
+
+            total += ret;
+            if((size_t)ret < iov[i].iov_len)
+                break;
+        }
+        return total;
+    }
+
+    const ssize_t ret = writev(sock->fd, iov, count);
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    return ret;
+}
+#endif
+
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size)
 {
     const socklen_t slen = sizeof(struct sockaddr_in);
     return sendto(sock->fd, buffer, size, 0, (struct sockaddr *)&sock->sockaddr, slen);
 }
 
+/*
+ * send datagrams msg[i].buffer with msg[i].length to the sockaddr of the socket.
+ * returns number of successful sends, failed datagrams are dropped
+ */
+int asc_socket_send_batch(asc_socket_t *sock, asc_socket_msg_t *msg, int count)
+{
+    int sent = 0;
+
+#ifdef __linux__
+    struct mmsghdr mmsg[ASC_SOCKET_BATCH_SIZE];
+    struct iovec iov[ASC_SOCKET_BATCH_SIZE];
+
+    for(int skip = 0; skip < count; )
+    {
+        int batch = count - skip;
+        if(batch > ASC_SOCKET_BATCH_SIZE)
+            batch = ASC_SOCKET_BATCH_SIZE;
+
+        memset(mmsg, 0, sizeof(struct mmsghdr) * batch);
+        for(int i = 0; i < batch; ++i)
+        {
+            iov[i].iov_base = msg[skip + i].buffer;
+            iov[i].iov_len = msg[skip + i].length;
+
+            mmsg[i].msg_hdr.msg_name = &sock->sockaddr;
+            mmsg[i].msg_hdr.msg_namelen = sizeof(sock->sockaddr);
+            mmsg[i].msg_hdr.msg_iov = &iov[i];
+            mmsg[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int ret = sendmmsg(sock->fd, mmsg, batch, MSG_DONTWAIT);
+        if(ret <= 0)
+        {
+            ++skip;
+            continue;
+        }
+
+        sent += ret;
+        skip += ret;
+    }
+#else
+    for(int i = 0; i < count; ++i)
+    {
+        if(asc_socket_sendto(sock, msg[i].buffer, msg[i].length) != -1)
+            ++sent;
+    }
+#endif
+
+    return sent;
+}
+
+/*
+ * send the same datagram to the list of destinations. the error of each
+ * destination is stored in dest[i].error. returns number of successful sends
+ */
+int asc_socket_sendto_multi(  asc_socket_t *sock, const void *buffer, size_t size
+                            , asc_socket_dest_t *dest, int count)
+{
+    int sent = 0;
+
+#ifdef __linux__
+    struct mmsghdr mmsg[ASC_SOCKET_BATCH_SIZE];
+    struct sockaddr_in addr[ASC_SOCKET_BATCH_SIZE];
+    struct iovec iov;
+    iov.iov_base = (void *)buffer;
+    iov.iov_len = size;
+
+    for(int skip = 0; skip < count; )
+    {
+        int batch = count - skip;
+        if(batch > ASC_SOCKET_BATCH_SIZE)
+            batch = ASC_SOCKET_BATCH_SIZE;
+
+        memset(mmsg, 0, sizeof(struct mmsghdr) * batch);
+        for(int i = 0; i < batch; ++i)
+        {
+            memset(&addr[i], 0, sizeof(struct sockaddr_in));
+            addr[i].sin_family = AF_INET;
+            addr[i].sin_addr.s_addr = dest[skip + i].addr;
+            addr[i].sin_port = htons(dest[skip + i].port);
+
+            mmsg[i].msg_hdr.msg_name = &addr[i];
+            mmsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            mmsg[i].msg_hdr.msg_iov = &iov;
+            mmsg[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int ret = sendmmsg(sock->fd, mmsg, batch, MSG_DONTWAIT);
+        if(ret <= 0)
+        {
+            /* first message of the batch is failed. skip it and continue */
+            dest[skip].error = errno;
+            ++skip;
+            continue;
+        }
+
+        for(int i = 0; i < ret; ++i)
+            dest[skip + i].error = 0;
+        sent += ret;
+        skip += ret;
+    }
+#else
+    for(int i = 0; i < count; ++i)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = dest[i].addr;
+        addr.sin_port = htons(dest[i].port);
+
+        if(sendto(sock->fd, buffer, size, 0, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+            dest[i].error = errno;
+        else
+        {
+            dest[i].error = 0;
+            ++sent;
+        }
+    }
+#endif
+
+    return sent;
+}
+
 /*
  * ooooo oooo   oooo ooooooooooo  ooooooo
  *  888   8888o  88   888    88 o888   888o
@@ -586,6 +909,85 @@ int asc_socket_port(asc_socket_t *sock)
     return -1;
 }
 
+/* queue length and memory usage of the socket */
+bool asc_socket_get_stats(asc_socket_t *sock, asc_socket_stats_t *stats)
+{
+    memset(stats, 0, sizeof(asc_socket_stats_t));
+
+#ifdef __linux__
+    if(ioctl(sock->fd, SIOCINQ, &stats->rx_queue) == -1)
+        return false;
+    if(ioctl(sock->fd, SIOCOUTQ, &stats->tx_queue) == -1)
+        return false;
+
+#   ifdef SO_MEMINFO
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t slen = sizeof(meminfo);
+    memset(meminfo, 0, slen);
+    if(getsockopt(sock->fd, SOL_SOCKET, SO_MEMINFO, meminfo, &slen) != -1)
+    {
+        stats->rmem = meminfo[SK_MEMINFO_RMEM_ALLOC];
+        stats->rcvbuf = meminfo[SK_MEMINFO_RCVBUF];
+        stats->wmem = meminfo[SK_MEMINFO_WMEM_ALLOC];
+        stats->sndbuf = meminfo[SK_MEMINFO_SNDBUF];
+        stats->drops = meminfo[SK_MEMINFO_DROPS];
+        return true;
+    }
+#   endif
+#endif
+
+    int value = 0;
+    socklen_t slen_value = sizeof(value);
+    if(getsockopt(sock->fd, SOL_SOCKET, SO_RCVBUF, (void *)&value, &slen_value) != -1)
+        stats->rcvbuf = value;
+    slen_value = sizeof(value);
+    if(getsockopt(sock->fd, SOL_SOCKET, SO_SNDBUF, (void *)&value, &slen_value) != -1)
+        stats->sndbuf = value;
+
+    return true;
+}
+
+/* connection state of the TCP socket */
+bool asc_socket_get_tcp_info(asc_socket_t *sock, asc_socket_tcp_info_t *info)
+{
+    memset(info, 0, sizeof(asc_socket_tcp_info_t));
+
+#if defined(__linux__) && defined(TCP_INFO)
+    /* older kernels return the shorter structure */
+    struct tcp_info tcpi;
+    socklen_t slen = sizeof(tcpi);
+    memset(&tcpi, 0, slen);
+    if(getsockopt(sock->fd, IPPROTO_TCP, TCP_INFO, &tcpi, &slen) == -1)
+        return false;
+
+#define TCPI_HAS(_field) (slen >= offsetof(struct tcp_info, _field) + sizeof(tcpi._field))
+
+    info->rtt = tcpi.tcpi_rtt;
+    info->rttvar = tcpi.tcpi_rttvar;
+    info->cwnd = tcpi.tcpi_snd_cwnd;
+    info->mss = tcpi.tcpi_snd_mss;
+    info->unacked = tcpi.tcpi_unacked;
+    info->lost = tcpi.tcpi_lost;
+    info->retrans = tcpi.tcpi_total_retrans;
+    if(TCPI_HAS(tcpi_bytes_acked))
+        info->bytes_acked = tcpi.tcpi_bytes_acked;
+    if(TCPI_HAS(tcpi_delivery_rate))
+        info->delivery_rate = tcpi.tcpi_delivery_rate;
+
+#undef TCPI_HAS
+
+#   ifdef SIOCOUTQNSD
+    if(ioctl(sock->fd, SIOCOUTQNSD, &info->notsent) == -1)
+        info->notsent = 0;
+#   endif
+
+    return true;
+#else
+    __uarg(sock);
+    return false;
+#endif
+}
+
 /*
  *  oooooooo8 ooooooooooo ooooooooooo          oo    oo
  * 888         888    88  88  888  88           88oo88
@@ -595,6 +997,25 @@ int asc_socket_port(asc_socket_t *sock)
  *
  */
 
+/* layer is released with the socket */
+void asc_socket_set_layer(asc_socket_t *sock, const asc_socket_layer_t *layer, void *arg)
+{
+    sock->layer = layer;
+    sock->layer_arg = arg;
+}
+
+/* true if the descriptor could be used for writev(), sendfile() and splice() */
+bool asc_socket_is_direct(asc_socket_t *sock)
+{
+    return (!sock->layer || sock->layer->is_direct(sock->layer_arg));
+}
+
+/* bytes of the incomplete write in the layer. the caller should send them before the skip */
+size_t asc_socket_send_pending(asc_socket_t *sock)
+{
+    return (sock->layer) ? sock->layer->send_pending(sock->layer_arg) : 0;
+}
+
 void asc_socket_set_nonblock(asc_socket_t *sock, bool is_nonblock)
 {
     if(is_nonblock == false && sock->event)
@@ -635,6 +1056,115 @@ void asc_socket_set_reuseaddr(asc_socket_t *sock, int is_on)
     setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, (void *)&is_on, sizeof(is_on));
 }
 
+void asc_socket_set_reuseport(asc_socket_t *sock, int is_on)
+{
+#ifdef SO_REUSEPORT
+    setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, (void *)&is_on, sizeof(is_on));
+#else
+    __uarg(sock);
+    __uarg(is_on);
+#endif
+}
+
+/* spread datagrams randomly across the SO_REUSEPORT group of the count sockets */
+bool asc_socket_set_reuseport_cbpf(asc_socket_t *sock, int count)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] =
+    {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_RANDOM) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)count },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { ASC_ARRAY_SIZE(code), code };
+
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1)
+    {
+        asc_log_error(MSG("failed to attach reuseport filter (%s)"), asc_socket_error());
+        return false;
+    }
+    return true;
+#else
+    __uarg(sock);
+    __uarg(count);
+    return false;
+#endif
+}
+
+/* request kernel receive time for each datagram. see asc_socket_recv_batch() */
+bool asc_socket_set_timestamp(asc_socket_t *sock, int is_on)
+{
+#ifdef SO_TIMESTAMPNS
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_TIMESTAMPNS, (void *)&is_on, sizeof(is_on)) == -1)
+        return false;
+    return true;
+#else
+    __uarg(sock);
+    __uarg(is_on);
+    return false;
+#endif
+}
+
+/* attach the kernel drop counter to each datagram. see asc_socket_recv_batch() */
+bool asc_socket_set_rxq_ovfl(asc_socket_t *sock, int is_on)
+{
+#ifdef SO_RXQ_OVFL
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_RXQ_OVFL, (void *)&is_on, sizeof(is_on)) == -1)
+        return false;
+    return true;
+#else
+    __uarg(sock);
+    __uarg(is_on);
+    return false;
+#endif
+}
+
+/* report destination address of each datagram. see asc_socket_recv_batch() */
+bool asc_socket_set_pktinfo(asc_socket_t *sock, int is_on)
+{
+#ifdef IP_PKTINFO
+    if(setsockopt(sock->fd, IPPROTO_IP, IP_PKTINFO, (void *)&is_on, sizeof(is_on)) == -1)
+        return false;
+    return true;
+#else
+    __uarg(sock);
+    __uarg(is_on);
+    return false;
+#endif
+}
+
+bool asc_socket_set_multicast_all(asc_socket_t *sock, int is_on)
+{
+#ifdef IP_MULTICAST_ALL
+    if(setsockopt(sock->fd, IPPROTO_IP, IP_MULTICAST_ALL, (void *)&is_on, sizeof(is_on)) == -1)
+        return false;
+    return true;
+#else
+    __uarg(sock);
+    __uarg(is_on);
+    return false;
+#endif
+}
+
+/* attach classic BPF program. code is the array of struct sock_filter */
+bool asc_socket_attach_filter(asc_socket_t *sock, const void *code, int count)
+{
+#if defined(__linux__) && defined(SO_ATTACH_FILTER)
+    struct sock_fprog prog = { (unsigned short)count, (struct sock_filter *)code };
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+    {
+        asc_log_error(MSG("failed to attach socket filter (%s)"), asc_socket_error());
+        return false;
+    }
+    return true;
+#else
+    __uarg(sock);
+    __uarg(code);
+    __uarg(count);
+    return false;
+#endif
+}
+
 void asc_socket_set_non_delay(asc_socket_t *sock, int is_on)
 {
     switch(sock->protocol)
@@ -846,7 +1376,23 @@ static int __asc_socket_multicast_cmd(asc_socket_t *sock, int cmd)
 {
     int r;
 
-    r = setsockopt(sock->fd, IPPROTO_IP, cmd, (void *)&sock->mreq, sizeof(sock->mreq));
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+    if(sock->mreq_source.s_addr != INADDR_ANY)
+    {
+        struct ip_mreq_source mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = sock->mreq.imr_multiaddr;
+        mreq.imr_interface = sock->mreq.imr_interface;
+        mreq.imr_sourceaddr = sock->mreq_source;
+
+        const int source_cmd = (cmd == IP_ADD_MEMBERSHIP)
+                             ? IP_ADD_SOURCE_MEMBERSHIP
+                             : IP_DROP_SOURCE_MEMBERSHIP;
+        r = setsockopt(sock->fd, IPPROTO_IP, source_cmd, (void *)&mreq, sizeof(mreq));
+    }
+    else
+#endif
+        r = setsockopt(sock->fd, IPPROTO_IP, cmd, (void *)&sock->mreq, sizeof(sock->mreq));
     if(r == -1)
         return -1;
 
@@ -877,6 +1423,28 @@ static int __asc_socket_multicast_cmd(asc_socket_t *sock, int cmd)
 
 void asc_socket_multicast_join(asc_socket_t *sock, const char *addr, const char *localaddr)
 {
+    asc_socket_multicast_join_source(sock, addr, localaddr, NULL);
+}
+
+/* join the multicast group with IGMPv3 source filter if source is defined */
+void asc_socket_multicast_join_source(  asc_socket_t *sock, const char *addr
+                                      , const char *localaddr, const char *source)
+{
+    sock->mreq_source.s_addr = INADDR_ANY;
+    if(source)
+    {
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+        sock->mreq_source.s_addr = inet_addr(source);
+        if(sock->mreq_source.s_addr == INADDR_NONE)
+        {
+            asc_log_error(MSG("wrong multicast source \"%s\""), source);
+            sock->mreq_source.s_addr = INADDR_ANY;
+        }
+#else
+        asc_log_warning(MSG("source-specific multicast is not available"));
+#endif
+    }
+
     memset(&sock->mreq, 0, sizeof(sock->mreq));
     sock->mreq.imr_multiaddr.s_addr = inet_addr(addr);
     if(sock->mreq.imr_multiaddr.s_addr == INADDR_NONE)
@@ -935,3 +1503,67 @@ void asc_socket_multicast_renew(asc_socket_t *sock)
     asc_log_error(MSG("failed to renew multicast \"%s\" (%s)"),
         inet_ntoa(sock->mreq.imr_multiaddr), asc_socket_error());
 }
+
+/*
+ * additional memberships on the same socket. used to receive many groups
+ * with single socket, without IGMP emulation and renewing
+ */
+
+static bool __asc_socket_membership(  asc_socket_t *sock, const char *addr
+                                    , const char *localaddr, const char *source
+                                    , bool is_add)
+{
+    struct in_addr group, iface;
+    group.s_addr = inet_addr(addr);
+    iface.s_addr = (localaddr) ? inet_addr(localaddr) : INADDR_ANY;
+    if(iface.s_addr == INADDR_NONE)
+        iface.s_addr = INADDR_ANY;
+
+    int r;
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+    if(source)
+    {
+        struct ip_mreq_source mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = group;
+        mreq.imr_interface = iface;
+        mreq.imr_sourceaddr.s_addr = inet_addr(source);
+        r = setsockopt(  sock->fd, IPPROTO_IP
+                       , (is_add) ? IP_ADD_SOURCE_MEMBERSHIP : IP_DROP_SOURCE_MEMBERSHIP
+                       , (void *)&mreq, sizeof(mreq));
+    }
+    else
+#else
+    __uarg(source);
+#endif
+    {
+        struct ip_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = group;
+        mreq.imr_interface = iface;
+        r = setsockopt(  sock->fd, IPPROTO_IP
+                       , (is_add) ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP
+                       , (void *)&mreq, sizeof(mreq));
+    }
+
+    if(r == -1)
+    {
+        asc_log_error(MSG("failed to %s multicast \"%s\" (%s)")
+                      , (is_add) ? "join" : "leave", addr, asc_socket_error());
+        return false;
+    }
+
+    return true;
+}
+
+bool asc_socket_multicast_add_membership(  asc_socket_t *sock, const char *addr
+                                         , const char *localaddr, const char *source)
+{
+    return __asc_socket_membership(sock, addr, localaddr, source, true);
+}
+
+bool asc_socket_multicast_drop_membership(  asc_socket_t *sock, const char *addr
+                                          , const char *localaddr, const char *source)
+{
+    return __asc_socket_membership(sock, addr, localaddr, source, false);
+}
@@ -24,8 +24,74 @@
 #include "base.h"
 #include "event.h"
 
+#ifndef _WIN32
+#   include <sys/uio.h>
+#endif
+
 typedef struct asc_socket_t asc_socket_t;
 
+#define ASC_SOCKET_BATCH_SIZE 64
+
+typedef struct
+{
+    void *buffer;
+    size_t size;        /* buffer size */
+    size_t length;      /* received datagram length */
+    uint64_t timestamp; /* kernel receive time in nanoseconds, 0 if not available */
+    uint32_t drops;     /* total datagrams dropped by the kernel (SO_RXQ_OVFL) */
+    uint32_t addr;      /* destination address in network byte order (IP_PKTINFO) */
+} asc_socket_msg_t;
+
+typedef struct
+{
+    uint32_t addr;      /* destination address in network byte order */
+    int port;
+    int error;          /* errno of the last send, 0 on success */
+} asc_socket_dest_t;
+
+typedef struct
+{
+    int rx_queue;       /* bytes in the receive queue */
+    int tx_queue;       /* bytes in the send queue */
+    uint32_t rcvbuf;
+    uint32_t sndbuf;
+    uint32_t rmem;      /* receive memory allocated */
+    uint32_t wmem;      /* send memory allocated */
+    uint32_t drops;
+} asc_socket_stats_t;
+
+typedef struct
+{
+    uint32_t rtt;       /* smoothed round trip time in microseconds */
+    uint32_t rttvar;
+    uint32_t cwnd;      /* congestion window in segments */
+    uint32_t mss;
+    uint32_t unacked;   /* segments in flight */
+    uint32_t lost;
+    uint32_t retrans;   /* total retransmitted segments */
+    int notsent;        /* bytes in the send queue not sent yet */
+    uint64_t bytes_acked; /* total bytes acknowledged by the peer. Linux 4.1+ */
+    uint64_t delivery_rate; /* recent delivery rate in bytes per second. Linux 4.9+ */
+} asc_socket_tcp_info_t;
+
+/*
+ * stream transformation between the socket and the application (TLS).
+ * recv and send have the same return values as asc_socket_recv() and asc_socket_send().
+ * incomplete write is kept in the layer, send returns 0 until it is done and then
+ * reports its bytes. the caller should not drop them in the meantime
+ */
+typedef struct
+{
+    ssize_t (*recv)(void *arg, void *buffer, size_t size);
+    ssize_t (*send)(void *arg, const void *buffer, size_t size);
+    bool (*is_ready)(void *arg);    /* false if received data is not enough to read */
+    size_t (*pending)(void *arg);   /* bytes are ready to read without the socket event */
+    bool (*is_direct)(void *arg);   /* data written to the descriptor is handled by the kernel */
+    size_t (*send_pending)(void *arg); /* bytes of the incomplete write */
+    bool (*is_send_wait)(void *arg);   /* incomplete write waits for data from the peer */
+    void (*close)(void *arg);
+} asc_socket_layer_t;
+
 void asc_socket_core_init(void);
 void asc_socket_core_destroy(void);
 
@@ -35,6 +101,7 @@ asc_socket_t * asc_socket_open_tcp4(void * arg) __wur;
 asc_socket_t * asc_socket_open_udp4(void * arg) __wur;
 asc_socket_t * asc_socket_open_sctp4(void * arg) __wur;
 
+void asc_socket_set_arg(asc_socket_t *sock, void *arg);
 void asc_socket_set_on_read(asc_socket_t * sock, event_callback_t on_read);
 void asc_socket_set_on_close(asc_socket_t * sock, event_callback_t on_close);
 void asc_socket_set_on_ready(asc_socket_t * sock, event_callback_t on_ready);
@@ -53,17 +120,37 @@ void asc_socket_connect(  asc_socket_t *sock, const char *addr, int port
 
 ssize_t asc_socket_recv(asc_socket_t *sock, void *buffer, size_t size) __wur;
 ssize_t asc_socket_recvfrom(asc_socket_t *sock, void *buffer, size_t size) __wur;
+int asc_socket_recv_batch(asc_socket_t *sock, asc_socket_msg_t *msg, int count) __wur;
 
 ssize_t asc_socket_send(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+#ifndef _WIN32
+ssize_t asc_socket_sendv(asc_socket_t *sock, const struct iovec *iov, int count) __wur;
+#endif
 ssize_t asc_socket_sendto(asc_socket_t *sock, const void *buffer, size_t size) __wur;
+int asc_socket_send_batch(asc_socket_t *sock, asc_socket_msg_t *msg, int count);
+int asc_socket_sendto_multi(  asc_socket_t *sock, const void *buffer, size_t size
+                            , asc_socket_dest_t *dest, int count);
 
 int asc_socket_fd(asc_socket_t *sock) __wur;
 const char * asc_socket_addr(asc_socket_t *sock) __wur;
 int asc_socket_port(asc_socket_t *sock) __wur;
+bool asc_socket_get_stats(asc_socket_t *sock, asc_socket_stats_t *stats);
+bool asc_socket_get_tcp_info(asc_socket_t *sock, asc_socket_tcp_info_t *info);
+
+void asc_socket_set_layer(asc_socket_t *sock, const asc_socket_layer_t *layer, void *arg);
+bool asc_socket_is_direct(asc_socket_t *sock);
+size_t asc_socket_send_pending(asc_socket_t *sock);
 
 void asc_socket_set_nonblock(asc_socket_t *sock, bool is_nonblock);
 void asc_socket_set_sockaddr(asc_socket_t *sock, const char *addr, int port);
 void asc_socket_set_reuseaddr(asc_socket_t *sock, int is_on);
+void asc_socket_set_reuseport(asc_socket_t *sock, int is_on);
+bool asc_socket_set_reuseport_cbpf(asc_socket_t *sock, int count);
+bool asc_socket_set_timestamp(asc_socket_t *sock, int is_on);
+bool asc_socket_set_rxq_ovfl(asc_socket_t *sock, int is_on);
+bool asc_socket_set_pktinfo(asc_socket_t *sock, int is_on);
+bool asc_socket_set_multicast_all(asc_socket_t *sock, int is_on);
+bool asc_socket_attach_filter(asc_socket_t *sock, const void *code, int count);
 void asc_socket_set_non_delay(asc_socket_t *sock, int is_on);
 void asc_socket_set_keep_alive(asc_socket_t *sock, int is_on);
 void asc_socket_set_broadcast(asc_socket_t *sock, int is_on);
@@ -74,7 +161,14 @@ void asc_socket_set_multicast_if(asc_socket_t *sock, const char *addr);
 void asc_socket_set_multicast_ttl(asc_socket_t *sock, int ttl);
 void asc_socket_set_multicast_loop(asc_socket_t *sock, int is_on);
 void asc_socket_multicast_join(asc_socket_t *sock, const char *addr, const char *localaddr);
+void asc_socket_multicast_join_source(  asc_socket_t *sock, const char *addr
+                                      , const char *localaddr, const char *source);
 void asc_socket_multicast_leave(asc_socket_t *sock);
 void asc_socket_multicast_renew(asc_socket_t *sock);
 
+bool asc_socket_multicast_add_membership(  asc_socket_t *sock, const char *addr
+                                         , const char *localaddr, const char *source);
+bool asc_socket_multicast_drop_membership(  asc_socket_t *sock, const char *addr
+                                          , const char *localaddr, const char *source);
+
 #endif /* _ASC_SOCKET_H_ */
@@ -22,6 +22,7 @@ struct http_client_t
     char buffer[HTTP_BUFFER_SIZE];
     size_t buffer_skip;
     size_t chunk_left;
+    size_t parse_skip;  // position to resume the search of the end of headers
 
     // request
     int status;         // 1 - empty line is found, 2 - request ready, 3 - release
@@ -32,10 +33,24 @@ struct http_client_t
     bool is_content_length;
     string_buffer_t *content;
 
+    // keep-alive
+    bool is_keep_alive;
+    bool is_http10;
+    int request_count;
+    uint64_t idle_time;
+    char *pending;      // pipelined data received while the request is processed
+    size_t pending_size;
+
+    // admission
+    bool is_admitted;
+    void *admission_ip; // per-IP counter, owned by the server
+    uint64_t bytes_acked;
+
     // response
     event_callback_t on_send;
     event_callback_t on_read;
     event_callback_t on_ready;
+    event_callback_t on_stats; // fills the client stats into the :data() table on the stack
     http_response_t *response;
 
     int idx_content;
@@ -47,13 +62,29 @@ void http_response_code(http_client_t *client, int code, const char *message);
 void http_response_header(http_client_t *client, const char *header, ...);
 void http_response_send(http_client_t *client);
 
+const char * http_request_header(http_client_t *client, const char *name, size_t *size);
+
 void http_client_warning(http_client_t *client, const char *message, ...);
 void http_client_error(http_client_t *client, const char *message, ...);
 void http_client_close(http_client_t *client);
+void http_client_done(http_client_t *client);
 
 void http_client_redirect(http_client_t *client, int code, const char *location);
 void http_client_abort(http_client_t *client, int code, const char *text);
 
+// TLS
+
+typedef struct http_tls_t http_tls_t;
+typedef void (*http_tls_callback_t)(void *arg, const char *error);
+
+http_tls_t * http_tls_server_init(const char *cert, const char *key);
+http_tls_t * http_tls_client_init(const char *ca, bool is_verify);
+void http_tls_destroy(http_tls_t *tls);
+const char * http_tls_error(void);
+
+void http_tls_handshake(  http_tls_t *tls, asc_socket_t *sock, const char *host
+                        , http_tls_callback_t callback, void *arg);
+
 // Utils
 
 void lua_string_to_lower(const char *str, size_t size);
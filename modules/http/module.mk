@@ -1,13 +1,50 @@
-SOURCES="parser.c utils.c server.c request.c \
+SOURCES="parser.c utils.c tls.c server.c request.c \
 modules/redirect.c \
 modules/static.c \
 modules/websocket.c \
 modules/upstream.c \
-modules/downstream.c"
+modules/downstream.c \
+modules/hls.c"
 
 MODULES="http_server http_request \
 http_redirect \
 http_static \
 http_websocket \
 http_upstream \
-http_downstream"
+http_downstream \
+hls_output"
+
+# TLS
+
+openssl_test_c()
+{
+    cat <<EOF
+#include <stdio.h>
+#include <openssl/ssl.h>
+int main(void) { SSL_CTX *ctx = SSL_CTX_new(TLS_method()); SSL_CTX_free(ctx); return 0; }
+EOF
+}
+
+check_openssl()
+{
+    openssl_test_c | $APP_C -Werror $APP_CFLAGS -c -o .link-test.o -x c - >/dev/null 2>&1
+    if [ $? -ne 0 ] ; then
+        return 1
+    fi
+
+    $APP_C .link-test.o -o .link-test $APP_LDFLAGS -lssl -lcrypto >/dev/null 2>&1
+    if [ $? -ne 0 ] ; then
+        rm -f .link-test.o
+        return 1
+    fi
+
+    rm -f .link-test.o .link-test
+    return 0
+}
+
+if check_openssl ; then
+    CFLAGS="-DHAVE_OPENSSL=1"
+    LDFLAGS="-lssl -lcrypto"
+else
+    echo "$MODULE: warning: libssl-dev is not found. TLS disabled" >&2
+fi
@@ -0,0 +1,491 @@
+/*
+ * Astra Module: HTTP Module: HLS Output
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2014-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      hls_output
+ *
+ * Module Options:
+ *      upstream    - object, stream instance returned by module_instance:stream()
+ *      name        - string, name for the log messages
+ *      duration    - number, target segment duration in seconds. default: 6
+ *      count       - number, segments in the playlist. default: 5
+ *
+ * Usage:
+ *      the module instance is the http_server route:
+ *      { "/live/channel/" .. "*", hls_output({ upstream = channel:stream() }) }
+ *      any "*.m3u8" request returns the playlist, segments are "<sequence>.ts"
+ *
+ *      segments are started from the video keyframe with PAT and PMT.
+ *      segment is an immutable buffer, shared by all clients
+ */
+
+#include <astra.h>
+#include "../http.h"
+
+#define MSG(_msg) "[hls_output %s] " _msg, mod->name
+
+#define PTS_MASK 0x1FFFFFFFFULL
+
+typedef struct
+{
+    int refcount;
+
+    uint64_t seq;
+    uint32_t duration;  /* in 1/90000 of second */
+
+    uint8_t *buffer;
+    size_t size;
+} hls_buffer_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    const char *name;
+    uint32_t duration;
+    int count;
+
+    mpegts_keyframe_t *kf;
+    char kf_name[128];
+    size_t pes_skip;    /* position of the PES start in the current segment */
+
+    // current segment
+    bool is_segment;
+    uint64_t segment_pts;
+    uint64_t segment_time;
+
+    uint8_t *buffer;
+    size_t buffer_size;
+    size_t buffer_skip;
+
+    uint64_t seq;
+    asc_list_t *segments;
+    hls_buffer_t *playlist;
+};
+
+struct http_response_t
+{
+    hls_buffer_t *data;
+    size_t skip;
+};
+
+static hls_buffer_t * hls_buffer_init(uint8_t *buffer, size_t size)
+{
+    hls_buffer_t *data = (hls_buffer_t *)calloc(1, sizeof(hls_buffer_t));
+    data->refcount = 1;
+    data->buffer = buffer;
+    data->size = size;
+    return data;
+}
+
+static void hls_buffer_release(hls_buffer_t *data)
+{
+    --data->refcount;
+    if(data->refcount > 0)
+        return;
+
+    free(data->buffer);
+    free(data);
+}
+
+/*
+ *  oooooooo8 ooooooooooo   oooooooo8 oooo     oooo ooooooooooo oooo   oooo ooooooooooo
+ * 888         888    88  o888     88  8888o   888   888    88   8888o  88  88  888  88
+ *  888oooooo  888ooo8    888    oooo  88 888o8 88   888ooo8     88 888o88      888
+ *         888 888    oo  888o    88   88  888  88   888    oo   88   8888      888
+ * o88oooo888 o888ooo8888  888ooo888  o88o  8  o88o o888ooo8888 o88o    88     o888o
+ *
+ */
+
+static void segment_append(module_data_t *mod, const uint8_t *ts)
+{
+    if(mod->buffer_skip + TS_PACKET_SIZE > mod->buffer_size)
+    {
+        mod->buffer_size *= 2;
+        mod->buffer = (uint8_t *)realloc(mod->buffer, mod->buffer_size);
+    }
+
+    memcpy(&mod->buffer[mod->buffer_skip], ts, TS_PACKET_SIZE);
+    mod->buffer_skip += TS_PACKET_SIZE;
+}
+
+static void on_psi_ts(void *arg, const uint8_t *ts)
+{
+    segment_append((module_data_t *)arg, ts);
+}
+
+static void playlist_update(module_data_t *mod)
+{
+    uint32_t target = 0;
+    uint64_t first = 0;
+
+    asc_list_first(mod->segments);
+    if(!asc_list_eol(mod->segments))
+        first = ((hls_buffer_t *)asc_list_data(mod->segments))->seq;
+
+    asc_list_for(mod->segments)
+    {
+        hls_buffer_t *segment = (hls_buffer_t *)asc_list_data(mod->segments);
+        const uint32_t duration = (segment->duration + 90000 - 1) / 90000;
+        if(duration > target)
+            target = duration;
+    }
+
+    string_buffer_t *playlist = string_buffer_alloc();
+    string_buffer_addfstring(playlist
+                             , "#EXTM3U\n"
+                               "#EXT-X-VERSION:3\n"
+                               "#EXT-X-TARGETDURATION:%u\n"
+                               "#EXT-X-MEDIA-SEQUENCE:%llu\n"
+                             , target, (unsigned long long)first);
+
+    asc_list_for(mod->segments)
+    {
+        hls_buffer_t *segment = (hls_buffer_t *)asc_list_data(mod->segments);
+        string_buffer_addfstring(playlist
+                                 , "#EXTINF:%u.%03u,\n%llu.ts\n"
+                                 , segment->duration / 90000
+                                 , (segment->duration % 90000) / 90
+                                 , (unsigned long long)segment->seq);
+    }
+
+    size_t size = 0;
+    char *buffer = string_buffer_release(playlist, &size);
+
+    if(mod->playlist)
+        hls_buffer_release(mod->playlist);
+    mod->playlist = hls_buffer_init((uint8_t *)buffer, size);
+}
+
+/* current segment is started with PAT and PMT */
+static void segment_begin(module_data_t *mod, const uint8_t *tail, size_t tail_size)
+{
+    mod->buffer_skip = 0;
+    mpegts_keyframe_psi_demux(mod->kf, false, on_psi_ts, mod);
+
+    if(mod->buffer_skip + tail_size > mod->buffer_size)
+    {
+        mod->buffer_size = mod->buffer_skip + tail_size;
+        mod->buffer = (uint8_t *)realloc(mod->buffer, mod->buffer_size);
+    }
+
+    memcpy(&mod->buffer[mod->buffer_skip], tail, tail_size);
+    mod->buffer_skip += tail_size;
+    mod->pes_skip = mod->buffer_skip - tail_size;
+
+    mod->segment_pts = mod->kf->pts;
+    mod->segment_time = asc_utime();
+}
+
+/* keyframe is found at mod->pes_skip */
+static void segment_cut(module_data_t *mod)
+{
+    const size_t tail_size = mod->buffer_skip - mod->pes_skip;
+
+    if(!mod->is_segment)
+    {
+        // first keyframe. drop everything before
+        mod->is_segment = true;
+        uint8_t *tail = (uint8_t *)malloc(tail_size);
+        memcpy(tail, &mod->buffer[mod->pes_skip], tail_size);
+        segment_begin(mod, tail, tail_size);
+        free(tail);
+        return;
+    }
+
+    const uint64_t time = asc_utime();
+    const uint64_t wall_duration = (time - mod->segment_time) * 9 / 100;
+
+    uint64_t duration = wall_duration;
+    if(mod->kf->is_pts)
+    {
+        duration = (mod->kf->pts - mod->segment_pts) & PTS_MASK;
+        // PTS discontinuity
+        if(duration > (uint64_t)mod->duration * 10)
+            duration = wall_duration;
+    }
+
+    if(duration < mod->duration)
+        return;
+
+    // current buffer is owned by the segment. the tail is copied to the new buffer
+    hls_buffer_t *segment = hls_buffer_init(mod->buffer, mod->pes_skip);
+    segment->seq = mod->seq;
+    segment->duration = (uint32_t)duration;
+    ++mod->seq;
+
+    const uint8_t *tail = &mod->buffer[mod->pes_skip];
+    const size_t buffer_size = mod->buffer_size;
+    mod->buffer = (uint8_t *)malloc(buffer_size);
+    segment_begin(mod, tail, tail_size);
+
+    asc_list_insert_tail(mod->segments, segment);
+    while(asc_list_size(mod->segments) > (size_t)mod->count)
+    {
+        asc_list_first(mod->segments);
+        hls_buffer_t *item = (hls_buffer_t *)asc_list_data(mod->segments);
+        asc_list_remove_current(mod->segments);
+        hls_buffer_release(item);
+    }
+
+    playlist_update(mod);
+}
+
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    mpegts_keyframe_t *kf = mod->kf;
+
+    const int flags = mpegts_keyframe_mux(kf, ts);
+    if(flags & MPEGTS_KEYFRAME_PSI)
+        return;
+
+    const uint16_t pid = TS_GET_PID(ts);
+    if(!kf->pid || pid == NULL_TS_PID)
+        return;
+
+    if(pid != kf->pid)
+    {
+        // other elementary streams wait for the first keyframe
+        if(mod->is_segment)
+            segment_append(mod, ts);
+        return;
+    }
+
+    if(flags & MPEGTS_KEYFRAME_PES)
+    {
+        if(!mod->is_segment)
+            mod->buffer_skip = 0;
+
+        mod->pes_skip = mod->buffer_skip;
+    }
+
+    segment_append(mod, ts);
+
+    if(flags & MPEGTS_KEYFRAME_KEY)
+        segment_cut(mod);
+    else if(!mod->is_segment && !kf->is_scan)
+        mod->buffer_skip = 0;
+}
+
+/*
+ * oooo   oooo ooooooooooo ooooooooooo oooooooooo
+ *  888    888 88  888  88 88  888  88  888    888
+ *  888oooo888     888         888      888oooo88
+ *  888    888     888         888      888
+ * o888o  o888o   o888o       o888o    o888o
+ *
+ */
+
+static void on_hls_ready(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    hls_buffer_t *data = response->data;
+
+    // whole remaining data with the single call
+    const ssize_t send_size = asc_socket_send(  client->sock
+                                              , &data->buffer[response->skip]
+                                              , data->size - response->skip);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
+
+    response->skip += send_size;
+    if(response->skip < data->size)
+        return;
+
+    hls_buffer_release(data);
+    free(response);
+    client->response = NULL;
+
+    http_client_done(client);
+}
+
+static hls_buffer_t * hls_find(module_data_t *mod, const char *path, const char **mime)
+{
+    const char *name = strrchr(path, '/');
+    name = (name) ? (name + 1) : path;
+
+    const char *ext = strrchr(name, '.');
+    if(!ext)
+        return NULL;
+
+    if(asc_list_size(mod->segments) == 0)
+        return NULL;
+
+    if(!strcmp(ext, ".m3u8"))
+    {
+        *mime = "application/vnd.apple.mpegurl";
+        return mod->playlist;
+    }
+
+    if(strcmp(ext, ".ts") || ext == name)
+        return NULL;
+
+    char *end = NULL;
+    const uint64_t seq = strtoull(name, &end, 10);
+    if(end != ext)
+        return NULL;
+
+    *mime = "video/MP2T";
+    asc_list_for(mod->segments)
+    {
+        hls_buffer_t *segment = (hls_buffer_t *)asc_list_data(mod->segments);
+        if(segment->seq == seq)
+            return segment;
+    }
+
+    return NULL;
+}
+
+/* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
+static int module_call(module_data_t *mod)
+{
+    http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
+
+    if(lua_isnil(lua, 4))
+    {
+        if(client->response)
+        {
+            hls_buffer_release(client->response->data);
+            free(client->response);
+            client->response = NULL;
+        }
+        return 0;
+    }
+
+    lua_getfield(lua, 4, "path");
+    const char *path = lua_tostring(lua, -1);
+    lua_pop(lua, 1); // path
+
+    const char *mime = NULL;
+    hls_buffer_t *data = (path) ? hls_find(mod, path, &mime) : NULL;
+    if(!data)
+    {
+        http_client_abort(client, 404, NULL);
+        return 0;
+    }
+
+    http_response_code(client, 200, NULL);
+    http_response_header(client, "Content-Type: %s", mime);
+    http_response_header(client, "Content-Length: %lu", (unsigned long)data->size);
+    if(data == mod->playlist)
+        http_response_header(client, "Cache-Control: no-cache");
+    else
+    {
+        // segment is immutable while it is available
+        const uint32_t max_age = mod->count * mod->duration / 90000;
+        http_response_header(client, "Cache-Control: max-age=%u", max_age);
+    }
+
+    if(!client->is_keep_alive)
+        http_response_header(client, "Connection: close");
+    else if(client->is_http10)
+        http_response_header(client, "Connection: keep-alive");
+
+    client->on_send = NULL;
+    client->on_read = NULL;
+
+    if(!client->is_head)
+    {
+        ++data->refcount;
+        client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
+        client->response->data = data;
+        client->on_ready = on_hls_ready;
+    }
+
+    http_response_send(client);
+
+    return 0;
+}
+
+static int __module_call(lua_State *L)
+{
+    module_data_t *mod = (module_data_t *)lua_touserdata(L, lua_upvalueindex(1));
+    return module_call(mod);
+}
+
+static void module_init(module_data_t *mod)
+{
+    mod->name = "";
+    module_option_string("name", &mod->name, NULL);
+
+    int duration = 6;
+    module_option_number("duration", &duration);
+    asc_assert(duration > 0, MSG("option 'duration' must be greater than 0"));
+    mod->duration = duration * 90000;
+
+    mod->count = 5;
+    module_option_number("count", &mod->count);
+    asc_assert(mod->count > 0, MSG("option 'count' must be greater than 0"));
+
+    snprintf(mod->kf_name, sizeof(mod->kf_name), "hls_output %s", mod->name);
+    mod->kf = mpegts_keyframe_init(mod->kf_name, true);
+
+    mod->buffer_size = 1024 * TS_PACKET_SIZE;
+    mod->buffer = (uint8_t *)malloc(mod->buffer_size);
+
+    mod->segments = asc_list_init();
+    playlist_update(mod);
+
+    module_stream_init(mod, on_ts);
+
+    // Set callback for http route
+    lua_getmetatable(lua, 3);
+    lua_pushlightuserdata(lua, (void *)mod);
+    lua_pushcclosure(lua, __module_call, 1);
+    lua_setfield(lua, -2, "__call");
+    lua_pop(lua, 1);
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    // segments are released by the clients
+    asc_list_first(mod->segments);
+    while(!asc_list_eol(mod->segments))
+    {
+        hls_buffer_release((hls_buffer_t *)asc_list_data(mod->segments));
+        asc_list_remove_current(mod->segments);
+    }
+    asc_list_destroy(mod->segments);
+
+    if(mod->playlist)
+        hls_buffer_release(mod->playlist);
+
+    free(mod->buffer);
+
+    mpegts_keyframe_destroy(mod->kf);
+}
+
+MODULE_STREAM_METHODS()
+
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { NULL, NULL }
+};
+
+MODULE_LUA_REGISTER(hls_output)
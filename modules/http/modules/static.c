@@ -18,6 +18,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_static
+ *
+ * Module Options:
+ *      path        - string, directory with files
+ *      skip        - string, request path prefix to remove
+ *      block_size  - number, sendfile block size in Kb. default: 128
+ *      default_mime - string, default: application/octet-stream
+ *      cache       - number, total size of the file cache in Kb. default: 16384. 0 - disable
+ *      cache_file  - number, maximum size of the cached file in Kb. default: 256
+ *      cache_check - number, interval in seconds to check the cached file on disk. default: 1
+ *
+ * Small files are kept in memory with prebuilt headers. Least recently used files
+ * are removed from the cache when it is full. Cached file is checked with stat() not
+ * often than cache_check interval and reloaded if size or modification time is changed.
+ * Conditional requests (If-None-Match, If-Modified-Since) and single byte range
+ * requests (Range, If-Range) are supported for all files.
+ */
+
 #include <astra.h>
 
 #if defined(__linux) || defined(__APPLE__) || defined(__FreeBSD__)
@@ -33,6 +53,34 @@
 
 #include "../http.h"
 
+#define CACHE_HASH_SIZE 256 /* must be power of 2 */
+
+typedef struct static_file_t static_file_t;
+
+struct static_file_t
+{
+    char *filename;
+    uint32_t hash;
+    static_file_t *hash_next;
+
+    /* LRU list. head is the most recently used file */
+    static_file_t *prev;
+    static_file_t *next;
+
+    int refcount;
+    bool is_cached;
+
+    time_t mtime;
+    off_t size;
+    uint64_t check_time;
+
+    char etag[64];
+    char last_modified[32];
+    char *headers;
+
+    uint8_t *data;
+};
+
 struct module_data_t
 {
     const char *path;
@@ -41,26 +89,331 @@ struct module_data_t
     size_t block_size;
 
     const char *default_mime;
+
+    size_t cache_size;
+    size_t cache_file_size;
+    uint64_t cache_check;
+
+    size_t cache_fill;
+    static_file_t *cache_hash[CACHE_HASH_SIZE];
+    static_file_t *cache_head;
+    static_file_t *cache_tail;
 };
 
 struct http_response_t
 {
     module_data_t *mod;
 
+    static_file_t *file; /* cached file or NULL */
+
     int file_fd;
     int sock_fd;
 
     off_t file_skip;
-    off_t file_size;
+    off_t file_size; /* end of the range */
 };
 
 static const char __path[] = "path";
 
+static const struct
+{
+    const char *ext;
+    const char *mime;
+} mime_list[] =
+{
+    { "html", "text/html" },
+    { "htm", "text/html" },
+    { "css", "text/css" },
+    { "js", "application/javascript" },
+    { "json", "application/json" },
+    { "xml", "application/xml" },
+    { "txt", "text/plain" },
+    { "csv", "text/csv" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "svg", "image/svg+xml" },
+    { "ico", "image/x-icon" },
+    { "webp", "image/webp" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf", "font/ttf" },
+    { "otf", "font/otf" },
+    { "eot", "application/vnd.ms-fontobject" },
+    { "wasm", "application/wasm" },
+    { "map", "application/json" },
+    { "pdf", "application/pdf" },
+    { "zip", "application/zip" },
+    { "gz", "application/gzip" },
+    { "m3u8", "application/vnd.apple.mpegurl" },
+    { "m3u", "audio/x-mpegurl" },
+    { "ts", "video/MP2T" },
+    { "mp4", "video/mp4" },
+    { "m4s", "video/iso.segment" },
+    { "mpd", "application/dash+xml" },
+    { "webm", "video/webm" },
+    { "mp3", "audio/mpeg" },
+    { "aac", "audio/aac" },
+    { "vtt", "text/vtt" },
+    { NULL, NULL }
+};
+
 /*
  * client->mod - http_server module
  * client->response->mod - http_static module
  */
 
+/*
+ *   oooooooo8     o       oooooooo8 ooooo ooooo ooooooooooo
+ * o888     88    888    o888     88  888   888   888    88
+ * 888           8  88   888          888ooo888   888ooo8
+ * 888o     oo  8oooo88  888o     oo  888   888   888    oo
+ *  888oooo88 o88o  o888o 888oooo88  o888o o888o o888ooo8888
+ *
+ */
+
+static uint32_t cache_hash(const char *filename)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261U;
+    for(; *filename; ++filename)
+        hash = (hash ^ (uint8_t)*filename) * 16777619U;
+    return hash;
+}
+
+static void file_release(static_file_t *file)
+{
+    --file->refcount;
+    if(file->refcount > 0)
+        return;
+
+    free(file->filename);
+    free(file->headers);
+    free(file->data);
+    free(file);
+}
+
+static void cache_remove(module_data_t *mod, static_file_t *file)
+{
+    static_file_t **link = &mod->cache_hash[file->hash & (CACHE_HASH_SIZE - 1)];
+    while(*link != file)
+        link = &(*link)->hash_next;
+    *link = file->hash_next;
+
+    if(file->prev)
+        file->prev->next = file->next;
+    else
+        mod->cache_head = file->next;
+
+    if(file->next)
+        file->next->prev = file->prev;
+    else
+        mod->cache_tail = file->prev;
+
+    mod->cache_fill -= file->size;
+    file->is_cached = false;
+
+    /* data is released by the last client */
+    file_release(file);
+}
+
+static void cache_insert(module_data_t *mod, static_file_t *file)
+{
+    while(mod->cache_tail && mod->cache_fill + file->size > mod->cache_size)
+        cache_remove(mod, mod->cache_tail);
+
+    const size_t i = file->hash & (CACHE_HASH_SIZE - 1);
+    file->hash_next = mod->cache_hash[i];
+    mod->cache_hash[i] = file;
+
+    file->prev = NULL;
+    file->next = mod->cache_head;
+    if(mod->cache_head)
+        mod->cache_head->prev = file;
+    else
+        mod->cache_tail = file;
+    mod->cache_head = file;
+
+    mod->cache_fill += file->size;
+    file->is_cached = true;
+    ++file->refcount;
+}
+
+static static_file_t * cache_find(module_data_t *mod, const char *filename)
+{
+    const uint32_t hash = cache_hash(filename);
+    static_file_t *file = mod->cache_hash[hash & (CACHE_HASH_SIZE - 1)];
+    for(; file; file = file->hash_next)
+    {
+        if(file->hash == hash && !strcmp(file->filename, filename))
+            break;
+    }
+
+    if(!file)
+        return NULL;
+
+    const uint64_t now = asc_utime();
+    if(now - file->check_time >= mod->cache_check)
+    {
+        struct stat sb;
+        if(   stat(filename, &sb) == -1
+           || !S_ISREG(sb.st_mode)
+           || sb.st_mtime != file->mtime
+           || sb.st_size != file->size)
+        {
+            cache_remove(mod, file);
+            return NULL;
+        }
+        file->check_time = now;
+    }
+
+    if(file != mod->cache_head)
+    {
+        /* move to the head of the LRU list */
+        file->prev->next = file->next;
+        if(file->next)
+            file->next->prev = file->prev;
+        else
+            mod->cache_tail = file->prev;
+
+        file->prev = NULL;
+        file->next = mod->cache_head;
+        mod->cache_head->prev = file;
+        mod->cache_head = file;
+    }
+
+    return file;
+}
+
+/*
+ * oooo     oooo ooooo oooo     oooo ooooooooooo
+ *  8888o   888   888   8888o   888   888    88
+ *  88 888o8 88   888   88 888o8 88   888ooo8
+ *  88  888  88   888   88  888  88   888    oo
+ * o88o  8  o88o o888o o88o  8  o88o o888ooo8888
+ *
+ */
+
+static const char * file_mime(module_data_t *mod, const char *path)
+{
+    const char *mime = mod->default_mime;
+    size_t dot = 0;
+    for(size_t i = 0; true; ++i)
+    {
+        const char c = path[i];
+        if(!c)
+            break;
+        else if(c == '/')
+            dot = 0;
+        else if(c == '.')
+            dot = i;
+    }
+
+    if(dot == 0)
+        return mime;
+    const char *extension = &path[dot + 1];
+
+    for(size_t i = 0; mime_list[i].ext; ++i)
+    {
+        if(!strcasecmp(mime_list[i].ext, extension))
+        {
+            mime = mime_list[i].mime;
+            break;
+        }
+    }
+
+    /* global mime table overrides the default list */
+    lua_getglobal(lua, "mime");
+    if(lua_istable(lua, -1))
+    {
+        lua_getfield(lua, -1, extension);
+        if(lua_isstring(lua, -1))
+            mime = lua_tostring(lua, -1);
+        lua_pop(lua, 1); // extension
+    }
+    lua_pop(lua, 1); // mime
+    return mime;
+}
+
+/* file description for the response headers */
+static void file_init(  module_data_t *mod, static_file_t *file
+                      , const char *path, const struct stat *sb)
+{
+    file->mtime = sb->st_mtime;
+    file->size = sb->st_size;
+    file->check_time = asc_utime();
+
+    snprintf(  file->etag, sizeof(file->etag), "\"%lx-%llx\""
+             , (unsigned long)sb->st_mtime, (unsigned long long)sb->st_size);
+
+    struct tm tm;
+    if(gmtime_r(&sb->st_mtime, &tm))
+    {
+        strftime(  file->last_modified, sizeof(file->last_modified)
+                 , "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    }
+
+    const char *mime = file_mime(mod, path);
+    const size_t size = strlen(mime) + strlen(file->etag) + strlen(file->last_modified) + 64;
+    file->headers = (char *)malloc(size);
+    snprintf(  file->headers, size
+             , "Content-Type: %s\r\n"
+               "ETag: %s\r\n"
+               "Last-Modified: %s\r\n"
+               "Accept-Ranges: bytes"
+             , mime, file->etag, file->last_modified);
+}
+
+static static_file_t * file_load(  module_data_t *mod, const char *filename
+                                 , const char *path, int fd, const struct stat *sb)
+{
+    static_file_t *file = (static_file_t *)calloc(1, sizeof(static_file_t));
+    file->filename = strdup(filename);
+    file->hash = cache_hash(filename);
+    file->refcount = 1;
+    file->data = (uint8_t *)malloc((sb->st_size > 0) ? sb->st_size : 1);
+
+    off_t skip = 0;
+    while(skip < sb->st_size)
+    {
+        const ssize_t len = pread(fd, &file->data[skip], sb->st_size - skip, skip);
+        if(len <= 0)
+        {
+            free(file->filename);
+            free(file->data);
+            free(file);
+            return NULL;
+        }
+        skip += len;
+    }
+
+    file_init(mod, file, path, sb);
+    return file;
+}
+
+/*
+ * oooooooooo  ooooooooooo  oooooooo8 oooooooooo
+ *  888    888  888    88  888         888    888
+ *  888oooo88   888ooo8     888oooooo  888oooo88
+ *  888  88o    888    oo          888 888
+ * o888o  88o8 o888ooo8888 o88oooo888 o888o
+ *
+ */
+
+static void response_release(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    if(response->file)
+        file_release(response->file);
+    if(response->file_fd != -1)
+        close(response->file_fd);
+
+    free(response);
+    client->response = NULL;
+}
+
 static void on_ready_send_file(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
@@ -68,10 +421,22 @@ static void on_ready_send_file(void *arg)
 
     ssize_t send_size;
 
-    if(!response->mod->block_size)
+    size_t block_size = response->file_size - response->file_skip;
+
+    if(response->file)
+    {
+        send_size = asc_socket_send(  client->sock
+                                    , &response->file->data[response->file_skip]
+                                    , block_size);
+    }
+    else if(!response->mod->block_size || !asc_socket_is_direct(client->sock))
     {
+        /* userspace TLS: file is encrypted by the socket layer */
+        if(block_size > HTTP_BUFFER_SIZE)
+            block_size = HTTP_BUFFER_SIZE;
+
         const ssize_t len = pread(  response->file_fd
-                                  , client->buffer, HTTP_BUFFER_SIZE
+                                  , client->buffer, block_size
                                   , response->file_skip);
         if(len <= 0)
             send_size = -1;
@@ -80,36 +445,43 @@ static void on_ready_send_file(void *arg)
     }
     else
     {
+        if(block_size > response->mod->block_size)
+            block_size = response->mod->block_size;
+
 #if defined(__linux)
 
+        off_t file_skip = response->file_skip;
         send_size = sendfile(  response->sock_fd
                              , response->file_fd
-                             , NULL, response->mod->block_size);
+                             , &file_skip, block_size);
+        /* socket buffer is full. continue on the next on_ready */
+        if(send_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            send_size = 0;
 
 #elif defined(__APPLE__)
 
-        off_t block_size = response->mod->block_size;
+        off_t len = block_size;
         const int r = sendfile(  response->file_fd
                                , response->sock_fd
                                , response->file_skip
-                               , &block_size, NULL, 0);
+                               , &len, NULL, 0);
 
-        if(r == 0 || (r == -1 && errno == EAGAIN && block_size > 0))
-            send_size = block_size;
+        if(r == 0 || (r == -1 && errno == EAGAIN))
+            send_size = len;
         else
             send_size = -1;
 
 #elif defined(__FreeBSD__)
 
-        off_t block_size = 0;
+        off_t len = 0;
         const int r = sendfile(  response->file_fd
                                , response->sock_fd
                                , response->file_skip
-                               , response->mod->block_size, NULL
-                               , &block_size, 0);
+                               , block_size, NULL
+                               , &len, 0);
 
-        if(r == 0 || (r == -1 && errno == EAGAIN && block_size > 0))
-            send_size = block_size;
+        if(r == 0 || (r == -1 && errno == EAGAIN))
+            send_size = len;
         else
             send_size = -1;
 
@@ -130,38 +502,122 @@ static void on_ready_send_file(void *arg)
     response->file_skip += send_size;
 
     if(response->file_skip >= response->file_size)
-        http_client_close(client);
+    {
+        response_release(client);
+        http_client_done(client);
+    }
 }
 
-static const char * lua_get_mime(http_client_t *client, const char *path)
+/* If-None-Match and If-Modified-Since */
+static bool is_not_modified(http_client_t *client, const static_file_t *file)
 {
-    const char *mime = client->response->mod->default_mime;
-    size_t dot = 0;
-    for(size_t i = 0; true; ++i)
+    size_t size = 0;
+    const char *value = http_request_header(client, "if-none-match", &size);
+    if(value)
     {
-        const char c = path[i];
-        if(!c)
-            break;
-        else if(c == '/')
-            dot = 0;
-        else if(c == '.')
-            dot = i;
+        const size_t etag_size = strlen(file->etag);
+        if(size == 1 && value[0] == '*')
+            return true;
+        for(size_t i = 0; i + etag_size <= size; ++i)
+        {
+            if(!memcmp(&value[i], file->etag, etag_size))
+                return true;
+        }
+        return false;
     }
 
-    if(dot == 0)
-        return mime;
-    const char *extension = &path[dot + 1];
+    value = http_request_header(client, "if-modified-since", &size);
+    if(value && file->last_modified[0])
+    {
+        /* exact match with the Last-Modified value */
+        return (size == strlen(file->last_modified)
+                && !memcmp(value, file->last_modified, size));
+    }
 
-    lua_getglobal(lua, "mime");
-    if(lua_istable(lua, -1))
+    return false;
+}
+
+static bool parse_offset(const char **str, const char *end, off_t *value)
+{
+    const char *p = *str;
+    if(p >= end || *p < '0' || *p > '9')
+        return false;
+
+    off_t result = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; ++p)
+        result = result * 10 + (*p - '0');
+
+    *str = p;
+    *value = result;
+    return true;
+}
+
+/*
+ * Single byte range. Returns:
+ *  0 - no range, whole file is sent
+ *  1 - range is in the [begin, end)
+ * -1 - range is not satisfiable
+ */
+static int parse_range(http_client_t *client, const static_file_t *file
+                       , off_t *begin, off_t *end)
+{
+    size_t size = 0;
+    const char *value = http_request_header(client, "range", &size);
+    if(!value || size < 7 || strncmp(value, "bytes=", 6))
+        return 0;
+
+    /* range is ignored if the file is changed */
+    size_t if_range_size = 0;
+    const char *if_range = http_request_header(client, "if-range", &if_range_size);
+    if(if_range)
     {
-        lua_getfield(lua, -1, extension);
-        if(lua_isstring(lua, -1))
-            mime = lua_tostring(lua, -1);
-        lua_pop(lua, 1); // extension
+        const char *validator = (if_range[0] == '"') ? file->etag : file->last_modified;
+        if(if_range_size != strlen(validator) || memcmp(if_range, validator, if_range_size))
+            return 0;
     }
-    lua_pop(lua, 1); // mime
-    return mime;
+
+    const char *p = &value[6];
+    const char *p_end = &value[size];
+    off_t first = 0;
+    off_t last = 0;
+
+    if(*p == '-')
+    {
+        /* suffix: last N bytes */
+        ++p;
+        if(!parse_offset(&p, p_end, &last) || p != p_end)
+            return 0;
+        if(last == 0)
+            return -1;
+        first = (last < file->size) ? (file->size - last) : 0;
+        last = file->size - 1;
+    }
+    else
+    {
+        if(!parse_offset(&p, p_end, &first) || p == p_end || *p != '-')
+            return 0;
+        ++p;
+        if(p == p_end)
+            last = file->size - 1;
+        else if(!parse_offset(&p, p_end, &last) || p != p_end || last < first)
+            return 0; /* multiple ranges or syntax error */
+        if(first >= file->size)
+            return -1;
+        if(last >= file->size)
+            last = file->size - 1;
+    }
+
+    *begin = first;
+    *end = last + 1;
+    return 1;
+}
+
+static void response_connection(http_client_t *client)
+{
+    if(!client->is_keep_alive)
+        http_response_header(client, "Connection: close");
+    else if(client->is_http10)
+        http_response_header(client, "Connection: keep-alive");
 }
 
 /* Stack: 1 - instance, 2 - server, 3 - client, 4 - request */
@@ -172,63 +628,155 @@ static int module_call(module_data_t *mod)
     if(lua_isnil(lua, 4))
     {
         if(client->response)
-        {
-            close(client->response->file_fd);
-            free(client->response);
-            client->response = NULL;
-        }
+            response_release(client);
         return 0;
     }
 
-    client->response = (http_response_t *)calloc(1, sizeof(http_response_t));
-    client->response->mod = mod;
-    client->on_send = NULL;
-    client->on_read = NULL;
-    client->on_ready = on_ready_send_file;
-    client->response->sock_fd = asc_socket_fd(client->sock);
-
-    lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
-    lua_getfield(lua, -1, __path);
+    lua_getfield(lua, 4, __path);
     const char *path = lua_tostring(lua, -1);
-    lua_pop(lua, 2); // request + path
+    lua_pop(lua, 1); // path, referenced by the request
 
-    char *filename = (char *)malloc(PATH_MAX);
-    sprintf(filename, "%s%s", mod->path, &path[mod->path_skip]);
-    client->response->file_fd = open(filename, O_RDONLY);
-    free(filename);
-    if(client->response->file_fd == -1)
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s%s", mod->path, &path[mod->path_skip]);
+
+    static_file_t *file = (mod->cache_size) ? cache_find(mod, filename) : NULL;
+    int fd = -1;
+
+    /* description of the not cached file */
+    static_file_t stat_file;
+
+    if(file)
+        ++file->refcount;
+    else
     {
-        http_client_warning(client, "file not found %s", path);
+        fd = open(filename, O_RDONLY);
+        if(fd == -1)
+        {
+            http_client_warning(client, "file not found %s", path);
+            http_client_abort(client, 404, NULL);
+            return 0;
+        }
 
-        free(client->response);
-        client->response = NULL;
+        struct stat sb;
+        if(fstat(fd, &sb) == -1)
+        {
+            http_client_error(client, "failed to get file status %s [%s]", path, strerror(errno));
+            close(fd);
+            http_client_abort(client, 500, NULL);
+            return 0;
+        }
 
-        http_client_abort(client, 404, NULL);
-        return 0;
+        if(!S_ISREG(sb.st_mode))
+        {
+            http_client_warning(client, "wrong file type %s", path);
+            close(fd);
+            http_client_abort(client, 404, NULL);
+            return 0;
+        }
+
+        if(   (size_t)sb.st_size <= mod->cache_file_size
+           && (size_t)sb.st_size <= mod->cache_size)
+        {
+            file = file_load(mod, filename, path, fd, &sb);
+            if(file)
+            {
+                cache_insert(mod, file);
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        if(!file)
+        {
+            memset(&stat_file, 0, sizeof(stat_file));
+            file_init(mod, &stat_file, path, &sb);
+        }
     }
 
-    struct stat sb;
-    fstat(client->response->file_fd, &sb);
+    const static_file_t *info = (file) ? file : &stat_file;
 
-    if(!S_ISREG(sb.st_mode))
-    {
-        http_client_warning(client, "wrong file type %s", path);
+    http_response_t *response = (http_response_t *)calloc(1, sizeof(http_response_t));
+    response->mod = mod;
+    response->file = file;
+    response->file_fd = fd;
+    response->sock_fd = asc_socket_fd(client->sock);
+    response->file_size = info->size;
 
-        close(client->response->file_fd);
-        free(client->response);
-        client->response = NULL;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = on_ready_send_file;
 
-        http_client_abort(client, 404, NULL);
-        return 0;
+    if(is_not_modified(client, info))
+    {
+        http_response_code(client, 304, NULL);
+        http_response_header(client, "ETag: %s", info->etag);
+        http_response_header(client, "Last-Modified: %s", info->last_modified);
+        response_connection(client);
+        client->response = response;
+        response_release(client);
     }
+    else
+    {
+        off_t begin = 0;
+        off_t end = info->size;
+        const int range = parse_range(client, info, &begin, &end);
 
-    client->response->file_size = sb.st_size;
+        if(range == -1)
+        {
+            http_response_code(client, 416, NULL);
+            http_response_header(client, "Content-Range: bytes */%llu"
+                                 , (unsigned long long)info->size);
+            http_response_header(client, "Content-Length: 0");
+            response_connection(client);
+            client->response = response;
+            response_release(client);
+        }
+        else
+        {
+            if(range == 1)
+            {
+                http_response_code(client, 206, NULL);
+                http_response_header(client, "Content-Range: bytes %llu-%llu/%llu"
+                                     , (unsigned long long)begin
+                                     , (unsigned long long)(end - 1)
+                                     , (unsigned long long)info->size);
+            }
+            else
+                http_response_code(client, 200, NULL);
+
+            http_response_header(client, "Content-Length: %llu"
+                                 , (unsigned long long)(end - begin));
+            http_response_header(client, "%s", info->headers);
+            response_connection(client);
+
+            response->file_skip = begin;
+            response->file_size = end;
+            client->response = response;
+
+            if(client->is_head || begin == end)
+                response_release(client);
+        }
+    }
+
+    if(!file)
+        free(stat_file.headers);
 
-    http_response_code(client, 200, NULL);
-    http_response_header(client, "Content-Length: %lu", client->response->file_size);
-    http_response_header(client, "Content-Type: %s", lua_get_mime(client, path));
     http_response_send(client);
 
+    /* small cached file is sent with the headers */
+    response = client->response;
+    if(response && response->file)
+    {
+        const size_t size = response->file_size - response->file_skip;
+        if(size <= HTTP_BUFFER_SIZE - client->chunk_left)
+        {
+            memcpy(  &client->buffer[client->chunk_left]
+                   , &response->file->data[response->file_skip], size);
+            client->chunk_left += size;
+            response_release(client);
+        }
+    }
+
     return 0;
 }
 
@@ -267,6 +815,18 @@ static void module_init(module_data_t *mod)
     mod->default_mime = "application/octet-stream";
     module_option_string("default_mime", &mod->default_mime, NULL);
 
+    int cache_size = 16 * 1024;
+    module_option_number("cache", &cache_size);
+    mod->cache_size = (cache_size > 0) ? ((size_t)cache_size * 1024) : 0;
+
+    int cache_file_size = 256;
+    module_option_number("cache_file", &cache_file_size);
+    mod->cache_file_size = (cache_file_size > 0) ? ((size_t)cache_file_size * 1024) : 0;
+
+    int cache_check = 1;
+    module_option_number("cache_check", &cache_check);
+    mod->cache_check = (cache_check > 0) ? ((uint64_t)cache_check * 1000000) : 0;
+
     struct stat s;
     asc_assert(stat(mod->path, &s) != -1, "[http_static] path is not found");
     asc_assert(S_ISDIR(s.st_mode), "[http_static] path is not directory");
@@ -281,7 +841,9 @@ static void module_init(module_data_t *mod)
 
 static void module_destroy(module_data_t *mod)
 {
-    __uarg(mod);
+    /* files in use are released by the clients */
+    while(mod->cache_tail)
+        cache_remove(mod, mod->cache_tail);
 }
 
 MODULE_LUA_METHODS()
@@ -18,125 +18,1804 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_upstream
+ *
+ * Module Options:
+ *      callback    - function, route callback
+ *      shared      - boolean, all clients of the same upstream read from the single
+ *                    ring buffer, each client holds only the read position.
+ *                    ring is allocated with buffer_size and buffer_fill of the first client
+ *      slow_client - string, policy for the client behind the write position:
+ *                    "skip" - skip forward to the recent data (default).
+ *                    client with own buffer is skipped to the PAT or keyframe,
+ *                    client of the shared ring to the nearest one if it is found,
+ *                    "disconnect" - close connection
+ *      splice      - boolean, Linux only. like shared, but the stream is written once
+ *                    into the pipe and duplicated to the client pipes with tee(),
+ *                    clients are fed with splice() without copying to userspace
+ *      workers     - number, Linux only. like shared, but sending to the client sockets
+ *                    is moved from the main loop to the pool of worker threads.
+ *                    the pool is common for all instances, the first one sets its size.
+ *                    requests, responses headers and Lua callbacks are processed
+ *                    in the main loop
+ *      gop_cache   - number, maximum size of the keyframe cache in Kb (default: 0, disabled).
+ *                    new client receives the cache from the recent video keyframe
+ *                    with PAT and PMT, then continues with the live stream.
+ *                    cache is started with the first client of the stream and kept
+ *                    while the stream exists
+ *
+ * Client stats are available with server:data(client).stats:
+ *      bytes, bitrate (Kbit/s), lag (bytes queued for the client), skip, skip_bytes,
+ *      uptime (seconds) and TCP state: rtt, rttvar (ms), cwnd, retrans, lost, notsent,
+ *      delivery_rate (Kbit/s)
+ */
+
 #include <astra.h>
 #include "../http.h"
 
-#define DEFAULT_BUFFER_SIZE (1024 * 1024)
-#define DEFAULT_BUFFER_FILL (128 * 1024)
+#ifndef _WIN32
+#   include <sys/uio.h>
+#endif
+
+#if defined(__linux)
+#   define ASC_SPLICE
+#   define ASC_WORKERS
+#endif
+
+#ifdef ASC_SPLICE
+#   include <fcntl.h>
+#   include <sys/ioctl.h>
+#endif
+
+#ifdef ASC_WORKERS
+#   include <pthread.h>
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#endif
+
+#define DEFAULT_BUFFER_SIZE (1024 * 1024)
+#define DEFAULT_BUFFER_FILL (128 * 1024)
+
+#define SYNC_POINT_SIZE 64
+
+struct module_data_t
+{
+    int idx_callback;
+
+    bool is_shared;
+    bool is_splice;
+    bool is_slow_disconnect;
+    bool is_workers;
+
+    size_t gop_cache_size;
+    asc_list_t *gop_list;
+};
+
+/* cached GOP. data is appended only, clients read the size taken on attach */
+typedef struct
+{
+    int refcount;       /* cache and clients */
+
+    uint8_t *buffer;
+    size_t size;
+} http_gop_t;
+
+/* keyframe cache, one per upstream stream */
+typedef struct
+{
+    MODULE_STREAM_DATA();
+
+    module_stream_t *upstream;
+
+    mpegts_keyframe_t *kf;
+    size_t pes_skip;    /* position of the PES start in the gop */
+
+    size_t buffer_size;
+    http_gop_t *gop;
+    bool is_key;        /* gop is started with the keyframe */
+} http_gop_cache_t;
+
+/* shared ring, one per upstream stream */
+typedef struct
+{
+    MODULE_STREAM_DATA();
+
+    module_stream_t *upstream;
+
+    uint8_t *buffer;
+    size_t buffer_size; /* multiple of TS_PACKET_SIZE */
+    size_t buffer_fill;
+    size_t lag_max;     /* client behind the head more than this is skipped */
+    uint64_t head;      /* total bytes written. read by the workers */
+
+    // head values of the PAT and keyframe packets. read by the workers
+    uint64_t sync_point[SYNC_POINT_SIZE];
+    uint32_t sync_count;
+
+    asc_list_t *clients;
+    int worker_count;   /* clients served by the workers */
+} http_ring_t;
+
+static asc_list_t *ring_list = NULL;
+
+#ifdef ASC_SPLICE
+/* splice fan-out, one per upstream stream */
+typedef struct
+{
+    MODULE_STREAM_DATA();
+
+    module_stream_t *upstream;
+
+    int fd[2];          /* source pipe, each chunk is written once */
+    int null_fd;        /* to drain the source pipe */
+    size_t pipe_size;   /* requested capacity of the client pipe */
+
+    uint8_t *buffer;    /* chunk */
+    size_t buffer_fill;
+    size_t buffer_count;
+
+    asc_list_t *clients;
+} http_pipe_t;
+
+static asc_list_t *pipe_list = NULL;
+#endif
+
+#ifdef ASC_WORKERS
+#define WORKER_EVENTS 256
+#define WORKER_REAP_INTERVAL 100 /* ms */
+
+typedef struct http_worker_t http_worker_t;
+
+/* client socket served by the worker thread */
+typedef struct
+{
+    http_client_t *client; /* main thread only */
+    http_worker_t *worker;
+    http_ring_t *ring;
+    bool is_slow_disconnect;
+
+    int fd;
+    uint64_t cursor;
+    uint8_t tail[TS_PACKET_SIZE];
+    size_t tail_size;
+    uint64_t sent;
+    uint64_t skip_count;
+    uint64_t skip_bytes;
+    int index;          /* position in worker->clients, -1 if removed */
+    bool is_busy;       /* waiting for EPOLLOUT */
+    bool is_closed;     /* in worker->closed */
+
+    bool is_slow;
+    int error;
+} http_worker_client_t;
+
+struct http_worker_t
+{
+    asc_thread_t *thread;
+    bool is_started;
+
+    /* locked by the worker while the events are processed */
+    pthread_mutex_t mutex;
+
+    int epoll_fd;
+    int event_fd;       /* new data in the rings */
+
+    http_worker_client_t **clients;
+    int clients_count;
+    int clients_size;
+
+    asc_list_t *closed;  /* failed clients. closed by the main thread */
+    asc_list_t *garbage; /* detached clients. released by the worker */
+};
+
+typedef struct
+{
+    int refcount;       /* modules and clients */
+
+    http_worker_t *workers;
+    int count;
+    int next;
+
+    asc_timer_t *timer;
+} http_worker_pool_t;
+
+static http_worker_pool_t *worker_pool = NULL;
+#endif
+
+struct http_response_t
+{
+    MODULE_STREAM_DATA();
+
+    module_data_t *mod;
+
+    uint8_t *buffer;
+    size_t buffer_count;
+    size_t buffer_read;
+    size_t buffer_write;
+
+    size_t buffer_size;
+    size_t buffer_fill;
+
+    bool is_socket_busy;
+    bool is_shutdown;   /* slow client is disconnected, waiting for on_read */
+
+    // own buffer. positions in the total bytes, sync points are PAT and keyframes
+    uint64_t read_total;
+    uint64_t write_total;
+    uint64_t sync_point[SYNC_POINT_SIZE];
+    int sync_head;
+    int sync_count;
+    bool is_sync_wait;  /* buffer is dropped, waiting for the next sync point */
+
+    // stats
+    uint64_t start_time;
+    uint64_t sent;
+    uint64_t skip_count;
+    uint64_t skip_bytes;
+
+    // shared mode
+    http_ring_t *ring;
+    uint64_t cursor;    /* read position in the ring->head units */
+    uint8_t tail[TS_PACKET_SIZE]; /* remainder of the packet, sent before the cursor */
+    size_t tail_size;
+
+#ifdef ASC_SPLICE
+    // splice mode
+    http_pipe_t *pipe;
+    int pipe_fd[2];
+    size_t pipe_size;   /* capacity granted by the system */
+    bool is_pipe_shutdown;
+#endif
+
+#ifdef ASC_WORKERS
+    // workers mode
+    http_worker_client_t *worker_client;
+#endif
+
+    // cached GOP is sent before the live data
+    http_gop_t *gop;
+    size_t gop_size;
+    size_t gop_skip;
+};
+
+static http_gop_t * gop_init(size_t size)
+{
+    http_gop_t *gop = (http_gop_t *)calloc(1, sizeof(http_gop_t));
+    gop->refcount = 1;
+    gop->buffer = (uint8_t *)malloc(size);
+    return gop;
+}
+
+static void gop_release(http_gop_t *gop)
+{
+    --gop->refcount;
+    if(gop->refcount > 0)
+        return;
+
+    free(gop->buffer);
+    free(gop);
+}
+
+/* returns false if the cached GOP is not sent yet or the client is closed */
+static bool gop_send(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    const ssize_t send_size = asc_socket_send(  client->sock
+                                              , &response->gop->buffer[response->gop_skip]
+                                              , response->gop_size - response->gop_skip);
+    if(send_size == -1)
+    {
+        http_client_error(client, "failed to send ts [%s]", asc_socket_error());
+        http_client_close(client);
+        return false;
+    }
+
+    response->gop_skip += send_size;
+    response->sent += send_size;
+    if(response->gop_skip < response->gop_size)
+        return false;
+
+    gop_release(response->gop);
+    response->gop = NULL;
+    return true;
+}
+
+/*
+ * client->mod - http_server module
+ * client->response->mod - http_upstream module
+ */
+
+static void on_upstream_ready(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(response->gop && !gop_send(client))
+        return;
+
+    if(response->buffer_count > 0)
+    {
+        size_t block_size = (response->buffer_write > response->buffer_read)
+                          ? (response->buffer_write - response->buffer_read)
+                          : (response->buffer_size - response->buffer_read);
+
+        if(block_size > response->buffer_count)
+            block_size = response->buffer_count;
+
+        const ssize_t send_size = asc_socket_send(  client->sock
+                                                  , &response->buffer[response->buffer_read]
+                                                  , block_size);
+
+        if(send_size > 0)
+        {
+            response->sent += send_size;
+            response->read_total += send_size;
+            response->buffer_count -= send_size;
+            response->buffer_read += send_size;
+            if(response->buffer_read >= response->buffer_size)
+                response->buffer_read = 0;
+        }
+        else if(send_size == -1)
+        {
+            http_client_error(  client, "failed to send ts (%d bytes) [%s]"
+                              , block_size, asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+    }
+
+    if(response->buffer_count == 0)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+}
+
+static void slow_client_warning(http_client_t *client, const char *action)
+{
+    asc_socket_tcp_info_t info;
+    if(asc_socket_get_tcp_info(client->sock, &info))
+    {
+        http_client_warning(  client, "slow client, %s. rtt:%.1fms cwnd:%u retrans:%u notsent:%d"
+                            , action, info.rtt / 1000.0, info.cwnd, info.retrans, info.notsent);
+    }
+    else
+        http_client_warning(client, "slow client, %s", action);
+}
+
+static bool is_sync_point(const uint8_t *ts)
+{
+    if(TS_GET_PID(ts) == 0)
+        return TS_IS_PAYLOAD_START(ts);
+
+    /* random access indicator */
+    return (TS_IS_AF(ts) && ts[4] > 0 && (ts[5] & 0x40));
+}
+
+/* buffer overflow. drops data up to the sync point, returns false if the client is closed */
+static bool buffer_skip(http_client_t *client)
+{
+    http_response_t *response = client->response;
+
+    ++response->skip_count;
+
+    if(response->mod->is_slow_disconnect)
+    {
+        // on_read is called with the error, client is closed out of the stream loop
+        slow_client_warning(client, "disconnect");
+        asc_socket_shutdown_both(client->sock);
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+        response->is_shutdown = true;
+        return false;
+    }
+
+    // incomplete TLS record and the remainder of the partially sent packet
+    const size_t pending = asc_socket_send_pending(client->sock);
+    const size_t partial = (response->read_total + pending) % TS_PACKET_SIZE;
+    const size_t keep = pending + ((partial > 0) ? (TS_PACKET_SIZE - partial) : 0);
+
+    // earliest sync point that frees a half of the buffer, or the recent one
+    const uint64_t limit = response->write_total - response->buffer_size / 2;
+    uint64_t target = 0;
+    for(int i = 0; i < response->sync_count; ++i)
+    {
+        const int idx = (response->sync_head + SYNC_POINT_SIZE - response->sync_count + i)
+                      % SYNC_POINT_SIZE;
+        const uint64_t point = response->sync_point[idx];
+        if(point <= response->read_total + keep)
+            continue;
+
+        target = point;
+        if(point >= limit)
+            break;
+    }
+
+    if(target == 0)
+    {
+        // no sync point in the buffer. drop everything
+        target = response->write_total;
+        response->is_sync_wait = true;
+    }
+
+    const uint64_t read_total = target - keep;
+
+    // drop sync points before the new read position
+    while(response->sync_count > 0)
+    {
+        const int idx = (response->sync_head + SYNC_POINT_SIZE - response->sync_count)
+                      % SYNC_POINT_SIZE;
+        if(response->sync_point[idx] > read_total)
+            break;
+        --response->sync_count;
+    }
+    const size_t drop = read_total - response->read_total;
+
+    size_t buffer_read = (response->buffer_read + drop) % response->buffer_size;
+    for(size_t i = 0; i < keep; ++i)
+    {
+        response->buffer[(buffer_read + i) % response->buffer_size]
+            = response->buffer[(response->buffer_read + i) % response->buffer_size];
+    }
+
+    response->buffer_read = buffer_read;
+    response->buffer_count -= drop;
+    response->read_total = read_total;
+    response->skip_bytes += drop;
+
+    char action[64];
+    snprintf(action, sizeof(action), "skip %lu bytes", (unsigned long)drop);
+    slow_client_warning(client, action);
+
+    if(response->buffer_count == 0 && response->is_socket_busy)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+
+    return true;
+}
+
+static void on_ts(void *arg, const uint8_t *ts)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(response->is_shutdown)
+        return;
+
+    const bool is_sync = is_sync_point(ts);
+    if(response->is_sync_wait)
+    {
+        if(!is_sync)
+            return;
+        response->is_sync_wait = false;
+    }
+
+    if(response->buffer_count + TS_PACKET_SIZE >= response->buffer_size)
+    {
+        // overflow
+        if(!buffer_skip(client))
+            return;
+
+        if(response->is_sync_wait)
+        {
+            if(!is_sync)
+                return;
+            response->is_sync_wait = false;
+        }
+    }
+
+    if(is_sync)
+    {
+        response->sync_point[response->sync_head] = response->write_total;
+        response->sync_head = (response->sync_head + 1) % SYNC_POINT_SIZE;
+        if(response->sync_count < SYNC_POINT_SIZE)
+            ++response->sync_count;
+    }
+
+    const size_t buffer_write = response->buffer_write + TS_PACKET_SIZE;
+    if(buffer_write < response->buffer_size)
+    {
+        memcpy(&response->buffer[response->buffer_write], ts, TS_PACKET_SIZE);
+        response->buffer_write = buffer_write;
+    }
+    else if(buffer_write > response->buffer_size)
+    {
+        const size_t ts_head = response->buffer_size - response->buffer_write;
+        memcpy(&response->buffer[response->buffer_write], ts, ts_head);
+        response->buffer_write = TS_PACKET_SIZE - ts_head;
+        memcpy(response->buffer, &ts[ts_head], response->buffer_write);
+    }
+    else
+    {
+        memcpy(&response->buffer[response->buffer_write], ts, TS_PACKET_SIZE);
+        response->buffer_write = 0;
+    }
+    response->buffer_count += TS_PACKET_SIZE;
+    response->write_total += TS_PACKET_SIZE;
+
+    if(   response->is_socket_busy == false
+       && response->buffer_count >= response->buffer_fill)
+    {
+        asc_socket_set_on_ready(client->sock, on_upstream_ready);
+        response->is_socket_busy = true;
+    }
+}
+
+/*
+ * Nearest to the target sync point not older than the half of the ring.
+ * Returns the target if no sync point is found
+ */
+static uint64_t ring_sync_point(http_ring_t *ring, uint64_t head, uint64_t low, uint64_t target)
+{
+    size_t window = ring->buffer_size / 2;
+    if(window > ring->lag_max)
+        window = ring->lag_max;
+    if(head - low > window)
+        low = head - window;
+
+    bool is_after = false, is_before = false;
+    uint64_t after = 0, before = 0;
+
+    const uint32_t count = __atomic_load_n(&ring->sync_count, __ATOMIC_ACQUIRE);
+    for(uint32_t i = 0; i < count && i < SYNC_POINT_SIZE; ++i)
+    {
+        /* slot could be replaced with the newer point while reading */
+        const uint32_t idx = (count - 1 - i) % SYNC_POINT_SIZE;
+        const uint64_t point = __atomic_load_n(&ring->sync_point[idx], __ATOMIC_RELAXED);
+        if(point < low || point + TS_PACKET_SIZE > head)
+            continue;
+
+        if(point >= target)
+        {
+            after = point;
+            is_after = true;
+        }
+        else if(!is_before)
+        {
+            before = point;
+            is_before = true;
+        }
+    }
+
+    if(is_after && (!is_before || after - target <= target - before))
+        return after;
+    if(is_before)
+        return before;
+    return target;
+}
+
+/*
+ * Client is behind the write position. The cursor jumps to the sync point
+ * near the recent data, remainder of the partially sent packet is copied
+ * to the tail and sent first. Returns skipped bytes
+ */
+static uint64_t ring_skip(http_ring_t *ring, uint64_t head, uint64_t *cursor
+                          , uint8_t *tail, size_t *tail_size)
+{
+    const size_t partial = *cursor % TS_PACKET_SIZE;
+    uint64_t next = *cursor;
+
+    if(partial > 0)
+    {
+        const uint64_t start = *cursor - partial;
+        const size_t size = TS_PACKET_SIZE - partial;
+        memcpy(&tail[partial], &ring->buffer[*cursor % ring->buffer_size], size);
+
+        /* packet could be overwritten while copied. alignment is kept anyway */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - start >= ring->buffer_size)
+            memset(&tail[partial], 0xFF, size);
+
+        *tail_size = size;
+        next = start + TS_PACKET_SIZE;
+    }
+
+    uint64_t target = head - ((ring->buffer_fill < ring->lag_max)
+                              ? ring->buffer_fill : ring->lag_max);
+    if(target < next)
+        target = next;
+    target = ring_sync_point(ring, head, next, target);
+
+    *cursor = target;
+    return target - next;
+}
+
+#ifdef ASC_WORKERS
+/*
+ * oooo     oooo   ooooooo   oooooooooo   oooo   oooo ooooooooooo oooooooooo
+ *  88   88  88  o888   888o  888    888   888  o88    888    88   888    888
+ *   88 888 88   888     888  888oooo88    888888      888ooo8     888oooo88
+ *    888 888    888o   o888  888  88o     888  88o    888    oo   888  88o
+ *     8   8       88ooo88   o888o  88o8  o888o o888o o888ooo8888 o888o  88o8
+ *
+ */
+
+/*
+ * Worker thread sends the shared ring data to the client sockets.
+ * Ring is written by the main thread, ring->head is published with the release store.
+ * Worker functions are called with the worker->mutex locked.
+ */
+
+static void worker_remove(http_worker_t *worker, http_worker_client_t *item)
+{
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, item->fd, NULL);
+
+    --worker->clients_count;
+    http_worker_client_t *last = worker->clients[worker->clients_count];
+    worker->clients[item->index] = last;
+    last->index = item->index;
+    item->index = -1;
+}
+
+static void worker_close(http_worker_t *worker, http_worker_client_t *item)
+{
+    worker_remove(worker, item);
+
+    // client is closed by the main thread
+    item->is_closed = true;
+    asc_list_insert_tail(worker->closed, item);
+}
+
+static void worker_send(http_worker_t *worker, http_worker_client_t *item)
+{
+    http_ring_t *ring = item->ring;
+    const uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    // data in the margin over lag_max is not overwritten while writev() reads it
+    uint64_t count = head - item->cursor;
+    if(count > ring->lag_max)
+    {
+        // client is behind the write position
+        if(item->is_slow_disconnect)
+        {
+            item->is_slow = true;
+            worker_close(worker, item);
+            return;
+        }
+
+        ++item->skip_count;
+        item->skip_bytes += ring_skip(ring, head, &item->cursor, item->tail, &item->tail_size);
+        count = head - item->cursor;
+    }
+
+    if(count == 0 && item->tail_size == 0)
+        return;
+
+    const size_t skip = item->cursor % ring->buffer_size;
+    size_t head_size = ring->buffer_size - skip;
+    if(head_size > count)
+        head_size = count;
+
+    struct iovec iov[3];
+    int iov_count = 0;
+    if(item->tail_size > 0)
+    {
+        iov[iov_count].iov_base = &item->tail[TS_PACKET_SIZE - item->tail_size];
+        iov[iov_count].iov_len = item->tail_size;
+        ++iov_count;
+    }
+    iov[iov_count].iov_base = &ring->buffer[skip];
+    iov[iov_count].iov_len = head_size;
+    ++iov_count;
+    if(count > head_size)
+    {
+        iov[iov_count].iov_base = ring->buffer;
+        iov[iov_count].iov_len = count - head_size;
+        ++iov_count;
+    }
+
+    ssize_t send_size = writev(item->fd, iov, iov_count);
+    if(send_size == -1)
+    {
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            item->error = errno;
+            worker_close(worker, item);
+            return;
+        }
+        send_size = 0;
+    }
+
+    const uint64_t cursor = item->cursor;
+
+    item->sent += send_size;
+    if((size_t)send_size >= item->tail_size)
+    {
+        item->cursor += send_size - item->tail_size;
+        item->tail_size = 0;
+    }
+    else
+        item->tail_size -= send_size;
+
+    // sent data might be overwritten by the main thread
+    const uint64_t head_sent = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(head_sent - cursor > ring->buffer_size - TS_PACKET_SIZE)
+    {
+        if(item->is_slow_disconnect)
+        {
+            item->is_slow = true;
+            worker_close(worker, item);
+            return;
+        }
+
+        ++item->skip_count;
+        item->skip_bytes += ring_skip(  ring, head_sent, &item->cursor
+                                      , item->tail, &item->tail_size);
+    }
+
+    if(item->cursor != head || item->tail_size > 0)
+    {
+        // socket buffer is full
+        struct epoll_event event;
+        event.events = EPOLLOUT | EPOLLONESHOT;
+        event.data.ptr = item;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, item->fd, &event);
+        item->is_busy = true;
+    }
+}
+
+static void worker_loop(void *arg)
+{
+    http_worker_t *worker = (http_worker_t *)arg;
+    struct epoll_event events[WORKER_EVENTS];
+
+    while(worker->is_started)
+    {
+        const int ret = epoll_wait(worker->epoll_fd, events, WORKER_EVENTS, 100);
+
+        pthread_mutex_lock(&worker->mutex);
+
+        bool is_wakeup = false;
+        for(int i = 0; i < ret; ++i)
+        {
+            http_worker_client_t *item = (http_worker_client_t *)events[i].data.ptr;
+            if(!item)
+            {
+                uint64_t value;
+                const ssize_t r = read(worker->event_fd, &value, sizeof(value));
+                __uarg(r);
+                is_wakeup = true;
+                continue;
+            }
+
+            // removed after epoll_wait()
+            if(item->index == -1)
+                continue;
+
+            item->is_busy = false;
+            worker_send(worker, item);
+        }
+
+        if(is_wakeup)
+        {
+            // reverse order: removed client is replaced with the last one
+            for(int i = worker->clients_count - 1; i >= 0; --i)
+            {
+                if(i >= worker->clients_count)
+                    continue;
+                http_worker_client_t *item = worker->clients[i];
+                if(!item->is_busy)
+                    worker_send(worker, item);
+            }
+        }
+
+        // events with the detached clients are processed
+        asc_list_first(worker->garbage);
+        while(!asc_list_eol(worker->garbage))
+        {
+            free(asc_list_data(worker->garbage));
+            asc_list_remove_current(worker->garbage);
+        }
+
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+static void on_worker_close(void *arg)
+{
+    http_worker_t *worker = (http_worker_t *)arg;
+
+    worker->is_started = false;
+
+    if(worker->thread)
+    {
+        asc_thread_destroy(worker->thread);
+        worker->thread = NULL;
+    }
+}
+
+/* Main thread. closes clients failed in the workers */
+static void on_worker_timer(void *arg)
+{
+    __uarg(arg);
+
+    for(int i = 0; worker_pool && i < worker_pool->count; ++i)
+    {
+        http_worker_t *worker = &worker_pool->workers[i];
+
+        while(true)
+        {
+            http_worker_client_t *item = NULL;
+
+            pthread_mutex_lock(&worker->mutex);
+            asc_list_first(worker->closed);
+            if(!asc_list_eol(worker->closed))
+            {
+                item = (http_worker_client_t *)asc_list_data(worker->closed);
+                asc_list_remove_current(worker->closed);
+                item->is_closed = false;
+            }
+            pthread_mutex_unlock(&worker->mutex);
+
+            if(!item)
+                break;
+
+            http_client_t *client = item->client;
+            if(item->is_slow)
+                slow_client_warning(client, "disconnect");
+            else
+                http_client_error(client, "failed to send ts [%s]", strerror(item->error));
+
+            // worker_detach() is called on the response cleanup
+            http_client_close(client);
+
+            // pool is destroyed with the last client
+            if(!worker_pool)
+                return;
+        }
+    }
+}
+
+static void worker_pool_destroy(void)
+{
+    asc_timer_destroy(worker_pool->timer);
+
+    for(int i = 0; i < worker_pool->count; ++i)
+    {
+        http_worker_t *worker = &worker_pool->workers[i];
+        on_worker_close(worker);
+
+        close(worker->epoll_fd);
+        close(worker->event_fd);
+        pthread_mutex_destroy(&worker->mutex);
+
+        asc_list_first(worker->garbage);
+        while(!asc_list_eol(worker->garbage))
+        {
+            free(asc_list_data(worker->garbage));
+            asc_list_remove_current(worker->garbage);
+        }
+        asc_list_destroy(worker->garbage);
+        asc_list_destroy(worker->closed);
+        free(worker->clients);
+    }
+
+    free(worker_pool->workers);
+    free(worker_pool);
+    worker_pool = NULL;
+}
+
+static void worker_pool_attach(int count)
+{
+    if(worker_pool)
+    {
+        ++worker_pool->refcount;
+        return;
+    }
+
+    worker_pool = (http_worker_pool_t *)calloc(1, sizeof(http_worker_pool_t));
+    worker_pool->refcount = 1;
+    worker_pool->count = count;
+    worker_pool->workers = (http_worker_t *)calloc(count, sizeof(http_worker_t));
+
+    for(int i = 0; i < count; ++i)
+    {
+        http_worker_t *worker = &worker_pool->workers[i];
+
+        pthread_mutex_init(&worker->mutex, NULL);
+        worker->closed = asc_list_init();
+        worker->garbage = asc_list_init();
+
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        asc_assert(  worker->epoll_fd != -1 && worker->event_fd != -1
+                   , "[http_upstream] failed to init worker [%s]", strerror(errno));
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->event_fd, &event);
+
+        worker->is_started = true;
+        worker->thread = asc_thread_init(worker);
+        asc_thread_start(worker->thread, worker_loop, NULL, NULL, on_worker_close);
+    }
+
+    worker_pool->timer = asc_timer_init(WORKER_REAP_INTERVAL, on_worker_timer, NULL);
+}
+
+static void worker_pool_detach(void)
+{
+    --worker_pool->refcount;
+    if(worker_pool->refcount == 0)
+        worker_pool_destroy();
+}
+
+static void worker_pool_wake(void)
+{
+    const uint64_t value = 1;
+    for(int i = 0; i < worker_pool->count; ++i)
+    {
+        // EAGAIN on the counter overflow. worker is woken up anyway
+        const ssize_t r = write(worker_pool->workers[i].event_fd, &value, sizeof(value));
+        __uarg(r);
+    }
+}
+
+/* Main thread. response headers are sent, the socket is moved to the worker */
+static void on_worker_start(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    // cached GOP is sent by the main thread
+    if(response->gop && !gop_send(client))
+        return;
+
+    asc_socket_set_on_ready(client->sock, NULL);
+
+    http_worker_client_t *item
+        = (http_worker_client_t *)calloc(1, sizeof(http_worker_client_t));
+    item->client = client;
+    item->ring = response->ring;
+    item->is_slow_disconnect = response->mod->is_slow_disconnect;
+    item->fd = asc_socket_fd(client->sock);
+    item->cursor = response->cursor;
+    memcpy(item->tail, response->tail, TS_PACKET_SIZE);
+    item->tail_size = response->tail_size;
+    item->is_busy = true;
+
+    ++worker_pool->refcount;
+    http_worker_t *worker = &worker_pool->workers[worker_pool->next];
+    worker_pool->next = (worker_pool->next + 1) % worker_pool->count;
+    item->worker = worker;
+
+    pthread_mutex_lock(&worker->mutex);
+
+    if(worker->clients_count == worker->clients_size)
+    {
+        worker->clients_size = (worker->clients_size > 0) ? (worker->clients_size * 2) : 64;
+        worker->clients = (http_worker_client_t **)realloc(
+            worker->clients, worker->clients_size * sizeof(http_worker_client_t *));
+    }
+    item->index = worker->clients_count;
+    worker->clients[worker->clients_count] = item;
+    ++worker->clients_count;
+
+    // first event starts sending
+    struct epoll_event event;
+    event.events = EPOLLOUT | EPOLLONESHOT;
+    event.data.ptr = item;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, item->fd, &event);
+
+    pthread_mutex_unlock(&worker->mutex);
+
+    response->worker_client = item;
+    ++response->ring->worker_count;
+}
+
+/* Main thread. socket is not used by the worker on return */
+static void worker_detach(http_worker_client_t *item)
+{
+    http_worker_t *worker = item->worker;
+
+    pthread_mutex_lock(&worker->mutex);
+
+    if(item->index != -1)
+        worker_remove(worker, item);
+    else if(item->is_closed)
+        asc_list_remove_item(worker->closed, item);
+
+    asc_list_insert_tail(worker->garbage, item);
+
+    pthread_mutex_unlock(&worker->mutex);
+
+    worker_pool_detach();
+}
+#endif /* ASC_WORKERS */
+
+/*
+ *  oooooooo8 ooooo ooooo      o      oooooooooo  ooooooooooo ooooooooo
+ * 888         888   888      888      888    888  888    88   888    88o
+ *  888oooooo  888ooo888     8  88     888oooo88   888ooo8     888    888
+ *         888 888   888    8oooo88    888  88o    888    oo   888    888
+ * o88oooo888 o888o o888o o88o  o888o o888o  88o8 o888ooo8888 o888ooo88
+ *
+ */
+
+static void on_ring_ready(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+    http_ring_t *ring = response->ring;
+
+    if(response->gop && !gop_send(client))
+        return;
+
+    uint64_t count = ring->head - response->cursor;
+    const size_t pending = asc_socket_send_pending(client->sock);
+    if(count > ring->lag_max && pending > 0)
+    {
+        // incomplete TLS record is sent before the skip
+        count = (pending > response->tail_size) ? (pending - response->tail_size) : 0;
+    }
+    else if(count > ring->lag_max)
+    {
+        // client is behind the write position
+        if(response->mod->is_slow_disconnect)
+        {
+            slow_client_warning(client, "disconnect");
+            http_client_close(client);
+            return;
+        }
+
+        ++response->skip_count;
+        response->skip_bytes += ring_skip(  ring, ring->head, &response->cursor
+                                          , response->tail, &response->tail_size);
+        count = ring->head - response->cursor;
+    }
+
+    if(count > 0 || response->tail_size > 0)
+    {
+        const size_t skip = response->cursor % ring->buffer_size;
+        size_t head_size = ring->buffer_size - skip;
+        if(head_size > count)
+            head_size = count;
+
+        const uint8_t *tail = &response->tail[TS_PACKET_SIZE - response->tail_size];
+
+        ssize_t send_size;
+#ifndef _WIN32
+        struct iovec iov[3];
+        int iov_count = 0;
+        if(response->tail_size > 0)
+        {
+            iov[iov_count].iov_base = (void *)tail;
+            iov[iov_count].iov_len = response->tail_size;
+            ++iov_count;
+        }
+        iov[iov_count].iov_base = &ring->buffer[skip];
+        iov[iov_count].iov_len = head_size;
+        ++iov_count;
+        if(count > head_size)
+        {
+            iov[iov_count].iov_base = ring->buffer;
+            iov[iov_count].iov_len = count - head_size;
+            ++iov_count;
+        }
+
+        send_size = asc_socket_sendv(client->sock, iov, iov_count);
+#else
+        if(response->tail_size > 0)
+            send_size = asc_socket_send(client->sock, tail, response->tail_size);
+        else
+            send_size = asc_socket_send(client->sock, &ring->buffer[skip], head_size);
+#endif
+
+        if(send_size == -1)
+        {
+            http_client_error(  client, "failed to send ts (%d bytes) [%s]"
+                              , (int)count, asc_socket_error());
+            http_client_close(client);
+            return;
+        }
+
+        response->sent += send_size;
+        if((size_t)send_size >= response->tail_size)
+        {
+            response->cursor += send_size - response->tail_size;
+            response->tail_size = 0;
+        }
+        else
+            response->tail_size -= send_size;
+    }
+
+    if(response->cursor == ring->head && response->tail_size == 0)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+    }
+}
+
+static void on_ring_ts(void *arg, const uint8_t *ts)
+{
+    http_ring_t *ring = (http_ring_t *)arg;
+
+    const size_t skip = ring->head % ring->buffer_size;
+    memcpy(&ring->buffer[skip], ts, TS_PACKET_SIZE);
+
+    if(is_sync_point(ts))
+    {
+        const uint32_t idx = ring->sync_count % SYNC_POINT_SIZE;
+#ifdef ASC_WORKERS
+        __atomic_store_n(&ring->sync_point[idx], ring->head, __ATOMIC_RELAXED);
+        __atomic_store_n(&ring->sync_count, ring->sync_count + 1, __ATOMIC_RELEASE);
+#else
+        ring->sync_point[idx] = ring->head;
+        ++ring->sync_count;
+#endif
+    }
+
+#ifdef ASC_WORKERS
+    // packet is published for the workers
+    __atomic_store_n(&ring->head, ring->head + TS_PACKET_SIZE, __ATOMIC_RELEASE);
+#else
+    ring->head += TS_PACKET_SIZE;
+#endif
+
+    // wake up idle clients each buffer_fill bytes
+    if((ring->head % ring->buffer_fill) >= TS_PACKET_SIZE)
+        return;
+
+#ifdef ASC_WORKERS
+    if(ring->worker_count > 0)
+        worker_pool_wake();
+#endif
+
+    asc_list_for(ring->clients)
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(ring->clients);
+        http_response_t *response = client->response;
+        if(!response->is_socket_busy)
+        {
+            asc_socket_set_on_ready(client->sock, on_ring_ready);
+            response->is_socket_busy = true;
+        }
+    }
+}
+
+static http_ring_t * ring_attach(http_client_t *client, module_stream_t *upstream)
+{
+    http_response_t *response = client->response;
+    http_ring_t *ring = NULL;
+
+    if(ring_list)
+    {
+        asc_list_for(ring_list)
+        {
+            http_ring_t *item = (http_ring_t *)asc_list_data(ring_list);
+            /* parent is cleared if the upstream is destroyed */
+            if(item->upstream == upstream && item->__stream.parent == upstream)
+            {
+                ring = item;
+                break;
+            }
+        }
+    }
+    else
+        ring_list = asc_list_init();
+
+    if(!ring)
+    {
+        ring = (http_ring_t *)calloc(1, sizeof(http_ring_t));
+        ring->upstream = upstream;
+        ring->buffer_size = response->buffer_size - (response->buffer_size % TS_PACKET_SIZE);
+        ring->buffer_fill = response->buffer_fill - (response->buffer_fill % TS_PACKET_SIZE);
+        if(ring->buffer_fill == 0)
+            ring->buffer_fill = TS_PACKET_SIZE;
+        /*
+         * buffer_fill is reserved for the data written while the socket is busy.
+         * the ring is extended with buffer_fill for the data written by the main
+         * thread while the worker sends
+         */
+        ring->lag_max = (ring->buffer_size > ring->buffer_fill)
+                      ? (ring->buffer_size - ring->buffer_fill) : TS_PACKET_SIZE;
+        ring->buffer_size += ring->buffer_fill;
+        ring->buffer = (uint8_t *)malloc(ring->buffer_size);
+        ring->clients = asc_list_init();
+
+        // like module_stream_init()
+        ring->__stream.self = (void *)ring;
+        ring->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ring_ts;
+        __module_stream_init(&ring->__stream);
+        __module_stream_attach(upstream, &ring->__stream);
+
+        asc_list_insert_tail(ring_list, ring);
+    }
+
+    response->ring = ring;
+    response->cursor = ring->head;
+    asc_list_insert_tail(ring->clients, client);
+
+    // ring doesn't wake up the client until response headers are sent
+    response->is_socket_busy = true;
+
+    return ring;
+}
+
+static void ring_detach(http_client_t *client)
+{
+    http_ring_t *ring = client->response->ring;
+    client->response->ring = NULL;
+
+#ifdef ASC_WORKERS
+    if(client->response->worker_client)
+    {
+        worker_detach(client->response->worker_client);
+        client->response->worker_client = NULL;
+        --ring->worker_count;
+    }
+#endif
+
+    asc_list_remove_item(ring->clients, client);
+    if(asc_list_size(ring->clients) > 0)
+        return;
+
+    asc_list_destroy(ring->clients);
+    module_stream_destroy(ring);
+    free(ring->buffer);
+
+    asc_list_remove_item(ring_list, ring);
+    if(asc_list_size(ring_list) == 0)
+    {
+        asc_list_destroy(ring_list);
+        ring_list = NULL;
+    }
+
+    free(ring);
+}
+
+#ifdef ASC_SPLICE
+
+/*
+ *  oooooooo8 oooooooooo ooooo       ooooo  oooooooo8 ooooooooooo
+ * 888         888    888 888         888 o888     88  888    88
+ *  888oooooo  888oooo88  888         888 888          888ooo8
+ *         888 888        888      o  888 888o     oo  888    oo
+ * o88oooo888 o888o      o888ooooo88 o888o 888oooo88  o888ooo8888
+ *
+ */
+
+static size_t pipe_queued(int fd)
+{
+    int count = 0;
+    if(ioctl(fd, FIONREAD, &count) == -1)
+        return 0;
+    return (size_t)count;
+}
+
+/* returns capacity of the pipe or 0 on error */
+static size_t pipe_open(int fd[2], size_t size)
+{
+    if(pipe2(fd, O_NONBLOCK | O_CLOEXEC) == -1)
+        return 0;
+
+    // result is limited by /proc/sys/fs/pipe-max-size
+    fcntl(fd[1], F_SETPIPE_SZ, (int)size);
+    const int pipe_size = fcntl(fd[1], F_GETPIPE_SZ);
+    if(pipe_size <= 0)
+    {
+        close(fd[0]);
+        close(fd[1]);
+        return 0;
+    }
+
+    return (size_t)pipe_size;
+}
 
-struct module_data_t
+static void on_pipe_ready(void *arg)
 {
-    int idx_callback;
-};
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
 
-struct http_response_t
-{
-    MODULE_STREAM_DATA();
+    if(response->gop && !gop_send(client))
+        return;
 
-    module_data_t *mod;
+    const ssize_t send_size = splice(  response->pipe_fd[0], NULL
+                                     , asc_socket_fd(client->sock), NULL
+                                     , response->pipe_size
+                                     , SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
 
-    uint8_t *buffer;
-    size_t buffer_count;
-    size_t buffer_read;
-    size_t buffer_write;
+    if(send_size == -1 && errno != EAGAIN)
+    {
+        http_client_error(client, "failed to send ts [%s]", asc_socket_error());
+        http_client_close(client);
+        return;
+    }
 
-    size_t buffer_size;
-    size_t buffer_fill;
+    if(send_size > 0)
+        response->sent += send_size;
 
-    bool is_socket_busy;
-};
+    // EAGAIN is returned for the empty pipe as well as for the full socket
+    if(pipe_queued(response->pipe_fd[0]) > 0)
+        return;
 
-/*
- * client->mod - http_server module
- * client->response->mod - http_upstream module
- */
+    asc_socket_set_on_ready(client->sock, NULL);
+    response->is_socket_busy = false;
+}
 
-static void on_upstream_ready(void *arg)
+static void pipe_flush(http_pipe_t *p)
 {
-    http_client_t *client = (http_client_t *)arg;
-    http_response_t *response = client->response;
+    const size_t count = p->buffer_count;
+    p->buffer_count = 0;
 
-    if(response->buffer_count > 0)
+    ssize_t write_size = write(p->fd[1], p->buffer, count);
+    if(write_size != (ssize_t)count)
     {
-        size_t block_size = (response->buffer_write > response->buffer_read)
-                          ? (response->buffer_write - response->buffer_read)
-                          : (response->buffer_size - response->buffer_read);
+        asc_log_error("[http_upstream] failed to write to the pipe [%s]", strerror(errno));
+        if(write_size <= 0)
+            return;
+    }
 
-        if(block_size > response->buffer_count)
-            block_size = response->buffer_count;
+    // only whole packets are duplicated, remainder of the partial write is drained
+    const ssize_t drain_size = write_size;
+    write_size -= write_size % TS_PACKET_SIZE;
 
-        const ssize_t send_size = asc_socket_send(  client->sock
-                                                  , &response->buffer[response->buffer_read]
-                                                  , block_size);
+    asc_list_for(p->clients)
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(p->clients);
+        http_response_t *response = client->response;
 
-        if(send_size > 0)
+        if(response->is_pipe_shutdown || write_size == 0)
+            continue;
+
+        // keep a half of the pipe as reserve: tee() takes one pipe slot per page
+        if(pipe_queued(response->pipe_fd[0]) + write_size > response->pipe_size / 2)
         {
-            response->buffer_count -= send_size;
-            response->buffer_read += send_size;
-            if(response->buffer_read >= response->buffer_size)
-                response->buffer_read = 0;
+            if(response->mod->is_slow_disconnect)
+            {
+                // on_read is called with the error, client is closed out of this loop
+                slow_client_warning(client, "disconnect");
+                asc_socket_shutdown_both(client->sock);
+                response->is_pipe_shutdown = true;
+            }
+            else
+            {
+                ++response->skip_count;
+                response->skip_bytes += write_size;
+            }
+            continue;
         }
-        else if(send_size == -1)
+
+        const ssize_t tee_size = tee(  p->fd[0], response->pipe_fd[1]
+                                     , write_size, SPLICE_F_NONBLOCK);
+        if(tee_size != write_size)
         {
-            http_client_error(  client, "failed to send ts (%d bytes) [%s]"
-                              , block_size, asc_socket_error());
-            http_client_close(client);
-            return;
+            // TS stream is broken if the chunk is partially duplicated
+            http_client_error(client, "failed to duplicate ts [%s]", strerror(errno));
+            asc_socket_shutdown_both(client->sock);
+            response->is_pipe_shutdown = true;
+            continue;
+        }
+
+        if(!response->is_socket_busy)
+        {
+            asc_socket_set_on_ready(client->sock, on_pipe_ready);
+            response->is_socket_busy = true;
         }
     }
 
-    if(response->buffer_count == 0)
+    // drain the source pipe
+    if(splice(p->fd[0], NULL, p->null_fd, NULL, drain_size, SPLICE_F_NONBLOCK) != drain_size)
     {
-        asc_socket_set_on_ready(client->sock, NULL);
-        response->is_socket_busy = false;
+        while(read(p->fd[0], p->buffer, p->buffer_fill) > 0)
+            ;
     }
 }
 
-static void on_ts(void *arg, const uint8_t *ts)
+static void on_pipe_ts(void *arg, const uint8_t *ts)
+{
+    http_pipe_t *p = (http_pipe_t *)arg;
+
+    memcpy(&p->buffer[p->buffer_count], ts, TS_PACKET_SIZE);
+    p->buffer_count += TS_PACKET_SIZE;
+
+    if(p->buffer_count + TS_PACKET_SIZE > p->buffer_fill)
+        pipe_flush(p);
+}
+
+static void pipe_destroy(http_pipe_t *p)
+{
+    module_stream_destroy(p);
+
+    if(p->fd[0] != -1)
+    {
+        close(p->fd[0]);
+        close(p->fd[1]);
+    }
+    if(p->null_fd != -1)
+        close(p->null_fd);
+
+    asc_list_destroy(p->clients);
+    free(p->buffer);
+    free(p);
+}
+
+/* pipe without clients is detached from the upstream and destroyed */
+static void pipe_release(http_pipe_t *p)
+{
+    if(asc_list_size(p->clients) > 0)
+        return;
+
+    asc_list_remove_item(pipe_list, p);
+    if(asc_list_size(pipe_list) == 0)
+    {
+        asc_list_destroy(pipe_list);
+        pipe_list = NULL;
+    }
+
+    pipe_destroy(p);
+}
+
+static bool pipe_attach(http_client_t *client, module_stream_t *upstream)
 {
-    http_client_t *client = (http_client_t *)arg;
     http_response_t *response = client->response;
+    http_pipe_t *p = NULL;
 
-    if(response->buffer_count + TS_PACKET_SIZE >= response->buffer_size)
+    if(pipe_list)
     {
-        // overflow
-        response->buffer_count = 0;
-        response->buffer_read = 0;
-        response->buffer_write = 0;
-        if(response->is_socket_busy)
+        asc_list_for(pipe_list)
+        {
+            http_pipe_t *item = (http_pipe_t *)asc_list_data(pipe_list);
+            /* parent is cleared if the upstream is destroyed */
+            if(item->upstream == upstream && item->__stream.parent == upstream)
+            {
+                p = item;
+                break;
+            }
+        }
+    }
+    else
+        pipe_list = asc_list_init();
+
+    if(!p)
+    {
+        p = (http_pipe_t *)calloc(1, sizeof(http_pipe_t));
+        p->upstream = upstream;
+        p->buffer_fill = response->buffer_fill - (response->buffer_fill % TS_PACKET_SIZE);
+        if(p->buffer_fill == 0)
+            p->buffer_fill = TS_PACKET_SIZE;
+        p->buffer = (uint8_t *)malloc(p->buffer_fill);
+        p->pipe_size = response->buffer_size;
+        p->clients = asc_list_init();
+
+        p->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        const size_t pipe_size = (p->null_fd != -1) ? pipe_open(p->fd, p->buffer_fill * 2) : 0;
+        if(pipe_size < TS_PACKET_SIZE)
         {
-            asc_socket_set_on_ready(client->sock, NULL);
-            response->is_socket_busy = false;
+            if(pipe_size > 0)
+            {
+                close(p->fd[0]);
+                close(p->fd[1]);
+            }
+            p->fd[0] = -1;
+            http_client_warning(client, "failed to open pipe [%s]", strerror(errno));
+            pipe_destroy(p);
+            if(asc_list_size(pipe_list) == 0)
+            {
+                asc_list_destroy(pipe_list);
+                pipe_list = NULL;
+            }
+            return false;
         }
+
+        // each chunk is written at once
+        if(pipe_size < p->buffer_fill)
+            p->buffer_fill = pipe_size - (pipe_size % TS_PACKET_SIZE);
+
+        // like module_stream_init()
+        p->__stream.self = (void *)p;
+        p->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_pipe_ts;
+        __module_stream_init(&p->__stream);
+        __module_stream_attach(upstream, &p->__stream);
+
+        asc_list_insert_tail(pipe_list, p);
+    }
+
+    response->pipe_size = pipe_open(response->pipe_fd, p->pipe_size);
+    if(!response->pipe_size)
+    {
+        response->pipe_fd[0] = -1;
+        http_client_warning(client, "failed to open pipe [%s]", strerror(errno));
+        pipe_release(p);
+        return false;
+    }
+
+    // pipe buffer might be limited by the system
+    if(response->pipe_size / 2 < p->buffer_fill)
+    {
+        http_client_warning(  client, "pipe buffer is too small (%d bytes). "
+                              "check /proc/sys/fs/pipe-max-size"
+                            , (int)response->pipe_size);
+        close(response->pipe_fd[0]);
+        close(response->pipe_fd[1]);
+        response->pipe_fd[0] = -1;
+        response->pipe_size = 0;
+        pipe_release(p);
+        return false;
+    }
+
+    response->pipe = p;
+    asc_list_insert_tail(p->clients, client);
+
+    // pipe doesn't wake up the client until response headers are sent
+    response->is_socket_busy = true;
+
+    return true;
+}
+
+static void pipe_detach(http_client_t *client)
+{
+    http_response_t *response = client->response;
+    http_pipe_t *p = response->pipe;
+    response->pipe = NULL;
+
+    close(response->pipe_fd[0]);
+    close(response->pipe_fd[1]);
+
+    asc_list_remove_item(p->clients, client);
+    pipe_release(p);
+}
+
+#endif /* ASC_SPLICE */
+
+/*
+ *   oooooooo8    ooooooo   oooooooooo
+ * o888     88  o888   888o  888    888
+ * 888    oooo  888     888  888oooo88
+ * 888o    88   888o   o888  888
+ *  888ooo888     88ooo88   o888o
+ *
+ */
+
+/*
+ * Keyframe cache keeps the stream from the recent video keyframe.
+ * New client receives it before the live data, so player doesn't wait
+ * for the next keyframe.
+ */
+
+static void gop_reset(http_gop_cache_t *cache)
+{
+    cache->is_key = false;
+    cache->kf->is_scan = false;
+
+    // buffer is changed only if no one reads it
+    if(cache->gop->refcount > 1)
+    {
+        gop_release(cache->gop);
+        cache->gop = gop_init(cache->buffer_size);
+    }
+    cache->gop->size = 0;
+}
+
+static void gop_append(http_gop_t *gop, const uint8_t *ts)
+{
+    memcpy(&gop->buffer[gop->size], ts, TS_PACKET_SIZE);
+    gop->size += TS_PACKET_SIZE;
+}
+
+static void on_gop_psi_ts(void *arg, const uint8_t *ts)
+{
+    gop_append((http_gop_t *)arg, ts);
+}
+
+/* keyframe is found at cache->pes_skip */
+static void gop_cut(http_gop_cache_t *cache)
+{
+    http_gop_t *prev = cache->gop;
+    const size_t tail_size = prev->size - cache->pes_skip;
+
+    if(mpegts_keyframe_psi_size(cache->kf) + tail_size > cache->buffer_size)
+    {
+        gop_reset(cache);
         return;
     }
 
-    const size_t buffer_write = response->buffer_write + TS_PACKET_SIZE;
-    if(buffer_write < response->buffer_size)
+    // new GOP is started with PAT and PMT. live PSI in the tail is continued
+    http_gop_t *gop = gop_init(cache->buffer_size);
+    mpegts_keyframe_psi_demux(cache->kf, true, on_gop_psi_ts, gop);
+
+    memcpy(&gop->buffer[gop->size], &prev->buffer[cache->pes_skip], tail_size);
+    cache->pes_skip = gop->size;
+    gop->size += tail_size;
+
+    gop_release(prev);
+    cache->gop = gop;
+    cache->is_key = true;
+}
+
+static void on_gop_ts(void *arg, const uint8_t *ts)
+{
+    http_gop_cache_t *cache = (http_gop_cache_t *)arg;
+    mpegts_keyframe_t *kf = cache->kf;
+
+    const int flags = mpegts_keyframe_mux(kf, ts);
+    if(flags & MPEGTS_KEYFRAME_CHANGED)
+        gop_reset(cache);
+
+    // program without video is not cached
+    if(!kf->pid || TS_GET_PID(ts) == NULL_TS_PID)
+        return;
+
+    if(flags & MPEGTS_KEYFRAME_PES)
     {
-        memcpy(&response->buffer[response->buffer_write], ts, TS_PACKET_SIZE);
-        response->buffer_write = buffer_write;
+        // drop everything before the first keyframe
+        if(!cache->is_key)
+            cache->gop->size = 0;
+
+        cache->pes_skip = cache->gop->size;
     }
-    else if(buffer_write > response->buffer_size)
+
+    if(cache->gop->size + TS_PACKET_SIZE > cache->buffer_size)
     {
-        const size_t ts_head = response->buffer_size - response->buffer_write;
-        memcpy(&response->buffer[response->buffer_write], ts, ts_head);
-        response->buffer_write = TS_PACKET_SIZE - ts_head;
-        memcpy(response->buffer, &ts[ts_head], response->buffer_write);
+        // GOP is too long. wait for the next keyframe
+        gop_reset(cache);
+        return;
     }
-    else
+    gop_append(cache->gop, ts);
+
+    if(flags & MPEGTS_KEYFRAME_KEY)
+        gop_cut(cache);
+    else if(!cache->is_key && !kf->is_scan)
+        cache->gop->size = 0;
+}
+
+static http_gop_cache_t * gop_cache_init(module_data_t *mod, module_stream_t *upstream)
+{
+    http_gop_cache_t *cache = (http_gop_cache_t *)calloc(1, sizeof(http_gop_cache_t));
+    cache->upstream = upstream;
+    cache->buffer_size = mod->gop_cache_size - (mod->gop_cache_size % TS_PACKET_SIZE);
+    cache->gop = gop_init(cache->buffer_size);
+
+    cache->kf = mpegts_keyframe_init("http_upstream", false);
+
+    // like module_stream_init()
+    cache->__stream.self = (void *)cache;
+    cache->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_gop_ts;
+    __module_stream_init(&cache->__stream);
+    __module_stream_attach(upstream, &cache->__stream);
+
+    return cache;
+}
+
+static void gop_cache_destroy(http_gop_cache_t *cache)
+{
+    module_stream_destroy(cache);
+
+    mpegts_keyframe_destroy(cache->kf);
+
+    gop_release(cache->gop);
+    free(cache);
+}
+
+static void gop_attach(http_client_t *client, module_stream_t *upstream)
+{
+    http_response_t *response = client->response;
+    module_data_t *mod = response->mod;
+    http_gop_cache_t *cache = NULL;
+
+    asc_list_first(mod->gop_list);
+    while(!asc_list_eol(mod->gop_list))
     {
-        memcpy(&response->buffer[response->buffer_write], ts, TS_PACKET_SIZE);
-        response->buffer_write = 0;
+        http_gop_cache_t *item = (http_gop_cache_t *)asc_list_data(mod->gop_list);
+        /* parent is cleared if the upstream is destroyed */
+        if(item->__stream.parent != item->upstream)
+        {
+            gop_cache_destroy(item);
+            asc_list_remove_current(mod->gop_list);
+            continue;
+        }
+
+        if(item->upstream == upstream)
+            cache = item;
+        asc_list_next(mod->gop_list);
     }
-    response->buffer_count += TS_PACKET_SIZE;
 
-    if(   response->is_socket_busy == false
-       && response->buffer_count >= response->buffer_fill)
+    if(!cache)
     {
-        asc_socket_set_on_ready(client->sock, on_upstream_ready);
-        response->is_socket_busy = true;
+        cache = gop_cache_init(mod, upstream);
+        asc_list_insert_tail(mod->gop_list, cache);
+        return;
+    }
+
+    if(!cache->is_key)
+        return;
+
+    size_t size = cache->gop->size;
+#ifdef ASC_SPLICE
+    // packets in the pipe chunk are not flushed yet. client receives them with tee()
+    if(response->pipe)
+    {
+        if(size <= response->pipe->buffer_count)
+            return;
+        size -= response->pipe->buffer_count;
+    }
+#endif
+
+    ++cache->gop->refcount;
+    response->gop = cache->gop;
+    response->gop_size = size;
+    response->gop_skip = 0;
+}
+
+/* server:data(client).stats */
+static void on_upstream_stats(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    uint64_t sent = response->sent;
+    uint64_t lag = response->buffer_count;
+    uint64_t cursor = response->cursor;
+    uint64_t skip_count = response->skip_count;
+    uint64_t skip_bytes = response->skip_bytes;
+
+    if(response->ring)
+    {
+#ifdef ASC_WORKERS
+        http_worker_client_t *item = response->worker_client;
+        if(item)
+        {
+            pthread_mutex_lock(&item->worker->mutex);
+            cursor = item->cursor;
+            sent += item->sent;
+            skip_count += item->skip_count;
+            skip_bytes += item->skip_bytes;
+            pthread_mutex_unlock(&item->worker->mutex);
+        }
+#endif
+        lag = response->ring->head - cursor;
+    }
+#ifdef ASC_SPLICE
+    if(response->pipe)
+        lag = pipe_queued(response->pipe_fd[0]);
+#endif
+    if(response->gop)
+        lag += response->gop_size - response->gop_skip;
+
+    const uint64_t uptime = (asc_utime() - response->start_time) / 1000;
+
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, sent);
+    lua_setfield(lua, -2, "bytes");
+    lua_pushnumber(lua, (uptime > 0) ? (sent * 8 / uptime) : 0);
+    lua_setfield(lua, -2, "bitrate");
+    lua_pushnumber(lua, lag);
+    lua_setfield(lua, -2, "lag");
+    lua_pushnumber(lua, skip_count);
+    lua_setfield(lua, -2, "skip");
+    lua_pushnumber(lua, skip_bytes);
+    lua_setfield(lua, -2, "skip_bytes");
+    lua_pushnumber(lua, uptime / 1000);
+    lua_setfield(lua, -2, "uptime");
+
+    // socket is closed before the close callback
+    asc_socket_tcp_info_t info;
+    if(client->sock && asc_socket_get_tcp_info(client->sock, &info))
+    {
+        lua_pushnumber(lua, info.rtt / 1000.0);
+        lua_setfield(lua, -2, "rtt");
+        lua_pushnumber(lua, info.rttvar / 1000.0);
+        lua_setfield(lua, -2, "rttvar");
+        lua_pushnumber(lua, info.cwnd);
+        lua_setfield(lua, -2, "cwnd");
+        lua_pushnumber(lua, info.retrans);
+        lua_setfield(lua, -2, "retrans");
+        lua_pushnumber(lua, info.lost);
+        lua_setfield(lua, -2, "lost");
+        lua_pushnumber(lua, info.notsent);
+        lua_setfield(lua, -2, "notsent");
+        lua_pushnumber(lua, info.delivery_rate * 8 / 1000);
+        lua_setfield(lua, -2, "delivery_rate");
     }
+
+    lua_setfield(lua, -2, "stats");
 }
 
 static void on_upstream_read(void *arg)
@@ -200,16 +1879,58 @@ static void on_upstream_send(void *arg)
         return;
     }
 
-    client->response->buffer = (uint8_t *)malloc(client->response->buffer_size);
+    /* userspace TLS: descriptor is not used directly, stream goes through the ring */
+    const bool is_direct = asc_socket_is_direct(client->sock);
 
-    // like module_stream_init()
-    client->response->__stream.self = (void *)client;
-    client->response->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ts;
-    __module_stream_init(&client->response->__stream);
-    __module_stream_attach(upstream, &client->response->__stream);
+#ifdef ASC_SPLICE
+    /* stream goes through the ring if the pipe is not available */
+    if(client->response->mod->is_splice && is_direct && pipe_attach(client, upstream))
+    {
+        // data is duplicated from the source pipe
+    }
+    else
+#endif
+    if(client->response->mod->is_shared || client->response->mod->is_splice)
+    {
+        ring_attach(client, upstream);
+    }
+    else
+    {
+        client->response->buffer = (uint8_t *)malloc(client->response->buffer_size);
+
+        // like module_stream_init()
+        client->response->__stream.self = (void *)client;
+        client->response->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_ts;
+        __module_stream_init(&client->response->__stream);
+        __module_stream_attach(upstream, &client->response->__stream);
+    }
+
+    if(client->response->mod->gop_cache_size > 0)
+        gop_attach(client, upstream);
 
     client->on_read = on_upstream_read;
     client->on_ready = NULL;
+    client->on_stats = on_upstream_stats;
+    client->response->start_time = asc_utime();
+
+    // cached GOP is sent right after the headers
+    if(client->response->gop)
+    {
+        client->response->is_socket_busy = true;
+        client->on_ready = on_upstream_ready;
+    }
+
+    // continue with the response data when headers are sent
+#ifdef ASC_SPLICE
+    if(client->response->pipe)
+        client->on_ready = on_pipe_ready;
+#endif
+    if(client->response->ring)
+        client->on_ready = on_ring_ready;
+#ifdef ASC_WORKERS
+    if(client->response->ring && client->response->mod->is_workers && is_direct)
+        client->on_ready = on_worker_start;
+#endif
 
     const char *content_type = lua_isstring(lua, 4)
                              ? lua_tostring(lua, 4)
@@ -237,8 +1958,19 @@ static int module_call(module_data_t *mod)
             lua_pushvalue(lua, 4);
             lua_call(lua, 3, 0);
 
+            client->on_stats = NULL;
+
+            if(client->response->ring)
+                ring_detach(client);
+#ifdef ASC_SPLICE
+            if(client->response->pipe)
+                pipe_detach(client);
+#endif
             module_stream_destroy(client->response);
 
+            if(client->response->gop)
+                gop_release(client->response->gop);
+
             free(client->response->buffer);
             free(client->response);
             client->response = NULL;
@@ -272,6 +2004,54 @@ static void module_init(module_data_t *mod)
     asc_assert(lua_isfunction(lua, -1), "[http_upstream] option 'callback' is required");
     mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
 
+    module_option_boolean("shared", &mod->is_shared);
+
+    module_option_boolean("splice", &mod->is_splice);
+#ifndef ASC_SPLICE
+    if(mod->is_splice)
+    {
+        asc_log_error("[http_upstream] splice is not supported. use shared ring");
+        mod->is_shared = true;
+    }
+#endif
+
+    int workers = 0;
+    module_option_number("workers", &workers);
+    if(workers > 0)
+    {
+#ifdef ASC_WORKERS
+        if(mod->is_splice)
+            asc_log_error("[http_upstream] workers are not used with splice");
+        else
+        {
+            mod->is_workers = true;
+            mod->is_shared = true;
+            worker_pool_attach(workers);
+        }
+#else
+        asc_log_error("[http_upstream] workers are not supported. use shared ring");
+        mod->is_shared = true;
+#endif
+    }
+
+    int gop_cache = 0;
+    module_option_number("gop_cache", &gop_cache);
+    if(gop_cache > 0)
+    {
+        mod->gop_cache_size = gop_cache * 1024;
+        mod->gop_list = asc_list_init();
+    }
+
+    const char *slow_client = NULL;
+    module_option_string("slow_client", &slow_client, NULL);
+    if(slow_client)
+    {
+        if(!strcmp(slow_client, "disconnect"))
+            mod->is_slow_disconnect = true;
+        else if(strcmp(slow_client, "skip"))
+            asc_log_error("[http_upstream] unknown slow_client policy: %s", slow_client);
+    }
+
     // Deprecated
     bool is_deprecated = false;
 
@@ -304,6 +2084,26 @@ static void module_destroy(module_data_t *mod)
         luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
         mod->idx_callback = 0;
     }
+
+#ifdef ASC_WORKERS
+    if(mod->is_workers)
+    {
+        worker_pool_detach();
+        mod->is_workers = false;
+    }
+#endif
+
+    if(mod->gop_list)
+    {
+        asc_list_first(mod->gop_list);
+        while(!asc_list_eol(mod->gop_list))
+        {
+            gop_cache_destroy((http_gop_cache_t *)asc_list_data(mod->gop_list));
+            asc_list_remove_current(mod->gop_list);
+        }
+        asc_list_destroy(mod->gop_list);
+        mod->gop_list = NULL;
+    }
 }
 
 MODULE_LUA_METHODS()
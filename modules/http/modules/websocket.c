@@ -18,9 +18,33 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Module Name:
+ *      http_websocket
+ *
+ * Module Options:
+ *      callback    - function, called with the received messages
+ *      queue_size  - number, limit of the data queued for the client in Kb (default: 1024)
+ *      slow_client - string, policy for the client with the full queue:
+ *                    "skip" - drop new messages until the queue is sent (default),
+ *                    "disconnect" - close connection
+ *
+ * Module Methods:
+ *      broadcast(data [, binary])
+ *                  - send message to all connected clients. message is framed once
+ *
+ * server:send(client, data) sends text message to the client.
+ * server:send(client, { upstream = stream }) starts MPEG-TS streaming in the binary
+ * messages, e.g. for MSE players. stream is framed once for all clients
+ */
+
 #include <astra.h>
 #include "../http.h"
 
+#ifndef _WIN32
+#   include <sys/uio.h>
+#endif
+
 /* WebSocket Frame */
 #define FRAME_HEADER_SIZE 2
 #define FRAME_KEY_SIZE 4
@@ -28,18 +52,50 @@
 #define FRAME_SIZE16_SIZE 2
 #define FRAME_SIZE64_SIZE 8
 
+#define FRAME_OPCODE_TEXT 0x01
+#define FRAME_OPCODE_BINARY 0x02
+
+#define FRAME_IOV_SIZE 64
+
+/* MPEG-TS packets in the binary message */
+#define STREAM_FRAME_SIZE (TS_PACKET_SIZE * 64)
+
+#define DEFAULT_QUEUE_SIZE (1024 * 1024)
+
 struct module_data_t
 {
     int idx_callback;
+
+    size_t queue_size;
+    bool is_slow_disconnect;
+
+    asc_list_t *clients;
+    asc_list_t *stream_list;
 };
 
+/* framed message. shared between the client queues */
 typedef struct
 {
+    int refcount;
+
     uint8_t *buffer;
     size_t size;
-    size_t skip;
 } frame_t;
 
+/* MPEG-TS fan-out, one per upstream stream */
+typedef struct
+{
+    MODULE_STREAM_DATA();
+
+    module_stream_t *upstream;
+    module_data_t *mod;
+
+    frame_t *frame;     /* message in progress, header is reserved */
+    size_t frame_fill;
+
+    asc_list_t *clients;
+} websocket_stream_t;
+
 struct http_response_t
 {
     module_data_t *mod;
@@ -51,6 +107,14 @@ struct http_response_t
     uint8_t frame_key_i;
 
     asc_list_t *frame_queue;
+    size_t frame_skip;  /* sent bytes of the first frame */
+    size_t queue_size;  /* bytes in the queue, not sent yet */
+
+    bool is_socket_busy;
+    bool is_shutdown;   /* slow client is disconnected, waiting for on_read */
+    bool is_skip;
+
+    websocket_stream_t *stream;
 };
 
 /*
@@ -60,87 +124,298 @@ struct http_response_t
 
 static const char __websocket_magic[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 
+static size_t frame_header_size(size_t size)
+{
+    if(size <= 125)
+        return FRAME_HEADER_SIZE;
+    else if(size <= 0xFFFF)
+        return FRAME_HEADER_SIZE + FRAME_SIZE16_SIZE;
+    else
+        return FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE;
+}
+
+static void frame_header(uint8_t *buffer, uint8_t opcode, size_t size)
+{
+    buffer[0] = 0x80 | opcode;
+
+    if(size <= 125)
+    {
+        buffer[1] = size & 0xFF;
+    }
+    else if(size <= 0xFFFF)
+    {
+        buffer[1] = 126;
+        buffer[2] = (size >> 8) & 0xFF;
+        buffer[3] = (size     ) & 0xFF;
+    }
+    else
+    {
+        buffer[1] = 127;
+        buffer[2] = 0;
+        buffer[3] = 0;
+        buffer[4] = 0;
+        buffer[5] = 0;
+        buffer[6] = (size >> 24) & 0xFF;
+        buffer[7] = (size >> 16) & 0xFF;
+        buffer[8] = (size >> 8 ) & 0xFF;
+        buffer[9] = (size      ) & 0xFF;
+    }
+}
+
+/* frame with the reserved payload */
+static frame_t * frame_init(size_t payload_size)
+{
+    frame_t *frame = (frame_t *)malloc(sizeof(frame_t));
+    frame->refcount = 1;
+    frame->size = frame_header_size(payload_size) + payload_size;
+    frame->buffer = (uint8_t *)malloc(frame->size);
+    return frame;
+}
+
+static frame_t * frame_create(uint8_t opcode, const void *data, size_t size)
+{
+    frame_t *frame = frame_init(size);
+    const size_t header_size = frame->size - size;
+    frame_header(frame->buffer, opcode, size);
+    memcpy(&frame->buffer[header_size], data, size);
+    return frame;
+}
+
+static void frame_release(frame_t *frame)
+{
+    --frame->refcount;
+    if(frame->refcount > 0)
+        return;
+
+    free(frame->buffer);
+    free(frame);
+}
+
 static void on_websocket_ready(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
     http_response_t *response = client->response;
 
+    if(asc_list_size(response->frame_queue) == 0)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
+        return;
+    }
+
+    ssize_t size;
+#ifndef _WIN32
+    struct iovec iov[FRAME_IOV_SIZE];
+    int iov_count = 0;
+    size_t skip = response->frame_skip;
+
+    asc_list_for(response->frame_queue)
+    {
+        if(iov_count == FRAME_IOV_SIZE)
+            break;
+
+        frame_t *frame = (frame_t *)asc_list_data(response->frame_queue);
+        iov[iov_count].iov_base = &frame->buffer[skip];
+        iov[iov_count].iov_len = frame->size - skip;
+        ++iov_count;
+        skip = 0;
+    }
+
+    size = asc_socket_sendv(client->sock, iov, iov_count);
+#else
     asc_list_first(response->frame_queue);
     frame_t *frame = (frame_t *)asc_list_data(response->frame_queue);
+    size = asc_socket_send(  client->sock
+                           , &frame->buffer[response->frame_skip]
+                           , frame->size - response->frame_skip);
+#endif
 
-    ssize_t size = asc_socket_send(  client->sock
-                                   , &frame->buffer[frame->skip]
-                                   , frame->size - frame->skip);
-    if(size <= 0)
+    if(size == -1)
     {
         http_client_error(client, "failed to send data [%s]", asc_socket_error());
         http_client_close(client);
         return;
     }
 
-    frame->skip += size;
+    response->queue_size -= size;
 
-    if(frame->size == frame->skip)
+    // release sent frames
+    asc_list_first(response->frame_queue);
+    while(size > 0)
     {
-        free(frame->buffer);
-        free(frame);
+        frame_t *frame = (frame_t *)asc_list_data(response->frame_queue);
+        const size_t frame_left = frame->size - response->frame_skip;
+        if((size_t)size < frame_left)
+        {
+            response->frame_skip += size;
+            break;
+        }
+
+        size -= frame_left;
+        response->frame_skip = 0;
+        frame_release(frame);
         asc_list_remove_current(response->frame_queue);
-        if(asc_list_eol(response->frame_queue))
-            asc_socket_set_on_ready(client->sock, NULL);
+    }
+
+    if(asc_list_size(response->frame_queue) == 0)
+    {
+        asc_socket_set_on_ready(client->sock, NULL);
+        response->is_socket_busy = false;
     }
 }
 
-/* Stack: 1 - server, 2 - client, 3 - response */
-static void on_websocket_send(void *arg)
+/* queues frame for the client. client is not closed here */
+static void frame_push(http_client_t *client, frame_t *frame)
 {
-    http_client_t *client = (http_client_t *)arg;
     http_response_t *response = client->response;
 
-    const char *str = lua_tostring(lua, 3);
-    const int str_size = luaL_len(lua, 3);
+    if(response->is_shutdown)
+        return;
+
+    if(   response->queue_size > 0
+       && response->queue_size + frame->size > response->mod->queue_size)
+    {
+        if(response->mod->is_slow_disconnect)
+        {
+            // on_read is called with the error
+            http_client_warning(client, "slow client, disconnect");
+            asc_socket_shutdown_both(client->sock);
+            response->is_shutdown = true;
+            return;
+        }
+
+        if(!response->is_skip)
+        {
+            http_client_warning(client, "slow client, skip messages");
+            response->is_skip = true;
+        }
+        return;
+    }
+    response->is_skip = false;
 
-    frame_t *frame = malloc(sizeof(frame_t));
+    ++frame->refcount;
+    asc_list_insert_tail(response->frame_queue, frame);
+    response->queue_size += frame->size;
 
-    if(str_size <= 125)
+    if(!response->is_socket_busy)
     {
-        frame->size = FRAME_HEADER_SIZE;
-        frame->buffer = malloc(frame->size + str_size);
+        asc_socket_set_on_ready(client->sock, on_websocket_ready);
+        response->is_socket_busy = true;
+    }
+}
 
-        frame->buffer[1] = str_size & 0xFF;
+/*
+ *  oooooooo8 ooooooooooo oooooooooo  ooooooooooo      o      oooo     oooo
+ * 888        88  888  88  888    888  888    88      888      8888o   888
+ *  888oooooo     888      888oooo88   888ooo8       8  88     88 888o8 88
+ *         888    888      888  88o    888    oo    8oooo88    88  888  88
+ * o88oooo888    o888o    o888o  88o8 o888ooo8888 o88o  o888o o88o  8  o88o
+ *
+ */
+
+static void on_stream_ts(void *arg, const uint8_t *ts)
+{
+    websocket_stream_t *stream = (websocket_stream_t *)arg;
+
+    if(!stream->frame)
+    {
+        stream->frame = frame_init(STREAM_FRAME_SIZE);
+        frame_header(stream->frame->buffer, FRAME_OPCODE_BINARY, STREAM_FRAME_SIZE);
+        stream->frame_fill = stream->frame->size - STREAM_FRAME_SIZE;
     }
-    else if(str_size <= 0xFFFF)
+
+    memcpy(&stream->frame->buffer[stream->frame_fill], ts, TS_PACKET_SIZE);
+    stream->frame_fill += TS_PACKET_SIZE;
+    if(stream->frame_fill < stream->frame->size)
+        return;
+
+    asc_list_for(stream->clients)
     {
-        frame->size = FRAME_HEADER_SIZE + FRAME_SIZE16_SIZE;
-        frame->buffer = malloc(frame->size + str_size);
+        http_client_t *client = (http_client_t *)asc_list_data(stream->clients);
+        frame_push(client, stream->frame);
+    }
+
+    frame_release(stream->frame);
+    stream->frame = NULL;
+}
+
+static void stream_attach(http_client_t *client, module_stream_t *upstream)
+{
+    module_data_t *mod = client->response->mod;
+    websocket_stream_t *stream = NULL;
 
-        frame->buffer[1] = 126;
-        frame->buffer[2] = (str_size >> 8) & 0xFF;
-        frame->buffer[3] = (str_size     ) & 0xFF;
+    asc_list_for(mod->stream_list)
+    {
+        websocket_stream_t *item = (websocket_stream_t *)asc_list_data(mod->stream_list);
+        /* parent is cleared if the upstream is destroyed */
+        if(item->upstream == upstream && item->__stream.parent == upstream)
+        {
+            stream = item;
+            break;
+        }
     }
-    else
+
+    if(!stream)
     {
-        frame->size = FRAME_HEADER_SIZE + FRAME_SIZE64_SIZE;
-        frame->buffer = malloc(frame->size + str_size);
-
-        frame->buffer[1] = 127;
-        frame->buffer[2] = 0;
-        frame->buffer[3] = 0;
-        frame->buffer[4] = 0;
-        frame->buffer[5] = 0;
-        frame->buffer[6] = (str_size >> 24) & 0xFF;
-        frame->buffer[7] = (str_size >> 16) & 0xFF;
-        frame->buffer[8] = (str_size >> 8 ) & 0xFF;
-        frame->buffer[9] = (str_size      ) & 0xFF;
+        stream = (websocket_stream_t *)calloc(1, sizeof(websocket_stream_t));
+        stream->upstream = upstream;
+        stream->mod = mod;
+        stream->clients = asc_list_init();
+
+        // like module_stream_init()
+        stream->__stream.self = (void *)stream;
+        stream->__stream.on_ts = (void (*)(module_data_t *, const uint8_t *))on_stream_ts;
+        __module_stream_init(&stream->__stream);
+        __module_stream_attach(upstream, &stream->__stream);
+
+        asc_list_insert_tail(mod->stream_list, stream);
     }
 
-    frame->buffer[0] = 0x81;
-    memcpy(&frame->buffer[frame->size], str, str_size);
-    frame->size += str_size;
-    frame->skip = 0;
+    client->response->stream = stream;
+    asc_list_insert_tail(stream->clients, client);
+}
 
-    asc_list_insert_tail(response->frame_queue, frame);
-    if(asc_list_size(response->frame_queue) == 1)
-        asc_socket_set_on_ready(client->sock, on_websocket_ready);
+static void stream_detach(http_client_t *client)
+{
+    websocket_stream_t *stream = client->response->stream;
+    client->response->stream = NULL;
+
+    asc_list_remove_item(stream->clients, client);
+    if(asc_list_size(stream->clients) > 0)
+        return;
+
+    asc_list_remove_item(stream->mod->stream_list, stream);
+
+    module_stream_destroy(stream);
+    if(stream->frame)
+        frame_release(stream->frame);
+    asc_list_destroy(stream->clients);
+    free(stream);
+}
+
+/* Stack: 1 - server, 2 - client, 3 - response */
+static void on_websocket_send(void *arg)
+{
+    http_client_t *client = (http_client_t *)arg;
+    http_response_t *response = client->response;
+
+    if(lua_istable(lua, 3))
+    {
+        lua_getfield(lua, 3, "upstream");
+        if(lua_islightuserdata(lua, -1) && !response->stream)
+            stream_attach(client, (module_stream_t *)lua_touserdata(lua, -1));
+        else
+            http_client_error(client, ":send() upstream instance required");
+        lua_pop(lua, 1);
+        return;
+    }
+
+    const char *str = lua_tostring(lua, 3);
+    const int str_size = luaL_len(lua, 3);
+
+    frame_t *frame = frame_create(FRAME_OPCODE_TEXT, str, str_size);
+    frame_push(client, frame);
+    frame_release(frame);
 }
 
 static void on_websocket_read(void *arg)
@@ -300,6 +575,26 @@ static void on_websocket_read(void *arg)
     }
 }
 
+static int method_broadcast(module_data_t *mod)
+{
+    size_t size = 0;
+    const char *data = luaL_checklstring(lua, 2, &size);
+    const uint8_t opcode = lua_toboolean(lua, 3) ? FRAME_OPCODE_BINARY : FRAME_OPCODE_TEXT;
+
+    if(asc_list_size(mod->clients) == 0)
+        return 0;
+
+    frame_t *frame = frame_create(opcode, data, size);
+    asc_list_for(mod->clients)
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(mod->clients);
+        frame_push(client, frame);
+    }
+    frame_release(frame);
+
+    return 0;
+}
+
 static int module_call(module_data_t *mod)
 {
     http_client_t *client = (http_client_t *)lua_touserdata(lua, 3);
@@ -319,6 +614,9 @@ static int module_call(module_data_t *mod)
                 string_buffer_free(client->content);
                 client->content = NULL;
             }
+            if(client->response->stream)
+                stream_detach(client);
+            asc_list_remove_item(client->response->mod->clients, client);
             if(client->response->frame_queue)
             {
                 for(  asc_list_first(client->response->frame_queue)
@@ -326,8 +624,7 @@ static int module_call(module_data_t *mod)
                     ; asc_list_remove_current(client->response->frame_queue))
                 {
                     frame_t *frame = (frame_t *)asc_list_data(client->response->frame_queue);
-                    free(frame->buffer);
-                    free(frame);
+                    frame_release(frame);
                 }
                 asc_list_destroy(client->response->frame_queue);
                 client->response->frame_queue = NULL;
@@ -382,7 +679,12 @@ static int module_call(module_data_t *mod)
     client->response->frame_queue = asc_list_init();
     client->on_send = on_websocket_send;
     client->on_read = on_websocket_read;
-    client->on_ready = NULL;
+
+    // queued messages are sent when headers are sent
+    client->response->is_socket_busy = true;
+    client->on_ready = on_websocket_ready;
+
+    asc_list_insert_tail(mod->clients, client);
 
     http_response_code(client, 101, "Switching Protocols");
     http_response_header(client, "Upgrade: websocket");
@@ -409,6 +711,23 @@ static void module_init(module_data_t *mod)
     asc_assert(lua_isfunction(lua, -1), "[http_websocket] option 'callback' is required");
     mod->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
 
+    int queue_size = 0;
+    module_option_number("queue_size", &queue_size);
+    mod->queue_size = (queue_size > 0) ? (queue_size * 1024) : DEFAULT_QUEUE_SIZE;
+
+    const char *slow_client = NULL;
+    module_option_string("slow_client", &slow_client, NULL);
+    if(slow_client)
+    {
+        if(!strcmp(slow_client, "disconnect"))
+            mod->is_slow_disconnect = true;
+        else if(strcmp(slow_client, "skip"))
+            asc_log_error("[http_websocket] unknown slow_client policy: %s", slow_client);
+    }
+
+    mod->clients = asc_list_init();
+    mod->stream_list = asc_list_init();
+
     // Set callback for http route
     lua_getmetatable(lua, 3);
     lua_pushlightuserdata(lua, (void *)mod);
@@ -424,10 +743,23 @@ static void module_destroy(module_data_t *mod)
         luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_callback);
         mod->idx_callback = 0;
     }
+
+    // clients are closed by the http_server
+    if(mod->clients)
+    {
+        asc_list_destroy(mod->clients);
+        mod->clients = NULL;
+    }
+    if(mod->stream_list)
+    {
+        asc_list_destroy(mod->stream_list);
+        mod->stream_list = NULL;
+    }
 }
 
 MODULE_LUA_METHODS()
 {
+    { "broadcast", method_broadcast },
     { NULL, NULL }
 };
 
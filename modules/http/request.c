@@ -33,9 +33,34 @@
  *      stream      - boolean, true to read MPEG-TS stream
  *      sync        - boolean or number, enable stream synchronization
  *      sctp        - boolean, use sctp instead of tcp
+ *      tls         - boolean, HTTPS. keep_alive is not used with TLS
+ *      tls_verify  - boolean, verify the server certificate and the host name
+ *                    (default: true)
+ *      tls_ca      - string, path to the PEM file with trusted certificates
+ *                    (default: system certificates)
  *      timeout     - number, request timeout
  *      callback    - function,
  *      upstream    - object, stream instance returned by module_instance:stream()
+ *      keep_alive  - number, seconds to keep the idle connection in the pool
+ *                    for the next request to the same host (default: 0, disabled)
+ *      pool_size   - number, maximum idle connections per host (default: 8)
+ *      pipeline    - boolean, send the next :send() requests without waiting
+ *                    for the response. content is not allowed
+ *      reconnect   - boolean, stream mode. lost connection is restored without
+ *                    the callback, the stream and the sync state are kept.
+ *                    delay between attempts starts at 50ms and is doubled.
+ *                    outage is filled with null packets at the stream bitrate
+ *      reconnect_max - number, maximum delay between attempts in seconds (default: 5)
+ *      reconnect_timeout - number, maximum outage in seconds (default: 3). then
+ *                    filling is stopped and the stream is closed with the callback
+ *
+ * Response Fields:
+ *      connect_time - number, connection establishment time in milliseconds
+ *      reused      - boolean, true if the connection is taken from the pool
+ *
+ * Module Methods:
+ *      stats()     - returns table: reconnect (count), outage (current, ms),
+ *                    outage_last (ms), outage_total (ms), null_packets
  */
 
 #include "http.h"
@@ -45,6 +70,12 @@
                                   , mod->config.port    \
                                   , mod->config.path
 
+#define HTTP_PIPELINE_SIZE 16 /* bits in the pipeline_head */
+
+#define RECONNECT_DELAY 50 /* ms */
+#define RECONNECT_FILL_INTERVAL 20 /* ms */
+#define RECONNECT_RATE_INTERVAL 1000000 /* us */
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -83,6 +114,21 @@ struct module_data_t
     bool is_connection_close;
     bool is_connection_keep_alive;
 
+    // keep-alive
+    int keep_alive;         // idle time in the pool, ms
+    int pool_size;
+    bool is_reused;
+    bool is_retry;          // reconnect if the reused connection is closed by server
+    bool is_idle;           // response is done. connection could be pooled
+    bool is_server_keep_alive;
+    uint64_t connect_time;
+
+    // pipeline
+    bool is_pipeline;
+    int pipeline_count;     // number of the queued responses
+    uint32_t pipeline_head; // bit mask. HEAD requests in the queue
+    string_buffer_t *pipeline_queue;
+
     // response
     char buffer[HTTP_BUFFER_SIZE];
     size_t buffer_skip;
@@ -114,8 +160,44 @@ struct module_data_t
     // stream
     bool is_thread_started;
     asc_thread_t *thread;
+    asc_thread_buffer_t *thread_input;  // packets received by the main thread
     asc_thread_buffer_t *thread_output;
 
+    http_tls_t *tls;
+
+    // reconnect
+    struct
+    {
+        bool is_enabled;
+        bool is_sctp;
+        int delay_max;          // ms
+        uint64_t timeout;       // us, maximum outage
+        int delay;
+        asc_timer_t *timer;
+        int count;
+
+        bool is_outage;
+        uint64_t outage_time;   // start of the current outage
+        uint64_t outage_last;
+        uint64_t outage_total;
+    } reconnect;
+
+    // null packets in the outage
+    struct
+    {
+        asc_timer_t *timer;
+        bool is_active;         // outage is not finished until the stream output
+        uint64_t time;
+
+        uint64_t input;         // received bytes in the rate window
+        uint64_t input_time;
+        uint64_t rate;          // bytes per second
+
+        uint64_t output;        // stream bytes since the last tick
+        int64_t pending;
+        uint64_t count;
+    } fill;
+
     struct
     {
         uint8_t *buffer;
@@ -147,7 +229,10 @@ static const char __connection[] = "Connection: ";
 static const char __close[] = "close";
 static const char __keep_alive[] = "keep-alive";
 
+static const uint8_t null_ts[TS_PACKET_SIZE] = { 0x47, 0x1F, 0xFF, 0x10, 0x00 };
+
 static void on_close(void *);
+static void stream_reconnect(module_data_t *mod);
 
 static void callback(module_data_t *mod)
 {
@@ -163,6 +248,13 @@ static void callback(module_data_t *mod)
 
 static void call_error(module_data_t *mod, const char *msg)
 {
+    /* stream is restored in background */
+    if(mod->reconnect.is_outage)
+    {
+        asc_log_debug(MSG("reconnect failed: %s"), msg);
+        return;
+    }
+
     lua_newtable(lua);
     lua_pushnumber(lua, 0);
     lua_setfield(lua, -2, __code);
@@ -177,6 +269,14 @@ void timeout_callback(void *arg)
 
     asc_timer_destroy(mod->timeout);
     mod->timeout = NULL;
+    mod->is_idle = false;
+
+    if(mod->reconnect.is_outage)
+    {
+        asc_log_debug(MSG("reconnect timeout"));
+        stream_reconnect(mod);
+        return;
+    }
 
     if(mod->request.status == 0)
     {
@@ -194,17 +294,230 @@ void timeout_callback(void *arg)
     on_close(mod);
 }
 
+/*
+ * oooooooooo   ooooooo     ooooooo  ooooo
+ *  888    888 o888   888o o888   888o 888
+ *  888oooo88  888     888 888     888 888
+ *  888        888o   o888 888o   o888 888      o
+ * o888o         88ooo88     88ooo88  o888ooooo88
+ *
+ */
+
+typedef struct
+{
+    char *host;
+    int port;
+    asc_socket_t *sock;
+    uint64_t expire;
+} http_pool_item_t;
+
+/* idle keep-alive connections. shared by all instances */
+static asc_list_t *pool_list = NULL;
+static asc_timer_t *pool_timer = NULL;
+
+static void pool_item_free(http_pool_item_t *item)
+{
+    asc_socket_close(item->sock);
+    free(item->host);
+    free(item);
+}
+
+static void pool_check_empty(void)
+{
+    if(asc_list_size(pool_list) > 0)
+        return;
+
+    asc_list_destroy(pool_list);
+    pool_list = NULL;
+
+    asc_timer_destroy(pool_timer);
+    pool_timer = NULL;
+}
+
+static void on_pool_close(void *arg)
+{
+    /* idle connection should not receive anything.
+     * closed by server, error, or unexpected data */
+    http_pool_item_t *item = (http_pool_item_t *)arg;
+
+    asc_list_remove_item(pool_list, item);
+    pool_item_free(item);
+    pool_check_empty();
+}
+
+static void on_pool_timer(void *arg)
+{
+    __uarg(arg);
+
+    const uint64_t now = asc_utime();
+
+    asc_list_first(pool_list);
+    while(!asc_list_eol(pool_list))
+    {
+        http_pool_item_t *item = (http_pool_item_t *)asc_list_data(pool_list);
+        if(now < item->expire)
+        {
+            asc_list_next(pool_list);
+            continue;
+        }
+
+        pool_item_free(item);
+        asc_list_remove_current(pool_list);
+    }
+
+    pool_check_empty();
+}
+
+static bool pool_put(module_data_t *mod)
+{
+    if(!pool_list)
+    {
+        pool_list = asc_list_init();
+        pool_timer = asc_timer_init(1000, on_pool_timer, NULL);
+    }
+
+    int count = 0;
+    asc_list_for(pool_list)
+    {
+        http_pool_item_t *item = (http_pool_item_t *)asc_list_data(pool_list);
+        if(item->port == mod->config.port && !strcmp(item->host, mod->config.host))
+            ++count;
+    }
+
+    if(count >= mod->pool_size)
+    {
+        pool_check_empty();
+        return false;
+    }
+
+    http_pool_item_t *item = (http_pool_item_t *)calloc(1, sizeof(http_pool_item_t));
+    item->host = strdup(mod->config.host);
+    item->port = mod->config.port;
+    item->sock = mod->sock;
+    item->expire = asc_utime() + (uint64_t)mod->keep_alive * 1000;
+
+    asc_socket_set_arg(item->sock, item);
+    asc_socket_set_on_ready(item->sock, NULL);
+    asc_socket_set_on_read(item->sock, on_pool_close);
+    asc_socket_set_on_close(item->sock, on_pool_close);
+
+    asc_list_insert_tail(pool_list, item);
+
+    return true;
+}
+
+static asc_socket_t * pool_get(module_data_t *mod)
+{
+    if(!pool_list)
+        return NULL;
+
+    /* the last released connection is the least likely to be closed by server */
+    http_pool_item_t *found = NULL;
+    asc_list_for(pool_list)
+    {
+        http_pool_item_t *item = (http_pool_item_t *)asc_list_data(pool_list);
+        if(item->port == mod->config.port && !strcmp(item->host, mod->config.host))
+            found = item;
+    }
+
+    if(!found)
+        return NULL;
+
+    asc_socket_t *sock = found->sock;
+    asc_list_remove_item(pool_list, found);
+    free(found->host);
+    free(found);
+    pool_check_empty();
+
+    return sock;
+}
+
+static bool is_pool_ready(module_data_t *mod)
+{
+    return (   mod->keep_alive > 0
+            && mod->is_idle
+            && mod->is_server_keep_alive
+            && !mod->is_connection_close
+            && !mod->is_stream
+            && !mod->__stream.self
+            && !mod->receiver.callback.ptr
+            && !mod->thread
+            && mod->pipeline_count == 0
+            && !mod->pipeline_queue);
+}
+
 static void on_thread_close(void *arg);
+static void on_connect(void *arg);
+
+static void on_sock_error(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->is_idle = false;
+    on_close(mod);
+}
+
+static void request_retry(module_data_t *mod)
+{
+    asc_log_debug(MSG("keep-alive connection is closed by server. reconnect"));
+
+    mod->is_retry = false;
+    mod->is_reused = false;
+
+    asc_socket_close(mod->sock);
+
+    if(mod->request.buffer)
+    {
+        if(mod->request.status == 1)
+            free((void *)mod->request.buffer);
+        mod->request.buffer = NULL;
+    }
+    mod->request.status = 0;
+    mod->buffer_skip = 0;
+
+    if(mod->timeout)
+        asc_timer_destroy(mod->timeout);
+    mod->timeout = asc_timer_init(mod->timeout_ms, timeout_callback, mod);
+
+    mod->connect_time = asc_utime();
+    mod->sock = asc_socket_open_tcp4(mod);
+    asc_socket_connect(mod->sock, mod->config.host, mod->config.port, on_connect, on_sock_error);
+}
 
 static void on_close(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
+    /* stream is kept, connection is restored in background */
+    if(   mod->reconnect.is_enabled
+       && mod->request.status != -1
+       && (mod->status == 3 || mod->reconnect.is_outage))
+    {
+        stream_reconnect(mod);
+        return;
+    }
+
     if(mod->thread)
         on_thread_close(mod);
 
-    if(!mod->sock)
+    if(mod->reconnect.timer)
+    {
+        asc_timer_destroy(mod->reconnect.timer);
+        mod->reconnect.timer = NULL;
+    }
+
+    if(mod->fill.timer)
+    {
+        asc_timer_destroy(mod->fill.timer);
+        mod->fill.timer = NULL;
+    }
+
+    // socket is closed between the reconnect attempts
+    if(!mod->sock && !mod->reconnect.is_outage)
         return;
+    mod->reconnect.is_outage = false;
+
+    const bool is_pool = is_pool_ready(mod);
 
     if(mod->receiver.callback.ptr)
     {
@@ -214,8 +527,28 @@ static void on_close(void *arg)
         mod->receiver.callback.ptr = NULL;
     }
 
-    asc_socket_close(mod->sock);
+    /* pooled connection is closed before the response. send request again */
+    if(   mod->is_retry
+       && mod->request.status > 0
+       && mod->status == 0
+       && mod->pipeline_count == 0)
+    {
+        request_retry(mod);
+        return;
+    }
+
+    if(!is_pool || !pool_put(mod))
+        asc_socket_close(mod->sock);
     mod->sock = NULL;
+    mod->is_idle = false;
+
+    if(mod->pipeline_queue)
+    {
+        string_buffer_free(mod->pipeline_queue);
+        mod->pipeline_queue = NULL;
+    }
+    mod->pipeline_count = 0;
+    mod->pipeline_head = 0;
 
     if(mod->timeout)
     {
@@ -387,6 +720,12 @@ static void on_thread_close(void *arg)
         mod->thread = NULL;
     }
 
+    if(mod->thread_input)
+    {
+        asc_thread_buffer_destroy(mod->thread_input);
+        mod->thread_input = NULL;
+    }
+
     if(mod->thread_output)
     {
         asc_thread_buffer_destroy(mod->thread_output);
@@ -403,7 +742,19 @@ static void on_thread_read(void *arg)
     uint8_t ts[TS_PACKET_SIZE];
     const ssize_t r = asc_thread_buffer_read(mod->thread_output, ts, sizeof(ts));
     if(r == sizeof(ts))
+    {
+        mod->fill.output += TS_PACKET_SIZE;
         module_stream_send(mod, ts);
+    }
+}
+
+/* socket is read by the thread if the connection is not restored by the main thread */
+static ssize_t thread_recv(module_data_t *mod, void *buffer, size_t size)
+{
+    if(!mod->thread_input)
+        return asc_socket_recv(mod->sock, buffer, size);
+
+    return asc_thread_buffer_read(mod->thread_input, buffer, size);
 }
 
 static void thread_loop(void *arg)
@@ -439,9 +790,9 @@ static void thread_loop(void *arg)
         {
             system_time = asc_utime();
 
-            const ssize_t size = asc_socket_recv(  mod->sock
-                                                 , &mod->sync.buffer[mod->sync.buffer_write]
-                                                 , mod->sync.buffer_size - mod->sync.buffer_write);
+            const ssize_t size = thread_recv(  mod
+                                             , &mod->sync.buffer[mod->sync.buffer_write]
+                                             , mod->sync.buffer_size - mod->sync.buffer_write);
             if(size > 0)
             {
                 system_time_check = system_time;
@@ -449,7 +800,9 @@ static void thread_loop(void *arg)
             }
             else
             {
-                if(system_time - system_time_check >= (uint32_t)mod->timeout_ms * 1000)
+                // connection is restored by the main thread
+                if(   !mod->reconnect.is_enabled
+                   && system_time - system_time_check >= (uint32_t)mod->timeout_ms * 1000)
                 {
                     asc_log_error(MSG("receiving timeout"));
                     return;
@@ -487,9 +840,9 @@ static void thread_loop(void *arg)
                                   ? (mod->sync.buffer_read - mod->sync.buffer_write)
                                   : (mod->sync.buffer_size - mod->sync.buffer_write);
 
-                const ssize_t l = asc_socket_recv(  mod->sock
-                                                  , &mod->sync.buffer[mod->sync.buffer_write]
-                                                  , tail);
+                const ssize_t l = thread_recv(  mod
+                                              , &mod->sync.buffer[mod->sync.buffer_write]
+                                              , tail);
                 if(l > 0)
                 {
                     mod->sync.buffer_write += l;
@@ -502,8 +855,17 @@ static void thread_loop(void *arg)
             // get PCR
             if(!seek_pcr(mod, &block_size, &next_block, &pcr))
             {
-                asc_log_error(MSG("next PCR is not found"));
-                break;
+                if(   !mod->reconnect.is_enabled
+                   || mod->sync.buffer_count >= mod->sync.buffer_size)
+                {
+                    asc_log_error(MSG("next PCR is not found"));
+                    break;
+                }
+
+                // wait for the reconnect. PCR is kept, timing is restarted with the next block
+                asc_usleep(1000);
+                reset = true;
+                continue;
             }
             block_time = mpegts_pcr_block_us(&mod->pcr, &pcr);
             mod->pcr = pcr;
@@ -613,9 +975,25 @@ static void on_ts_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
+    /* sync buffer is owned by the thread, packets are passed with the thread_input */
+    uint8_t *buffer;
+    size_t buffer_size, *buffer_write;
+    if(mod->config.sync)
+    {
+        buffer = (uint8_t *)mod->buffer;
+        buffer_size = HTTP_BUFFER_SIZE;
+        buffer_write = &mod->buffer_skip;
+    }
+    else
+    {
+        buffer = mod->sync.buffer;
+        buffer_size = mod->sync.buffer_size;
+        buffer_write = &mod->sync.buffer_write;
+    }
+
     ssize_t size = asc_socket_recv(  mod->sock
-                                   , &mod->sync.buffer[mod->sync.buffer_write]
-                                   , mod->sync.buffer_size - mod->sync.buffer_write);
+                                   , &buffer[*buffer_write]
+                                   , buffer_size - *buffer_write);
     if(size <= 0)
     {
         on_close(mod);
@@ -623,33 +1001,276 @@ static void on_ts_read(void *arg)
     }
 
     mod->is_active = true;
-    mod->sync.buffer_write += size;
-    mod->sync.buffer_read = 0;
+    mod->fill.input += size;
+    *buffer_write += size;
+    size_t buffer_read = 0;
 
     while(1)
     {
-        while(mod->sync.buffer[mod->sync.buffer_read] != 0x47)
+        while(buffer[buffer_read] != 0x47)
         {
-            ++mod->sync.buffer_read;
-            if(mod->sync.buffer_read >= mod->sync.buffer_write)
+            ++buffer_read;
+            if(buffer_read >= *buffer_write)
             {
-                mod->sync.buffer_write = 0;
+                *buffer_write = 0;
                 return;
             }
         }
 
-        const size_t next = mod->sync.buffer_read + TS_PACKET_SIZE;
-        if(next > mod->sync.buffer_write)
+        // aligned packets are passed at once
+        size_t next = buffer_read;
+        while(next + TS_PACKET_SIZE <= *buffer_write && buffer[next] == 0x47)
+            next += TS_PACKET_SIZE;
+
+        if(next > buffer_read)
+        {
+            if(mod->config.sync)
+            {
+                if(asc_thread_buffer_write(  mod->thread_input
+                                           , &buffer[buffer_read]
+                                           , next - buffer_read) == -1)
+                {
+                    asc_log_debug(MSG("sync buffer overflow"));
+                }
+            }
+            else
+            {
+                mod->fill.output += next - buffer_read;
+                for(; buffer_read < next; buffer_read += TS_PACKET_SIZE)
+                    module_stream_send(mod, &buffer[buffer_read]);
+            }
+            buffer_read = next;
+        }
+
+        if(buffer_read + TS_PACKET_SIZE > *buffer_write)
         {
-            const size_t tail = mod->sync.buffer_write - mod->sync.buffer_read;
+            const size_t tail = *buffer_write - buffer_read;
             if(tail > 0)
-                memmove(mod->sync.buffer, &mod->sync.buffer[mod->sync.buffer_read], tail);
-            mod->sync.buffer_write = tail;
+                memmove(buffer, &buffer[buffer_read], tail);
+            *buffer_write = tail;
             return;
         }
+    }
+}
+
+static void stream_expire(module_data_t *mod);
+
+static void on_fill_timer(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint64_t now = asc_utime();
+    const uint64_t elapsed = now - mod->fill.time;
+    mod->fill.time = now;
+
+    const uint64_t output = mod->fill.output;
+    mod->fill.output = 0;
+
+    if(mod->reconnect.is_outage && now - mod->reconnect.outage_time >= mod->reconnect.timeout)
+    {
+        stream_expire(mod);
+        return;
+    }
+
+    if(mod->fill.is_active)
+    {
+        if(!mod->reconnect.is_outage && output > 0)
+        {
+            mod->fill.is_active = false;
+            mod->fill.input = 0;
+            mod->fill.input_time = now;
+        }
+    }
+
+    if(!mod->fill.is_active)
+    {
+        // stream bitrate
+        const uint64_t window = now - mod->fill.input_time;
+        if(window >= RECONNECT_RATE_INTERVAL)
+        {
+            mod->fill.rate = mod->fill.input * 1000000 / window;
+            mod->fill.input = 0;
+            mod->fill.input_time = now;
+        }
+        mod->fill.pending = 0;
+        return;
+    }
+
+    // data from the sync buffer is sent before the null packets
+    mod->fill.pending += (int64_t)(mod->fill.rate * elapsed / 1000000) - (int64_t)output;
+    if(mod->fill.pending < 0)
+        mod->fill.pending = 0;
+
+    while(mod->fill.pending >= TS_PACKET_SIZE)
+    {
+        module_stream_send(mod, null_ts);
+        mod->fill.pending -= TS_PACKET_SIZE;
+        ++mod->fill.count;
+    }
+}
+
+static void on_reconnect(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    mod->reconnect.timer = NULL;
+
+    mod->timeout = asc_timer_init(mod->timeout_ms, timeout_callback, mod);
+    mod->connect_time = asc_utime();
+
+    if(mod->reconnect.is_sctp)
+        mod->sock = asc_socket_open_sctp4(mod);
+    else
+        mod->sock = asc_socket_open_tcp4(mod);
+
+    asc_socket_connect(mod->sock, mod->config.host, mod->config.port, on_connect, on_sock_error);
+}
+
+/* connection or the reconnect attempt is closed */
+static void stream_reset(module_data_t *mod)
+{
+    asc_socket_close(mod->sock);
+    mod->sock = NULL;
+
+    if(mod->timeout)
+    {
+        asc_timer_destroy(mod->timeout);
+        mod->timeout = NULL;
+    }
+
+    if(mod->request.buffer)
+    {
+        if(mod->request.status == 1)
+            free((void *)mod->request.buffer);
+        mod->request.buffer = NULL;
+    }
+
+    if(mod->request.idx_body)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->request.idx_body);
+        mod->request.idx_body = 0;
+    }
+
+    if(mod->content)
+    {
+        string_buffer_free(mod->content);
+        mod->content = NULL;
+    }
+
+    mod->request.status = 0;
+    mod->status = 0;
+    mod->buffer_skip = 0;
+    mod->chunk_left = 0;
+    mod->is_chunked = false;
+    mod->is_content_length = false;
+    mod->is_connection_close = false;
+    mod->is_idle = false;
+
+    // partial packet of the lost connection
+    if(!mod->config.sync)
+        mod->sync.buffer_write = 0;
+}
+
+/* connection is not restored in reconnect_timeout. stream is closed like without reconnect */
+static void stream_expire(module_data_t *mod)
+{
+    asc_log_error(MSG("connection is not restored in %"PRIu64"ms")
+                  , (asc_utime() - mod->reconnect.outage_time) / 1000);
+
+    stream_reset(mod);
+
+    mod->status = 3;
+    mod->request.status = -1;
+    on_close(mod);
+}
+
+/* connection is lost. stream and sync thread are kept */
+static void stream_reconnect(module_data_t *mod)
+{
+    stream_reset(mod);
+
+    if(!mod->reconnect.is_outage)
+    {
+        asc_log_warning(MSG("connection lost. reconnecting"));
+
+        mod->reconnect.is_outage = true;
+        mod->reconnect.outage_time = asc_utime();
+        mod->reconnect.delay = RECONNECT_DELAY;
+        ++mod->reconnect.count;
+
+        mod->fill.is_active = true;
+        mod->fill.pending = 0;
+    }
+    else
+    {
+        mod->reconnect.delay *= 2;
+        if(mod->reconnect.delay > mod->reconnect.delay_max)
+            mod->reconnect.delay = mod->reconnect.delay_max;
+    }
+
+    mod->reconnect.timer = asc_timer_one_shot(mod->reconnect.delay, on_reconnect, mod);
+}
+
+/* stream response is received */
+static void stream_start(module_data_t *mod)
+{
+    if(mod->reconnect.is_outage)
+    {
+        const uint64_t outage = asc_utime() - mod->reconnect.outage_time;
+        mod->reconnect.is_outage = false;
+        mod->reconnect.outage_last = outage;
+        mod->reconnect.outage_total += outage;
+
+        asc_log_info(MSG("reconnected. outage %"PRIu64"ms"), outage / 1000);
+    }
+    else
+    {
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
+        lua_pushboolean(lua, mod->is_stream);
+        lua_setfield(lua, -2, __stream);
+        callback(mod);
+
+        /* closed in the callback */
+        if(mod->status != 3)
+            return;
+
+        if(mod->reconnect.is_enabled)
+        {
+            mod->fill.time = asc_utime();
+            mod->fill.input_time = mod->fill.time;
+            mod->fill.timer = asc_timer_init(RECONNECT_FILL_INTERVAL, on_fill_timer, mod);
+        }
+    }
+
+    if(!mod->sync.buffer)
+        mod->sync.buffer = (uint8_t *)malloc(mod->sync.buffer_size);
+
+    if(mod->config.sync && !mod->reconnect.is_enabled)
+    {
+        // socket is read by the thread
+        asc_socket_set_on_read(mod->sock, NULL);
+        asc_socket_set_on_ready(mod->sock, NULL);
+        asc_socket_set_on_close(mod->sock, NULL);
+    }
+    else
+    {
+        mod->timeout = asc_timer_init(mod->timeout_ms, check_is_active, mod);
+
+        asc_socket_set_on_read(mod->sock, on_ts_read);
+        asc_socket_set_on_ready(mod->sock, NULL);
+    }
 
-        module_stream_send(mod, &mod->sync.buffer[mod->sync.buffer_read]);
-        mod->sync.buffer_read += TS_PACKET_SIZE;
+    if(mod->config.sync && !mod->thread)
+    {
+        mod->thread = asc_thread_init(mod);
+        // socket could be replaced, packets are passed by the main thread
+        if(mod->reconnect.is_enabled)
+            mod->thread_input = asc_thread_buffer_init(mod->sync.buffer_size);
+        mod->thread_output = asc_thread_buffer_init(mod->sync.buffer_size);
+        asc_thread_start(  mod->thread
+                         , thread_loop
+                         , on_thread_read, mod->thread_output
+                         , on_thread_close);
     }
 }
 
@@ -662,43 +1283,73 @@ static void on_ts_read(void *arg)
  *
  */
 
-static void on_read(void *arg)
+/* response is received, before callback */
+static void response_complete(module_data_t *mod, size_t skip)
 {
-    module_data_t *mod = (module_data_t *)arg;
-
-    if(mod->timeout)
-    {
-        asc_timer_destroy(mod->timeout);
-        mod->timeout = NULL;
-    }
+    mod->status = 3;
+    mod->is_idle = (   mod->request.status == 3
+                    && mod->pipeline_count == 0
+                    && skip >= mod->buffer_skip);
+}
 
-    ssize_t size = asc_socket_recv(  mod->sock
-                                   , &mod->buffer[mod->buffer_skip]
-                                   , HTTP_BUFFER_SIZE - mod->buffer_skip);
-    if(size <= 0)
+/* response is complete. returns true if the next pipelined response is in the buffer */
+static bool response_done(module_data_t *mod, size_t skip)
+{
+    if(mod->is_connection_close)
     {
         on_close(mod);
-        return;
+        return false;
     }
 
-    if(mod->receiver.callback.ptr)
+    /* closed or the next request is started in the callback */
+    if(!mod->sock || mod->status != 3)
     {
-        mod->receiver.callback.fn(mod->receiver.arg, &mod->buffer[mod->buffer_skip], size);
-        return;
+        mod->buffer_skip = 0;
+        return false;
     }
 
-    if(mod->status == 3)
+    if(mod->pipeline_count == 0 || skip >= mod->buffer_skip)
+        mod->buffer_skip = 0;
+    else
     {
-        asc_log_warning(MSG("received data after response"));
-        return;
+        mod->buffer_skip -= skip;
+        memmove(mod->buffer, &mod->buffer[skip], mod->buffer_skip);
     }
 
+    if(mod->pipeline_count == 0)
+        return false;
+
+    --mod->pipeline_count;
+    mod->is_head = (mod->pipeline_head & 1);
+    mod->pipeline_head >>= 1;
+    mod->status = 0;
+
+    if(!mod->timeout)
+        mod->timeout = asc_timer_init(mod->timeout_ms, timeout_callback, mod);
+
+    return (mod->buffer_skip > 0);
+}
+
+static bool response_parse(module_data_t *mod)
+{
     size_t eoh = 0; // end of headers
     size_t skip = 0;
-    mod->buffer_skip += size;
 
     if(mod->status == 0)
     {
+        // skip line breaks after the previous response
+        while(   skip < mod->buffer_skip
+              && (mod->buffer[skip] == '\r' || mod->buffer[skip] == '\n'))
+        {
+            ++skip;
+        }
+        if(skip > 0)
+        {
+            mod->buffer_skip -= skip;
+            memmove(mod->buffer, &mod->buffer[skip], mod->buffer_skip);
+            skip = 0;
+        }
+
         // check empty line
         while(skip < mod->buffer_skip)
         {
@@ -721,7 +1372,7 @@ static void on_read(void *arg)
         }
 
         if(mod->status != 1)
-            return;
+            return false;
     }
 
     if(mod->status == 1)
@@ -743,7 +1394,7 @@ static void on_read(void *arg)
         {
             call_error(mod, "failed to parse response line");
             on_close(mod);
-            return;
+            return false;
         }
 
         lua_newtable(lua);
@@ -757,6 +1408,9 @@ static void on_read(void *arg)
         lua_pushlstring(lua, &mod->buffer[m[1].so], m[1].eo - m[1].so);
         lua_setfield(lua, response, __version);
 
+        const bool is_http10 = (   m[1].eo - m[1].so == 8
+                                && !strncmp(&mod->buffer[m[1].so], "HTTP/1.0", 8));
+
         mod->status_code = atoi(&mod->buffer[m[2].so]);
         lua_pushnumber(lua, mod->status_code);
         lua_setfield(lua, response, __code);
@@ -764,6 +1418,12 @@ static void on_read(void *arg)
         lua_pushlstring(lua, &mod->buffer[m[3].so], m[3].eo - m[3].so);
         lua_setfield(lua, response, __message);
 
+        lua_pushnumber(lua, (lua_Number)mod->connect_time / 1000.0);
+        lua_setfield(lua, response, "connect_time");
+
+        lua_pushboolean(lua, mod->is_reused);
+        lua_setfield(lua, response, "reused");
+
         skip += m[0].eo;
 
 /*
@@ -786,7 +1446,7 @@ static void on_read(void *arg)
             {
                 call_error(mod, "failed to parse response headers");
                 on_close(mod);
-                return;
+                return false;
             }
 
             if(m[1].eo == 0)
@@ -805,6 +1465,7 @@ static void on_read(void *arg)
 
         mod->chunk_left = 0;
         mod->is_content_length = false;
+        mod->is_chunked = false;
 
         if(mod->content)
         {
@@ -831,6 +1492,18 @@ static void on_read(void *arg)
         }
         lua_pop(lua, 1); // transfer-encoding
 
+        mod->is_server_keep_alive = !is_http10;
+        lua_getfield(lua, headers, "connection");
+        if(lua_isstring(lua, -1))
+        {
+            const char *connection = lua_tostring(lua, -1);
+            if(!strncasecmp(connection, __close, sizeof(__close) - 1))
+                mod->is_server_keep_alive = false;
+            else if(!strncasecmp(connection, __keep_alive, sizeof(__keep_alive) - 1))
+                mod->is_server_keep_alive = true;
+        }
+        lua_pop(lua, 1); // connection
+
         if(mod->is_content_length || mod->is_chunked)
             mod->content = string_buffer_alloc();
 
@@ -841,66 +1514,37 @@ static void on_read(void *arg)
            || (mod->status_code == 204)
            || (mod->status_code == 304))
         {
-            mod->status = 3;
+            response_complete(mod, skip);
 
             lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
             callback(mod);
 
-            if(mod->is_connection_close)
-                on_close(mod);
-
-            mod->buffer_skip = 0;
-            return;
+            return response_done(mod, skip);
         }
 
         if(mod->is_stream && mod->status_code == 200)
         {
             mod->status = 3;
-
-            lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
-            lua_pushboolean(lua, mod->is_stream);
-            lua_setfield(lua, -2, __stream);
-            callback(mod);
-
-            mod->sync.buffer = (uint8_t *)malloc(mod->sync.buffer_size);
-
-            if(!mod->config.sync)
-            {
-                mod->timeout = asc_timer_init(mod->timeout_ms, check_is_active, mod);
-
-                asc_socket_set_on_read(mod->sock, on_ts_read);
-                asc_socket_set_on_ready(mod->sock, NULL);
-            }
-            else
-            {
-                asc_socket_set_on_read(mod->sock, NULL);
-                asc_socket_set_on_ready(mod->sock, NULL);
-                asc_socket_set_on_close(mod->sock, NULL);
-
-                mod->thread = asc_thread_init(mod);
-                mod->thread_output = asc_thread_buffer_init(mod->sync.buffer_size);
-                asc_thread_start(  mod->thread
-                                 , thread_loop
-                                 , on_thread_read, mod->thread_output
-                                 , on_thread_close);
-            }
-
             mod->buffer_skip = 0;
-            return;
+            stream_start(mod);
+            return false;
+        }
+
+        if(mod->reconnect.is_outage)
+        {
+            asc_log_debug(MSG("reconnect failed: %d"), mod->status_code);
+            on_close(mod);
+            return false;
         }
 
         if(!mod->content)
         {
-            mod->status = 3;
+            response_complete(mod, skip);
 
             lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
             callback(mod);
 
-            if(mod->is_connection_close)
-                on_close(mod);
-
-            mod->buffer_skip = 0;
-            return;
+            return response_done(mod, skip);
         }
     }
 
@@ -926,7 +1570,7 @@ static void on_read(void *arg)
                 {
                     call_error(mod, "invalid chunk");
                     on_close(mod);
-                    return;
+                    return false;
                 }
 
                 mod->chunk_left = 0;
@@ -944,26 +1588,27 @@ static void on_read(void *arg)
 
                 if(!mod->chunk_left)
                 {
+                    // empty line after the last chunk
+                    if(   skip + 1 < mod->buffer_skip
+                       && mod->buffer[skip] == '\r' && mod->buffer[skip + 1] == '\n')
+                    {
+                        skip += 2;
+                    }
+
                     lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
                     string_buffer_push(lua, mod->content);
                     mod->content = NULL;
                     lua_setfield(lua, -2, __content);
-                    mod->status = 3;
+                    response_complete(mod, skip);
                     callback(mod);
 
-                    if(mod->is_connection_close)
-                    {
-                        on_close(mod);
-                        return;
-                    }
-
-                    break;
+                    return response_done(mod, skip);
                 }
 
                 mod->chunk_left += 2;
             }
 
-            const size_t tail = size - skip;
+            const size_t tail = mod->buffer_skip - skip;
             if(mod->chunk_left <= tail)
             {
                 string_buffer_addlstring(mod->content, &mod->buffer[skip], mod->chunk_left - 2);
@@ -980,7 +1625,7 @@ static void on_read(void *arg)
         }
 
         mod->buffer_skip = 0;
-        return;
+        return false;
     }
 
     // Content-Length: *
@@ -996,25 +1641,65 @@ static void on_read(void *arg)
         else
         {
             string_buffer_addlstring(mod->content, &mod->buffer[skip], mod->chunk_left);
+            skip += mod->chunk_left;
             mod->chunk_left = 0;
 
             lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_response);
             string_buffer_push(lua, mod->content);
             mod->content = NULL;
             lua_setfield(lua, -2, __content);
-            mod->status = 3;
+            response_complete(mod, skip);
             callback(mod);
 
-            if(mod->is_connection_close)
-            {
-                on_close(mod);
-                return;
-            }
+            return response_done(mod, skip);
         }
 
         mod->buffer_skip = 0;
+        return false;
+    }
+
+    return false;
+}
+
+static void on_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->timeout)
+    {
+        asc_timer_destroy(mod->timeout);
+        mod->timeout = NULL;
+    }
+
+    ssize_t size = asc_socket_recv(  mod->sock
+                                   , &mod->buffer[mod->buffer_skip]
+                                   , HTTP_BUFFER_SIZE - mod->buffer_skip);
+    if(size <= 0)
+    {
+        mod->is_idle = false;
+        on_close(mod);
+        return;
+    }
+
+    mod->is_retry = false;
+
+    if(mod->receiver.callback.ptr)
+    {
+        mod->receiver.callback.fn(mod->receiver.arg, &mod->buffer[mod->buffer_skip], size);
+        return;
+    }
+
+    if(mod->status == 3)
+    {
+        asc_log_warning(MSG("received data after response"));
+        mod->is_idle = false;
         return;
     }
+
+    mod->buffer_skip += size;
+
+    while(response_parse(mod))
+        ;
 }
 
 /*
@@ -1026,6 +1711,18 @@ static void on_read(void *arg)
  *
  */
 
+static void on_ready_send_request(void *arg);
+
+static void pipeline_flush(module_data_t *mod)
+{
+    mod->request.buffer = string_buffer_release(mod->pipeline_queue, &mod->request.size);
+    mod->request.skip = 0;
+    mod->request.status = 1;
+    mod->pipeline_queue = NULL;
+
+    asc_socket_set_on_ready(mod->sock, on_ready_send_request);
+}
+
 static void on_ready_send_content(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -1055,7 +1752,10 @@ static void on_ready_send_content(void *arg)
 
         mod->request.status = 3;
 
-        asc_socket_set_on_ready(mod->sock, NULL);
+        if(mod->pipeline_queue)
+            pipeline_flush(mod);
+        else
+            asc_socket_set_on_ready(mod->sock, NULL);
     }
 }
 
@@ -1100,19 +1800,20 @@ static void on_ready_send_request(void *arg)
         {
             mod->request.status = 3;
 
-            asc_socket_set_on_ready(mod->sock, NULL);
+            if(mod->pipeline_queue)
+                pipeline_flush(mod);
+            else
+                asc_socket_set_on_ready(mod->sock, NULL);
         }
     }
 }
 
-static void lua_make_request(module_data_t *mod)
+static bool lua_make_request(module_data_t *mod, string_buffer_t *buffer)
 {
     lua_getfield(lua, -1, __method);
     const char *method = lua_isstring(lua, -1) ? lua_tostring(lua, -1) : __default_method;
     lua_pop(lua, 1);
 
-    mod->is_head = (strcmp(method, "HEAD") == 0);
-
     lua_getfield(lua, -1, __path);
     mod->config.path = lua_isstring(lua, -1) ? lua_tostring(lua, -1) : __default_path;
     lua_pop(lua, 1);
@@ -1121,8 +1822,6 @@ static void lua_make_request(module_data_t *mod)
     const char *version = lua_isstring(lua, -1) ? lua_tostring(lua, -1) : __default_version;
     lua_pop(lua, 1);
 
-    string_buffer_t *buffer = string_buffer_alloc();
-
     string_buffer_addfstring(buffer, "%s %s %s\r\n", method, mod->config.path, version);
 
     lua_getfield(lua, -1, __headers);
@@ -1148,8 +1847,23 @@ static void lua_make_request(module_data_t *mod)
 
     string_buffer_addlstring(buffer, "\r\n", 2);
 
+    return (strcmp(method, "HEAD") == 0);
+}
+
+static void request_start(module_data_t *mod)
+{
+    if(mod->request.buffer)
+    {
+        if(mod->request.status == 1)
+            free((void *)mod->request.buffer);
+        mod->request.buffer = NULL;
+    }
+
+    string_buffer_t *buffer = string_buffer_alloc();
+    mod->is_head = lua_make_request(mod, buffer);
     mod->request.buffer = string_buffer_release(buffer, &mod->request.size);
     mod->request.skip = 0;
+    mod->request.status = 1;
 
     if(mod->request.idx_body)
     {
@@ -1162,24 +1876,59 @@ static void lua_make_request(module_data_t *mod)
         mod->request.idx_body = luaL_ref(lua, LUA_REGISTRYINDEX);
     else
         lua_pop(lua, 1);
+
+    asc_socket_set_on_read(mod->sock, on_read);
+    asc_socket_set_on_ready(mod->sock, on_ready_send_request);
 }
 
-static void on_connect(void *arg)
+static void on_connect_done(module_data_t *mod)
 {
-    module_data_t *mod = (module_data_t *)arg;
-
-    mod->request.status = 1;
+    mod->connect_time = (mod->is_reused) ? 0 : (asc_utime() - mod->connect_time);
 
     asc_timer_destroy(mod->timeout);
     mod->timeout = asc_timer_init(mod->timeout_ms, timeout_callback, mod);
 
     lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_self);
     lua_getfield(lua, -1, "__options");
-    lua_make_request(mod);
+    request_start(mod);
     lua_pop(lua, 2); // self + __options
+}
 
-    asc_socket_set_on_read(mod->sock, on_read);
-    asc_socket_set_on_ready(mod->sock, on_ready_send_request);
+static void on_tls_connect(void *arg, const char *error)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(error)
+    {
+        if(!mod->reconnect.is_outage)
+        {
+            mod->status = -1;
+            mod->request.status = -1;
+            call_error(mod, error);
+        }
+        else
+            asc_log_debug(MSG("TLS handshake failed: %s"), error);
+
+        on_sock_error(mod);
+        return;
+    }
+
+    asc_socket_set_on_close(mod->sock, on_sock_error);
+    on_connect_done(mod);
+}
+
+static void on_connect(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->tls)
+    {
+        asc_socket_set_on_ready(mod->sock, NULL);
+        http_tls_handshake(mod->tls, mod->sock, mod->config.host, on_tls_connect, mod);
+        return;
+    }
+
+    on_connect_done(mod);
 }
 
 static void on_upstream_ready(void *arg)
@@ -1293,22 +2042,57 @@ static int method_set_receiver(module_data_t *mod)
     return 0;
 }
 
+static void pipeline_send(module_data_t *mod)
+{
+    lua_getfield(lua, 2, __content);
+    const bool is_content = !lua_isnil(lua, -1);
+    lua_pop(lua, 1);
+
+    if(is_content)
+        luaL_error(lua, MSG(":send() content is not allowed in pipeline"));
+
+    if(mod->pipeline_count >= HTTP_PIPELINE_SIZE)
+        luaL_error(lua, MSG(":send() pipeline is full"));
+
+    if(!mod->pipeline_queue)
+        mod->pipeline_queue = string_buffer_alloc();
+
+    lua_pushvalue(lua, 2);
+    if(lua_make_request(mod, mod->pipeline_queue))
+        mod->pipeline_head |= (1 << mod->pipeline_count);
+    lua_pop(lua, 1);
+
+    ++mod->pipeline_count;
+
+    if(mod->request.status == 3)
+        pipeline_flush(mod);
+}
+
 static int method_send(module_data_t *mod)
 {
+    asc_assert(lua_istable(lua, 2), MSG(":send() table required"));
+
+    mod->is_retry = false;
+    mod->is_idle = false;
+
+    /* previous response is not received yet */
+    if(   mod->is_pipeline
+       && ((mod->status >= 0 && mod->status < 3) || mod->pipeline_count > 0))
+    {
+        pipeline_send(mod);
+        return 0;
+    }
+
     mod->status = 0;
 
     if(mod->timeout)
         asc_timer_destroy(mod->timeout);
     mod->timeout = asc_timer_init(mod->timeout_ms, timeout_callback, mod);
 
-    asc_assert(lua_istable(lua, 2), MSG(":send() table required"));
     lua_pushvalue(lua, 2);
-    lua_make_request(mod);
+    request_start(mod);
     lua_pop(lua, 2); // :send() options
 
-    asc_socket_set_on_read(mod->sock, on_read);
-    asc_socket_set_on_ready(mod->sock, on_ready_send_request);
-
     return 0;
 }
 
@@ -1321,6 +2105,31 @@ static int method_close(module_data_t *mod)
     return 0;
 }
 
+static int method_stats(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, mod->reconnect.count);
+    lua_setfield(lua, -2, "reconnect");
+
+    uint64_t outage = 0;
+    if(mod->reconnect.is_outage)
+        outage = asc_utime() - mod->reconnect.outage_time;
+    lua_pushnumber(lua, outage / 1000);
+    lua_setfield(lua, -2, "outage");
+
+    lua_pushnumber(lua, mod->reconnect.outage_last / 1000);
+    lua_setfield(lua, -2, "outage_last");
+
+    lua_pushnumber(lua, (mod->reconnect.outage_total + outage) / 1000);
+    lua_setfield(lua, -2, "outage_total");
+
+    lua_pushnumber(lua, mod->fill.count);
+    lua_setfield(lua, -2, "null_packets");
+
+    return 1;
+}
+
 static void module_init(module_data_t *mod)
 {
     module_option_string("host", &mod->config.host, NULL);
@@ -1353,6 +2162,16 @@ static void module_init(module_data_t *mod)
             value = 1;
 
         mod->sync.buffer_size = value * 1024 * 1024;
+
+        module_option_boolean("reconnect", &mod->reconnect.is_enabled);
+
+        value = 5;
+        module_option_number("reconnect_max", &value);
+        mod->reconnect.delay_max = value * 1000;
+
+        value = 3;
+        module_option_number("reconnect_timeout", &value);
+        mod->reconnect.timeout = (uint64_t)value * 1000000;
     }
 
     lua_getfield(lua, MODULE_OPTIONS_IDX, "upstream");
@@ -1380,12 +2199,57 @@ static void module_init(module_data_t *mod)
 
     bool sctp = false;
     module_option_boolean("sctp", &sctp);
+    mod->reconnect.is_sctp = sctp;
+
+    module_option_number("keep_alive", &mod->keep_alive);
+    mod->keep_alive *= 1000;
+    mod->pool_size = 8;
+    module_option_number("pool_size", &mod->pool_size);
+    module_option_boolean("pipeline", &mod->is_pipeline);
+
+    bool tls = false;
+    module_option_boolean("tls", &tls);
+    if(tls)
+    {
+        bool tls_verify = true;
+        module_option_boolean("tls_verify", &tls_verify);
+        const char *tls_ca = NULL;
+        module_option_string("tls_ca", &tls_ca, NULL);
+
+        mod->tls = http_tls_client_init(tls_ca, tls_verify);
+        if(!mod->tls)
+        {
+            asc_log_error(MSG("failed to initialize TLS: %s"), http_tls_error());
+            astra_abort();
+        }
+    }
+
+    mod->connect_time = asc_utime();
+
+    if(mod->keep_alive > 0 && sctp == false && tls == false)
+    {
+        mod->sock = pool_get(mod);
+        if(mod->sock)
+        {
+            mod->is_reused = true;
+            mod->is_retry = true;
+
+            asc_socket_set_arg(mod->sock, mod);
+            asc_socket_set_on_close(mod->sock, on_sock_error);
+            asc_socket_set_on_read(mod->sock, NULL);
+            asc_socket_set_on_ready(mod->sock, on_connect);
+            return;
+        }
+    }
+    else
+        mod->keep_alive = 0;
+
     if(sctp == true)
         mod->sock = asc_socket_open_sctp4(mod);
     else
         mod->sock = asc_socket_open_tcp4(mod);
 
-    asc_socket_connect(mod->sock, mod->config.host, mod->config.port, on_connect, on_close);
+    asc_socket_connect(mod->sock, mod->config.host, mod->config.port, on_connect, on_sock_error);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -1394,6 +2258,12 @@ static void module_destroy(module_data_t *mod)
     mod->request.status = -1;
 
     on_close(mod);
+
+    if(mod->tls)
+    {
+        http_tls_destroy(mod->tls);
+        mod->tls = NULL;
+    }
 }
 
 MODULE_STREAM_METHODS()
@@ -1403,6 +2273,7 @@ MODULE_LUA_METHODS()
     { "send", method_send },
     { "close", method_close },
     { "set_receiver", method_set_receiver },
+    { "stats", method_stats },
 };
 
 MODULE_LUA_REGISTER(http_request)
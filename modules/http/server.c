@@ -28,7 +28,29 @@
  *      server_name  - string, default value: "Astra"
  *      http_version - string, default value: "HTTP/1.1"
  *      sctp         - boolean, use sctp instead of tcp
+ *      tls_cert     - string, path to the PEM certificate chain. enables HTTPS
+ *      tls_key      - string, path to the PEM private key. default: tls_cert
+ *                     record encryption is made by the kernel (kTLS) if available
  *      route        - list, format: { { "/path", callback }, ... }
+ *      keep_alive   - boolean, persistent connections. default value: true.
+ *                     responses with known length keep the connection open,
+ *                     pipelined requests are processed in order.
+ *                     route callback is called with nil request after each response
+ *      keep_alive_timeout
+ *                   - number, idle timeout in seconds. default value: 15
+ *      keep_alive_max
+ *                   - number, maximum requests per connection. default value: 100
+ *      max_clients  - number, maximum admitted connections. default value: unlimited
+ *      max_clients_ip
+ *                   - number, maximum admitted connections from one IP address
+ *      max_bitrate  - number, egress budget in Mbit/s. measured by the acknowledged
+ *                     TCP bytes of all clients
+ *      max_cpu      - number, CPU usage of the main thread in percent
+ *      max_lag      - number, event loop lag in milliseconds
+ *      retry_after  - number, Retry-After in seconds for the 503 responses.
+ *                     default value: 5
+ *                     limits are checked on the first request of the connection
+ *                     before the route callback. rejected request gets 503
  *
  * Module Methods:
  *      port()      - return number, server port
@@ -43,12 +65,47 @@
  *                    * content - string, response body from the string
  *      data(client)
  *                  - return table, client data
+ *      stats()     - return table: clients, bitrate (Kbit/s), cpu (%), lag (ms),
+ *                    rejected
  */
 
 #include "http.h"
 
+#ifndef _WIN32
+#   include <sys/resource.h>
+#endif
+
 #define MSG(_msg) "[http_server %s:%d] " _msg, mod->addr, mod->port
 
+typedef struct
+{
+    const char *path;
+    size_t path_size;   /* for wildcard routes: size of the prefix before '*' */
+    bool is_prefix;
+    int index;          /* first matched route in the configuration is used */
+    int idx_callback;
+} route_t;
+
+#define RESPONSE_TEMPLATE_COUNT 16
+
+/* status line and the Server header */
+typedef struct
+{
+    int code;
+    size_t size;
+    char *text;
+} response_template_t;
+
+#define LIMIT_IP_HASH_SIZE 256 /* must be power of 2 */
+
+/* admitted connections from one IP address */
+typedef struct limit_ip_t
+{
+    struct limit_ip_t *next;
+    int count;
+    char addr[16];
+} limit_ip_t;
+
 struct module_data_t
 {
     int idx_self;
@@ -59,16 +116,52 @@ struct module_data_t
     const char *http_version;
 
     asc_list_t *routes;
+    route_t **route_hash;   /* exact paths. open addressing */
+    size_t route_hash_size;
+    route_t **route_prefix; /* paths with wildcard in the configuration order */
+    size_t route_prefix_count;
+
+    int idx_request_meta;
+    response_template_t templates[RESPONSE_TEMPLATE_COUNT];
 
     asc_socket_t *sock;
     asc_list_t *clients;
-};
 
-typedef struct
-{
-    const char *path;
-    int idx_callback;
-} route_t;
+    http_tls_t *tls;
+
+    bool is_keep_alive;
+    int keep_alive_timeout;
+    int keep_alive_max;
+    asc_timer_t *timer_idle;
+
+    // admission
+    struct
+    {
+        int max_clients;
+        int max_clients_ip;
+        uint64_t max_bitrate;   // bytes per second
+        int max_cpu;
+        int max_lag;
+        int retry_after;
+
+        int clients;
+        limit_ip_t **ip_hash;
+
+        asc_timer_t *timer;
+        int tick;
+        uint64_t tick_time;
+        uint64_t window_time;
+        uint64_t cpu_time;
+
+        uint64_t lag;           // us
+        int cpu;
+        uint64_t bitrate;       // bytes per second
+
+        uint64_t rejected;
+        uint64_t rejected_window;
+        const char *reason;     // last reject reason
+    } limit;
+};
 
 static const char __method[] = "method";
 static const char __version[] = "version";
@@ -81,6 +174,12 @@ static const char __message[] = "message";
 
 static const char __content_length[] = "Content-Length: ";
 static const char __connection_close[] = "Connection: close";
+static const char __connection_keep_alive[] = "Connection: keep-alive";
+
+#define IDLE_CHECK_INTERVAL 1000
+
+#define LIMIT_INTERVAL 100 /* ms */
+#define LIMIT_WINDOW 10 /* ticks to update the CPU usage and the bitrate */
 
 /*
  *   oooooooo8 ooooo       ooooo ooooooooooo oooo   oooo ooooooooooo
@@ -103,6 +202,8 @@ static void callback(http_client_t *client)
     lua_call(lua, 3, 0);
 }
 
+static void limit_release(http_client_t *client);
+
 static void on_client_close(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
@@ -114,6 +215,9 @@ static void on_client_close(void *arg)
     asc_socket_close(client->sock);
     client->sock = NULL;
 
+    if(client->is_admitted)
+        limit_release(client);
+
     if(client->status == 3)
     {
         client->status = 0;
@@ -147,37 +251,308 @@ static void on_client_close(void *arg)
         client->content = NULL;
     }
 
+    if(client->pending)
+    {
+        free(client->pending);
+        client->pending = NULL;
+    }
+
     asc_list_remove_item(mod->clients, client);
     free(client);
 }
 
-static bool routecmp(const char *path, const char *route)
+static void client_parse(http_client_t *client);
+static bool limit_check(http_client_t *client);
+static void on_client_read(void *arg);
+static void response_append(http_client_t *client, const char *header, size_t size);
+
+/* keep bytes from the buffer after the current request. false if pending buffer is full */
+static bool client_save_pending(http_client_t *client, size_t skip)
 {
-    size_t skip = 0;
-    while(1)
+    if(skip >= client->buffer_skip)
+        return true;
+
+    const size_t size = client->buffer_skip - skip;
+    if(size + client->pending_size > HTTP_BUFFER_SIZE)
     {
-        const char cp = path[skip];
-        const char cr = route[skip];
+        http_client_error(client, "pipelined requests are too large");
+        client->is_keep_alive = false;
+        http_client_abort(client, 413, NULL);
+        return false;
+    }
 
-        if(cp == cr)
-        {
-            if(cp == '\0')
-                return true;
+    if(!client->pending)
+        client->pending = (char *)malloc(HTTP_BUFFER_SIZE);
 
-            ++skip;
-        }
+    memmove(&client->pending[size], client->pending, client->pending_size);
+    memcpy(client->pending, &client->buffer[skip], size);
+    client->pending_size += size;
+    client->buffer_skip = skip;
+    return true;
+}
+
+/* response is sent. close connection or wait for the next request */
+static void on_response_done(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
+
+    if(!client->is_keep_alive || client->response)
+    {
+        on_client_close(client);
+        return;
+    }
+
+    if(client->status == 3)
+    {
+        /* request is completed. socket is hidden to keep the client alive */
+        asc_socket_t *sock = client->sock;
+        client->sock = NULL;
+        client->status = 0;
+        callback(client);
+        client->sock = sock;
+    }
+
+    if(client->idx_content)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_content);
+        client->idx_content = 0;
+    }
+
+    if(client->idx_request)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_request);
+        client->idx_request = 0;
+    }
+
+    if(client->idx_data)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_data);
+        client->idx_data = 0;
+    }
+
+    if(client->content)
+    {
+        string_buffer_free(client->content);
+        client->content = NULL;
+    }
+
+    client->status = 0;
+    client->idx_callback = 0;
+    client->chunk_left = 0;
+    client->is_head = false;
+    client->is_content_length = false;
+    client->is_keep_alive = false;
+    client->on_send = NULL;
+    client->on_read = NULL;
+    client->on_ready = NULL;
+    client->on_stats = NULL;
+    client->idle_time = asc_utime();
+
+    client->buffer_skip = client->pending_size;
+    if(client->pending_size > 0)
+    {
+        memcpy(client->buffer, client->pending, client->pending_size);
+        client->pending_size = 0;
+    }
+
+    asc_socket_set_on_ready(client->sock, NULL);
+    asc_socket_set_on_read(client->sock, on_client_read);
+
+    asc_log_debug(MSG("client %s:%d keep-alive (%d requests)")
+                  , asc_socket_addr(client->sock), asc_socket_port(client->sock)
+                  , client->request_count);
+
+    if(client->buffer_skip > 0)
+        client_parse(client);
+}
+
+/* FNV-1a */
+static uint32_t route_hash(const char *path, size_t size)
+{
+    uint32_t hash = 2166136261U;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= (uint8_t)path[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void route_compile(module_data_t *mod)
+{
+    size_t exact_count = 0;
+    asc_list_for(mod->routes)
+    {
+        route_t *route = (route_t *)asc_list_data(mod->routes);
+        if(route->is_prefix)
+            ++mod->route_prefix_count;
         else
+            ++exact_count;
+    }
+
+    mod->route_hash_size = 16;
+    while(mod->route_hash_size < exact_count * 2)
+        mod->route_hash_size *= 2;
+
+    mod->route_hash = (route_t **)calloc(mod->route_hash_size, sizeof(route_t *));
+    mod->route_prefix = (route_t **)calloc(mod->route_prefix_count + 1, sizeof(route_t *));
+
+    size_t prefix_count = 0;
+    asc_list_for(mod->routes)
+    {
+        route_t *route = (route_t *)asc_list_data(mod->routes);
+        if(route->is_prefix)
         {
-            if(cr == '*')
-                return true;
+            mod->route_prefix[prefix_count++] = route;
+            continue;
+        }
 
+        const size_t mask = mod->route_hash_size - 1;
+        size_t i = route_hash(route->path, route->path_size) & mask;
+        while(mod->route_hash[i])
+        {
+            /* duplicate path. first one is used */
+            if(   mod->route_hash[i]->path_size == route->path_size
+               && !memcmp(mod->route_hash[i]->path, route->path, route->path_size))
+            {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        if(!mod->route_hash[i])
+            mod->route_hash[i] = route;
+    }
+}
+
+static const route_t * route_find(module_data_t *mod, const char *path, size_t path_size)
+{
+    const route_t *route = NULL;
+
+    const size_t mask = mod->route_hash_size - 1;
+    size_t i = route_hash(path, path_size) & mask;
+    while(mod->route_hash[i])
+    {
+        const route_t *item = mod->route_hash[i];
+        if(item->path_size == path_size && !memcmp(item->path, path, path_size))
+        {
+            route = item;
             break;
         }
+        i = (i + 1) & mask;
     }
 
+    for(size_t j = 0; j < mod->route_prefix_count; ++j)
+    {
+        const route_t *item = mod->route_prefix[j];
+        if(route && route->index < item->index)
+            break;
+
+        if(path_size >= item->path_size && !memcmp(item->path, path, item->path_size))
+            return item;
+    }
+
+    return route;
+}
+
+/* case-insensitive search of the token in the header value */
+static bool header_has_token(const char *value, size_t size, const char *token)
+{
+    const size_t token_size = strlen(token);
+    for(size_t i = 0; i + token_size <= size; ++i)
+    {
+        if(!strncasecmp(&value[i], token, token_size))
+            return true;
+    }
     return false;
 }
 
+/* request.__index. headers table is built from the raw header block on first access */
+static int request_index(lua_State *L)
+{
+    const char *key = lua_tostring(L, 2);
+    if(!key || strcmp(key, __headers))
+        return 0;
+
+    lua_pushlightuserdata(L, (void *)__headers);
+    lua_rawget(L, 1);
+    size_t size = 0;
+    const char *raw = lua_tolstring(L, -1, &size);
+    if(!raw)
+        return 0;
+
+    lua_newtable(L);
+    const int headers = lua_gettop(L);
+
+    parse_match_t m[4];
+    size_t skip = 0;
+    while(skip < size && http_parse_header(&raw[skip], size - skip, m) && m[1].eo != 0)
+    {
+        lua_string_to_lower(&raw[skip], m[1].eo);
+        lua_pushlstring(L, &raw[skip + m[2].so], m[2].eo - m[2].so);
+        lua_settable(L, headers);
+
+        skip += m[0].eo;
+    }
+
+    lua_pushvalue(L, headers);
+    lua_setfield(L, 1, __headers);
+
+    lua_pushlightuserdata(L, (void *)__headers);
+    lua_pushnil(L);
+    lua_rawset(L, 1);
+
+    return 1;
+}
+
+/* value of the request header. name in lower case. valid while the request is processed */
+const char * http_request_header(http_client_t *client, const char *name, size_t *size)
+{
+    const char *result = NULL;
+    size_t result_size = 0;
+
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
+    lua_pushlightuserdata(lua, (void *)__headers);
+    lua_rawget(lua, -2);
+
+    size_t raw_size = 0;
+    const char *raw = lua_tolstring(lua, -1, &raw_size);
+    if(raw)
+    {
+        const size_t name_size = strlen(name);
+        parse_match_t m[4];
+        size_t skip = 0;
+        while(   skip < raw_size
+              && http_parse_header(&raw[skip], raw_size - skip, m)
+              && m[1].eo != 0)
+        {
+            /* last value is used. same as the headers table */
+            if(m[1].eo == name_size && !strncasecmp(&raw[skip], name, name_size))
+            {
+                result = &raw[skip + m[2].so];
+                result_size = m[2].eo - m[2].so;
+            }
+            skip += m[0].eo;
+        }
+    }
+    else
+    {
+        /* headers table is already built */
+        lua_getfield(lua, -2, __headers);
+        if(lua_istable(lua, -1))
+        {
+            lua_getfield(lua, -1, name);
+            result = lua_tolstring(lua, -1, &result_size);
+            lua_pop(lua, 1); // value is referenced by the headers table
+        }
+        lua_pop(lua, 1); // headers
+    }
+    lua_pop(lua, 2); // raw headers + request
+
+    if(size)
+        *size = result_size;
+    return result;
+}
+
 /*
  * oooooooooo  ooooooooooo      o      ooooooooo
  *  888    888  888    88      888      888    88o
@@ -187,10 +562,40 @@ static bool routecmp(const char *path, const char *route)
  *
  */
 
+static void on_client_read_pending(http_client_t *client)
+{
+    if(!client->pending)
+        client->pending = (char *)malloc(HTTP_BUFFER_SIZE);
+
+    if(client->pending_size == HTTP_BUFFER_SIZE)
+    {
+        /* wait for the response. data is buffered by the kernel */
+        asc_socket_set_on_read(client->sock, NULL);
+        return;
+    }
+
+    const ssize_t size = asc_socket_recv(  client->sock
+                                         , &client->pending[client->pending_size]
+                                         , HTTP_BUFFER_SIZE - client->pending_size);
+    if(size <= 0)
+    {
+        on_client_close(client);
+        return;
+    }
+
+    client->pending_size += size;
+}
+
 static void on_client_read(void *arg)
 {
     http_client_t *client = (http_client_t *)arg;
-    module_data_t *mod = client->mod;
+
+    if(client->status == 3)
+    {
+        /* pipelined request. processed after the response */
+        on_client_read_pending(client);
+        return;
+    }
 
     ssize_t size = asc_socket_recv(  client->sock
                                    , &client->buffer[client->buffer_skip]
@@ -201,38 +606,50 @@ static void on_client_read(void *arg)
         return;
     }
 
-    if(client->status == 3)
-    {
-        asc_log_warning(MSG("received data after request"));
-        return;
-    }
+    client->buffer_skip += size;
+    client_parse(client);
+}
+
+static void client_parse(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
 
     char *uri_host = NULL;
     size_t uri_host_size = 0;
 
     size_t eoh = 0; // end of headers
     size_t skip = 0;
-    client->buffer_skip += size;
 
     if(client->status == 0)
     {
-        // check empty line
+        // check empty line. search is resumed from the end of the previous read
+        skip = client->parse_skip;
         while(skip < client->buffer_skip)
         {
-            if(   client->buffer[skip + 0] == '\r'
-               && client->buffer[skip + 1] == '\n'
-               && client->buffer[skip + 2] == '\r'
-               && client->buffer[skip + 3] == '\n')
+            const char *lf = (const char *)memchr(  &client->buffer[skip], '\n'
+                                                  , client->buffer_skip - skip);
+            if(!lf)
+                break;
+
+            skip = lf - client->buffer + 1;
+            if(   skip >= 4
+               && client->buffer[skip - 2] == '\r'
+               && client->buffer[skip - 3] == '\n'
+               && client->buffer[skip - 4] == '\r')
             {
-                eoh = skip + 4;
+                eoh = skip;
                 client->status = 1; // empty line is found
                 break;
             }
-            ++skip;
         }
 
         if(client->status != 1)
+        {
+            client->parse_skip = client->buffer_skip;
             return;
+        }
+
+        client->parse_skip = 0;
     }
 
     if(client->status == 1)
@@ -306,7 +723,8 @@ static void on_client_read(void *arg)
             ++path_skip;
 
         const bool is_safe = lua_safe_path(&client->buffer[skip], path_skip - skip);
-        const char *path = lua_tostring(lua, -1);
+        size_t path_size = 0;
+        const char *path = lua_tolstring(lua, -1, &path_size);
         lua_setfield(lua, request, __path);
 
         if(!is_safe)
@@ -330,6 +748,7 @@ static void on_client_read(void *arg)
         }
 
         lua_pushlstring(lua, &client->buffer[m[3].so], m[3].eo - m[3].so);
+        client->is_http10 = (strcmp(lua_tostring(lua, -1), "HTTP/1.0") == 0);
         lua_setfield(lua, request, __version);
 
         skip = m[0].eo;
@@ -343,67 +762,92 @@ static void on_client_read(void *arg)
  *
  */
 
-        lua_newtable(lua);
-        lua_pushvalue(lua, -1);
-        lua_setfield(lua, request, __headers);
-        const int headers = lua_gettop(lua);
+        /* headers table is built on the first access to request.headers */
+        const size_t headers_skip = skip;
+        size_t content_length = 0;
+        bool is_connection_close = false;
+        bool is_connection_keep_alive = false;
 
         while(skip < eoh)
         {
             if(!http_parse_header(&client->buffer[skip], eoh - skip, m))
             {
                 asc_log_error(MSG("failed to parse request headers"));
+                lua_pop(lua, 1); // request
                 on_client_close(client);
                 return;
             }
 
             if(m[1].eo == 0)
             { /* empty line */
-                skip += m[0].eo;
                 client->status = 2;
                 break;
             }
 
-            lua_string_to_lower(&client->buffer[skip], m[1].eo);
-            lua_pushlstring(lua, &client->buffer[skip + m[2].so], m[2].eo - m[2].so);
-            lua_settable(lua, headers);
+            const char *name = &client->buffer[skip];
+            const char *value = &client->buffer[skip + m[2].so];
+            const size_t value_size = m[2].eo - m[2].so;
+
+            if(m[1].eo == 14 && !strncasecmp(name, "content-length", 14))
+            {
+                content_length = 0;
+                for(size_t i = 0; i < value_size && value[i] >= '0' && value[i] <= '9'; ++i)
+                    content_length = content_length * 10 + (value[i] - '0');
+            }
+            else if(m[1].eo == 10 && !strncasecmp(name, "connection", 10))
+            {
+                is_connection_close = header_has_token(value, value_size, "close");
+                is_connection_keep_alive = header_has_token(value, value_size, "keep-alive");
+            }
 
             skip += m[0].eo;
         }
 
+        lua_pushlightuserdata(lua, (void *)__headers);
+        lua_pushlstring(lua, &client->buffer[headers_skip], skip - headers_skip);
         if(uri_host)
         {
+            /* last value overrides the Host header */
+            lua_pushstring(lua, "Host: ");
             lua_pushlstring(lua, uri_host, uri_host_size);
-            lua_setfield(lua, headers, "host");
+            lua_pushstring(lua, "\r\n");
+            lua_concat(lua, 4);
         }
+        lua_rawset(lua, request);
 
-        lua_getfield(lua, headers, "content-length");
-        if(lua_isnumber(lua, -1))
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->idx_request_meta);
+        lua_setmetatable(lua, request);
+
+        skip += m[0].eo; // empty line
+
+        if(content_length > 0)
         {
-            client->chunk_left = lua_tonumber(lua, -1);
-            if(client->chunk_left > 0)
-            {
-                if(client->content)
-                    string_buffer_free(client->content);
-                client->content = string_buffer_alloc();
-                client->is_content_length = true;
-            }
+            client->chunk_left = content_length;
+            if(client->content)
+                string_buffer_free(client->content);
+            client->content = string_buffer_alloc();
+            client->is_content_length = true;
         }
-        lua_pop(lua, 1); // content-length
-
-        lua_pop(lua, 2); // headers + request
 
-        client->idx_callback = 0;
-        asc_list_for(mod->routes)
+        ++client->request_count;
+        client->is_keep_alive = (  mod->is_keep_alive
+                                 && client->request_count < mod->keep_alive_max);
+        if(client->is_keep_alive)
         {
-            route_t *route = (route_t *)asc_list_data(mod->routes);
-            if(routecmp(path, route->path))
-            {
-                client->idx_callback = route->idx_callback;
-                break;
-            }
+            if(client->is_http10)
+                client->is_keep_alive = is_connection_keep_alive;
+            else if(is_connection_close)
+                client->is_keep_alive = false;
         }
 
+        lua_pop(lua, 1); // request
+
+        if(!client->content && !client_save_pending(client, skip))
+            return;
+
+        const route_t *route = route_find(mod, path, path_size);
+        client->idx_callback = (route) ? route->idx_callback : 0;
+
         if(!client->idx_callback)
         {
             http_client_warning(client, "route not found %s", path);
@@ -411,6 +855,9 @@ static void on_client_read(void *arg)
             return;
         }
 
+        if(!client->is_admitted && !limit_check(client))
+            return;
+
         if(!client->content)
         {
             client->status = 3;
@@ -449,6 +896,8 @@ static void on_client_read(void *arg)
         {
             string_buffer_addlstring(client->content,
                 &client->buffer[skip], client->chunk_left);
+            if(!client_save_pending(client, skip + client->chunk_left))
+                return;
             client->chunk_left = 0;
 
             lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_request);
@@ -506,7 +955,7 @@ static void on_ready_send_content(void *arg)
     client->chunk_left -= send_size;
 
     if(client->chunk_left == 0)
-        on_client_close(client);
+        on_response_done(client);
 }
 
 /* Stack: 1 - server, 2 - client, 3 - response */
@@ -539,6 +988,39 @@ static int method_send(module_data_t *mod)
 
     http_response_code(client, code, message);
 
+    lua_getfield(lua, idx_response, __content);
+    const bool is_content = lua_isstring(lua, -1);
+    lua_pop(lua, 1); // content
+
+    /* connection is persistent if the response length is known */
+    if(!is_content && !client->is_head && code != 204 && code != 304)
+        client->is_keep_alive = false;
+
+    bool is_connection = false;
+    lua_getfield(lua, idx_response, __headers);
+    if(lua_istable(lua, -1))
+    {
+        lua_foreach(lua, -2)
+        {
+            const char *header = lua_tostring(lua, -1);
+            if(header && !strncasecmp(header, "connection:", 11))
+            {
+                is_connection = true;
+                if(strcasestr(header, "close"))
+                    client->is_keep_alive = false;
+            }
+        }
+    }
+    lua_pop(lua, 1); // headers
+
+    if(!is_connection)
+    {
+        if(!client->is_keep_alive)
+            http_response_header(client, __connection_close);
+        else if(client->is_http10)
+            http_response_header(client, __connection_keep_alive);
+    }
+
     lua_getfield(lua, idx_response, __content);
     if(lua_isstring(lua, -1))
     {
@@ -561,14 +1043,33 @@ static int method_send(module_data_t *mod)
     {
         lua_foreach(lua, -2)
         {
-            const char *header = lua_tostring(lua, -1);
-            http_response_header(client, "%s", header);
+            size_t header_size = 0;
+            const char *header = lua_tolstring(lua, -1, &header_size);
+            response_append(client, header, header_size);
         }
     }
     lua_pop(lua, 1); // headers
 
     http_response_send(client);
 
+    if(client->idx_content && !client->is_head)
+    {
+        /* small content is sent with the headers */
+        lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_content);
+        size_t content_size = 0;
+        const char *content = lua_tolstring(lua, -1, &content_size);
+        if(content_size <= HTTP_BUFFER_SIZE - client->chunk_left)
+        {
+            memcpy(&client->buffer[client->chunk_left], content, content_size);
+            client->chunk_left += content_size;
+
+            luaL_unref(lua, LUA_REGISTRYINDEX, client->idx_content);
+            client->idx_content = 0;
+            client->on_ready = NULL;
+        }
+        lua_pop(lua, 1); // content
+    }
+
     return 0;
 }
 
@@ -614,7 +1115,7 @@ static void on_ready_send_response(void *arg)
             return;
         }
 
-        on_client_close(client);
+        on_response_done(client);
     }
 }
 
@@ -623,6 +1124,7 @@ static const char * http_code(int code)
     switch(code)
     {
         case 200: return "Ok";
+        case 206: return "Partial Content";
 
         case 301: return "Moved Permanently";
         case 302: return "Found";
@@ -633,6 +1135,8 @@ static const char * http_code(int code)
         case 403: return "Forbidden";
         case 404: return "Not Found";
         case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 416: return "Range Not Satisfiable";
         case 429: return "Too Many Requests";
 
         case 500: return "Internal Server Error";
@@ -644,23 +1148,69 @@ static const char * http_code(int code)
     }
 }
 
+/* append header line without formatting. 2 bytes are reserved for the empty line */
+static void response_append(http_client_t *client, const char *header, size_t size)
+{
+    if(size > HTTP_BUFFER_SIZE - 4 - client->chunk_left)
+        size = HTTP_BUFFER_SIZE - 4 - client->chunk_left;
+    memcpy(&client->buffer[client->chunk_left], header, size);
+    client->chunk_left += size;
+    client->buffer[client->chunk_left + 0] = '\r';
+    client->buffer[client->chunk_left + 1] = '\n';
+    client->chunk_left += 2;
+}
+
 void http_response_code(http_client_t *client, int code, const char *message)
 {
+    module_data_t *mod = client->mod;
+
     if(!message)
+    {
+        /* status line with default message is formatted once */
+        for(int i = 0; i < RESPONSE_TEMPLATE_COUNT; ++i)
+        {
+            response_template_t *item = &mod->templates[i];
+            if(!item->text)
+            {
+                item->code = code;
+                item->size = snprintf(  client->buffer, HTTP_BUFFER_SIZE
+                                      , "%s %d %s\r\nServer: %s\r\n"
+                                      , mod->http_version, code, http_code(code)
+                                      , mod->server_name);
+                item->text = (char *)malloc(item->size);
+                memcpy(item->text, client->buffer, item->size);
+            }
+
+            if(item->code == code)
+            {
+                memcpy(client->buffer, item->text, item->size);
+                client->chunk_left = item->size;
+                return;
+            }
+        }
+
         message = http_code(code);
+    }
 
     client->chunk_left  = snprintf(client->buffer, HTTP_BUFFER_SIZE
                                    , "%s %d %s\r\n"
-                                   , client->mod->http_version, code, message);
+                                   , mod->http_version, code, message);
 
     client->chunk_left += snprintf(&client->buffer[client->chunk_left]
                                    , HTTP_BUFFER_SIZE - client->chunk_left
                                    , "Server: %s\r\n"
-                                   , client->mod->server_name);
+                                   , mod->server_name);
 }
 
 void http_response_header(http_client_t *client, const char *header, ...)
 {
+    if(!strchr(header, '%'))
+    {
+        /* constant header */
+        response_append(client, header, strlen(header));
+        return;
+    }
+
     va_list ap;
     va_start(ap, header);
 
@@ -719,6 +1269,12 @@ void http_client_close(http_client_t *client)
     on_client_close(client);
 }
 
+/* response is sent by the route module. client->response should be released before */
+void http_client_done(http_client_t *client)
+{
+    on_response_done(client);
+}
+
 void http_client_abort(http_client_t *client, int code, const char *text)
 {
     module_data_t *mod = client->mod;
@@ -750,10 +1306,19 @@ void http_client_abort(http_client_t *client, int code, const char *text)
     client->on_read = NULL;
     client->on_ready = on_ready_send_content;
 
+    /* request body is not received */
+    if(client->content)
+        client->is_keep_alive = false;
+
     http_response_code(client, code, message);
     http_response_header(client, "Content-Type: text/html");
     http_response_header(client, "%s%d", __content_length, content_length);
-    http_response_header(client, __connection_close);
+    if(code == 503 && mod->limit.retry_after > 0)
+        http_response_header(client, "Retry-After: %d", mod->limit.retry_after);
+    if(!client->is_keep_alive)
+        http_response_header(client, __connection_close);
+    else if(client->is_http10)
+        http_response_header(client, __connection_keep_alive);
     http_response_send(client);
 }
 
@@ -772,6 +1337,7 @@ void http_client_redirect(http_client_t *client, int code, const char *location)
     client->on_ready = NULL;
 
     client->is_head = true; // hack to close connection after response
+    client->is_keep_alive = false;
 
     http_response_code(client, code, NULL);
     http_response_header(client, "Location: %s", location);
@@ -779,6 +1345,198 @@ void http_client_redirect(http_client_t *client, int code, const char *location)
     http_response_send(client);
 }
 
+/*
+ * ooooo       ooooo oooo     oooo ooooo ooooooooooo
+ *  888         888   8888o   888   888  88  888  88
+ *  888         888   88 888o8 88   888      888
+ *  888      o  888   88  888  88   888      888
+ * o888ooooo88 o888o o88o  8  o88o o888o    o888o
+ *
+ */
+
+/* CPU time of the current thread in microseconds */
+static uint64_t limit_cpu_time(void)
+{
+#ifndef _WIN32
+    struct rusage usage;
+#   ifdef RUSAGE_THREAD
+    if(getrusage(RUSAGE_THREAD, &usage) != 0)
+#   else
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+#   endif
+        return 0;
+
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#else
+    return 0;
+#endif
+}
+
+static limit_ip_t * limit_ip_find(module_data_t *mod, const char *addr, limit_ip_t ***prev)
+{
+    const size_t i = route_hash(addr, strlen(addr)) & (LIMIT_IP_HASH_SIZE - 1);
+
+    *prev = &mod->limit.ip_hash[i];
+    while(**prev)
+    {
+        limit_ip_t *item = **prev;
+        if(!strcmp(item->addr, addr))
+            return item;
+        *prev = &item->next;
+    }
+
+    return NULL;
+}
+
+static void limit_release(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
+
+    client->is_admitted = false;
+    --mod->limit.clients;
+
+    limit_ip_t *item = (limit_ip_t *)client->admission_ip;
+    if(!item)
+        return;
+    client->admission_ip = NULL;
+
+    if(--item->count > 0)
+        return;
+
+    limit_ip_t **prev;
+    if(limit_ip_find(mod, item->addr, &prev) == item)
+        *prev = item->next;
+    free(item);
+}
+
+static void limit_reject(http_client_t *client, const char *reason)
+{
+    module_data_t *mod = client->mod;
+
+    ++mod->limit.rejected;
+    ++mod->limit.rejected_window;
+    mod->limit.reason = reason;
+
+    client->is_keep_alive = false;
+    http_client_abort(client, 503, reason);
+}
+
+/* first request of the connection. returns false if the request is rejected */
+static bool limit_check(http_client_t *client)
+{
+    module_data_t *mod = client->mod;
+
+    if(mod->limit.max_clients > 0 && mod->limit.clients >= mod->limit.max_clients)
+    {
+        limit_reject(client, "Too many connections");
+        return false;
+    }
+
+    if(mod->limit.max_lag > 0 && mod->limit.lag >= (uint64_t)mod->limit.max_lag * 1000)
+    {
+        limit_reject(client, "Server is overloaded");
+        return false;
+    }
+
+    if(mod->limit.max_cpu > 0 && mod->limit.cpu >= mod->limit.max_cpu)
+    {
+        limit_reject(client, "Server is overloaded");
+        return false;
+    }
+
+    if(mod->limit.max_bitrate > 0 && mod->limit.bitrate >= mod->limit.max_bitrate)
+    {
+        limit_reject(client, "Bandwidth limit exceeded");
+        return false;
+    }
+
+    limit_ip_t *item = NULL;
+    if(mod->limit.max_clients_ip > 0)
+    {
+        const char *addr = asc_socket_addr(client->sock);
+        limit_ip_t **prev;
+        item = limit_ip_find(mod, addr, &prev);
+        if(!item)
+        {
+            item = (limit_ip_t *)calloc(1, sizeof(limit_ip_t));
+            strncpy(item->addr, addr, sizeof(item->addr) - 1);
+            *prev = item;
+        }
+        else if(item->count >= mod->limit.max_clients_ip)
+        {
+            limit_reject(client, "Too many connections from your address");
+            return false;
+        }
+        ++item->count;
+    }
+
+    client->is_admitted = true;
+    client->admission_ip = item;
+    ++mod->limit.clients;
+
+    return true;
+}
+
+static void limit_update_bitrate(module_data_t *mod, uint64_t window)
+{
+    uint64_t bytes = 0;
+
+    asc_list_for(mod->clients)
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(mod->clients);
+        asc_socket_tcp_info_t info;
+        if(!client->sock || !asc_socket_get_tcp_info(client->sock, &info))
+            continue;
+
+        if(info.bytes_acked > client->bytes_acked)
+            bytes += info.bytes_acked - client->bytes_acked;
+        client->bytes_acked = info.bytes_acked;
+    }
+
+    mod->limit.bitrate = bytes * 1000000 / window;
+}
+
+static void limit_timer_callback(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint64_t now = asc_utime();
+
+    /* timer delay. fast attack, slow decay */
+    const uint64_t expected = mod->limit.tick_time + LIMIT_INTERVAL * 1000;
+    const uint64_t lag = (now > expected) ? (now - expected) : 0;
+    if(lag > mod->limit.lag)
+        mod->limit.lag = lag;
+    else
+        mod->limit.lag = (mod->limit.lag * 7 + lag) / 8;
+    mod->limit.tick_time = now;
+
+    if(++mod->limit.tick < LIMIT_WINDOW)
+        return;
+    mod->limit.tick = 0;
+
+    const uint64_t window = now - mod->limit.window_time;
+    mod->limit.window_time = now;
+    if(window == 0)
+        return;
+
+    const uint64_t cpu_time = limit_cpu_time();
+    mod->limit.cpu = (int)((cpu_time - mod->limit.cpu_time) * 100 / window);
+    mod->limit.cpu_time = cpu_time;
+
+    if(mod->limit.max_bitrate > 0)
+        limit_update_bitrate(mod, window);
+
+    if(mod->limit.rejected_window > 0)
+    {
+        asc_log_warning(MSG("%"PRIu64" requests rejected: %s. clients:%d cpu:%d%% lag:%"PRIu64"ms")
+                        , mod->limit.rejected_window, mod->limit.reason
+                        , mod->limit.clients, mod->limit.cpu, mod->limit.lag / 1000);
+        mod->limit.rejected_window = 0;
+    }
+}
+
 /*
  *  oooooooo8 ooooooooooo oooooooooo ooooo  oooo ooooooooooo oooooooooo
  * 888         888    88   888    888 888    88   888    88   888    888
@@ -798,6 +1556,18 @@ static void on_server_close(void *arg)
     asc_socket_close(mod->sock);
     mod->sock = NULL;
 
+    if(mod->timer_idle)
+    {
+        asc_timer_destroy(mod->timer_idle);
+        mod->timer_idle = NULL;
+    }
+
+    if(mod->limit.timer)
+    {
+        asc_timer_destroy(mod->limit.timer);
+        mod->limit.timer = NULL;
+    }
+
     if(mod->clients)
     {
         http_client_t *prev_client = NULL;
@@ -817,6 +1587,18 @@ static void on_server_close(void *arg)
         mod->clients = NULL;
     }
 
+    if(mod->limit.ip_hash)
+    {
+        free(mod->limit.ip_hash);
+        mod->limit.ip_hash = NULL;
+    }
+
+    if(mod->tls)
+    {
+        http_tls_destroy(mod->tls);
+        mod->tls = NULL;
+    }
+
     if(mod->routes)
     {
         for(  asc_list_first(mod->routes)
@@ -831,6 +1613,23 @@ static void on_server_close(void *arg)
 
         asc_list_destroy(mod->routes);
         mod->routes = NULL;
+
+        free(mod->route_hash);
+        mod->route_hash = NULL;
+        free(mod->route_prefix);
+        mod->route_prefix = NULL;
+    }
+
+    if(mod->idx_request_meta)
+    {
+        luaL_unref(lua, LUA_REGISTRYINDEX, mod->idx_request_meta);
+        mod->idx_request_meta = 0;
+    }
+
+    for(int i = 0; i < RESPONSE_TEMPLATE_COUNT; ++i)
+    {
+        free(mod->templates[i].text);
+        mod->templates[i].text = NULL;
     }
 
     if(mod->idx_self)
@@ -840,6 +1639,49 @@ static void on_server_close(void *arg)
     }
 }
 
+static void timer_idle_callback(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const uint64_t timeout = (uint64_t)mod->keep_alive_timeout * 1000000;
+    const uint64_t now = asc_utime();
+
+    asc_list_first(mod->clients);
+    while(!asc_list_eol(mod->clients))
+    {
+        http_client_t *client = (http_client_t *)asc_list_data(mod->clients);
+        if(  client->request_count > 0
+           && client->status == 0 && client->buffer_skip == 0
+           && now > client->idle_time + timeout)
+        {
+            asc_log_debug(MSG("client %s:%d idle timeout")
+                          , asc_socket_addr(client->sock), asc_socket_port(client->sock));
+            on_client_close(client);
+            asc_list_first(mod->clients);
+            continue;
+        }
+        asc_list_next(mod->clients);
+    }
+}
+
+static void on_client_handshake(void *arg, const char *error)
+{
+    http_client_t *client = (http_client_t *)arg;
+    module_data_t *mod = client->mod;
+
+    if(error)
+    {
+        asc_log_debug(MSG("client %s:%d TLS handshake failed: %s")
+                      , asc_socket_addr(client->sock), asc_socket_port(client->sock)
+                      , error);
+        on_client_close(client);
+        return;
+    }
+
+    asc_socket_set_on_read(client->sock, on_client_read);
+    asc_socket_set_on_close(client->sock, on_client_close);
+}
+
 static void on_server_accept(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
@@ -855,6 +1697,10 @@ static void on_server_accept(void *arg)
         astra_abort(); // TODO: try to restart server
     }
 
+    /* response is written by the complete blocks */
+    asc_socket_set_non_delay(client->sock, 1);
+
+    client->idle_time = asc_utime();
     asc_list_insert_tail(mod->clients, client);
 
     asc_log_debug(MSG("client connected %s:%d (%lu clients)")
@@ -862,6 +1708,12 @@ static void on_server_accept(void *arg)
                       , asc_socket_port(client->sock)
                       , asc_list_size(mod->clients));
 
+    if(mod->tls)
+    {
+        http_tls_handshake(mod->tls, client->sock, NULL, on_client_handshake, client);
+        return;
+    }
+
     asc_socket_set_on_read(client->sock, on_client_read);
     asc_socket_set_on_close(client->sock, on_client_close);
 }
@@ -886,6 +1738,28 @@ static int method_data(module_data_t *mod)
         client->idx_data = luaL_ref(lua, LUA_REGISTRYINDEX);
     }
     lua_rawgeti(lua, LUA_REGISTRYINDEX, client->idx_data);
+
+    if(client->on_stats)
+        client->on_stats(client);
+
+    return 1;
+}
+
+static int method_stats(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, mod->limit.clients);
+    lua_setfield(lua, -2, "clients");
+    lua_pushnumber(lua, mod->limit.bitrate * 8 / 1000);
+    lua_setfield(lua, -2, "bitrate");
+    lua_pushnumber(lua, mod->limit.cpu);
+    lua_setfield(lua, -2, "cpu");
+    lua_pushnumber(lua, mod->limit.lag / 1000);
+    lua_setfield(lua, -2, "lag");
+    lua_pushnumber(lua, mod->limit.rejected);
+    lua_setfield(lua, -2, "rejected");
+
     return 1;
 }
 
@@ -985,19 +1859,74 @@ static void module_init(module_data_t *mod)
 
         route_t *route = (route_t *)malloc(sizeof(route_t));
         route->idx_callback = luaL_ref(lua, LUA_REGISTRYINDEX);
-        route->path = lua_tostring(lua, -1);
+        route->path = lua_tolstring(lua, -1, &route->path_size);
+        route->index = asc_list_size(mod->routes);
         lua_pop(lua, 1); // path
 
+        const char *wildcard = strchr(route->path, '*');
+        route->is_prefix = (wildcard != NULL);
+        if(wildcard)
+            route->path_size = wildcard - route->path;
+
         asc_list_insert_tail(mod->routes, route);
     }
     lua_pop(lua, 1); // route
 
+    route_compile(mod);
+
+    // metatable for the request tables
+    lua_newtable(lua);
+    lua_pushcfunction(lua, request_index);
+    lua_setfield(lua, -2, "__index");
+    mod->idx_request_meta = luaL_ref(lua, LUA_REGISTRYINDEX);
+
     // store self in registry
     lua_pushvalue(lua, 3);
     mod->idx_self = luaL_ref(lua, LUA_REGISTRYINDEX);
 
     mod->clients = asc_list_init();
 
+    mod->is_keep_alive = true;
+    module_option_boolean("keep_alive", &mod->is_keep_alive);
+    mod->keep_alive_timeout = 15;
+    module_option_number("keep_alive_timeout", &mod->keep_alive_timeout);
+    mod->keep_alive_max = 100;
+    module_option_number("keep_alive_max", &mod->keep_alive_max);
+    if(mod->is_keep_alive)
+        mod->timer_idle = asc_timer_init(IDLE_CHECK_INTERVAL, timer_idle_callback, mod);
+
+    module_option_number("max_clients", &mod->limit.max_clients);
+    module_option_number("max_clients_ip", &mod->limit.max_clients_ip);
+    int max_bitrate = 0;
+    module_option_number("max_bitrate", &max_bitrate);
+    mod->limit.max_bitrate = (uint64_t)max_bitrate * 1000000 / 8;
+    module_option_number("max_cpu", &mod->limit.max_cpu);
+    module_option_number("max_lag", &mod->limit.max_lag);
+    mod->limit.retry_after = 5;
+    module_option_number("retry_after", &mod->limit.retry_after);
+
+    if(mod->limit.max_clients_ip > 0)
+        mod->limit.ip_hash = (limit_ip_t **)calloc(LIMIT_IP_HASH_SIZE, sizeof(limit_ip_t *));
+
+    mod->limit.tick_time = asc_utime();
+    mod->limit.window_time = mod->limit.tick_time;
+    mod->limit.cpu_time = limit_cpu_time();
+    mod->limit.timer = asc_timer_init(LIMIT_INTERVAL, limit_timer_callback, mod);
+
+    const char *tls_cert = NULL;
+    module_option_string("tls_cert", &tls_cert, NULL);
+    if(tls_cert)
+    {
+        const char *tls_key = NULL;
+        module_option_string("tls_key", &tls_key, NULL);
+        mod->tls = http_tls_server_init(tls_cert, tls_key);
+        if(!mod->tls)
+        {
+            asc_log_error(MSG("failed to load certificate: %s"), http_tls_error());
+            astra_abort();
+        }
+    }
+
     bool sctp = false;
     module_option_boolean("sctp", &sctp);
     if(sctp == true)
@@ -1027,6 +1956,7 @@ MODULE_LUA_METHODS()
     { "send", method_send },
     { "close", method_close },
     { "data", method_data },
+    { "stats", method_stats },
     { "redirect", method_redirect },
     { "abort", method_abort }
 };
@@ -0,0 +1,559 @@
+/*
+ * Astra Module: HTTP TLS
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Handshake is made by OpenSSL. If the kernel supports TLS (kTLS) the record
+ * encryption is moved to the kernel, then the socket descriptor could be used
+ * directly for writev(), sendfile() and splice(). Otherwise the data is passed
+ * through the SSL object with the socket layer
+ */
+
+#include "http.h"
+
+#ifdef HAVE_OPENSSL
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#define TLS_HANDSHAKE_TIMEOUT 10000 /* ms */
+
+struct http_tls_t
+{
+    SSL_CTX *ctx;
+    bool is_server;
+    bool is_verify;
+
+    // client context is shared by the instances with the same ca and is_verify
+    char *ca;
+    int refcount;
+};
+
+typedef struct
+{
+    SSL *ssl;
+    asc_socket_t *sock;
+
+    bool is_ktls_send;
+    bool is_ktls_recv;
+
+    // incomplete write. SSL_write() is repeated with the copy of the record
+    uint8_t *pending;
+    size_t pending_size;
+    bool is_pending_sent;   /* record is written, pending_size is not reported yet */
+    bool is_send_wait;      /* SSL_write() wants to read */
+
+    // handshake
+    http_tls_callback_t callback;
+    void *arg;
+    asc_timer_t *timeout;
+} http_tls_session_t;
+
+static char tls_error_buffer[256];
+
+static asc_list_t *tls_client_list = NULL;
+
+const char * http_tls_error(void)
+{
+    const unsigned long e = ERR_get_error();
+    ERR_clear_error();
+
+    if(!e)
+        return "unknown error";
+
+    ERR_error_string_n(e, tls_error_buffer, sizeof(tls_error_buffer));
+    return tls_error_buffer;
+}
+
+static SSL_CTX * tls_ctx_init(const SSL_METHOD *method)
+{
+    SSL_CTX *ctx = SSL_CTX_new(method);
+    if(!ctx)
+        return NULL;
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    /* asc_socket_send() returns the partial size and could be called with other buffer */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    return ctx;
+}
+
+http_tls_t * http_tls_server_init(const char *cert, const char *key)
+{
+    ERR_clear_error();
+
+    SSL_CTX *ctx = tls_ctx_init(TLS_server_method());
+    if(!ctx)
+        return NULL;
+
+    if(!key)
+        key = cert;
+
+    if(   SSL_CTX_use_certificate_chain_file(ctx, cert) != 1
+       || SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1
+       || SSL_CTX_check_private_key(ctx) != 1)
+    {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    http_tls_t *tls = (http_tls_t *)calloc(1, sizeof(http_tls_t));
+    tls->ctx = ctx;
+    tls->is_server = true;
+    return tls;
+}
+
+http_tls_t * http_tls_client_init(const char *ca, bool is_verify)
+{
+    if(tls_client_list)
+    {
+        asc_list_for(tls_client_list)
+        {
+            http_tls_t *item = (http_tls_t *)asc_list_data(tls_client_list);
+            if(   item->is_verify == is_verify
+               && ((!item->ca && !ca) || (item->ca && ca && !strcmp(item->ca, ca))))
+            {
+                ++item->refcount;
+                return item;
+            }
+        }
+    }
+
+    ERR_clear_error();
+
+    SSL_CTX *ctx = tls_ctx_init(TLS_client_method());
+    if(!ctx)
+        return NULL;
+
+    if(is_verify)
+    {
+        const int r = (ca)
+                    ? SSL_CTX_load_verify_locations(ctx, ca, NULL)
+                    : SSL_CTX_set_default_verify_paths(ctx);
+        if(r != 1)
+        {
+            SSL_CTX_free(ctx);
+            return NULL;
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    }
+
+    http_tls_t *tls = (http_tls_t *)calloc(1, sizeof(http_tls_t));
+    tls->ctx = ctx;
+    tls->is_verify = is_verify;
+    tls->ca = (ca) ? strdup(ca) : NULL;
+    tls->refcount = 1;
+
+    if(!tls_client_list)
+        tls_client_list = asc_list_init();
+    asc_list_insert_tail(tls_client_list, tls);
+
+    return tls;
+}
+
+void http_tls_destroy(http_tls_t *tls)
+{
+    if(!tls)
+        return;
+
+    if(!tls->is_server)
+    {
+        --tls->refcount;
+        if(tls->refcount > 0)
+            return;
+
+        asc_list_remove_item(tls_client_list, tls);
+        if(asc_list_size(tls_client_list) == 0)
+        {
+            asc_list_destroy(tls_client_list);
+            tls_client_list = NULL;
+        }
+        free(tls->ca);
+    }
+
+    SSL_CTX_free(tls->ctx);
+    free(tls);
+}
+
+/*
+ * ooooooooo        o      ooooooooooo      o
+ *  888    88o     888     88  888  88     888
+ *  888    888    8  88        888        8  88
+ *  888    888   8oooo88       888       8oooo88
+ * o888ooo88   o88o  o888o    o888o    o88o  o888o
+ *
+ */
+
+static ssize_t tls_recv(void *arg, void *buffer, size_t size)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+
+    ERR_clear_error();
+    const int r = SSL_read(session->ssl, buffer, (int)size);
+    if(r > 0)
+        return r;
+
+    switch(SSL_get_error(session->ssl, r))
+    {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        default:
+            ERR_clear_error();
+            errno = ECONNRESET;
+            return -1;
+    }
+}
+
+/* returns false on error */
+static bool tls_write(http_tls_session_t *session, const void *buffer, size_t size, int *ret)
+{
+    ERR_clear_error();
+    const int r = SSL_write(session->ssl, buffer, (int)size);
+    if(r > 0)
+    {
+        session->is_send_wait = false;
+        *ret = r;
+        return true;
+    }
+
+    *ret = 0;
+    switch(SSL_get_error(session->ssl, r))
+    {
+        case SSL_ERROR_WANT_READ:
+            session->is_send_wait = true;
+            return true;
+        case SSL_ERROR_WANT_WRITE:
+            session->is_send_wait = false;
+            return true;
+        default:
+            ERR_clear_error();
+            errno = EPIPE;
+            return false;
+    }
+}
+
+/*
+ * SSL_write() writes one record. if the socket is not ready, the record is
+ * copied and repeated on the next calls, 0 is returned until it is written.
+ * then its bytes are reported, so the caller should not drop them meanwhile
+ */
+static ssize_t tls_send(void *arg, const void *buffer, size_t size)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+
+    if(size == 0)
+        return 0;
+
+    int r;
+
+    if(session->pending_size > 0)
+    {
+        if(!session->is_pending_sent)
+        {
+            if(!tls_write(session, session->pending, session->pending_size, &r))
+                return -1;
+            if(r == 0)
+            {
+                errno = EAGAIN;
+                return 0;
+            }
+
+            /* with the smaller fragment the rest of the copy is sent by the caller */
+            session->pending_size = (size_t)r;
+            session->is_pending_sent = true;
+        }
+
+        const size_t report = (size < session->pending_size) ? size : session->pending_size;
+        session->pending_size -= report;
+        if(session->pending_size == 0)
+            session->is_pending_sent = false;
+        return (ssize_t)report;
+    }
+
+    if(size > SSL3_RT_MAX_PLAIN_LENGTH)
+        size = SSL3_RT_MAX_PLAIN_LENGTH;
+
+    if(!tls_write(session, buffer, size, &r))
+        return -1;
+    if(r > 0)
+        return r;
+
+    if(!session->pending)
+        session->pending = (uint8_t *)malloc(SSL3_RT_MAX_PLAIN_LENGTH);
+    memcpy(session->pending, buffer, size);
+    session->pending_size = size;
+
+    errno = EAGAIN;
+    return 0;
+}
+
+static bool tls_is_ready(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+
+    /* handshake is made in the socket callbacks */
+    if(!SSL_is_init_finished(session->ssl))
+        return true;
+
+    if(SSL_pending(session->ssl) > 0)
+        return true;
+
+    /* reads the record. errors are returned by the next SSL_read() */
+    uint8_t c;
+    ERR_clear_error();
+    const int r = SSL_peek(session->ssl, &c, 1);
+    if(r > 0)
+        return true;
+
+    const int e = SSL_get_error(session->ssl, r);
+    return (e != SSL_ERROR_WANT_READ && e != SSL_ERROR_WANT_WRITE);
+}
+
+static size_t tls_pending(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+    return (size_t)SSL_pending(session->ssl);
+}
+
+static bool tls_is_direct(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+    return session->is_ktls_send;
+}
+
+static size_t tls_send_pending(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+    return session->pending_size;
+}
+
+static bool tls_is_send_wait(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+    return (session->pending_size > 0 && !session->is_pending_sent && session->is_send_wait);
+}
+
+static void tls_close(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+
+    if(SSL_is_init_finished(session->ssl))
+    {
+        /* close_notify. result is not checked on the non-blocking socket */
+        ERR_clear_error();
+        SSL_shutdown(session->ssl);
+        ERR_clear_error();
+    }
+
+    if(session->timeout)
+        asc_timer_destroy(session->timeout);
+
+    SSL_free(session->ssl);
+    free(session->pending);
+    free(session);
+}
+
+static const asc_socket_layer_t tls_layer =
+{
+    .recv = tls_recv,
+    .send = tls_send,
+    .is_ready = tls_is_ready,
+    .pending = tls_pending,
+    .is_direct = tls_is_direct,
+    .send_pending = tls_send_pending,
+    .is_send_wait = tls_is_send_wait,
+    .close = tls_close,
+};
+
+/*
+ *   oooooooo8   ooooooo   oooo   oooo oooo   oooo ooooooooooo   oooooooo8 ooooooooooo
+ * o888     88 o888   888o  8888o  88   8888o  88   888    88  o888     88 88  888  88
+ * 888         888     888  88 888o88   88 888o88   888ooo8    888             888
+ * 888o     oo 888o   o888  88   8888   88   8888   888    oo  888o     oo     888
+ *  888oooo88    88ooo88   o88o    88  o88o    88  o888ooo8888  888oooo88     o888o
+ *
+ */
+
+static void handshake_done(http_tls_session_t *session, const char *error)
+{
+    asc_socket_t *sock = session->sock;
+    const http_tls_callback_t callback = session->callback;
+    void *arg = session->arg;
+
+    if(session->timeout)
+    {
+        asc_timer_destroy(session->timeout);
+        session->timeout = NULL;
+    }
+
+    asc_socket_set_on_read(sock, NULL);
+    asc_socket_set_on_ready(sock, NULL);
+    asc_socket_set_on_close(sock, NULL);
+    asc_socket_set_arg(sock, arg);
+
+    if(!error)
+    {
+#ifdef BIO_get_ktls_send
+        session->is_ktls_send = (BIO_get_ktls_send(SSL_get_wbio(session->ssl)) != 0);
+        session->is_ktls_recv = (BIO_get_ktls_recv(SSL_get_rbio(session->ssl)) != 0);
+#endif
+        asc_log_debug(  "[http_tls %s] %s %s. kTLS send:%s recv:%s"
+                      , asc_socket_addr(sock)
+                      , SSL_get_version(session->ssl)
+                      , SSL_get_cipher_name(session->ssl)
+                      , (session->is_ktls_send) ? "on" : "off"
+                      , (session->is_ktls_recv) ? "on" : "off");
+    }
+
+    /* socket could be closed in the callback */
+    callback(arg, error);
+}
+
+static void on_handshake_close(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+    handshake_done(session, "connection closed");
+}
+
+static void on_handshake_timeout(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+    session->timeout = NULL;
+    handshake_done(session, "handshake timeout");
+}
+
+static void on_handshake(void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)arg;
+
+    ERR_clear_error();
+    const int r = SSL_do_handshake(session->ssl);
+    if(r == 1)
+    {
+        handshake_done(session, NULL);
+        return;
+    }
+
+    switch(SSL_get_error(session->ssl, r))
+    {
+        case SSL_ERROR_WANT_READ:
+            asc_socket_set_on_ready(session->sock, NULL);
+            asc_socket_set_on_read(session->sock, on_handshake);
+            break;
+        case SSL_ERROR_WANT_WRITE:
+            asc_socket_set_on_read(session->sock, NULL);
+            asc_socket_set_on_ready(session->sock, on_handshake);
+            break;
+        default:
+        {
+            const long verify = SSL_get_verify_result(session->ssl);
+            if(verify != X509_V_OK)
+                handshake_done(session, X509_verify_cert_error_string(verify));
+            else
+                handshake_done(session, http_tls_error());
+            break;
+        }
+    }
+}
+
+/*
+ * socket callbacks and argument are replaced until the handshake is done or
+ * timed out. callback is called with NULL error on success, on_read, on_ready
+ * and on_close should be set again. SSL object is released with the socket
+ */
+void http_tls_handshake(  http_tls_t *tls, asc_socket_t *sock, const char *host
+                        , http_tls_callback_t callback, void *arg)
+{
+    http_tls_session_t *session = (http_tls_session_t *)calloc(1, sizeof(http_tls_session_t));
+    session->sock = sock;
+    session->callback = callback;
+    session->arg = arg;
+
+    session->ssl = SSL_new(tls->ctx);
+    SSL_set_fd(session->ssl, asc_socket_fd(sock));
+
+    if(tls->is_server)
+        SSL_set_accept_state(session->ssl);
+    else
+    {
+        SSL_set_connect_state(session->ssl);
+        /* server name is not sent for the IP address */
+        if(host && !X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(session->ssl), host))
+        {
+            SSL_set_tlsext_host_name(session->ssl, host);
+            if(tls->is_verify)
+                SSL_set1_host(session->ssl, host);
+        }
+    }
+
+    asc_socket_set_layer(sock, &tls_layer, session);
+    asc_socket_set_arg(sock, session);
+    asc_socket_set_on_close(sock, on_handshake_close);
+    session->timeout = asc_timer_one_shot(  TLS_HANDSHAKE_TIMEOUT
+                                          , on_handshake_timeout, session);
+
+    on_handshake(session);
+}
+
+#else /* HAVE_OPENSSL */
+
+const char * http_tls_error(void)
+{
+    return "OpenSSL is not found";
+}
+
+http_tls_t * http_tls_server_init(const char *cert, const char *key)
+{
+    __uarg(cert);
+    __uarg(key);
+    return NULL;
+}
+
+http_tls_t * http_tls_client_init(const char *ca, bool is_verify)
+{
+    __uarg(ca);
+    __uarg(is_verify);
+    return NULL;
+}
+
+void http_tls_destroy(http_tls_t *tls)
+{
+    __uarg(tls);
+}
+
+void http_tls_handshake(  http_tls_t *tls, asc_socket_t *sock, const char *host
+                        , http_tls_callback_t callback, void *arg)
+{
+    __uarg(tls);
+    __uarg(sock);
+    __uarg(host);
+    callback(arg, http_tls_error());
+}
+
+#endif /* HAVE_OPENSSL */
@@ -676,6 +676,7 @@ static void on_check_stat(void *arg)
     bool on_air = true;
 
     uint32_t bitrate = 0;
+    uint32_t null_bitrate = 0;
     uint32_t cc_errors = 0;
     uint32_t pes_errors = 0;
     bool scrambled = false;
@@ -703,6 +704,8 @@ static void on_check_stat(void *arg)
 
         const uint32_t item_bitrate = (item->packets * TS_PACKET_SIZE * 8) / 1000;
         bitrate += item_bitrate;
+        if(item->type == MPEGTS_PACKET_NULL)
+            null_bitrate += item_bitrate;
 
         lua_pushnumber(lua, item_bitrate);
         lua_setfield(lua, -2, "bitrate");
@@ -753,7 +756,8 @@ static void on_check_stat(void *arg)
     if(!mod->cc_check)
         mod->cc_check = true;
 
-    if(bitrate < bitrate_limit)
+    // stuffing is not counted. http_request fills the outage with null packets
+    if(bitrate - null_bitrate < bitrate_limit)
         on_air = false;
     if(mod->cc_limit > 0 && cc_errors >= (uint32_t)mod->cc_limit)
         on_air = false;
@@ -1,3 +1,3 @@
-SOURCES="src/pcr.c src/psi.c src/pes.c src/types.c"
+SOURCES="src/pcr.c src/psi.c src/pes.c src/types.c src/keyframe.c"
 SOURCES="$SOURCES analyze.c channel.c transmit.c"
 MODULES="analyze channel transmit"
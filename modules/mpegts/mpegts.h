@@ -700,4 +700,59 @@ void mpegts_pes_demux(mpegts_pes_t *pes, ts_callback_t callback, void *arg);
 
 uint64_t mpegts_pcr_block_us(uint64_t *pcr_last, const uint64_t *pcr_current);
 
+/*
+ * oooo   oooo ooooooooooo oooo   oooo
+ *  888  o88    888    88    888  88
+ *  888888      888ooo8        888
+ *  888  88o    888    oo      888
+ * o888o o888o o888ooo8888    o888o
+ *
+ */
+
+/*
+ * Keyframe tracker. Follows PAT and PMT of the first program and finds the
+ * PES with the video keyframe. Program without video is tracked by the audio
+ * pid if is_audio is set, each audio PES is the keyframe.
+ */
+
+#define MPEGTS_KEYFRAME_PSI     0x01    /* PAT or PMT packet */
+#define MPEGTS_KEYFRAME_CHANGED 0x02    /* PAT or PMT is changed */
+#define MPEGTS_KEYFRAME_PES     0x04    /* PES is started with this packet */
+#define MPEGTS_KEYFRAME_KEY     0x08    /* keyframe is found in the recent PES */
+
+typedef struct
+{
+    const char *name;
+    bool is_audio;
+
+    mpegts_psi_t *pat;
+    mpegts_psi_t *pmt;
+    mpegts_psi_t *pat_out;
+    mpegts_psi_t *pmt_out;
+
+    uint16_t pid;       /* tracked pid, 0 if not found */
+    uint8_t type;       /* stream type */
+    bool is_changed;
+
+    bool is_scan;       /* PES payload is scanning for the start code */
+    uint32_t code;      /* last bytes of the PES payload */
+
+    bool is_pts;
+    uint64_t pts;       /* PTS of the recent PES */
+
+    // continuity counters of the live PAT and PMT at the recent PES start
+    uint8_t pat_cc;
+    uint8_t pmt_cc;
+    uint8_t pes_pat_cc;
+    uint8_t pes_pmt_cc;
+} mpegts_keyframe_t;
+
+mpegts_keyframe_t * mpegts_keyframe_init(const char *name, bool is_audio);
+void mpegts_keyframe_destroy(mpegts_keyframe_t *kf);
+
+int mpegts_keyframe_mux(mpegts_keyframe_t *kf, const uint8_t *ts);
+size_t mpegts_keyframe_psi_size(mpegts_keyframe_t *kf);
+void mpegts_keyframe_psi_demux(  mpegts_keyframe_t *kf, bool is_live_cc
+                               , ts_callback_t callback, void *arg);
+
 #endif /* _MPEGTS_H_ */
@@ -0,0 +1,318 @@
+/*
+ * Astra Module: MPEG-TS (Keyframe tracker)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../mpegts.h"
+
+#define MSG(_msg) "[%s] " _msg, kf->name
+
+mpegts_keyframe_t * mpegts_keyframe_init(const char *name, bool is_audio)
+{
+    mpegts_keyframe_t *kf = (mpegts_keyframe_t *)calloc(1, sizeof(mpegts_keyframe_t));
+    kf->name = name;
+    kf->is_audio = is_audio;
+
+    kf->pat = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    kf->pmt = mpegts_psi_init(MPEGTS_PACKET_PMT, 0);
+    kf->pat_out = mpegts_psi_init(MPEGTS_PACKET_PAT, 0);
+    kf->pmt_out = mpegts_psi_init(MPEGTS_PACKET_PMT, 0);
+
+    return kf;
+}
+
+void mpegts_keyframe_destroy(mpegts_keyframe_t *kf)
+{
+    if(!kf)
+        return;
+
+    mpegts_psi_destroy(kf->pat);
+    mpegts_psi_destroy(kf->pmt);
+    mpegts_psi_destroy(kf->pat_out);
+    mpegts_psi_destroy(kf->pmt_out);
+    free(kf);
+}
+
+/* returns false if the PSI is not changed */
+static bool psi_check(mpegts_keyframe_t *kf, mpegts_psi_t *psi, const char *name)
+{
+    const uint32_t crc32 = PSI_GET_CRC32(psi);
+    if(crc32 == psi->crc32)
+        return false;
+
+    if(crc32 != PSI_CALC_CRC32(psi))
+    {
+        asc_log_error(MSG("%s checksum error"), name);
+        return false;
+    }
+
+    psi->crc32 = crc32;
+    return true;
+}
+
+static void on_pat(void *arg, mpegts_psi_t *psi)
+{
+    mpegts_keyframe_t *kf = (mpegts_keyframe_t *)arg;
+
+    if(psi->buffer[0] != 0x00 || !psi_check(kf, psi, "PAT"))
+        return;
+
+    kf->pmt->pid = 0;
+    kf->pmt->crc32 = 0;
+    kf->pid = 0;
+    kf->is_scan = false;
+
+    const uint8_t *pointer;
+    PAT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint16_t pnr = PAT_ITEM_GET_PNR(psi, pointer);
+        const uint16_t pid = PAT_ITEM_GET_PID(psi, pointer);
+
+        // first program only
+        if(pnr != 0 && pid != 0 && pid < NULL_TS_PID)
+        {
+            kf->pmt->pid = pid;
+            kf->pmt_out->pid = pid;
+            break;
+        }
+    }
+
+    memcpy(kf->pat_out->buffer, psi->buffer, psi->buffer_size);
+    kf->pat_out->buffer_size = psi->buffer_size;
+    kf->is_changed = true;
+}
+
+static void on_pmt(void *arg, mpegts_psi_t *psi)
+{
+    mpegts_keyframe_t *kf = (mpegts_keyframe_t *)arg;
+
+    if(psi->buffer[0] != 0x02 || !psi_check(kf, psi, "PMT"))
+        return;
+
+    uint16_t audio_pid = 0;
+    uint8_t audio_type = 0;
+    kf->pid = 0;
+    kf->is_scan = false;
+
+    const uint8_t *pointer;
+    PMT_ITEMS_FOREACH(psi, pointer)
+    {
+        const uint16_t pid = PMT_ITEM_GET_PID(psi, pointer);
+        const uint8_t type = PMT_ITEM_GET_TYPE(psi, pointer);
+        const mpegts_packet_type_t pes_type = mpegts_pes_type(type);
+
+        if(pes_type == MPEGTS_PACKET_VIDEO && !kf->pid)
+        {
+            kf->pid = pid;
+            kf->type = type;
+        }
+        else if(pes_type == MPEGTS_PACKET_AUDIO && !audio_pid)
+        {
+            audio_pid = pid;
+            audio_type = type;
+        }
+    }
+
+    if(!kf->pid && kf->is_audio)
+    {
+        // each audio PES is the keyframe
+        kf->pid = audio_pid;
+        kf->type = audio_type;
+    }
+
+    memcpy(kf->pmt_out->buffer, psi->buffer, psi->buffer_size);
+    kf->pmt_out->buffer_size = psi->buffer_size;
+    kf->is_changed = true;
+}
+
+/* find the keyframe in the PES payload. returns false if scan is completed */
+static bool pes_scan(mpegts_keyframe_t *kf, const uint8_t *ptr, const uint8_t *end, bool *is_key)
+{
+    uint32_t code = kf->code;
+
+    for(; ptr < end; ++ptr)
+    {
+        code = (code << 8) | *ptr;
+        if((code & 0xFFFFFF00) != 0x00000100)
+            continue;
+
+        const uint8_t nal = code & 0xFF;
+        switch(kf->type)
+        {
+            case 0x1B: /* H.264 */
+            {
+                const uint8_t nal_type = nal & 0x1F;
+                if(nal_type == 5)
+                {
+                    *is_key = true;
+                    return false;
+                }
+                if(nal_type >= 1 && nal_type <= 4)
+                    return false;
+                break;
+            }
+            case 0x24: /* HEVC */
+            {
+                const uint8_t nal_type = (nal >> 1) & 0x3F;
+                if(nal_type >= 16 && nal_type <= 21)
+                {
+                    *is_key = true;
+                    return false;
+                }
+                if(nal_type <= 9)
+                    return false;
+                break;
+            }
+            case 0x01: /* MPEG-1 */
+            case 0x02: /* MPEG-2 */
+            {
+                if(nal == 0x00)
+                {
+                    // picture_coding_type is in the second byte after the start code
+                    if(ptr + 2 < end)
+                        *is_key = (((ptr[2] >> 3) & 0x07) == 1);
+                    return false;
+                }
+                if(nal == 0xB3 || nal == 0xB8)
+                {
+                    *is_key = true;
+                    return false;
+                }
+                break;
+            }
+            default:
+                /* unknown codec. each PES is the keyframe */
+                *is_key = true;
+                return false;
+        }
+    }
+
+    kf->code = code;
+    return true;
+}
+
+/*
+ * returns MPEGTS_KEYFRAME_* flags for the packet. keyframe is found in
+ * the PES started with the recent MPEGTS_KEYFRAME_PES packet
+ */
+int mpegts_keyframe_mux(mpegts_keyframe_t *kf, const uint8_t *ts)
+{
+    const uint16_t pid = TS_GET_PID(ts);
+
+    if(pid == 0 || (pid == kf->pmt->pid && kf->pmt->pid != 0))
+    {
+        const bool is_pat = (pid == 0);
+        mpegts_psi_t *psi = (is_pat) ? kf->pat : kf->pmt;
+
+        if(is_pat)
+            kf->pat_cc = TS_GET_CC(ts);
+        else
+            kf->pmt_cc = TS_GET_CC(ts);
+
+        kf->is_changed = false;
+        mpegts_psi_mux(psi, ts, (is_pat) ? on_pat : on_pmt, kf);
+
+        return (kf->is_changed)
+             ? (MPEGTS_KEYFRAME_PSI | MPEGTS_KEYFRAME_CHANGED)
+             : MPEGTS_KEYFRAME_PSI;
+    }
+
+    if(pid != kf->pid)
+        return 0;
+
+    int flags = 0;
+    bool is_key = false;
+    const uint8_t *payload = TS_GET_PAYLOAD(ts);
+
+    if(TS_IS_PAYLOAD_START(ts))
+    {
+        flags |= MPEGTS_KEYFRAME_PES;
+        kf->is_scan = false;
+        kf->code = 0xFFFFFFFF;
+        kf->pes_pat_cc = kf->pat_cc;
+        kf->pes_pmt_cc = kf->pmt_cc;
+
+        kf->is_pts = false;
+        if(payload && payload[0] == 0x00 && payload[1] == 0x00 && payload[2] == 0x01
+           && (payload[7] & 0x80))
+        {
+            kf->is_pts = true;
+            kf->pts = ((uint64_t)(payload[9] & 0x0E) << 29)
+                    | (payload[10] << 22) | ((payload[11] & 0xFE) << 14)
+                    | (payload[12] << 7) | (payload[13] >> 1);
+        }
+
+        if(mpegts_pes_type(kf->type) != MPEGTS_PACKET_VIDEO)
+            is_key = true;
+        else if(TS_IS_AF(ts) && ts[4] > 0 && (ts[5] & 0x40))
+            is_key = true; /* random access indicator */
+        else if(payload && payload[0] == 0x00 && payload[1] == 0x00 && payload[2] == 0x01)
+        {
+            kf->is_scan = true;
+            payload += 9 + payload[8];
+        }
+    }
+
+    if(kf->is_scan && payload && payload < ts + TS_PACKET_SIZE)
+        kf->is_scan = pes_scan(kf, payload, ts + TS_PACKET_SIZE, &is_key);
+
+    if(is_key)
+    {
+        kf->is_scan = false;
+        flags |= MPEGTS_KEYFRAME_KEY;
+    }
+
+    return flags;
+}
+
+static size_t psi_packets(const mpegts_psi_t *psi)
+{
+    // pointer field is in the first packet
+    return (psi->buffer_size + TS_BODY_SIZE) / TS_BODY_SIZE;
+}
+
+/* size of the PAT and PMT packets made by mpegts_keyframe_psi_demux() */
+size_t mpegts_keyframe_psi_size(mpegts_keyframe_t *kf)
+{
+    size_t count = 0;
+    if(kf->pat_out->buffer_size)
+        count += psi_packets(kf->pat_out);
+    if(kf->pmt_out->buffer_size)
+        count += psi_packets(kf->pmt_out);
+    return count * TS_PACKET_SIZE;
+}
+
+/*
+ * makes PAT and PMT packets for the start of the keyframe. with is_live_cc
+ * the last packet has the continuity counter of the live PSI at the PES start,
+ * so the live PSI packets after the keyframe are continued without error
+ */
+void mpegts_keyframe_psi_demux(  mpegts_keyframe_t *kf, bool is_live_cc
+                               , ts_callback_t callback, void *arg)
+{
+    if(is_live_cc)
+    {
+        if(kf->pat_out->buffer_size)
+            kf->pat_out->cc = (kf->pes_pat_cc - psi_packets(kf->pat_out) + 1) & 0x0F;
+        if(kf->pmt_out->buffer_size)
+            kf->pmt_out->cc = (kf->pes_pmt_cc - psi_packets(kf->pmt_out) + 1) & 0x0F;
+    }
+
+    mpegts_psi_demux(kf->pat_out, callback, arg);
+    mpegts_psi_demux(kf->pmt_out, callback, arg);
+}
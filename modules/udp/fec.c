@@ -0,0 +1,393 @@
+/*
+ * Astra Module: UDP
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * SMPTE 2022-1 FEC. Media packets are arranged in the matrix of L columns
+ * and D rows. Column FEC packet protects D packets with offset L,
+ * row FEC packet protects L consecutive packets.
+ *
+ * FEC header:
+ *  0   SNBase low bits     (16)
+ *  2   Length recovery     (16)
+ *  4   E (1), PT recovery  (7)
+ *  5   Mask                (24)
+ *  8   TS recovery         (32)
+ *  12  X (1), D (1), type (3), index (3)
+ *  13  Offset              (8)
+ *  14  NA                  (8)
+ *  15  SNBase ext bits     (8)
+ */
+
+#include "udp.h"
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+#define FEC_PT 96
+
+#define FEC_HISTORY_MASK (FEC_HISTORY_SIZE - 1)
+
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) fec_word_t;
+
+void udp_fec_xor(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for(; i + 32 <= size; i += 32)
+    {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)&dst[i]);
+        const __m256i b = _mm256_loadu_si256((const __m256i *)&src[i]);
+        _mm256_storeu_si256((__m256i *)&dst[i], _mm256_xor_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for(; i + 16 <= size; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)&dst[i]);
+        const __m128i b = _mm_loadu_si128((const __m128i *)&src[i]);
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_xor_si128(a, b));
+    }
+#endif
+
+    for(; i + 8 <= size; i += 8)
+        *(fec_word_t *)&dst[i] ^= *(const fec_word_t *)&src[i];
+
+    for(; i < size; ++i)
+        dst[i] ^= src[i];
+}
+
+static void block_reset(udp_fec_block_t *block)
+{
+    block->size = 0;
+    block->length = 0;
+    block->pt = 0;
+    block->ts = 0;
+}
+
+static void block_append(udp_fec_block_t *block, const uint8_t *buffer, size_t size)
+{
+    const uint8_t *payload = &buffer[RTP_HEADER_SIZE];
+    const size_t payload_size = size - RTP_HEADER_SIZE;
+
+    if(block->size == 0)
+    {
+        memcpy(block->payload, payload, payload_size);
+        block->size = payload_size;
+    }
+    else
+    {
+        /* shorter packets are padded with zeros */
+        if(payload_size > block->size)
+        {
+            memset(&block->payload[block->size], 0, payload_size - block->size);
+            block->size = payload_size;
+        }
+        udp_fec_xor(block->payload, payload, payload_size);
+    }
+
+    block->length ^= payload_size;
+    block->pt ^= buffer[1] & 0x7F;
+    block->ts ^= RTP_GET_TS(buffer);
+}
+
+/*
+ * ooooooooooo oooo   oooo  oooooooo8   ooooooo  ooooooooo  ooooooooooo
+ *  888    88   8888o  88 o888     88 o888   888o 888    88o 888    88
+ *  888ooo8     88 888o88 888         888     888 888    888 888ooo8
+ *  888    oo   88   8888 888o     oo 888o   o888 888    888 888    oo
+ * o888ooo8888 o88o    88  888oooo88    88ooo88  o888ooo88  o888ooo8888
+ *
+ */
+
+udp_fec_encoder_t * udp_fec_encoder_init(int l, int d, udp_fec_callback_t callback, void *arg)
+{
+    udp_fec_encoder_t *enc = (udp_fec_encoder_t *)calloc(1, sizeof(udp_fec_encoder_t));
+    enc->l = l;
+    enc->d = d;
+    enc->callback = callback;
+    enc->arg = arg;
+    enc->columns = (udp_fec_block_t *)calloc(l, sizeof(udp_fec_block_t));
+
+    enc->packet[0] = 0x80;
+    enc->packet[1] = FEC_PT;
+
+    return enc;
+}
+
+void udp_fec_encoder_destroy(udp_fec_encoder_t *enc)
+{
+    free(enc->columns);
+    free(enc);
+}
+
+static void encoder_send(  udp_fec_encoder_t *enc, udp_fec_block_t *block
+                         , bool is_row, uint16_t sn_base)
+{
+    uint8_t *packet = enc->packet;
+    const uint16_t seq = (is_row) ? enc->row_seq++ : enc->column_seq++;
+
+    packet[2] = (seq >> 8) & 0xFF;
+    packet[3] = (seq     ) & 0xFF;
+    packet[4] = (block->ts >> 24) & 0xFF;
+    packet[5] = (block->ts >> 16) & 0xFF;
+    packet[6] = (block->ts >>  8) & 0xFF;
+    packet[7] = (block->ts      ) & 0xFF;
+
+    uint8_t *fec = &packet[RTP_HEADER_SIZE];
+    fec[0] = (sn_base >> 8) & 0xFF;
+    fec[1] = (sn_base     ) & 0xFF;
+    fec[2] = (block->length >> 8) & 0xFF;
+    fec[3] = (block->length     ) & 0xFF;
+    fec[4] = 0x80 | block->pt;
+    fec[5] = 0x00;
+    fec[6] = 0x00;
+    fec[7] = 0x00;
+    fec[8] = (block->ts >> 24) & 0xFF;
+    fec[9] = (block->ts >> 16) & 0xFF;
+    fec[10] = (block->ts >>  8) & 0xFF;
+    fec[11] = (block->ts      ) & 0xFF;
+    fec[12] = (is_row) ? 0x40 : 0x00;
+    fec[13] = (is_row) ? 1 : enc->l;
+    fec[14] = (is_row) ? enc->l : enc->d;
+    fec[15] = 0x00;
+
+    memcpy(&fec[FEC_HEADER_SIZE], block->payload, block->size);
+
+    enc->callback(enc->arg, is_row, packet, RTP_HEADER_SIZE + FEC_HEADER_SIZE + block->size);
+}
+
+void udp_fec_encoder_push(udp_fec_encoder_t *enc, const uint8_t *buffer, size_t size)
+{
+    if(size <= RTP_HEADER_SIZE)
+        return;
+
+    if(enc->index == 0)
+        enc->sn_base = RTP_GET_SEQ(buffer);
+
+    const int column = enc->index % enc->l;
+    const int row = enc->index / enc->l;
+
+    udp_fec_block_t *block = &enc->columns[column];
+    if(row == 0)
+        block_reset(block);
+    block_append(block, buffer, size);
+
+    if(column == 0)
+        block_reset(&enc->row);
+    block_append(&enc->row, buffer, size);
+
+    if(column == enc->l - 1)
+        encoder_send(enc, &enc->row, true, enc->sn_base + row * enc->l);
+
+    /* column packets are spread over the last row */
+    if(row == enc->d - 1)
+        encoder_send(enc, block, false, enc->sn_base + column);
+
+    ++enc->index;
+    if(enc->index == enc->l * enc->d)
+        enc->index = 0;
+}
+
+/*
+ * ooooooooo  ooooooooooo  oooooooo8   ooooooo  ooooooooo  ooooooooooo
+ *  888    88o 888    88 o888     88 o888   888o 888    88o 888    88
+ *  888    888 888ooo8   888         888     888 888    888 888ooo8
+ *  888    888 888    oo 888o     oo 888o   o888 888    888 888    oo
+ * o888ooo88  o888ooo8888 888oooo88    88ooo88  o888ooo88  o888ooo8888
+ *
+ */
+
+udp_fec_decoder_t * udp_fec_decoder_init(udp_fec_callback_t callback, void *arg)
+{
+    udp_fec_decoder_t *dec = (udp_fec_decoder_t *)calloc(1, sizeof(udp_fec_decoder_t));
+    dec->callback = callback;
+    dec->arg = arg;
+    dec->pending = (udp_fec_pending_t *)calloc(FEC_PENDING_SIZE, sizeof(udp_fec_pending_t));
+    dec->history = (udp_fec_media_t *)calloc(FEC_HISTORY_SIZE, sizeof(udp_fec_media_t));
+    return dec;
+}
+
+void udp_fec_decoder_destroy(udp_fec_decoder_t *dec)
+{
+    free(dec->pending);
+    free(dec->history);
+    free(dec);
+}
+
+static udp_fec_media_t * history_get(udp_fec_decoder_t *dec, uint16_t seq)
+{
+    udp_fec_media_t *media = &dec->history[seq & FEC_HISTORY_MASK];
+    return (media->is_used && media->seq == seq) ? media : NULL;
+}
+
+static void history_put(udp_fec_decoder_t *dec, const uint8_t *buffer, size_t size)
+{
+    const uint16_t seq = RTP_GET_SEQ(buffer);
+    udp_fec_media_t *media = &dec->history[seq & FEC_HISTORY_MASK];
+    media->is_used = true;
+    media->seq = seq;
+    media->size = size;
+    memcpy(media->buffer, buffer, size);
+}
+
+/* returns true if the FEC packet is not required anymore */
+static bool decoder_recover(udp_fec_decoder_t *dec, udp_fec_pending_t *fec)
+{
+    int missing_count = 0;
+    uint16_t missing_seq = 0;
+    const udp_fec_media_t *ref = NULL;
+
+    for(int i = 0; i < fec->na; ++i)
+    {
+        const uint16_t seq = fec->sn_base + i * fec->offset;
+        const udp_fec_media_t *media = history_get(dec, seq);
+        if(media)
+            ref = media;
+        else
+        {
+            ++missing_count;
+            missing_seq = seq;
+        }
+    }
+
+    if(missing_count == 0)
+        return true;
+    if(missing_count > 1 || !ref)
+        return false;
+
+    const uint8_t *header = &fec->buffer[RTP_HEADER_SIZE];
+    uint8_t *payload = &dec->packet[RTP_HEADER_SIZE];
+    size_t payload_size = fec->size - RTP_HEADER_SIZE - FEC_HEADER_SIZE;
+    memcpy(payload, &header[FEC_HEADER_SIZE], payload_size);
+
+    uint16_t length = (header[2] << 8) | header[3];
+    uint8_t pt = header[4] & 0x7F;
+    uint32_t ts = RTP_GET_TS((header + 4));
+
+    for(int i = 0; i < fec->na; ++i)
+    {
+        const uint16_t seq = fec->sn_base + i * fec->offset;
+        if(seq == missing_seq)
+            continue;
+
+        const udp_fec_media_t *media = history_get(dec, seq);
+        size_t media_size = media->size - RTP_HEADER_SIZE;
+        if(media_size > payload_size)
+            media_size = payload_size;
+
+        udp_fec_xor(payload, &media->buffer[RTP_HEADER_SIZE], media_size);
+        length ^= media->size - RTP_HEADER_SIZE;
+        pt ^= media->buffer[1] & 0x7F;
+        ts ^= RTP_GET_TS(media->buffer);
+    }
+
+    if(length > payload_size)
+    {
+        ++dec->errors;
+        return true;
+    }
+
+    uint8_t *packet = dec->packet;
+    packet[0] = 0x80;
+    packet[1] = pt;
+    packet[2] = (missing_seq >> 8) & 0xFF;
+    packet[3] = (missing_seq     ) & 0xFF;
+    packet[4] = (ts >> 24) & 0xFF;
+    packet[5] = (ts >> 16) & 0xFF;
+    packet[6] = (ts >>  8) & 0xFF;
+    packet[7] = (ts      ) & 0xFF;
+    memcpy(&packet[8], &ref->buffer[8], 4); /* SSRC */
+
+    const size_t size = RTP_HEADER_SIZE + length;
+    history_put(dec, packet, size);
+    ++dec->recovered;
+
+    dec->callback(dec->arg, false, packet, size);
+    return true;
+}
+
+/* recovered packet may complete other FEC groups */
+static void decoder_retry(udp_fec_decoder_t *dec)
+{
+    bool is_recovered = true;
+    while(is_recovered)
+    {
+        is_recovered = false;
+        for(int i = 0; i < FEC_PENDING_SIZE; ++i)
+        {
+            udp_fec_pending_t *fec = &dec->pending[i];
+            if(!fec->is_used)
+                continue;
+
+            const uint64_t recovered = dec->recovered;
+            if(decoder_recover(dec, fec))
+                fec->is_used = false;
+            if(recovered != dec->recovered)
+                is_recovered = true;
+        }
+    }
+}
+
+void udp_fec_decoder_push_media(udp_fec_decoder_t *dec, const uint8_t *buffer, size_t size)
+{
+    if(size <= RTP_HEADER_SIZE || size > UDP_BUFFER_SIZE)
+        return;
+
+    history_put(dec, buffer, size);
+}
+
+void udp_fec_decoder_push_fec(udp_fec_decoder_t *dec, const uint8_t *buffer, size_t size)
+{
+    if(size <= RTP_HEADER_SIZE + FEC_HEADER_SIZE || size > FEC_PACKET_SIZE)
+    {
+        ++dec->errors;
+        return;
+    }
+
+    const uint8_t *header = &buffer[RTP_HEADER_SIZE];
+    const uint8_t offset = header[13];
+    const uint8_t na = header[14];
+    if(offset == 0 || na == 0 || offset * na > FEC_HISTORY_SIZE / 2)
+    {
+        ++dec->errors;
+        return;
+    }
+
+    ++dec->fec_packets;
+
+    udp_fec_pending_t *fec = &dec->pending[dec->pending_next];
+    dec->pending_next = (dec->pending_next + 1) % FEC_PENDING_SIZE;
+
+    fec->is_used = true;
+    fec->sn_base = (header[0] << 8) | header[1];
+    fec->offset = offset;
+    fec->na = na;
+    fec->size = size;
+    memcpy(fec->buffer, buffer, size);
+
+    const uint64_t recovered = dec->recovered;
+    if(decoder_recover(dec, fec))
+        fec->is_used = false;
+    if(recovered != dec->recovered)
+        decoder_retry(dec);
+}
@@ -29,22 +29,112 @@
  *      socket_size - number, socket buffer size
  *      renew       - number, renewing multicast subscription interval in seconds
  *      rtp         - boolean, use RTP instead RAW UDP
+ *      source      - string, accept datagrams only from this sender.
+ *                    for multicast joins the group with IGMPv3 source filter
+ *      allowed_sources
+ *                  - list, accept datagrams only from these senders.
+ *                    with source or allowed_sources the kernel also drops datagrams
+ *                    with size not aligned to the TS packet
+ *      reorder     - number, RTP reorder buffer latency in milliseconds.
+ *                    datagrams are emitted by the sequence number, duplicates are dropped
+ *      fec         - boolean, SMPTE 2022-1 FEC recovery. column FEC is received on port+2,
+ *                    row FEC on port+4. requires rtp, reorder is 200ms by default
+ *      shared      - boolean, receive with the socket shared by all inputs with the same
+ *                    port and localaddr. the group is detected with IP_PKTINFO.
+ *                    threads and allowed_sources are not available in this mode
+ *      threads     - number, receive datagrams in the separate threads.
+ *                    for unicast RTP N sockets are sharded with SO_REUSEPORT
+ *                    and merged by the reorder buffer (reorder latency,
+ *                    default: 20ms). raw UDP and multicast use single thread:
+ *                    the kernel delivers a copy of each multicast datagram to
+ *                    all sockets of the group instead of selecting one of them,
+ *                    raw UDP has no sequence number to merge shards in order
+ *      xdp         - string, name of the ingress interface. receive with AF_XDP,
+ *                    the XDP program redirects datagrams of the group to the UMEM ring,
+ *                    other traffic goes to the network stack. Linux only, requires root.
+ *                    socket is bound on each receiving queue of the interface.
+ *                    threads and allowed_sources are not available in this mode.
+ *                    without AF_XDP support the regular socket is used
+ *      xdp_native  - boolean, attach the program in the driver mode.
+ *                    default: generic (SKB) mode, works on any interface
  *
  * Module Methods:
  *      port()      - return number, random port number
+ *      set_receiver(arg, fn)
+ *                  - add raw datagram receiver. fn is called instead of the stream
+ *                    processing, fec and reorder are skipped. used by rtp_merge
+ *                    and udp_output passthrough. fn(arg, NULL, 0, 0) is called
+ *                    at the end of each batch of received datagrams.
+ *                    set_receiver(arg, nil) - remove receiver
+ *      stats()     - return table, receiving statistics:
+ *                    packets, bytes, iat_min, iat_max, iat_avg - inter-arrival time
+ *                    in microseconds, iat_histogram - list of { limit, count },
+ *                    for RTP: jitter - RFC 3550 interarrival jitter in milliseconds,
+ *                    lost, reordered, duplicate, resync - sequence number tracking,
+ *                    reorder_late, reorder_duplicate, reorder_lost - reorder buffer,
+ *                    fec_packets, fec_recovered, fec_errors - FEC recovery,
+ *                    restored datagram is emitted and counted if the original
+ *                    is not received in the reorder latency window,
+ *                    kernel_drops - datagrams dropped by the kernel (SO_RXQ_OVFL),
+ *                    includes datagrams rejected by the source filter,
+ *                    rx_queue, rx_queue_max - bytes in the socket receive queue,
+ *                    rcvbuf, rmem - socket buffer size and allocated memory
  */
 
-#include <astra.h>
+#include "udp.h"
 
-#define UDP_BUFFER_SIZE 1460
-#define RTP_HEADER_SIZE 12
+#ifdef _WIN32
+#   define poll WSAPoll
+#else
+#   include <poll.h>
+#   include <arpa/inet.h>
+#endif
 
-#define RTP_IS_EXT(_data) ((_data[0] & 0x10))
-#define RTP_EXT_SIZE(_data) \
-    (((_data[RTP_HEADER_SIZE + 2] << 8) | _data[RTP_HEADER_SIZE + 3]) * 4 + 4)
+#ifdef __linux__
+#   include <linux/filter.h>
+#endif
 
 #define MSG(_msg) "[udp_input %s:%d] " _msg, mod->config.addr, mod->config.port
 
+#define FEC_REORDER_DEFAULT 200
+
+#define SOURCE_MAX 32
+
+#define STATS_INTERVAL 1000
+#define DROPS_WARNING_INTERVAL (10 * 1000000)
+
+#define RECEIVER_MAX 4
+
+#define SHARED_RETRY_INTERVAL 1000
+
+#define SHARD_MAX 16
+#define SHARD_REORDER_DEFAULT 20
+#define SHARD_BUFFER_SIZE (4 * 1024 * 1024)
+/* slot header: 2 bytes datagram length and 8 bytes receive time */
+#define SHARD_SLOT_HEADER 10
+#define SHARD_SLOT_SIZE (SHARD_SLOT_HEADER + UDP_BUFFER_SIZE)
+
+/* counters updated in the shard thread and read in the main loop */
+#define SHARD_STATS_ADD(_counter) __atomic_fetch_add(&(_counter), 1, __ATOMIC_RELAXED)
+#define SHARD_STATS_GET(_counter) __atomic_load_n(&(_counter), __ATOMIC_RELAXED)
+
+typedef struct
+{
+    module_data_t *mod;
+
+    asc_socket_t *sock;
+
+    bool is_thread_started;
+    asc_thread_t *thread;
+    asc_thread_buffer_t *thread_output;
+
+    uint32_t overflow;
+    uint32_t drops;
+
+    /* main loop side */
+    uint8_t buffer[UDP_BUFFER_SIZE];
+} udp_shard_t;
+
 struct module_data_t
 {
     MODULE_STREAM_DATA();
@@ -55,6 +145,13 @@ struct module_data_t
         int port;
         const char *localaddr;
         bool rtp;
+        int threads;
+        int socket_size;
+        int renew;
+
+        const char *source;
+        uint32_t source_list[SOURCE_MAX];
+        int source_count;
     } config;
 
     bool is_error_message;
@@ -62,18 +159,119 @@ struct module_data_t
     asc_socket_t *sock;
     asc_timer_t *timer_renew;
 
-    uint8_t buffer[UDP_BUFFER_SIZE];
+    udp_receiver_t *shared;
+    asc_timer_t *timer_shared;
+    udp_xdp_t *xdp;
+    asc_timer_t *timer_stats;
+
+    udp_reorder_t *reorder;
+    asc_timer_t *timer_reorder;
+
+    udp_fec_decoder_t *fec;
+    asc_socket_t *sock_fec_column;
+    asc_socket_t *sock_fec_row;
+    uint8_t fec_buffer[FEC_PACKET_SIZE];
+
+    udp_shard_t *shard_list;
+    int shard_count;
+    bool is_shard_merge;    /* shards are merged by the reorder buffer */
+
+    udp_stats_t stats;
+
+    uint32_t drops;
+    uint32_t drops_reported;
+    uint64_t drops_warning_time;
+    asc_socket_stats_t sock_stats;
+    int rx_queue_max;
+
+    // receivers
+    struct
+    {
+        void *arg;
+        union
+        {
+            udp_receiver_callback_t fn;
+            void *ptr;
+        } callback;
+    } receiver_list[RECEIVER_MAX];
+    int receiver_count;
+
+    uint8_t *batch;
+    asc_socket_msg_t msg[ASC_SOCKET_BATCH_SIZE];
 };
 
+static void socket_close(asc_socket_t **sock)
+{
+    if(*sock)
+    {
+        asc_socket_multicast_leave(*sock);
+        asc_socket_close(*sock);
+        *sock = NULL;
+    }
+}
+
+static void shard_close(udp_shard_t *shard)
+{
+    shard->is_thread_started = false;
+
+    if(shard->thread)
+    {
+        asc_thread_destroy(shard->thread);
+        shard->thread = NULL;
+    }
+
+    if(shard->thread_output)
+    {
+        asc_thread_buffer_destroy(shard->thread_output);
+        shard->thread_output = NULL;
+    }
+
+    socket_close(&shard->sock);
+}
+
 static void on_close(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    if(mod->sock)
+    socket_close(&mod->sock);
+    socket_close(&mod->sock_fec_column);
+
+    if(mod->shared)
     {
-        asc_socket_multicast_leave(mod->sock);
-        asc_socket_close(mod->sock);
-        mod->sock = NULL;
+        udp_receiver_detach(mod->shared, mod);
+        mod->shared = NULL;
+    }
+
+    if(mod->timer_shared)
+    {
+        asc_timer_destroy(mod->timer_shared);
+        mod->timer_shared = NULL;
+    }
+
+#ifdef HAVE_XDP
+    if(mod->xdp)
+    {
+        udp_xdp_detach(mod->xdp, mod);
+        mod->xdp = NULL;
+    }
+#endif
+    socket_close(&mod->sock_fec_row);
+
+    if(mod->batch)
+    {
+        free(mod->batch);
+        mod->batch = NULL;
+    }
+
+    if(mod->shard_list)
+    {
+        for(int i = 0; i < mod->shard_count; ++i)
+            shard_close(&mod->shard_list[i]);
+
+        free(mod->shard_list);
+        mod->shard_list = NULL;
+        mod->shard_count = 0;
+        mod->is_shard_merge = false;
     }
 
     if(mod->timer_renew)
@@ -81,13 +279,197 @@ static void on_close(void *arg)
         asc_timer_destroy(mod->timer_renew);
         mod->timer_renew = NULL;
     }
+
+    if(mod->timer_stats)
+    {
+        asc_timer_destroy(mod->timer_stats);
+        mod->timer_stats = NULL;
+    }
+
+    if(mod->timer_reorder)
+    {
+        asc_timer_destroy(mod->timer_reorder);
+        mod->timer_reorder = NULL;
+    }
+
+    if(mod->reorder)
+    {
+        udp_reorder_destroy(mod->reorder);
+        mod->reorder = NULL;
+    }
+
+    if(mod->fec)
+    {
+        udp_fec_decoder_destroy(mod->fec);
+        mod->fec = NULL;
+    }
+}
+
+static void on_payload(void *arg, const uint8_t *buffer, size_t size)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    const int len = size;
+    int i = 0;
+
+    if(mod->config.rtp)
+    {
+        i = rtp_header_size(buffer, size);
+        if(i < 0)
+            return;
+    }
+
+    for(; i <= len - TS_PACKET_SIZE; i += TS_PACKET_SIZE)
+        module_stream_send(mod, &buffer[i]);
+
+    if(i != len && !mod->is_error_message)
+    {
+        asc_log_error(MSG("wrong stream format. drop %d bytes"), len - i);
+        mod->is_error_message = true;
+    }
+}
+
+static void receiver_send(module_data_t *mod, const uint8_t *buffer, size_t size, uint64_t time)
+{
+    for(int i = 0; i < mod->receiver_count; ++i)
+        mod->receiver_list[i].callback.fn(mod->receiver_list[i].arg, buffer, size, time);
+}
+
+/* reorder buffer output */
+static void on_ordered(void *arg, const uint8_t *buffer, size_t size)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    /* merged shards. receiver gets datagrams in order. receive time is lost */
+    if(mod->receiver_count > 0)
+    {
+        receiver_send(mod, buffer, size, asc_utime() * 1000);
+        return;
+    }
+
+    on_payload(mod, buffer, size);
+}
+
+static void on_datagram(module_data_t *mod, const uint8_t *buffer, int len, uint64_t time)
+{
+    udp_stats_update(&mod->stats, buffer, len, time, mod->config.rtp);
+
+    if(mod->is_shard_merge)
+    {
+        if(mod->fec && mod->receiver_count == 0)
+            udp_fec_decoder_push_media(mod->fec, buffer, len);
+
+        udp_reorder_push(mod->reorder, buffer, len);
+        return;
+    }
+
+    if(mod->receiver_count > 0)
+    {
+        receiver_send(mod, buffer, len, time);
+        return;
+    }
+
+    if(mod->fec)
+        udp_fec_decoder_push_media(mod->fec, buffer, len);
+
+    if(mod->reorder)
+        udp_reorder_push(mod->reorder, buffer, len);
+    else
+        on_payload(mod, buffer, len);
+}
+
+static void on_batch_end(module_data_t *mod)
+{
+    if(mod->receiver_count > 0)
+        receiver_send(mod, NULL, 0, 0);
+}
+
+static void on_shared_datagram(void *arg, const uint8_t *buffer, size_t size, uint64_t time);
+
+static bool shared_attach(module_data_t *mod)
+{
+    mod->shared = udp_receiver_attach(  mod->config.port, mod->config.localaddr
+                                      , mod->config.addr, mod->config.source
+                                      , mod->config.socket_size, mod->config.renew
+                                      , on_shared_datagram, mod);
+    return (mod->shared != NULL);
+}
+
+static void timer_shared_callback(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(!shared_attach(mod))
+        return;
+
+    asc_log_info(MSG("shared receiver is restored"));
+    asc_timer_destroy(mod->timer_shared);
+    mod->timer_shared = NULL;
+}
+
+static void on_shared_datagram(void *arg, const uint8_t *buffer, size_t size, uint64_t time)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    if(buffer)
+        on_datagram(mod, buffer, size, time);
+    else if(size != UDP_RECEIVER_ERROR)
+        on_batch_end(mod);
+    else
+    {
+        /* member is already detached by the receiver */
+        mod->shared = NULL;
+        if(!mod->timer_shared)
+        {
+            mod->timer_shared = asc_timer_init(  SHARED_RETRY_INTERVAL
+                                               , timer_shared_callback, mod);
+        }
+    }
 }
 
 static void on_read(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
 
-    int len = asc_socket_recv(mod->sock, mod->buffer, UDP_BUFFER_SIZE);
+    const int count = asc_socket_recv_batch(mod->sock, mod->msg, ASC_SOCKET_BATCH_SIZE);
+    if(count <= 0)
+    {
+        if(count == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+
+        on_close(mod);
+        return;
+    }
+
+    for(int i = 0; i < count; ++i)
+        on_datagram(mod, mod->msg[i].buffer, mod->msg[i].length, mod->msg[i].timestamp);
+    on_batch_end(mod);
+
+    if(mod->msg[count - 1].drops > mod->drops)
+        mod->drops = mod->msg[count - 1].drops;
+}
+
+/*
+ * ooooooooooo ooooooooooo  oooooooo8
+ *  888    88   888    88 o888     88
+ *  888ooo8     888ooo8   888
+ *  888         888    oo 888o     oo
+ * o888o       o888ooo8888 888oooo88
+ *
+ */
+
+static void on_fec_recovered(void *arg, bool is_row, const uint8_t *buffer, size_t size)
+{
+    __uarg(is_row);
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(mod->reorder)
+        udp_reorder_push_recovered(mod->reorder, buffer, size);
+    else
+        on_payload(mod, buffer, size);
+}
+
+static void on_fec_read(module_data_t *mod, asc_socket_t *sock)
+{
+    const int len = asc_socket_recv(sock, mod->fec_buffer, FEC_PACKET_SIZE);
     if(len <= 0)
     {
         if(len == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
@@ -97,42 +479,447 @@ static void on_read(void *arg)
         return;
     }
 
-    int i = 0;
+    udp_fec_decoder_push_fec(mod->fec, mod->fec_buffer, len);
+}
 
-    if(mod->config.rtp)
+static void on_fec_column_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    on_fec_read(mod, mod->sock_fec_column);
+}
+
+static void on_fec_row_read(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    on_fec_read(mod, mod->sock_fec_row);
+}
+
+/*
+ *  oooooooo8 ooooo ooooo      o      oooooooooo  ooooooooo
+ * 888         888   888      888      888    888  888    88o
+ *  888oooooo  888ooo888     8  88     888oooo88   888    888
+ *         888 888   888    8oooo88    888  88o    888    888
+ * o88oooo888 o888o o888o o88o  o888o o888o  88o8 o888ooo88
+ *
+ */
+
+static void shard_thread_loop(void *arg)
+{
+    udp_shard_t *shard = (udp_shard_t *)arg;
+
+    uint8_t *batch = (uint8_t *)malloc(ASC_SOCKET_BATCH_SIZE * SHARD_SLOT_SIZE);
+    asc_socket_msg_t msg[ASC_SOCKET_BATCH_SIZE];
+    for(int i = 0; i < ASC_SOCKET_BATCH_SIZE; ++i)
+    {
+        msg[i].buffer = &batch[i * SHARD_SLOT_SIZE + SHARD_SLOT_HEADER];
+        msg[i].size = UDP_BUFFER_SIZE;
+    }
+
+    struct pollfd fds;
+    memset(&fds, 0, sizeof(fds));
+    fds.fd = asc_socket_fd(shard->sock);
+    fds.events = POLLIN;
+
+    shard->is_thread_started = true;
+
+    while(shard->is_thread_started)
     {
-        i = RTP_HEADER_SIZE;
-        if(RTP_IS_EXT(mod->buffer))
+        const int ret = poll(&fds, 1, 100);
+
+        if(!shard->is_thread_started)
+            break;
+
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(ret == 0)
+            continue;
+
+        const int count = asc_socket_recv_batch(shard->sock, msg, ASC_SOCKET_BATCH_SIZE);
+        if(count <= 0)
+        {
+            if(count == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
+            break;
+        }
+
+        for(int i = 0; i < count; ++i)
         {
-            if(len < RTP_HEADER_SIZE + 4)
-                return;
-            i += RTP_EXT_SIZE(mod->buffer);
+            uint8_t *slot = &batch[i * SHARD_SLOT_SIZE];
+            slot[0] = (msg[i].length >> 8) & 0xFF;
+            slot[1] = (msg[i].length     ) & 0xFF;
+            memcpy(&slot[2], &msg[i].timestamp, sizeof(uint64_t));
+
+            const ssize_t size = msg[i].length + SHARD_SLOT_HEADER;
+            if(asc_thread_buffer_write(shard->thread_output, slot, size) != size)
+                SHARD_STATS_ADD(shard->overflow);
         }
+
+        if(msg[count - 1].drops > shard->drops)
+            __atomic_store_n(&shard->drops, msg[count - 1].drops, __ATOMIC_RELAXED);
     }
 
-    for(; i <= len - TS_PACKET_SIZE; i += TS_PACKET_SIZE)
-        module_stream_send(mod, &mod->buffer[i]);
+    free(batch);
+}
 
-    if(i != len && !mod->is_error_message)
+static void on_shard_read(void *arg)
+{
+    udp_shard_t *shard = (udp_shard_t *)arg;
+    module_data_t *mod = shard->mod;
+
+    if(SHARD_STATS_GET(shard->overflow))
     {
-        asc_log_error(MSG("wrong stream format. drop %d bytes"), len - i);
-        mod->is_error_message = true;
+        const uint32_t overflow = __atomic_exchange_n(&shard->overflow, 0, __ATOMIC_RELAXED);
+        asc_log_warning(MSG("receive buffer overflow. drop %u datagrams"), overflow);
+    }
+
+    uint8_t head[SHARD_SLOT_HEADER];
+    while(asc_thread_buffer_read(shard->thread_output, head, SHARD_SLOT_HEADER) == SHARD_SLOT_HEADER)
+    {
+        const size_t size = (head[0] << 8) | head[1];
+        uint64_t time;
+        memcpy(&time, &head[2], sizeof(uint64_t));
+        if(asc_thread_buffer_read(shard->thread_output, shard->buffer, size) != (ssize_t)size)
+            break;
+
+        on_datagram(mod, shard->buffer, size, time);
     }
+    on_batch_end(mod);
 }
 
+static void on_shard_close(void *arg)
+{
+    udp_shard_t *shard = (udp_shard_t *)arg;
+    module_data_t *mod = shard->mod;
+
+    asc_log_error(MSG("receive thread is stopped"));
+    on_close(mod);
+}
+
+/*
+ * oooo     oooo  ooooooo  ooooooooo  ooooo  oooo ooooo       ooooooooooo
+ *  8888o   888 o888   888o 888    88o 888    88   888         888    88
+ *  88 888o8 88 888     888 888    888 888    88   888         888ooo8
+ *  88  888  88 888o   o888 888    888 888    88   888      o  888    oo
+ * o88o  8  o88o  88ooo88  o888ooo88    888oo88   o888ooooo88 o888ooo8888
+ *
+ */
+
 static void timer_renew_callback(void *arg)
 {
     module_data_t *mod = (module_data_t *)arg;
-    asc_socket_multicast_renew(mod->sock);
+
+    if(mod->sock)
+        asc_socket_multicast_renew(mod->sock);
+
+    for(int i = 0; i < mod->shard_count; ++i)
+        asc_socket_multicast_renew(mod->shard_list[i].sock);
+
+    if(mod->sock_fec_column)
+        asc_socket_multicast_renew(mod->sock_fec_column);
+    if(mod->sock_fec_row)
+        asc_socket_multicast_renew(mod->sock_fec_row);
+}
+
+static void timer_reorder_callback(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    udp_reorder_flush(mod->reorder);
+
+    if(mod->is_shard_merge)
+        on_batch_end(mod);
+}
+
+static void sample_socket(module_data_t *mod, asc_socket_t *sock, uint32_t drops)
+{
+    asc_socket_stats_t stats;
+    if(!sock || !asc_socket_get_stats(sock, &stats))
+        return;
+
+    mod->sock_stats.rx_queue += stats.rx_queue;
+    mod->sock_stats.rcvbuf += stats.rcvbuf;
+    mod->sock_stats.rmem += stats.rmem;
+    mod->sock_stats.drops += (stats.drops > drops) ? stats.drops : drops;
+}
+
+static void update_socket_stats(module_data_t *mod)
+{
+    memset(&mod->sock_stats, 0, sizeof(asc_socket_stats_t));
+    if(mod->shared)
+        udp_receiver_get_stats(mod->shared, &mod->sock_stats);
+#ifdef HAVE_XDP
+    if(mod->xdp)
+        udp_xdp_get_stats(mod->xdp, &mod->sock_stats);
+#endif
+    sample_socket(mod, mod->sock, mod->drops);
+    for(int i = 0; i < mod->shard_count; ++i)
+        sample_socket(mod, mod->shard_list[i].sock, SHARD_STATS_GET(mod->shard_list[i].drops));
+
+    if(mod->sock_stats.rx_queue > mod->rx_queue_max)
+        mod->rx_queue_max = mod->sock_stats.rx_queue;
+}
+
+static void timer_stats_callback(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    update_socket_stats(mod);
+
+    if(mod->sock_stats.drops > mod->drops_reported)
+    {
+        const uint64_t now = asc_utime();
+        if(now >= mod->drops_warning_time + DROPS_WARNING_INTERVAL)
+        {
+            if(mod->config.source_count > 0)
+                asc_log_warning(MSG("kernel dropped %u datagrams including rejected by filter. "
+                                    "socket buffer %u bytes")
+                                , mod->sock_stats.drops - mod->drops_reported
+                                , mod->sock_stats.rcvbuf);
+            else
+                asc_log_warning(MSG("kernel dropped %u datagrams. socket buffer %u bytes. "
+                                    "consider to increase socket_size")
+                                , mod->sock_stats.drops - mod->drops_reported
+                                , mod->sock_stats.rcvbuf);
+            mod->drops_reported = mod->sock_stats.drops;
+            mod->drops_warning_time = now;
+        }
+    }
 }
 
 static int method_port(module_data_t *mod)
 {
-    const int port = asc_socket_port(mod->sock);
+    asc_socket_t *sock = (mod->shard_list) ? mod->shard_list[0].sock : mod->sock;
+    int port = (sock) ? asc_socket_port(sock) : -1;
+    if(mod->shared)
+        port = mod->config.port;
     lua_pushnumber(lua, port);
     return 1;
 }
 
+static int method_set_receiver(module_data_t *mod)
+{
+    void *arg = lua_touserdata(lua, 2);
+
+    int i = 0;
+    for(; i < mod->receiver_count; ++i)
+    {
+        if(mod->receiver_list[i].arg == arg)
+            break;
+    }
+
+    if(lua_isnil(lua, 3))
+    {
+        if(i < mod->receiver_count)
+        {
+            --mod->receiver_count;
+            memmove(  &mod->receiver_list[i], &mod->receiver_list[i + 1]
+                    , (mod->receiver_count - i) * sizeof(mod->receiver_list[0]));
+        }
+        return 0;
+    }
+
+    if(i == mod->receiver_count)
+    {
+        asc_assert(mod->receiver_count < RECEIVER_MAX, MSG(":set_receiver() too many receivers"));
+        ++mod->receiver_count;
+    }
+
+    mod->receiver_list[i].arg = arg;
+    mod->receiver_list[i].callback.ptr = lua_touserdata(lua, 3);
+    return 0;
+}
+
+static int method_stats(module_data_t *mod)
+{
+    update_socket_stats(mod);
+    udp_stats_push(&mod->stats, mod->config.rtp);
+
+    if(mod->reorder)
+    {
+        lua_pushnumber(lua, mod->reorder->late);
+        lua_setfield(lua, -2, "reorder_late");
+        lua_pushnumber(lua, mod->reorder->duplicate);
+        lua_setfield(lua, -2, "reorder_duplicate");
+        lua_pushnumber(lua, mod->reorder->lost);
+        lua_setfield(lua, -2, "reorder_lost");
+    }
+
+    lua_pushnumber(lua, mod->sock_stats.drops);
+    lua_setfield(lua, -2, "kernel_drops");
+    lua_pushnumber(lua, mod->sock_stats.rx_queue);
+    lua_setfield(lua, -2, "rx_queue");
+    lua_pushnumber(lua, mod->rx_queue_max);
+    lua_setfield(lua, -2, "rx_queue_max");
+    lua_pushnumber(lua, mod->sock_stats.rcvbuf);
+    lua_setfield(lua, -2, "rcvbuf");
+    lua_pushnumber(lua, mod->sock_stats.rmem);
+    lua_setfield(lua, -2, "rmem");
+
+    if(mod->fec)
+    {
+        lua_pushnumber(lua, mod->fec->fec_packets);
+        lua_setfield(lua, -2, "fec_packets");
+        /* datagrams emitted before the original is received */
+        lua_pushnumber(lua, (mod->reorder) ? mod->reorder->recovered : mod->fec->recovered);
+        lua_setfield(lua, -2, "fec_recovered");
+        lua_pushnumber(lua, mod->fec->errors);
+        lua_setfield(lua, -2, "fec_errors");
+    }
+
+    return 1;
+}
+
+/* drop foreign senders and datagrams with wrong size in the kernel */
+static void attach_filter(module_data_t *mod, asc_socket_t *sock, bool is_media)
+{
+#ifdef __linux__
+    struct sock_filter code[SOURCE_MAX + 16];
+    int n = 0;
+
+    if(mod->config.source_count > 0)
+    {
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12);
+        for(int i = 0; i < mod->config.source_count; ++i)
+        {
+            const uint8_t jt = mod->config.source_count - i;
+            code[n++] = (struct sock_filter)BPF_JUMP(  BPF_JMP | BPF_JEQ | BPF_K
+                                                     , ntohl(mod->config.source_list[i])
+                                                     , jt, 0);
+        }
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    }
+
+    if(is_media)
+    {
+        /* datagram length includes UDP header */
+        const uint32_t header_size = 8 + ((mod->config.rtp) ? RTP_HEADER_SIZE : 0);
+
+        if(mod->config.rtp)
+        {
+            /* payload size is not fixed with RTP header extension */
+            code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8);
+            code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x10, 5, 0);
+        }
+
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+        code[n++] = (struct sock_filter)BPF_JUMP(  BPF_JMP | BPF_JGE | BPF_K
+                                                 , header_size + TS_PACKET_SIZE, 0, 4);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, header_size);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, TS_PACKET_SIZE);
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1);
+    }
+
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+    if(is_media)
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    if(!asc_socket_attach_filter(sock, code, n))
+        asc_log_warning(MSG("source filtering is not available"));
+#else
+    __uarg(sock);
+    __uarg(is_media);
+    asc_log_warning(MSG("source filtering is not available"));
+#endif
+}
+
+static asc_socket_t * open_socket(module_data_t *mod, void *arg, int port, bool is_reuseport)
+{
+    asc_socket_t *sock = asc_socket_open_udp4(arg);
+    asc_socket_set_reuseaddr(sock, 1);
+    if(is_reuseport)
+        asc_socket_set_reuseport(sock, 1);
+#ifdef _WIN32
+    if(!asc_socket_bind(sock, NULL, port))
+#else
+    if(!asc_socket_bind(sock, mod->config.addr, port))
+#endif
+    {
+        asc_socket_close(sock);
+        return NULL;
+    }
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(sock, value, 0);
+
+    asc_socket_set_timestamp(sock, 1);
+    asc_socket_set_rxq_ovfl(sock, 1);
+
+    asc_socket_multicast_join_source(  sock, mod->config.addr, mod->config.localaddr
+                                     , mod->config.source);
+
+    if(mod->config.source_count > 0)
+        attach_filter(mod, sock, (port == mod->config.port));
+
+    return sock;
+}
+
+static void shard_init(module_data_t *mod)
+{
+    const bool is_multicast = IN_MULTICAST(ntohl(inet_addr(mod->config.addr)));
+    if(is_multicast && mod->config.threads > 1)
+    {
+        /* kernel delivers a copy of each multicast datagram to all sockets */
+        asc_log_warning(MSG("reuseport sharding is not available for multicast. "
+                            "use single receiving thread"));
+        mod->config.threads = 1;
+    }
+    else if(!mod->config.rtp && mod->config.threads > 1)
+    {
+        /* raw UDP has no sequence number to restore the order of datagrams */
+        asc_log_warning(MSG("reuseport sharding requires 'rtp'. use single receiving thread"));
+        mod->config.threads = 1;
+    }
+    else if(mod->config.threads > SHARD_MAX)
+        mod->config.threads = SHARD_MAX;
+
+    mod->shard_count = mod->config.threads;
+    mod->shard_list = (udp_shard_t *)calloc(mod->shard_count, sizeof(udp_shard_t));
+
+    const bool is_reuseport = (mod->shard_count > 1);
+    if(is_reuseport)
+    {
+        /* datagrams of the flow are spread between shards */
+        mod->is_shard_merge = true;
+        if(!mod->reorder)
+        {
+            mod->reorder = udp_reorder_init(SHARD_REORDER_DEFAULT, on_ordered, mod);
+            mod->timer_reorder = asc_timer_init(  SHARD_REORDER_DEFAULT / 2
+                                                , timer_reorder_callback, mod);
+        }
+    }
+
+    for(int i = 0; i < mod->shard_count; ++i)
+    {
+        udp_shard_t *shard = &mod->shard_list[i];
+        shard->mod = mod;
+        shard->sock = open_socket(mod, shard, mod->config.port, is_reuseport);
+        if(!shard->sock)
+        {
+            on_close(mod);
+            return;
+        }
+    }
+
+    if(is_reuseport && !asc_socket_set_reuseport_cbpf(mod->shard_list[0].sock, mod->shard_count))
+        asc_log_warning(MSG("datagrams are distributed by the kernel hash"));
+
+    for(int i = 0; i < mod->shard_count; ++i)
+    {
+        udp_shard_t *shard = &mod->shard_list[i];
+        shard->thread = asc_thread_init(shard);
+        shard->thread_output = asc_thread_buffer_init(SHARD_BUFFER_SIZE);
+        asc_thread_start(  shard->thread
+                         , shard_thread_loop
+                         , on_shard_read, shard->thread_output
+                         , on_shard_close);
+    }
+}
+
 static void module_init(module_data_t *mod)
 {
     module_stream_init(mod, NULL);
@@ -141,30 +928,156 @@ static void module_init(module_data_t *mod)
     asc_assert(mod->config.addr != NULL, "[udp_input] option 'addr' is required");
 
     module_option_number("port", &mod->config.port);
+    module_option_string("localaddr", &mod->config.localaddr, NULL);
+    module_option_boolean("rtp", &mod->config.rtp);
+    module_option_number("threads", &mod->config.threads);
 
-    mod->sock = asc_socket_open_udp4(mod);
-    asc_socket_set_reuseaddr(mod->sock, 1);
-#ifdef _WIN32
-    if(!asc_socket_bind(mod->sock, NULL, mod->config.port))
+    module_option_string("source", &mod->config.source, NULL);
+    if(mod->config.source)
+    {
+        mod->config.source_list[0] = inet_addr(mod->config.source);
+        asc_assert(mod->config.source_list[0] != INADDR_NONE, MSG("option 'source': wrong address"));
+        mod->config.source_count = 1;
+    }
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "allowed_sources");
+    if(lua_istable(lua, -1))
+    {
+        lua_foreach(lua, -2)
+        {
+            asc_assert(mod->config.source_count < SOURCE_MAX
+                       , MSG("option 'allowed_sources': too many addresses"));
+            const char *addr = lua_tostring(lua, -1);
+            const uint32_t source = (addr) ? inet_addr(addr) : INADDR_NONE;
+            asc_assert(source != INADDR_NONE, MSG("option 'allowed_sources': wrong address"));
+            mod->config.source_list[mod->config.source_count] = source;
+            ++mod->config.source_count;
+        }
+    }
+    lua_pop(lua, 1); // allowed_sources
+
+    bool is_fec = false;
+    module_option_boolean("fec", &is_fec);
+    if(is_fec && !mod->config.rtp)
+    {
+        asc_log_warning(MSG("option 'fec' requires 'rtp'"));
+        is_fec = false;
+    }
+
+    int reorder = 0;
+    module_option_number("reorder", &reorder);
+    if(is_fec && reorder <= 0)
+        reorder = FEC_REORDER_DEFAULT;
+
+    if(reorder > 0)
+    {
+        if(mod->config.rtp)
+        {
+            mod->reorder = udp_reorder_init(reorder, on_ordered, mod);
+            const int interval = (reorder > 1) ? (reorder / 2) : 1;
+            mod->timer_reorder = asc_timer_init(interval, timer_reorder_callback, mod);
+        }
+        else
+            asc_log_warning(MSG("option 'reorder' requires 'rtp'"));
+    }
+
+    bool is_shared = false;
+    module_option_boolean("shared", &is_shared);
+
+    int renew = 0;
+    module_option_number("renew", &renew);
+
+    const char *xdp = NULL;
+    module_option_string("xdp", &xdp, NULL);
+
+#ifdef HAVE_XDP
+    if(xdp)
+    {
+        if(is_shared || mod->config.threads > 0 || mod->config.source_count > 1)
+            asc_log_warning(MSG("options 'shared', 'threads' and 'allowed_sources' are ignored "
+                                "for the XDP receiver"));
+
+        bool is_native = false;
+        module_option_boolean("xdp_native", &is_native);
+
+        mod->xdp = udp_xdp_attach(  xdp, is_native
+                                  , mod->config.localaddr, mod->config.addr
+                                  , mod->config.port, mod->config.source
+                                  , on_shared_datagram, mod);
+        if(!mod->xdp)
+        {
+            on_close(mod);
+            return;
+        }
+    }
+    else
 #else
-    if(!asc_socket_bind(mod->sock, mod->config.addr, mod->config.port))
+    if(xdp)
+        asc_log_warning(MSG("option 'xdp' is not supported. use the socket receiver"));
 #endif
-        return;
+    if(is_shared)
+    {
+        if(mod->config.threads > 0 || mod->config.source_count > 1)
+            asc_log_warning(MSG("options 'threads' and 'allowed_sources' are ignored "
+                                "for the shared receiver"));
 
-    int value;
-    if(module_option_number("socket_size", &value))
-        asc_socket_set_buffer(mod->sock, value, 0);
+        module_option_number("socket_size", &mod->config.socket_size);
+        mod->config.renew = renew;
 
-    module_option_boolean("rtp", &mod->config.rtp);
+        if(!shared_attach(mod))
+        {
+            on_close(mod);
+            return;
+        }
+        /* group is renewed by the receiver */
+        if(!is_fec)
+            renew = 0;
+    }
+    else if(mod->config.threads > 0)
+    {
+        shard_init(mod);
+        if(!mod->shard_list)
+            return;
+    }
+    else
+    {
+        mod->sock = open_socket(mod, mod, mod->config.port, false);
+        if(!mod->sock)
+            return;
+
+        mod->batch = (uint8_t *)malloc(ASC_SOCKET_BATCH_SIZE * UDP_BUFFER_SIZE);
+        for(int i = 0; i < ASC_SOCKET_BATCH_SIZE; ++i)
+        {
+            mod->msg[i].buffer = &mod->batch[i * UDP_BUFFER_SIZE];
+            mod->msg[i].size = UDP_BUFFER_SIZE;
+        }
+
+        asc_socket_set_on_read(mod->sock, on_read);
+        asc_socket_set_on_close(mod->sock, on_close);
+    }
 
-    asc_socket_set_on_read(mod->sock, on_read);
-    asc_socket_set_on_close(mod->sock, on_close);
+    if(is_fec)
+    {
+        mod->fec = udp_fec_decoder_init(on_fec_recovered, mod);
 
-    module_option_string("localaddr", &mod->config.localaddr, NULL);
-    asc_socket_multicast_join(mod->sock, mod->config.addr, mod->config.localaddr);
+        mod->sock_fec_column = open_socket(mod, mod, mod->config.port + FEC_COLUMN_PORT, false);
+        mod->sock_fec_row = open_socket(mod, mod, mod->config.port + FEC_ROW_PORT, false);
+        if(!mod->sock_fec_column || !mod->sock_fec_row)
+        {
+            on_close(mod);
+            return;
+        }
+
+        asc_socket_set_on_read(mod->sock_fec_column, on_fec_column_read);
+        asc_socket_set_on_close(mod->sock_fec_column, on_close);
+        asc_socket_set_on_read(mod->sock_fec_row, on_fec_row_read);
+        asc_socket_set_on_close(mod->sock_fec_row, on_close);
+    }
+
+    if(renew > 0)
+        mod->timer_renew = asc_timer_init(renew * 1000, timer_renew_callback, mod);
 
-    if(module_option_number("renew", &value))
-        mod->timer_renew = asc_timer_init(value * 1000, timer_renew_callback, mod);
+    mod->timer_stats = asc_timer_init(STATS_INTERVAL, timer_stats_callback, mod);
 }
 
 static void module_destroy(module_data_t *mod)
@@ -180,5 +1093,7 @@ MODULE_LUA_METHODS()
 {
     MODULE_STREAM_METHODS_REF(),
     { "port", method_port },
+    { "set_receiver", method_set_receiver },
+    { "stats", method_stats },
 };
 MODULE_LUA_REGISTER(udp_input)
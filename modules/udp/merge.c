@@ -0,0 +1,209 @@
+/*
+ * Astra Module: RTP Merge
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Module Name:
+ *      rtp_merge
+ *
+ * SMPTE 2022-7 seamless protection. Datagrams of the redundant RTP inputs are
+ * merged by the sequence number. First copy is forwarded, duplicate is dropped.
+ *
+ * Module Options:
+ *      inputs      - list, udp_input instances with rtp = true
+ *      buffer      - number, maximum skew between inputs in milliseconds. default: 50
+ *
+ * Module Methods:
+ *      stats()     - return table, merging statistics:
+ *                    lost - lost on all inputs, duplicate, late,
+ *                    inputs - list of the udp_input:stats() tables for each input
+ */
+
+#include "udp.h"
+
+#define MSG(_msg) "[rtp_merge] " _msg
+
+#define MERGE_MAX_INPUTS 4
+#define MERGE_BUFFER_DEFAULT 50
+
+typedef struct
+{
+    module_data_t *mod;
+    int idx_input;
+    udp_stats_t stats;
+} merge_input_t;
+
+struct module_data_t
+{
+    MODULE_STREAM_DATA();
+
+    bool is_error_message;
+
+    udp_reorder_t *reorder;
+    asc_timer_t *timer_reorder;
+
+    int input_count;
+    merge_input_t input_list[MERGE_MAX_INPUTS];
+};
+
+static void on_payload(void *arg, const uint8_t *buffer, size_t size)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    const int len = size;
+    int i = rtp_header_size(buffer, size);
+    if(i < 0)
+        return;
+
+    for(; i <= len - TS_PACKET_SIZE; i += TS_PACKET_SIZE)
+        module_stream_send(mod, &buffer[i]);
+
+    if(i != len && !mod->is_error_message)
+    {
+        asc_log_error(MSG("wrong stream format. drop %d bytes"), len - i);
+        mod->is_error_message = true;
+    }
+}
+
+static void on_input_datagram(void *arg, const uint8_t *buffer, size_t size, uint64_t time)
+{
+    merge_input_t *input = (merge_input_t *)arg;
+    module_data_t *mod = input->mod;
+
+    if(!buffer)
+        return;
+
+    udp_stats_update(&input->stats, buffer, size, time, true);
+    udp_reorder_push(mod->reorder, buffer, size);
+}
+
+static void timer_reorder_callback(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    udp_reorder_flush(mod->reorder);
+}
+
+static void input_set_receiver(merge_input_t *input, bool is_on)
+{
+    union
+    {
+        udp_receiver_callback_t fn;
+        void *ptr;
+    } callback;
+    callback.fn = on_input_datagram;
+
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, input->idx_input);
+    lua_getfield(lua, -1, "set_receiver");
+    asc_assert(lua_isfunction(lua, -1), MSG("option 'inputs': udp_input required"));
+    lua_pushvalue(lua, -2);
+    lua_pushlightuserdata(lua, input);
+    if(is_on)
+        lua_pushlightuserdata(lua, callback.ptr);
+    else
+        lua_pushnil(lua);
+    lua_call(lua, 3, 0);
+    lua_pop(lua, 1); // input
+}
+
+static int method_stats(module_data_t *mod)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, mod->reorder->lost);
+    lua_setfield(lua, -2, "lost");
+    lua_pushnumber(lua, mod->reorder->duplicate);
+    lua_setfield(lua, -2, "duplicate");
+    lua_pushnumber(lua, mod->reorder->late);
+    lua_setfield(lua, -2, "late");
+
+    lua_newtable(lua);
+    for(int i = 0; i < mod->input_count; ++i)
+    {
+        lua_pushnumber(lua, i + 1);
+        udp_stats_push(&mod->input_list[i].stats, true);
+        lua_settable(lua, -3);
+    }
+    lua_setfield(lua, -2, "inputs");
+
+    return 1;
+}
+
+static void module_init(module_data_t *mod)
+{
+    module_stream_init(mod, NULL);
+
+    int buffer = MERGE_BUFFER_DEFAULT;
+    module_option_number("buffer", &buffer);
+    if(buffer <= 0)
+        buffer = 1;
+
+    mod->reorder = udp_reorder_init(buffer, on_payload, mod);
+    mod->timer_reorder = asc_timer_init((buffer > 1) ? (buffer / 2) : 1
+                                        , timer_reorder_callback, mod);
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "inputs");
+    asc_assert(lua_istable(lua, -1), MSG("option 'inputs' is required"));
+    lua_foreach(lua, -2)
+    {
+        asc_assert(lua_istable(lua, -1), MSG("option 'inputs': udp_input required"));
+        asc_assert(mod->input_count < MERGE_MAX_INPUTS, MSG("option 'inputs': too many inputs"));
+
+        merge_input_t *input = &mod->input_list[mod->input_count];
+        ++mod->input_count;
+
+        input->mod = mod;
+        lua_pushvalue(lua, -1);
+        input->idx_input = luaL_ref(lua, LUA_REGISTRYINDEX);
+        input_set_receiver(input, true);
+    }
+    lua_pop(lua, 1); // inputs
+}
+
+static void module_destroy(module_data_t *mod)
+{
+    module_stream_destroy(mod);
+
+    for(int i = 0; i < mod->input_count; ++i)
+    {
+        merge_input_t *input = &mod->input_list[i];
+        input_set_receiver(input, false);
+        luaL_unref(lua, LUA_REGISTRYINDEX, input->idx_input);
+    }
+    mod->input_count = 0;
+
+    if(mod->timer_reorder)
+    {
+        asc_timer_destroy(mod->timer_reorder);
+        mod->timer_reorder = NULL;
+    }
+
+    if(mod->reorder)
+    {
+        udp_reorder_destroy(mod->reorder);
+        mod->reorder = NULL;
+    }
+}
+
+MODULE_STREAM_METHODS()
+MODULE_LUA_METHODS()
+{
+    MODULE_STREAM_METHODS_REF(),
+    { "stats", method_stats },
+};
+MODULE_LUA_REGISTER(rtp_merge)
@@ -1,2 +1,21 @@
-SOURCES="input.c output.c"
-MODULES="udp_input udp_output"
+SOURCES="rtp.c stats.c reorder.c fec.c receiver.c xdp.c input.c output.c merge.c"
+MODULES="udp_input udp_output rtp_merge"
+
+xdp_test_c()
+{
+    cat <<EOF
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+int main(void) { return XDP_RX_RING + BPF_MAP_TYPE_XSKMAP + XDP_FLAGS_SKB_MODE; }
+EOF
+}
+
+check_xdp()
+{
+    xdp_test_c | $APP_C -Werror $CFLAGS $APP_CFLAGS -o /dev/null -x c - >/dev/null 2>&1
+}
+
+if check_xdp ; then
+    CFLAGS="-DHAVE_XDP=1"
+fi
@@ -26,6 +26,12 @@
  *      upstream    - object, stream instance returned by module_instance:stream()
  *      addr        - string, source IP address
  *      port        - number, source UDP port
+ *      destinations - list, additional destinations: { { addr = "...", port = 1234 }, ... }
+ *                    port is optional, default value is the option 'port'.
+ *                    in the stream URL: #destinations=239.0.0.2:1234,239.0.0.3
+ *                    each datagram is packetized once and sent to all destinations
+ *                    with a single system call. an unreachable destination is
+ *                    suspended with exponential backoff and does not affect others
  *      ttl         - number, time to live
  *      localaddr   - string, IP address of the local interface
  *      socket_size - number, socket buffer size
@@ -33,13 +39,67 @@
  *      sync        - number, if greater then 0, then use MPEG-TS syncing.
  *                            average value of the stream bitrate in megabit per second
  *      cbr         - number, constant bitrate
+ *      fec_columns - number, SMPTE 2022-1 FEC matrix width (L). requires rtp.
+ *                    column FEC is sent to port+2, row FEC to port+4
+ *      fec_rows    - number, SMPTE 2022-1 FEC matrix height (D)
+ *      passthrough - object, udp_input instance. datagrams of the input are forwarded
+ *                    without splitting into TS packets. RTP header is stripped,
+ *                    or rewritten if option rtp is set. datagrams are received and
+ *                    sent in batches. upstream and sync are not available.
+ *                    the input must not feed other modules, its stream is bypassed
+ *      passthrough_stats
+ *                  - boolean, check continuity counters of the forwarded datagrams
+ *
+ * Module Methods:
+ *      stats()     - return table, sending statistics:
+ *                    packets, bytes, errors - datagrams sent and send errors,
+ *                    tx_queue, tx_queue_max - bytes in the socket send queue,
+ *                    sndbuf, wmem - socket buffer size and allocated memory,
+ *                    destinations - list of { addr, port, packets, errors, backoff },
+ *                    pids - list of { pid, packets, cc_errors } if passthrough_stats
  */
 
-#include <astra.h>
+#include "udp.h"
+
+#ifndef _WIN32
+#   include <arpa/inet.h>
+#endif
 
 #define MSG(_msg) "[udp_output %s:%d] " _msg, mod->addr, mod->port
 
-#define UDP_BUFFER_SIZE 1460
+#define STATS_INTERVAL 1000
+
+/*
+ * in sync mode packets are sent by the sync thread: the packet buffer and
+ * the FEC encoder are used only by this thread, counters are read by the main thread
+ */
+#define STATS_ADD(_counter, _value) __atomic_fetch_add(&(_counter), (_value), __ATOMIC_RELAXED)
+#define STATS_GET(_counter) __atomic_load_n(&(_counter), __ATOMIC_RELAXED)
+
+#define MAX_DESTINATIONS ASC_SOCKET_BATCH_SIZE
+#define BACKOFF_MIN 100     /* ms */
+#define BACKOFF_MAX 10000   /* ms */
+
+typedef struct
+{
+    char addr[16];
+    asc_socket_dest_t dest;
+
+    uint64_t packets;
+    uint64_t errors;
+
+    uint32_t backoff;       /* ms, 0 if destination is active */
+    uint64_t retry_time;    /* us */
+} output_dest_t;
+
+#define PASSTHROUGH_SLOT_SIZE (RTP_HEADER_SIZE + UDP_BUFFER_SIZE)
+
+typedef struct
+{
+    uint8_t cc;             /* last continuity counter, 0xFF if unknown */
+    uint64_t packets;
+    uint64_t cc_errors;
+} output_pid_t;
 
 struct module_data_t
 {
@@ -54,6 +114,33 @@ struct module_data_t
 
     asc_socket_t *sock;
 
+    int dest_count;
+    output_dest_t *dest_list;
+
+    struct
+    {
+        uint64_t packets;
+        uint64_t bytes;
+        uint64_t errors;
+        int tx_queue_max;
+        asc_socket_stats_t sock;
+    } stats;
+    asc_timer_t *timer_stats;
+
+    struct
+    {
+        int idx_input;
+        output_pid_t *pid_list;
+
+        int count;
+        asc_socket_msg_t msg[ASC_SOCKET_BATCH_SIZE];
+        uint8_t *buffer;
+    } passthrough;
+
+    udp_fec_encoder_t *fec;
+    asc_socket_t *sock_fec_column;
+    asc_socket_t *sock_fec_row;
+
     struct
     {
         uint32_t skip;
@@ -81,25 +168,112 @@ struct module_data_t
 
 static const uint8_t null_ts[TS_PACKET_SIZE] = { 0x47, 0x1F, 0xFF, 0x10, 0x00 };
 
-static void on_ts(module_data_t *mod, const uint8_t *ts)
+static bool is_socket_error(int error)
 {
-    if(mod->is_rtp && mod->packet.skip == 0)
+#ifndef _WIN32
+    return (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS);
+#else
+    return (error == WSAEWOULDBLOCK || error == WSAENOBUFS);
+#endif
+}
+
+static void send_multi(  module_data_t *mod, asc_socket_t *sock
+                       , const uint8_t *buffer, size_t size, int port_offset)
+{
+    const uint64_t now = asc_utime();
+
+    asc_socket_dest_t list[MAX_DESTINATIONS];
+    output_dest_t *ref[MAX_DESTINATIONS];
+    int count = 0;
+
+    for(int i = 0; i < mod->dest_count; ++i)
+    {
+        output_dest_t *d = &mod->dest_list[i];
+        if(d->backoff > 0 && now < d->retry_time)
+            continue;
+
+        list[count] = d->dest;
+        list[count].port += port_offset;
+        ref[count] = d;
+        ++count;
+    }
+
+    if(count == 0)
+        return;
+
+    asc_socket_sendto_multi(sock, buffer, size, list, count);
+
+    for(int i = 0; i < count; ++i)
     {
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        const uint64_t msec = ((tv.tv_sec % 1000000) * 1000) + (tv.tv_usec / 1000);
+        output_dest_t *d = ref[i];
+        const int error = list[i].error;
+
+        if(error == 0)
+        {
+            if(port_offset == 0)
+            {
+                STATS_ADD(d->packets, 1);
+                STATS_ADD(mod->stats.packets, 1);
+                STATS_ADD(mod->stats.bytes, size);
+            }
+            if(d->backoff > 0)
+            {
+                asc_log_info(MSG("destination %s:%d is restored"), d->addr, d->dest.port);
+                __atomic_store_n(&d->backoff, 0, __ATOMIC_RELAXED);
+            }
+        }
+        else if(is_socket_error(error))
+        {
+            /* socket queue is full. not a destination failure */
+            STATS_ADD(mod->stats.errors, 1);
+        }
+        else
+        {
+            STATS_ADD(d->errors, 1);
+            STATS_ADD(mod->stats.errors, 1);
+
+            uint32_t backoff = d->backoff;
+            if(backoff == 0)
+            {
+                asc_log_warning(MSG("destination %s:%d is suspended [%s]")
+                                , d->addr, d->dest.port, strerror(error));
+                backoff = BACKOFF_MIN;
+            }
+            else
+            {
+                backoff *= 2;
+                if(backoff > BACKOFF_MAX)
+                    backoff = BACKOFF_MAX;
+            }
+            __atomic_store_n(&d->backoff, backoff, __ATOMIC_RELAXED);
+            d->retry_time = now + backoff * 1000;
+        }
+    }
+}
+
+static void rtp_header_update(module_data_t *mod, uint8_t *buffer)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    const uint64_t msec = ((tv.tv_sec % 1000000) * 1000) + (tv.tv_usec / 1000);
 
-        mod->packet.buffer[2] = (mod->rtpseq >> 8) & 0xFF;
-        mod->packet.buffer[3] = (mod->rtpseq     ) & 0xFF;
+    buffer[2] = (mod->rtpseq >> 8) & 0xFF;
+    buffer[3] = (mod->rtpseq     ) & 0xFF;
 
-        mod->packet.buffer[4] = (msec >> 24) & 0xFF;
-        mod->packet.buffer[5] = (msec >> 16) & 0xFF;
-        mod->packet.buffer[6] = (msec >>  8) & 0xFF;
-        mod->packet.buffer[7] = (msec      ) & 0xFF;
+    buffer[4] = (msec >> 24) & 0xFF;
+    buffer[5] = (msec >> 16) & 0xFF;
+    buffer[6] = (msec >>  8) & 0xFF;
+    buffer[7] = (msec      ) & 0xFF;
 
-        ++mod->rtpseq;
+    ++mod->rtpseq;
+}
 
-        mod->packet.skip += 12;
+static void on_ts(module_data_t *mod, const uint8_t *ts)
+{
+    if(mod->is_rtp && mod->packet.skip == 0)
+    {
+        rtp_header_update(mod, mod->packet.buffer);
+        mod->packet.skip += RTP_HEADER_SIZE;
     }
 
     memcpy(&mod->packet.buffer[mod->packet.skip], ts, TS_PACKET_SIZE);
@@ -107,12 +281,298 @@ static void on_ts(module_data_t *mod, const uint8_t *ts)
 
     if(mod->packet.skip > UDP_BUFFER_SIZE - TS_PACKET_SIZE)
     {
-        if(asc_socket_sendto(mod->sock, mod->packet.buffer, mod->packet.skip) == -1)
+        if(mod->dest_list)
+            send_multi(mod, mod->sock, mod->packet.buffer, mod->packet.skip, 0);
+        else if(asc_socket_sendto(mod->sock, mod->packet.buffer, mod->packet.skip) == -1)
+        {
             asc_log_warning(MSG("error on send [%s]"), asc_socket_error());
+            STATS_ADD(mod->stats.errors, 1);
+        }
+        else
+        {
+            STATS_ADD(mod->stats.packets, 1);
+            STATS_ADD(mod->stats.bytes, mod->packet.skip);
+        }
+        if(mod->fec)
+            udp_fec_encoder_push(mod->fec, mod->packet.buffer, mod->packet.skip);
         mod->packet.skip = 0;
     }
 }
 
+static void on_fec(void *arg, bool is_row, const uint8_t *buffer, size_t size)
+{
+    module_data_t *mod = (module_data_t *)arg;
+
+    asc_socket_t *sock = (is_row) ? mod->sock_fec_row : mod->sock_fec_column;
+    if(mod->dest_list)
+        send_multi(mod, sock, buffer, size, (is_row) ? FEC_ROW_PORT : FEC_COLUMN_PORT);
+    else if(asc_socket_sendto(sock, buffer, size) == -1)
+        asc_log_warning(MSG("error on send FEC [%s]"), asc_socket_error());
+}
+
+/*
+ * oooooooooo   o       oooooooo8   oooooooo8
+ *  888    888 888     888         888
+ *  888oooo88 8  88     888oooooo   888oooooo
+ *  888      8oooo88           888         888
+ * o888o   o88o  o888o o88oooo888  o88oooo888
+ *
+ */
+
+static void passthrough_flush(module_data_t *mod)
+{
+    const int count = mod->passthrough.count;
+    if(count == 0)
+        return;
+
+    mod->passthrough.count = 0;
+
+    const int sent = asc_socket_send_batch(mod->sock, mod->passthrough.msg, count);
+    uint64_t bytes = 0;
+    for(int i = 0; i < count; ++i)
+        bytes += mod->passthrough.msg[i].length;
+    STATS_ADD(mod->stats.packets, sent);
+    STATS_ADD(mod->stats.errors, count - sent);
+    STATS_ADD(mod->stats.bytes, bytes);
+}
+
+static void passthrough_check_cc(module_data_t *mod, const uint8_t *buffer, size_t size)
+{
+    for(size_t i = 0; i + TS_PACKET_SIZE <= size; i += TS_PACKET_SIZE)
+    {
+        const uint8_t *ts = &buffer[i];
+        const uint16_t pid = TS_GET_PID(ts);
+
+        output_pid_t *item = &mod->passthrough.pid_list[pid];
+        ++item->packets;
+
+        if(pid == NULL_TS_PID || !TS_IS_PAYLOAD(ts))
+            continue;
+
+        const uint8_t cc = TS_GET_CC(ts);
+        if(item->cc != 0xFF && cc != ((item->cc + 1) & 0x0F) && cc != item->cc)
+            ++item->cc_errors;
+        item->cc = cc;
+    }
+}
+
+static void on_passthrough(void *arg, const uint8_t *buffer, size_t size, uint64_t time)
+{
+    __uarg(time);
+    module_data_t *mod = (module_data_t *)arg;
+
+    if(!buffer)
+    {
+        /* end of the received batch */
+        passthrough_flush(mod);
+        return;
+    }
+
+    int skip = 0;
+    if(!TS_IS_SYNC(buffer))
+    {
+        skip = rtp_header_size(buffer, size);
+        if(skip < 0)
+            return;
+    }
+
+    const uint8_t *payload = &buffer[skip];
+    const size_t payload_size = size - skip;
+    if(payload_size < TS_PACKET_SIZE || payload_size > UDP_BUFFER_SIZE)
+    {
+        STATS_ADD(mod->stats.errors, 1);
+        return;
+    }
+
+    if(mod->passthrough.pid_list)
+        passthrough_check_cc(mod, payload, payload_size);
+
+    asc_socket_msg_t *msg = &mod->passthrough.msg[mod->passthrough.count];
+    uint8_t *packet = (uint8_t *)msg->buffer;
+    size_t packet_size = 0;
+
+    if(mod->is_rtp)
+    {
+        memcpy(packet, mod->packet.buffer, RTP_HEADER_SIZE);
+        rtp_header_update(mod, packet);
+        packet_size = RTP_HEADER_SIZE;
+    }
+
+    memcpy(&packet[packet_size], payload, payload_size);
+    packet_size += payload_size;
+
+    if(mod->dest_list)
+        send_multi(mod, mod->sock, packet, packet_size, 0);
+    else
+    {
+        msg->length = packet_size;
+        ++mod->passthrough.count;
+    }
+
+    if(mod->fec)
+        udp_fec_encoder_push(mod->fec, packet, packet_size);
+
+    if(mod->passthrough.count == ASC_SOCKET_BATCH_SIZE)
+        passthrough_flush(mod);
+}
+
+static void passthrough_set_receiver(module_data_t *mod, bool is_on)
+{
+    union
+    {
+        udp_receiver_callback_t fn;
+        void *ptr;
+    } callback;
+    callback.fn = on_passthrough;
+
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, mod->passthrough.idx_input);
+    lua_getfield(lua, -1, "set_receiver");
+    asc_assert(lua_isfunction(lua, -1), MSG("option 'passthrough': udp_input required"));
+    lua_pushvalue(lua, -2);
+    lua_pushlightuserdata(lua, mod);
+    if(is_on)
+        lua_pushlightuserdata(lua, callback.ptr);
+    else
+        lua_pushnil(lua);
+    lua_call(lua, 3, 0);
+    lua_pop(lua, 1); // input
+}
+
+static void passthrough_init(module_data_t *mod)
+{
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "upstream");
+    asc_assert(lua_isnil(lua, -1), MSG("option 'upstream' is not available with 'passthrough'"));
+    lua_pop(lua, 1);
+
+    int value = 0;
+    module_option_number("sync", &value);
+    asc_assert(value == 0, MSG("option 'sync' is not available with 'passthrough'"));
+
+    bool is_stats = false;
+    module_option_boolean("passthrough_stats", &is_stats);
+    if(is_stats)
+    {
+        mod->passthrough.pid_list = (output_pid_t *)calloc(MAX_PID, sizeof(output_pid_t));
+        for(int i = 0; i < MAX_PID; ++i)
+            mod->passthrough.pid_list[i].cc = 0xFF;
+    }
+
+    mod->passthrough.buffer =
+        (uint8_t *)malloc(ASC_SOCKET_BATCH_SIZE * PASSTHROUGH_SLOT_SIZE);
+    for(int i = 0; i < ASC_SOCKET_BATCH_SIZE; ++i)
+    {
+        mod->passthrough.msg[i].buffer = &mod->passthrough.buffer[i * PASSTHROUGH_SLOT_SIZE];
+        mod->passthrough.msg[i].size = PASSTHROUGH_SLOT_SIZE;
+    }
+
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "passthrough");
+    mod->passthrough.idx_input = luaL_ref(lua, LUA_REGISTRYINDEX);
+    passthrough_set_receiver(mod, true);
+}
+
+static void passthrough_destroy(module_data_t *mod)
+{
+    passthrough_set_receiver(mod, false);
+    passthrough_flush(mod);
+
+    luaL_unref(lua, LUA_REGISTRYINDEX, mod->passthrough.idx_input);
+    mod->passthrough.idx_input = 0;
+
+    free(mod->passthrough.buffer);
+    mod->passthrough.buffer = NULL;
+
+    if(mod->passthrough.pid_list)
+    {
+        free(mod->passthrough.pid_list);
+        mod->passthrough.pid_list = NULL;
+    }
+}
+
+static void update_socket_stats(module_data_t *mod)
+{
+    if(!asc_socket_get_stats(mod->sock, &mod->stats.sock))
+        return;
+
+    if(mod->stats.sock.tx_queue > mod->stats.tx_queue_max)
+        mod->stats.tx_queue_max = mod->stats.sock.tx_queue;
+}
+
+static void timer_stats_callback(void *arg)
+{
+    module_data_t *mod = (module_data_t *)arg;
+    update_socket_stats(mod);
+}
+
+static int method_stats(module_data_t *mod)
+{
+    update_socket_stats(mod);
+
+    lua_newtable(lua);
+    lua_pushnumber(lua, STATS_GET(mod->stats.packets));
+    lua_setfield(lua, -2, "packets");
+    lua_pushnumber(lua, STATS_GET(mod->stats.bytes));
+    lua_setfield(lua, -2, "bytes");
+    lua_pushnumber(lua, STATS_GET(mod->stats.errors));
+    lua_setfield(lua, -2, "errors");
+    lua_pushnumber(lua, mod->stats.sock.tx_queue);
+    lua_setfield(lua, -2, "tx_queue");
+    lua_pushnumber(lua, mod->stats.tx_queue_max);
+    lua_setfield(lua, -2, "tx_queue_max");
+    lua_pushnumber(lua, mod->stats.sock.sndbuf);
+    lua_setfield(lua, -2, "sndbuf");
+    lua_pushnumber(lua, mod->stats.sock.wmem);
+    lua_setfield(lua, -2, "wmem");
+
+    if(mod->dest_list)
+    {
+        lua_newtable(lua);
+        for(int i = 0; i < mod->dest_count; ++i)
+        {
+            const output_dest_t *d = &mod->dest_list[i];
+
+            lua_pushnumber(lua, i + 1);
+            lua_newtable(lua);
+            lua_pushstring(lua, d->addr);
+            lua_setfield(lua, -2, "addr");
+            lua_pushnumber(lua, d->dest.port);
+            lua_setfield(lua, -2, "port");
+            lua_pushnumber(lua, STATS_GET(d->packets));
+            lua_setfield(lua, -2, "packets");
+            lua_pushnumber(lua, STATS_GET(d->errors));
+            lua_setfield(lua, -2, "errors");
+            lua_pushnumber(lua, STATS_GET(d->backoff));
+            lua_setfield(lua, -2, "backoff");
+            lua_settable(lua, -3);
+        }
+        lua_setfield(lua, -2, "destinations");
+    }
+
+    if(mod->passthrough.pid_list)
+    {
+        lua_newtable(lua);
+        int index = 1;
+        for(int pid = 0; pid < MAX_PID; ++pid)
+        {
+            const output_pid_t *item = &mod->passthrough.pid_list[pid];
+            if(item->packets == 0)
+                continue;
+
+            lua_pushnumber(lua, index++);
+            lua_newtable(lua);
+            lua_pushnumber(lua, pid);
+            lua_setfield(lua, -2, "pid");
+            lua_pushnumber(lua, item->packets);
+            lua_setfield(lua, -2, "packets");
+            lua_pushnumber(lua, item->cc_errors);
+            lua_setfield(lua, -2, "cc_errors");
+            lua_settable(lua, -3);
+        }
+        lua_setfield(lua, -2, "pids");
+    }
+
+    return 1;
+}
+
 static void thread_input_push(module_data_t *mod, const uint8_t *ts)
 {
     const ssize_t r = asc_thread_buffer_write(mod->thread_input, ts, TS_PACKET_SIZE);
@@ -341,14 +801,93 @@ static void thread_loop(void *arg)
     }
 }
 
+static asc_socket_t * open_socket(module_data_t *mod, int port)
+{
+    asc_socket_t *sock = asc_socket_open_udp4(mod);
+    asc_socket_set_reuseaddr(sock, 1);
+    if(!asc_socket_bind(sock, NULL, 0))
+        astra_abort();
+
+    int value;
+    if(module_option_number("socket_size", &value))
+        asc_socket_set_buffer(sock, 0, value);
+
+    const char *localaddr = NULL;
+    module_option_string("localaddr", &localaddr, NULL);
+    if(localaddr)
+        asc_socket_set_multicast_if(sock, localaddr);
+
+    value = 32;
+    module_option_number("ttl", &value);
+    asc_socket_set_multicast_ttl(sock, value);
+
+    if(!mod->dest_list)
+    {
+        asc_socket_multicast_join(sock, mod->addr, NULL);
+        asc_socket_set_sockaddr(sock, mod->addr, port);
+    }
+
+    return sock;
+}
+
+static void add_destination(module_data_t *mod, const char *addr, int port)
+{
+    asc_assert(mod->dest_count < MAX_DESTINATIONS, MSG("too many destinations"));
+
+    const uint32_t value = inet_addr(addr);
+    asc_assert(value != INADDR_NONE, MSG("wrong destination address: %s"), addr);
+
+    output_dest_t *d = &mod->dest_list[mod->dest_count];
+    ++mod->dest_count;
+
+    snprintf(d->addr, sizeof(d->addr), "%s", addr);
+    d->dest.addr = value;
+    d->dest.port = port;
+}
+
+static void parse_destinations(module_data_t *mod)
+{
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "destinations");
+    if(lua_istable(lua, -1))
+    {
+        mod->dest_list = (output_dest_t *)calloc(MAX_DESTINATIONS, sizeof(output_dest_t));
+
+        if(mod->addr)
+            add_destination(mod, mod->addr, mod->port);
+
+        lua_foreach(lua, -2)
+        {
+            asc_assert(lua_istable(lua, -1), MSG("option 'destinations': table required"));
+
+            lua_getfield(lua, -1, "addr");
+            asc_assert(lua_isstring(lua, -1), MSG("option 'destinations': addr required"));
+            const char *addr = lua_tostring(lua, -1);
+
+            int port = mod->port;
+            lua_getfield(lua, -2, "port");
+            if(lua_isnumber(lua, -1))
+                port = lua_tointeger(lua, -1);
+
+            add_destination(mod, addr, port);
+            lua_pop(lua, 2); // addr, port
+        }
+
+        asc_assert(mod->dest_count > 0, MSG("option 'destinations' is empty"));
+        mod->addr = mod->dest_list[0].addr;
+    }
+    lua_pop(lua, 1); // destinations
+}
+
 static void module_init(module_data_t *mod)
 {
     module_option_string("addr", &mod->addr, NULL);
-    asc_assert(mod->addr != NULL, "[udp_output] option 'addr' is required");
 
     mod->port = 1234;
     module_option_number("port", &mod->port);
 
+    parse_destinations(mod);
+    asc_assert(mod->addr != NULL, "[udp_output] option 'addr' is required");
+
     module_option_boolean("rtp", &mod->is_rtp);
     if(mod->is_rtp)
     {
@@ -365,30 +904,37 @@ static void module_init(module_data_t *mod)
         mod->packet.buffer[11] = (rtpssrc      ) & 0xFF;
     }
 
-    mod->sock = asc_socket_open_udp4(mod);
-    asc_socket_set_reuseaddr(mod->sock, 1);
-    if(!asc_socket_bind(mod->sock, NULL, 0))
-        astra_abort();
-
-    int value;
-    if(module_option_number("socket_size", &value))
-        asc_socket_set_buffer(mod->sock, 0, value);
-
-    const char *localaddr = NULL;
-    module_option_string("localaddr", &localaddr, NULL);
-    if(localaddr)
-        asc_socket_set_multicast_if(mod->sock, localaddr);
+    mod->sock = open_socket(mod, mod->port);
+    mod->timer_stats = asc_timer_init(STATS_INTERVAL, timer_stats_callback, mod);
 
-    value = 32;
-    module_option_number("ttl", &value);
-    asc_socket_set_multicast_ttl(mod->sock, value);
+    int fec_columns = 0, fec_rows = 0;
+    module_option_number("fec_columns", &fec_columns);
+    module_option_number("fec_rows", &fec_rows);
+    if(fec_columns > 0 || fec_rows > 0)
+    {
+        asc_assert(mod->is_rtp, MSG("FEC requires option 'rtp'"));
+        asc_assert(  fec_columns > 0 && fec_columns <= FEC_MAX_L
+                   && fec_rows > 0 && fec_rows <= FEC_MAX_D
+                   && fec_columns * fec_rows <= FEC_MAX_MATRIX
+                   , MSG("wrong FEC matrix size"));
+
+        mod->fec = udp_fec_encoder_init(fec_columns, fec_rows, on_fec, mod);
+        mod->sock_fec_column = open_socket(mod, mod->port + FEC_COLUMN_PORT);
+        mod->sock_fec_row = open_socket(mod, mod->port + FEC_ROW_PORT);
+    }
 
-    asc_socket_multicast_join(mod->sock, mod->addr, NULL);
-    asc_socket_set_sockaddr(mod->sock, mod->addr, mod->port);
+    lua_getfield(lua, MODULE_OPTIONS_IDX, "passthrough");
+    const bool is_passthrough = lua_istable(lua, -1);
+    lua_pop(lua, 1);
 
-    value = 0;
+    int value = 0;
     module_option_number("sync", &value);
-    if(value > 0)
+    if(is_passthrough)
+    {
+        module_stream_init(mod, NULL);
+        passthrough_init(mod);
+    }
+    else if(value > 0)
     {
         module_stream_init(mod, thread_input_push);
 
@@ -415,9 +961,18 @@ static void module_destroy(module_data_t *mod)
 {
     module_stream_destroy(mod);
 
+    if(mod->passthrough.buffer)
+        passthrough_destroy(mod);
+
     if(mod->thread)
         on_thread_close(mod);
 
+    if(mod->timer_stats)
+    {
+        asc_timer_destroy(mod->timer_stats);
+        mod->timer_stats = NULL;
+    }
+
     if(mod->sync.buffer)
     {
         free(mod->sync.buffer);
@@ -429,11 +984,29 @@ static void module_destroy(module_data_t *mod)
         asc_socket_close(mod->sock);
         mod->sock = NULL;
     }
+
+    if(mod->fec)
+    {
+        udp_fec_encoder_destroy(mod->fec);
+        mod->fec = NULL;
+
+        asc_socket_close(mod->sock_fec_column);
+        mod->sock_fec_column = NULL;
+        asc_socket_close(mod->sock_fec_row);
+        mod->sock_fec_row = NULL;
+    }
+
+    if(mod->dest_list)
+    {
+        free(mod->dest_list);
+        mod->dest_list = NULL;
+    }
 }
 
 MODULE_STREAM_METHODS()
 MODULE_LUA_METHODS()
 {
-    MODULE_STREAM_METHODS_REF()
+    MODULE_STREAM_METHODS_REF(),
+    { "stats", method_stats },
 };
 MODULE_LUA_REGISTER(udp_output)
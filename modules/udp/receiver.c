@@ -0,0 +1,394 @@
+/*
+ * Astra Module: UDP
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Shared receiver. All udp_input instances with the same port and local
+ * interface share single socket bound to INADDR_ANY. Each group is joined on
+ * this socket, the destination address of the datagram is obtained with
+ * IP_PKTINFO and used to find the instance. Datagrams are read in batches,
+ * so one wakeup serves many groups.
+ *
+ * Default limit of the memberships per socket is 20,
+ * increase net.ipv4.igmp_max_memberships for more groups.
+ */
+
+#include "udp.h"
+
+#ifndef _WIN32
+#   include <arpa/inet.h>
+#endif
+
+#define MSG(_msg) "[udp_receiver %s:%d] " _msg \
+    , (receiver->localaddr) ? receiver->localaddr : "*", receiver->port
+
+typedef struct
+{
+    uint32_t addr;
+    const char *addr_str;
+    const char *source;
+    udp_datagram_callback_t callback;
+    void *arg;
+} receiver_member_t;
+
+struct udp_receiver_t
+{
+    int port;
+    char *localaddr;
+
+    asc_socket_t *sock;
+    asc_timer_t *timer_renew;
+
+    uint32_t drops;
+
+    bool is_busy;   /* datagrams are processing */
+    bool is_closed; /* last member is detached while busy or socket is failed */
+
+    int member_count;
+    int member_size;
+    receiver_member_t *member_list;
+
+    /* open addressing hash table. index in the member_list + 1, 0 - empty */
+    uint32_t table_mask;
+    int *table;
+
+    uint8_t *batch;
+    asc_socket_msg_t msg[ASC_SOCKET_BATCH_SIZE];
+};
+
+static asc_list_t *receiver_list = NULL;
+
+static uint32_t member_hash(uint32_t addr)
+{
+    return (ntohl(addr) * 2654435761U);
+}
+
+static void table_rebuild(udp_receiver_t *receiver)
+{
+    uint32_t size = 16;
+    while(size < (uint32_t)receiver->member_count * 2)
+        size *= 2;
+
+    if(receiver->table_mask + 1 != size)
+    {
+        free(receiver->table);
+        receiver->table = (int *)malloc(size * sizeof(int));
+        receiver->table_mask = size - 1;
+    }
+    memset(receiver->table, 0, size * sizeof(int));
+
+    for(int i = 0; i < receiver->member_count; ++i)
+    {
+        uint32_t slot = member_hash(receiver->member_list[i].addr) & receiver->table_mask;
+        while(receiver->table[slot] != 0)
+            slot = (slot + 1) & receiver->table_mask;
+        receiver->table[slot] = i + 1;
+    }
+}
+
+static receiver_member_t * member_find(udp_receiver_t *receiver, uint32_t addr)
+{
+    uint32_t slot = member_hash(addr) & receiver->table_mask;
+    while(receiver->table[slot] != 0)
+    {
+        receiver_member_t *member = &receiver->member_list[receiver->table[slot] - 1];
+        if(member->addr == addr)
+            return member;
+        slot = (slot + 1) & receiver->table_mask;
+    }
+    return NULL;
+}
+
+static void receiver_unlink(udp_receiver_t *receiver)
+{
+    if(!receiver_list)
+        return;
+
+    asc_list_remove_item(receiver_list, receiver);
+    if(asc_list_size(receiver_list) == 0)
+    {
+        asc_list_destroy(receiver_list);
+        receiver_list = NULL;
+    }
+}
+
+static void receiver_destroy(udp_receiver_t *receiver)
+{
+    receiver_unlink(receiver);
+
+    if(receiver->timer_renew)
+        asc_timer_destroy(receiver->timer_renew);
+
+    if(receiver->sock)
+        asc_socket_close(receiver->sock);
+
+    free(receiver->localaddr);
+    free(receiver->member_list);
+    free(receiver->table);
+    free(receiver->batch);
+    free(receiver);
+}
+
+static void on_read(void *arg)
+{
+    udp_receiver_t *receiver = (udp_receiver_t *)arg;
+
+    const int count = asc_socket_recv_batch(receiver->sock, receiver->msg, ASC_SOCKET_BATCH_SIZE);
+    if(count <= 0)
+    {
+        if(count == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+
+        asc_log_error(MSG("failed to receive datagrams (%s)"), asc_socket_error());
+        return;
+    }
+
+    receiver->is_busy = true;
+
+    for(int i = 0; i < count && !receiver->is_closed; ++i)
+    {
+        const asc_socket_msg_t *msg = &receiver->msg[i];
+        const receiver_member_t *member = member_find(receiver, msg->addr);
+        if(member)
+            member->callback(member->arg, msg->buffer, msg->length, msg->timestamp);
+    }
+
+    /* end of the batch */
+    for(int i = 0; i < receiver->member_count && !receiver->is_closed; ++i)
+    {
+        const receiver_member_t *member = &receiver->member_list[i];
+        member->callback(member->arg, NULL, 0, 0);
+    }
+
+    receiver->is_busy = false;
+
+    if(receiver->is_closed)
+    {
+        receiver_destroy(receiver);
+        return;
+    }
+
+    if(receiver->msg[count - 1].drops > receiver->drops)
+        receiver->drops = receiver->msg[count - 1].drops;
+}
+
+static void on_close(void *arg)
+{
+    udp_receiver_t *receiver = (udp_receiver_t *)arg;
+
+    asc_log_error(MSG("socket closed"));
+
+    /* receiver is not available for the new members */
+    receiver->is_closed = true;
+    receiver_unlink(receiver);
+
+    if(receiver->timer_renew)
+    {
+        asc_timer_destroy(receiver->timer_renew);
+        receiver->timer_renew = NULL;
+    }
+
+    asc_socket_close(receiver->sock);
+    receiver->sock = NULL;
+
+    /* members are released with the receiver, each instance should attach again */
+    const int member_count = receiver->member_count;
+    receiver_member_t *member_list = receiver->member_list;
+    receiver->member_count = 0;
+    receiver->member_list = NULL;
+
+    if(!receiver->is_busy)
+        receiver_destroy(receiver);
+
+    for(int i = 0; i < member_count; ++i)
+        member_list[i].callback(member_list[i].arg, NULL, UDP_RECEIVER_ERROR, 0);
+
+    free(member_list);
+}
+
+static void timer_renew_callback(void *arg)
+{
+    udp_receiver_t *receiver = (udp_receiver_t *)arg;
+
+    for(int i = 0; i < receiver->member_count; ++i)
+    {
+        const receiver_member_t *member = &receiver->member_list[i];
+        asc_socket_multicast_drop_membership(  receiver->sock, member->addr_str
+                                             , receiver->localaddr, member->source);
+        asc_socket_multicast_add_membership(  receiver->sock, member->addr_str
+                                            , receiver->localaddr, member->source);
+    }
+}
+
+static udp_receiver_t * receiver_open(int port, const char *localaddr, int socket_size)
+{
+    udp_receiver_t *receiver = (udp_receiver_t *)calloc(1, sizeof(udp_receiver_t));
+    receiver->port = port;
+    receiver->localaddr = (localaddr) ? strdup(localaddr) : NULL;
+
+    receiver->sock = asc_socket_open_udp4(receiver);
+    asc_socket_set_reuseaddr(receiver->sock, 1);
+    if(!asc_socket_bind(receiver->sock, NULL, port))
+    {
+        asc_socket_close(receiver->sock);
+        free(receiver->localaddr);
+        free(receiver);
+        return NULL;
+    }
+
+    if(socket_size > 0)
+        asc_socket_set_buffer(receiver->sock, socket_size, 0);
+
+    asc_socket_set_timestamp(receiver->sock, 1);
+    asc_socket_set_rxq_ovfl(receiver->sock, 1);
+    /* only groups joined on this socket, not joined by other sockets on the host */
+    if(!asc_socket_set_multicast_all(receiver->sock, 0))
+        asc_log_warning(MSG("IP_MULTICAST_ALL is not available"));
+    if(!asc_socket_set_pktinfo(receiver->sock, 1))
+        asc_log_error(MSG("IP_PKTINFO is not available"));
+
+    receiver->batch = (uint8_t *)malloc(ASC_SOCKET_BATCH_SIZE * UDP_BUFFER_SIZE);
+    for(int i = 0; i < ASC_SOCKET_BATCH_SIZE; ++i)
+    {
+        receiver->msg[i].buffer = &receiver->batch[i * UDP_BUFFER_SIZE];
+        receiver->msg[i].size = UDP_BUFFER_SIZE;
+    }
+
+    table_rebuild(receiver);
+
+    asc_socket_set_on_read(receiver->sock, on_read);
+    asc_socket_set_on_close(receiver->sock, on_close);
+
+    if(!receiver_list)
+        receiver_list = asc_list_init();
+    asc_list_insert_tail(receiver_list, receiver);
+
+    return receiver;
+}
+
+udp_receiver_t * udp_receiver_attach(  int port, const char *localaddr
+                                     , const char *addr, const char *source
+                                     , int socket_size, int renew
+                                     , udp_datagram_callback_t callback, void *arg)
+{
+    const uint32_t group = inet_addr(addr);
+    if(group == INADDR_NONE)
+        return NULL;
+
+    udp_receiver_t *receiver = NULL;
+    if(receiver_list)
+    {
+        asc_list_for(receiver_list)
+        {
+            udp_receiver_t *item = (udp_receiver_t *)asc_list_data(receiver_list);
+            if(  item->port == port && !item->is_closed
+               && ((!item->localaddr && !localaddr)
+                   || (item->localaddr && localaddr && !strcmp(item->localaddr, localaddr))))
+            {
+                receiver = item;
+                break;
+            }
+        }
+    }
+
+    if(!receiver)
+    {
+        receiver = receiver_open(port, localaddr, socket_size);
+        if(!receiver)
+            return NULL;
+    }
+
+    if(member_find(receiver, group))
+    {
+        asc_log_error(MSG("group %s is already in use"), addr);
+        return NULL;
+    }
+
+    if(IN_MULTICAST(ntohl(group))
+       && !asc_socket_multicast_add_membership(receiver->sock, addr, localaddr, source))
+    {
+        if(receiver->member_count == 0)
+            receiver_destroy(receiver);
+        return NULL;
+    }
+
+    if(receiver->member_count == receiver->member_size)
+    {
+        receiver->member_size = (receiver->member_size > 0) ? receiver->member_size * 2 : 16;
+        receiver->member_list = (receiver_member_t *)realloc(
+            receiver->member_list, receiver->member_size * sizeof(receiver_member_t));
+    }
+
+    receiver_member_t *member = &receiver->member_list[receiver->member_count];
+    ++receiver->member_count;
+    member->addr = group;
+    member->addr_str = addr;
+    member->source = source;
+    member->callback = callback;
+    member->arg = arg;
+
+    table_rebuild(receiver);
+
+    if(renew > 0 && !receiver->timer_renew)
+        receiver->timer_renew = asc_timer_init(renew * 1000, timer_renew_callback, receiver);
+
+    return receiver;
+}
+
+void udp_receiver_detach(udp_receiver_t *receiver, void *arg)
+{
+    for(int i = 0; i < receiver->member_count; ++i)
+    {
+        receiver_member_t *member = &receiver->member_list[i];
+        if(member->arg != arg)
+            continue;
+
+        if(receiver->sock && IN_MULTICAST(ntohl(member->addr)))
+        {
+            asc_socket_multicast_drop_membership(  receiver->sock, member->addr_str
+                                                 , receiver->localaddr, member->source);
+        }
+
+        --receiver->member_count;
+        if(i != receiver->member_count)
+            *member = receiver->member_list[receiver->member_count];
+        break;
+    }
+
+    table_rebuild(receiver);
+
+    if(receiver->member_count > 0)
+        return;
+
+    if(receiver->is_busy)
+        receiver->is_closed = true;
+    else
+        receiver_destroy(receiver);
+}
+
+bool udp_receiver_get_stats(udp_receiver_t *receiver, asc_socket_stats_t *stats)
+{
+    if(!receiver->sock || !asc_socket_get_stats(receiver->sock, stats))
+        return false;
+
+    if(receiver->drops > stats->drops)
+        stats->drops = receiver->drops;
+    return true;
+}
@@ -0,0 +1,278 @@
+/*
+ * Astra Module: UDP
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * RTP reorder buffer. Datagrams are stored in the ring by the sequence number
+ * and emitted in order. Missing datagram is skipped when the next available
+ * datagram waits longer than the latency window. The ring is doubled when
+ * the datagrams received in the latency window do not fit. The buffer is
+ * restarted when the sender jumps back (restart of the sender), detected by
+ * the series of late datagrams without any datagram in the window.
+ */
+
+#include "udp.h"
+
+#define REORDER_SLOT(_reorder, _seq) (&(_reorder)->slots[(_seq) & ((_reorder)->size - 1)])
+
+/* consecutive late datagrams to restart from the sender sequence number */
+#define REORDER_RESYNC_COUNT 16
+
+udp_reorder_t * udp_reorder_init(  unsigned int latency_ms
+                                 , udp_reorder_callback_t callback, void *arg)
+{
+    udp_reorder_t *reorder = (udp_reorder_t *)calloc(1, sizeof(udp_reorder_t));
+    reorder->latency = (uint64_t)latency_ms * 1000;
+    reorder->callback = callback;
+    reorder->arg = arg;
+    reorder->size = UDP_REORDER_SIZE;
+    reorder->slots = (udp_reorder_slot_t *)calloc(reorder->size, sizeof(udp_reorder_slot_t));
+    return reorder;
+}
+
+void udp_reorder_destroy(udp_reorder_t *reorder)
+{
+    free(reorder->slots);
+    free(reorder);
+}
+
+static void emit_slot(udp_reorder_t *reorder, udp_reorder_slot_t *slot)
+{
+    slot->is_used = false;
+    --reorder->count;
+    ++reorder->seq;
+    if(slot->is_recovered)
+        ++reorder->recovered;
+    reorder->callback(reorder->arg, slot->buffer, slot->size);
+}
+
+/* datagram restored by FEC waits for the original until the gap is skipped */
+static void emit_ready(udp_reorder_t *reorder)
+{
+    while(reorder->count > 0)
+    {
+        udp_reorder_slot_t *slot = REORDER_SLOT(reorder, reorder->seq);
+        if(!slot->is_used || slot->seq != reorder->seq || slot->is_recovered)
+            break;
+
+        emit_slot(reorder, slot);
+    }
+
+    reorder->deadline = 0;
+}
+
+/* find the first buffered datagram after the gap and start waiting for it */
+static void update_deadline(udp_reorder_t *reorder)
+{
+    if(reorder->count == 0 || reorder->deadline != 0)
+        return;
+
+    /* head is the gap or the restored datagram */
+    for(uint16_t i = 0; i < reorder->size; ++i)
+    {
+        const uint16_t seq = reorder->seq + i;
+        udp_reorder_slot_t *slot = REORDER_SLOT(reorder, seq);
+        if(slot->is_used && slot->seq == seq)
+        {
+            reorder->deadline = slot->time + reorder->latency;
+            return;
+        }
+    }
+}
+
+static void skip_gap(udp_reorder_t *reorder)
+{
+    while(reorder->count > 0)
+    {
+        udp_reorder_slot_t *slot = REORDER_SLOT(reorder, reorder->seq);
+        if(slot->is_used && slot->seq == reorder->seq)
+        {
+            if(!slot->is_recovered)
+                break;
+
+            /* original is not received in the latency window */
+            emit_slot(reorder, slot);
+            continue;
+        }
+
+        ++reorder->lost;
+        ++reorder->seq;
+    }
+
+    emit_ready(reorder);
+}
+
+/* oldest buffered datagram is still in the latency window. ring is doubled */
+static bool grow(udp_reorder_t *reorder, int diff)
+{
+    if(reorder->count == 0)
+        return false;
+
+    const uint64_t now = asc_utime();
+    update_deadline(reorder);
+    if(reorder->deadline <= now)
+        return false;
+
+    size_t size = reorder->size;
+    while(size <= (size_t)diff && size < UDP_REORDER_MAX)
+        size *= 2;
+
+    if(size <= (size_t)diff)
+    {
+        if(!reorder->is_clamped)
+        {
+            asc_log_warning(  "[udp_reorder] latency window is clamped to %d datagrams"
+                            , UDP_REORDER_MAX);
+            reorder->is_clamped = true;
+        }
+        return false;
+    }
+
+    udp_reorder_slot_t *slots = (udp_reorder_slot_t *)calloc(size, sizeof(udp_reorder_slot_t));
+    for(size_t i = 0; i < reorder->size; ++i)
+    {
+        const udp_reorder_slot_t *slot = &reorder->slots[i];
+        if(slot->is_used)
+            memcpy(&slots[slot->seq & (size - 1)], slot, sizeof(udp_reorder_slot_t));
+    }
+
+    free(reorder->slots);
+    reorder->slots = slots;
+    reorder->size = size;
+    return true;
+}
+
+void udp_reorder_flush(udp_reorder_t *reorder)
+{
+    if(reorder->count == 0)
+        return;
+
+    update_deadline(reorder);
+
+    const uint64_t now = asc_utime();
+    while(reorder->count > 0 && reorder->deadline <= now)
+    {
+        skip_gap(reorder);
+        update_deadline(reorder);
+    }
+}
+
+static void reorder_push(  udp_reorder_t *reorder, const uint8_t *buffer, size_t size
+                         , bool is_recovered)
+{
+    if(size < RTP_HEADER_SIZE)
+        return;
+
+    const uint16_t seq = RTP_GET_SEQ(buffer);
+
+    if(!reorder->is_seq)
+    {
+        reorder->is_seq = true;
+        reorder->seq = seq;
+    }
+
+    int16_t diff = (int16_t)(seq - reorder->seq);
+
+    if(diff < 0)
+    {
+        /* emitted slot keeps the sequence number to detect duplicates */
+        const udp_reorder_slot_t *slot = REORDER_SLOT(reorder, seq);
+        if(slot->seq == seq && -diff < (int)reorder->size)
+        {
+            ++reorder->duplicate;
+            return;
+        }
+
+        ++reorder->late;
+        ++reorder->late_count;
+        if(reorder->late_count < REORDER_RESYNC_COUNT)
+            return;
+
+        /* sender is restarted. emit buffered datagrams and restart from this one */
+        asc_log_debug("[udp_reorder] resync %u -> %u", reorder->seq, seq);
+        while(reorder->count > 0)
+            skip_gap(reorder);
+        reorder->seq = seq;
+        diff = 0;
+    }
+
+    reorder->late_count = 0;
+
+    if(diff >= (int)reorder->size && !grow(reorder, diff))
+    {
+        /* out of the window. emit buffered datagrams and restart from this one */
+        while(reorder->count > 0)
+            skip_gap(reorder);
+        reorder->seq = seq;
+        diff = 0;
+    }
+
+    if(diff == 0 && reorder->count == 0 && !is_recovered)
+    {
+        /* in order. pass without copying */
+        REORDER_SLOT(reorder, seq)->seq = seq;
+        ++reorder->seq;
+        reorder->callback(reorder->arg, buffer, size);
+        return;
+    }
+
+    udp_reorder_slot_t *slot = REORDER_SLOT(reorder, seq);
+    if(slot->is_used && slot->seq == seq)
+    {
+        if(!slot->is_recovered || is_recovered)
+        {
+            ++reorder->duplicate;
+            return;
+        }
+
+        /* original is received in time. restored datagram is replaced */
+        slot->is_recovered = false;
+        slot->size = size;
+        memcpy(slot->buffer, buffer, size);
+    }
+    else
+    {
+        slot->is_used = true;
+        slot->is_recovered = is_recovered;
+        slot->seq = seq;
+        slot->time = asc_utime();
+        slot->size = size;
+        memcpy(slot->buffer, buffer, size);
+        ++reorder->count;
+    }
+
+    if(diff == 0)
+        emit_ready(reorder);
+
+    udp_reorder_flush(reorder);
+}
+
+void udp_reorder_push(udp_reorder_t *reorder, const uint8_t *buffer, size_t size)
+{
+    reorder_push(reorder, buffer, size, false);
+}
+
+/*
+ * datagram restored by FEC. it is emitted and counted in reorder->recovered
+ * if the original datagram is not received until the gap is skipped
+ */
+void udp_reorder_push_recovered(udp_reorder_t *reorder, const uint8_t *buffer, size_t size)
+{
+    reorder_push(reorder, buffer, size, true);
+}
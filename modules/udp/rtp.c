@@ -0,0 +1,38 @@
+/*
+ * Astra Module: UDP
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "udp.h"
+
+/* returns RTP header size with extension or -1 if datagram is too short */
+int rtp_header_size(const uint8_t *buffer, size_t size)
+{
+    if(size < RTP_HEADER_SIZE)
+        return -1;
+
+    if(!RTP_IS_EXT(buffer))
+        return RTP_HEADER_SIZE;
+
+    if(size < RTP_HEADER_SIZE + 4)
+        return -1;
+
+    const int skip = RTP_HEADER_SIZE + RTP_EXT_SIZE(buffer);
+    return (skip <= (int)size) ? skip : -1;
+}
@@ -0,0 +1,182 @@
+/*
+ * Astra Module: UDP
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "udp.h"
+
+/* RFC 3550 A.1 */
+#define RTP_MAX_DROPOUT 3000
+#define RTP_MAX_MISORDER 100
+
+/* upper bound of the each histogram bucket in microseconds. last is unlimited */
+static const uint32_t iat_histogram_limit[UDP_STATS_HISTOGRAM_SIZE - 1] =
+{
+    50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000,
+};
+
+static void update_iat(udp_stats_t *stats, uint64_t time)
+{
+    if(stats->last_time == 0 || time < stats->last_time)
+    {
+        stats->last_time = time;
+        return;
+    }
+
+    const uint64_t iat = (time - stats->last_time) / 1000;
+    stats->last_time = time;
+
+    if(stats->iat_count == 0 || iat < stats->iat_min)
+        stats->iat_min = iat;
+    if(iat > stats->iat_max)
+        stats->iat_max = iat;
+    stats->iat_sum += iat;
+    ++stats->iat_count;
+
+    int i = 0;
+    for(; i < UDP_STATS_HISTOGRAM_SIZE - 1; ++i)
+    {
+        if(iat < iat_histogram_limit[i])
+            break;
+    }
+    ++stats->iat_histogram[i];
+}
+
+static void update_rtp(udp_stats_t *stats, const uint8_t *buffer, uint64_t time)
+{
+    const uint16_t seq = RTP_GET_SEQ(buffer);
+    const uint32_t ts = RTP_GET_TS(buffer);
+
+    if(!stats->is_rtp_seq)
+    {
+        stats->is_rtp_seq = true;
+        stats->rtp_seq = seq + 1;
+        stats->rtp_window = 1;
+        stats->rtp_ts = ts;
+        stats->rtp_time = time;
+        return;
+    }
+
+    const int16_t diff = (int16_t)(seq - stats->rtp_seq);
+    if(diff >= 0 && diff < RTP_MAX_DROPOUT)
+    {
+        stats->rtp_lost += diff;
+        stats->rtp_seq = seq + 1;
+        stats->rtp_window = (diff < 63) ? ((stats->rtp_window << (diff + 1)) | 1) : 1;
+    }
+    else if(diff < 0 && diff >= -RTP_MAX_MISORDER)
+    {
+        const int offset = -diff - 1;
+        if(offset < 64)
+        {
+            const uint64_t bit = (uint64_t)1 << offset;
+            if(stats->rtp_window & bit)
+            {
+                ++stats->rtp_duplicate;
+                return;
+            }
+            stats->rtp_window |= bit;
+        }
+
+        /* late packet was already counted as lost */
+        ++stats->rtp_reordered;
+        if(stats->rtp_lost > 0)
+            --stats->rtp_lost;
+        return;
+    }
+    else
+    {
+        /* sender restart or huge gap */
+        ++stats->rtp_resync;
+        stats->rtp_seq = seq + 1;
+        stats->rtp_window = 1;
+        stats->rtp_ts = ts;
+        stats->rtp_time = time;
+        return;
+    }
+
+    /* D(i,j) = (Rj - Ri) - (Sj - Si), J += (|D(i,j)| - J) / 16 */
+    const int64_t arrival = (int64_t)(time - stats->rtp_time) * RTP_CLOCK_RATE / 1000000000;
+    const int64_t d = arrival - (int32_t)(ts - stats->rtp_ts);
+    stats->rtp_jitter += ((double)((d < 0) ? -d : d) - stats->rtp_jitter) / 16.0;
+
+    stats->rtp_ts = ts;
+    stats->rtp_time = time;
+}
+
+void udp_stats_update(  udp_stats_t *stats, const uint8_t *buffer, size_t size
+                      , uint64_t time, bool is_rtp)
+{
+    if(time == 0)
+        time = asc_utime() * 1000;
+
+    ++stats->packets;
+    stats->bytes += size;
+
+    update_iat(stats, time);
+
+    if(is_rtp && size >= RTP_HEADER_SIZE)
+        update_rtp(stats, buffer, time);
+}
+
+void udp_stats_push(udp_stats_t *stats, bool is_rtp)
+{
+    lua_newtable(lua);
+
+    lua_pushnumber(lua, stats->packets);
+    lua_setfield(lua, -2, "packets");
+    lua_pushnumber(lua, stats->bytes);
+    lua_setfield(lua, -2, "bytes");
+
+    lua_pushnumber(lua, stats->iat_min);
+    lua_setfield(lua, -2, "iat_min");
+    lua_pushnumber(lua, stats->iat_max);
+    lua_setfield(lua, -2, "iat_max");
+    lua_pushnumber(lua, (stats->iat_count > 0) ? (stats->iat_sum / stats->iat_count) : 0);
+    lua_setfield(lua, -2, "iat_avg");
+
+    lua_newtable(lua);
+    for(int i = 0; i < UDP_STATS_HISTOGRAM_SIZE; ++i)
+    {
+        lua_pushnumber(lua, i + 1);
+        lua_newtable(lua);
+        if(i < UDP_STATS_HISTOGRAM_SIZE - 1)
+        {
+            lua_pushnumber(lua, iat_histogram_limit[i]);
+            lua_setfield(lua, -2, "limit");
+        }
+        lua_pushnumber(lua, stats->iat_histogram[i]);
+        lua_setfield(lua, -2, "count");
+        lua_settable(lua, -3);
+    }
+    lua_setfield(lua, -2, "iat_histogram");
+
+    if(is_rtp)
+    {
+        lua_pushnumber(lua, stats->rtp_jitter * 1000.0 / RTP_CLOCK_RATE);
+        lua_setfield(lua, -2, "jitter");
+        lua_pushnumber(lua, stats->rtp_lost);
+        lua_setfield(lua, -2, "lost");
+        lua_pushnumber(lua, stats->rtp_reordered);
+        lua_setfield(lua, -2, "reordered");
+        lua_pushnumber(lua, stats->rtp_duplicate);
+        lua_setfield(lua, -2, "duplicate");
+        lua_pushnumber(lua, stats->rtp_resync);
+        lua_setfield(lua, -2, "resync");
+    }
+}
@@ -0,0 +1,253 @@
+/*
+ * Astra Module: UDP
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _UDP_H_
+#define _UDP_H_ 1
+
+#include <astra.h>
+
+#define UDP_BUFFER_SIZE 1460
+
+/* RTP */
+
+#define RTP_HEADER_SIZE 12
+
+#define RTP_IS_EXT(_data) ((_data[0] & 0x10))
+#define RTP_EXT_SIZE(_data) \
+    (((_data[RTP_HEADER_SIZE + 2] << 8) | _data[RTP_HEADER_SIZE + 3]) * 4 + 4)
+
+#define RTP_GET_SEQ(_data) ((uint16_t)((_data[2] << 8) | _data[3]))
+#define RTP_GET_TS(_data) \
+    (((uint32_t)_data[4] << 24) | (_data[5] << 16) | (_data[6] << 8) | (_data[7]))
+
+/* RTP clock rate for MPEG-TS payload (RFC 2250) */
+#define RTP_CLOCK_RATE 90000
+
+int rtp_header_size(const uint8_t *buffer, size_t size);
+
+/* arg, datagram, size, receive time in nanoseconds, 0 if not available */
+typedef void (*udp_receiver_callback_t)(void *, const uint8_t *, size_t, uint64_t);
+
+/* Stats */
+
+#define UDP_STATS_HISTOGRAM_SIZE 12
+
+typedef struct
+{
+    uint64_t packets;
+    uint64_t bytes;
+
+    /* inter-arrival time in microseconds */
+    uint64_t last_time; /* in nanoseconds */
+    uint64_t iat_min;
+    uint64_t iat_max;
+    uint64_t iat_sum;
+    uint64_t iat_count;
+    uint64_t iat_histogram[UDP_STATS_HISTOGRAM_SIZE];
+
+    /* RTP */
+    bool is_rtp_seq;
+    uint16_t rtp_seq;
+    uint64_t rtp_window; /* bit N is set if (rtp_seq - 1 - N) is received */
+    uint32_t rtp_ts;
+    uint64_t rtp_time;
+    double rtp_jitter; /* RFC 3550 interarrival jitter in timestamp units */
+    uint64_t rtp_lost;
+    uint64_t rtp_reordered;
+    uint64_t rtp_duplicate;
+    uint64_t rtp_resync;
+} udp_stats_t;
+
+void udp_stats_update(  udp_stats_t *stats, const uint8_t *buffer, size_t size
+                      , uint64_t time, bool is_rtp);
+void udp_stats_push(udp_stats_t *stats, bool is_rtp);
+
+/* Reorder */
+
+#define UDP_REORDER_SIZE 1024 /* initial ring size. must be power of 2 */
+#define UDP_REORDER_MAX 16384 /* ring grows up to this size for the latency window */
+
+typedef void (*udp_reorder_callback_t)(void *, const uint8_t *, size_t);
+
+typedef struct
+{
+    bool is_used;
+    bool is_recovered;
+    uint16_t seq;
+    uint64_t time;
+    size_t size;
+    uint8_t buffer[UDP_BUFFER_SIZE];
+} udp_reorder_slot_t;
+
+typedef struct
+{
+    uint64_t latency;   /* in microseconds */
+
+    udp_reorder_callback_t callback;
+    void *arg;
+
+    bool is_seq;
+    uint16_t seq;       /* next sequence number to emit */
+    size_t count;       /* number of buffered datagrams */
+    uint64_t deadline;  /* time to skip missing datagram at the head */
+
+    uint64_t late;
+    uint64_t duplicate;
+    uint64_t lost;
+    uint64_t recovered; /* emitted datagrams restored by FEC */
+
+    int late_count;     /* consecutive late datagrams */
+
+    bool is_clamped;    /* window is limited by UDP_REORDER_MAX */
+
+    size_t size;
+    udp_reorder_slot_t *slots;
+} udp_reorder_t;
+
+udp_reorder_t * udp_reorder_init(  unsigned int latency_ms
+                                 , udp_reorder_callback_t callback, void *arg);
+void udp_reorder_destroy(udp_reorder_t *reorder);
+void udp_reorder_push(udp_reorder_t *reorder, const uint8_t *buffer, size_t size);
+void udp_reorder_push_recovered(udp_reorder_t *reorder, const uint8_t *buffer, size_t size);
+void udp_reorder_flush(udp_reorder_t *reorder);
+
+/* FEC. SMPTE 2022-1 */
+
+#define FEC_HEADER_SIZE 16
+#define FEC_PACKET_SIZE (RTP_HEADER_SIZE + FEC_HEADER_SIZE + UDP_BUFFER_SIZE)
+
+#define FEC_MAX_L 20
+#define FEC_MAX_D 20
+#define FEC_MAX_MATRIX 100
+
+#define FEC_COLUMN_PORT 2
+#define FEC_ROW_PORT 4
+
+#define FEC_HISTORY_SIZE 256 /* must be power of 2 */
+#define FEC_PENDING_SIZE 64
+
+typedef void (*udp_fec_callback_t)(void *, bool, const uint8_t *, size_t);
+
+typedef struct
+{
+    size_t size;
+    uint16_t length;
+    uint8_t pt;
+    uint32_t ts;
+    uint8_t payload[UDP_BUFFER_SIZE];
+} udp_fec_block_t;
+
+typedef struct
+{
+    int l;
+    int d;
+    int index;          /* position in the matrix */
+    uint16_t sn_base;
+
+    uint16_t column_seq;
+    uint16_t row_seq;
+
+    udp_fec_callback_t callback; /* arg, is_row, packet, size */
+    void *arg;
+
+    udp_fec_block_t row;
+    udp_fec_block_t *columns;
+
+    uint8_t packet[FEC_PACKET_SIZE];
+} udp_fec_encoder_t;
+
+typedef struct
+{
+    bool is_used;
+    uint16_t seq;
+    size_t size;
+    uint8_t buffer[UDP_BUFFER_SIZE];
+} udp_fec_media_t;
+
+typedef struct
+{
+    bool is_used;
+    uint16_t sn_base;
+    uint8_t offset;
+    uint8_t na;
+    size_t size;
+    uint8_t buffer[FEC_PACKET_SIZE];
+} udp_fec_pending_t;
+
+typedef struct
+{
+    udp_fec_callback_t callback; /* arg, false, packet, size */
+    void *arg;
+
+    uint64_t fec_packets;
+    uint64_t recovered; /* made by the decoder. original may be received later */
+    uint64_t errors;
+
+    int pending_next;
+    udp_fec_pending_t *pending;
+    udp_fec_media_t *history;
+
+    uint8_t packet[UDP_BUFFER_SIZE];
+} udp_fec_decoder_t;
+
+void udp_fec_xor(uint8_t *dst, const uint8_t *src, size_t size);
+
+udp_fec_encoder_t * udp_fec_encoder_init(int l, int d, udp_fec_callback_t callback, void *arg);
+void udp_fec_encoder_destroy(udp_fec_encoder_t *enc);
+void udp_fec_encoder_push(udp_fec_encoder_t *enc, const uint8_t *buffer, size_t size);
+
+udp_fec_decoder_t * udp_fec_decoder_init(udp_fec_callback_t callback, void *arg);
+void udp_fec_decoder_destroy(udp_fec_decoder_t *dec);
+void udp_fec_decoder_push_media(udp_fec_decoder_t *dec, const uint8_t *buffer, size_t size);
+void udp_fec_decoder_push_fec(udp_fec_decoder_t *dec, const uint8_t *buffer, size_t size);
+
+/*
+ * Shared receiver. single socket for many groups on the same port.
+ * callback with NULL buffer: zero size - end of the batch,
+ * UDP_RECEIVER_ERROR - socket is failed, member is detached and should attach again
+ */
+
+#define UDP_RECEIVER_ERROR ((size_t)-1)
+
+typedef void (*udp_datagram_callback_t)(void *, const uint8_t *, size_t, uint64_t);
+
+typedef struct udp_receiver_t udp_receiver_t;
+
+udp_receiver_t * udp_receiver_attach(  int port, const char *localaddr
+                                     , const char *addr, const char *source
+                                     , int socket_size, int renew
+                                     , udp_datagram_callback_t callback, void *arg);
+void udp_receiver_detach(udp_receiver_t *receiver, void *arg);
+bool udp_receiver_get_stats(udp_receiver_t *receiver, asc_socket_stats_t *stats);
+
+/* AF_XDP receiver. datagrams are redirected by the XDP program */
+
+typedef struct udp_xdp_t udp_xdp_t;
+
+#ifdef HAVE_XDP
+udp_xdp_t * udp_xdp_attach(  const char *ifname, bool is_native
+                           , const char *localaddr, const char *addr, int port
+                           , const char *source
+                           , udp_datagram_callback_t callback, void *arg);
+void udp_xdp_detach(udp_xdp_t *xdp, void *arg);
+bool udp_xdp_get_stats(udp_xdp_t *xdp, asc_socket_stats_t *stats);
+#endif
+
+#endif /* _UDP_H_ */
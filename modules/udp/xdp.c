@@ -0,0 +1,902 @@
+/*
+ * Astra Module: UDP (AF_XDP receiver)
+ * http://cesbo.com/astra
+ *
+ * Copyright (C) 2012-2015, Andrey Dyldin <and@cesbo.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * AF_XDP receiver. Small XDP program is attached to the ingress interface.
+ * UDP datagrams for the registered groups (destination address and port are
+ * stored in the BPF hash map) are redirected to the AF_XDP socket,
+ * all other traffic is passed to the network stack. Frames are read from the
+ * UMEM ring and passed to the udp_input instances without socket-layer copies.
+ * Traffic could be spread by RSS, so the socket with own UMEM is bound
+ * on each receiving queue of the interface.
+ *
+ * Program is loaded with the bpf() syscall and attached over netlink,
+ * libbpf is not required. Generic (SKB) mode works on any interface,
+ * including veth. Native mode requires driver support.
+ * Groups are joined on a plain UDP socket to keep IGMP membership.
+ *
+ * Requires CAP_NET_ADMIN and CAP_BPF (or root).
+ */
+
+#include "udp.h"
+
+#ifdef HAVE_XDP
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#ifndef AF_XDP
+#   define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#   define SOL_XDP 283
+#endif
+
+#define MSG(_msg) "[udp_xdp %s] " _msg, xdp->ifname
+
+#define XDP_FRAME_SIZE 2048
+/* frames per queue. reduced down to XDP_FRAME_COUNT_MIN on interfaces with many queues */
+#define XDP_FRAME_COUNT 4096
+#define XDP_FRAME_COUNT_MIN 1024
+#define XDP_COMPLETION_SIZE 64
+
+#define XDP_GROUPS_MAX 1024
+#define XDP_QUEUES_MAX 64
+
+/* Ethernet + IPv4 without options + UDP */
+#define XDP_HEADER_SIZE (14 + 20 + 8)
+
+typedef struct
+{
+    uint32_t addr;  /* network byte order */
+    uint32_t port;  /* network byte order in the low 16 bits */
+} xdp_key_t;
+
+typedef struct
+{
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *ring;
+    uint32_t mask;
+
+    void *map;
+    size_t map_size;
+} xdp_ring_t;
+
+typedef struct
+{
+    xdp_key_t key;
+    const char *addr_str;
+    const char *source;
+    uint32_t source_addr; /* network byte order, 0 - any */
+    udp_datagram_callback_t callback;
+    void *arg;
+} xdp_member_t;
+
+typedef struct
+{
+    udp_xdp_t *xdp;
+    int queue;
+
+    int fd;
+    asc_event_t *event;
+
+    uint8_t *umem;
+    size_t umem_size;
+    uint32_t frame_count;
+    xdp_ring_t fill;
+    xdp_ring_t rx;
+} xdp_queue_t;
+
+struct udp_xdp_t
+{
+    char ifname[IF_NAMESIZE];
+    int ifindex;
+    uint32_t flags;     /* XDP_FLAGS_SKB_MODE or XDP_FLAGS_DRV_MODE */
+    char *localaddr;
+
+    int map_xsks;
+    int map_groups;
+    int prog;
+    bool is_attached;
+
+    int queue_count;
+    xdp_queue_t *queue_list;
+
+    asc_socket_t *sock; /* multicast membership */
+
+    bool is_busy;
+    bool is_closed;
+
+    int member_count;
+    int member_size;
+    xdp_member_t *member_list;
+
+    /* open addressing hash table. index in the member_list + 1, 0 - empty */
+    uint32_t table_mask;
+    int *table;
+};
+
+static asc_list_t *xdp_list = NULL;
+
+/*
+ * oooooooooo oooooooooo  oooooooooo
+ *  888    888 888    888  888    888
+ *  888oooo88  888oooo88   888oooo88
+ *  888    888 888         888
+ * o888ooo888 o888o       o888o
+ *
+ */
+
+#define INSN(_code, _dst, _src, _off, _imm) \
+    { .code = (_code), .dst_reg = (_dst), .src_reg = (_src), .off = (_off), .imm = (_imm) }
+
+#define INSN_MOV(_dst, _src) INSN(BPF_ALU64 | BPF_MOV | BPF_X, _dst, _src, 0, 0)
+#define INSN_MOV_IMM(_dst, _imm) INSN(BPF_ALU64 | BPF_MOV | BPF_K, _dst, 0, 0, _imm)
+#define INSN_ADD_IMM(_dst, _imm) INSN(BPF_ALU64 | BPF_ADD | BPF_K, _dst, 0, 0, _imm)
+#define INSN_AND_IMM(_dst, _imm) INSN(BPF_ALU64 | BPF_AND | BPF_K, _dst, 0, 0, _imm)
+#define INSN_LDX(_size, _dst, _src, _off) INSN(BPF_LDX | _size | BPF_MEM, _dst, _src, _off, 0)
+#define INSN_STX(_size, _dst, _src, _off) INSN(BPF_STX | _size | BPF_MEM, _dst, _src, _off, 0)
+#define INSN_LD_MAP(_dst, _fd) \
+    INSN(BPF_LD | BPF_DW | BPF_IMM, _dst, BPF_PSEUDO_MAP_FD, 0, _fd), INSN(0, 0, 0, 0, 0)
+#define INSN_CALL(_func) INSN(BPF_JMP | BPF_CALL, 0, 0, 0, _func)
+#define INSN_EXIT() INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+/* jump to the XDP_PASS exit. offset is resolved in xdp_prog_load() */
+#define JMP_PASS 0x7FFF
+#define INSN_JGT_PASS(_dst, _src) INSN(BPF_JMP | BPF_JGT | BPF_X, _dst, _src, JMP_PASS, 0)
+#define INSN_JNE_PASS(_dst, _imm) INSN(BPF_JMP | BPF_JNE | BPF_K, _dst, 0, JMP_PASS, _imm)
+#define INSN_JEQ_PASS(_dst, _imm) INSN(BPF_JMP | BPF_JEQ | BPF_K, _dst, 0, JMP_PASS, _imm)
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+static int xdp_map_create(uint32_t type, uint32_t key_size, uint32_t value_size
+                          , uint32_t max_entries)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int xdp_map_update(int map, const void *key, const void *value)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key = (uint64_t)(uintptr_t)key;
+    attr.value = (uint64_t)(uintptr_t)value;
+    attr.flags = BPF_ANY;
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static int xdp_map_delete(int map, const void *key)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key = (uint64_t)(uintptr_t)key;
+    return sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+}
+
+static int xdp_prog_load(udp_xdp_t *xdp)
+{
+    struct bpf_insn insns[] =
+    {
+        INSN_MOV(BPF_REG_6, BPF_REG_1),
+        /* bounds check */
+        INSN_LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data)),
+        INSN_LDX(BPF_W, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end)),
+        INSN_MOV(BPF_REG_4, BPF_REG_2),
+        INSN_ADD_IMM(BPF_REG_4, XDP_HEADER_SIZE),
+        INSN_JGT_PASS(BPF_REG_4, BPF_REG_3),
+        /* IPv4 without options, UDP, not fragmented */
+        INSN_LDX(BPF_H, BPF_REG_5, BPF_REG_2, 12),
+        INSN_JNE_PASS(BPF_REG_5, htons(0x0800)),
+        INSN_LDX(BPF_B, BPF_REG_5, BPF_REG_2, 14),
+        INSN_JNE_PASS(BPF_REG_5, 0x45),
+        INSN_LDX(BPF_B, BPF_REG_5, BPF_REG_2, 14 + 9),
+        INSN_JNE_PASS(BPF_REG_5, IPPROTO_UDP),
+        INSN_LDX(BPF_H, BPF_REG_5, BPF_REG_2, 14 + 6),
+        INSN_AND_IMM(BPF_REG_5, htons(0x3FFF)),
+        INSN_JNE_PASS(BPF_REG_5, 0),
+        /* key: destination address and port */
+        INSN_LDX(BPF_W, BPF_REG_5, BPF_REG_2, 14 + 16),
+        INSN_STX(BPF_W, BPF_REG_10, BPF_REG_5, -8),
+        INSN_LDX(BPF_H, BPF_REG_5, BPF_REG_2, 14 + 20 + 2),
+        INSN_STX(BPF_W, BPF_REG_10, BPF_REG_5, -4),
+        INSN_LD_MAP(BPF_REG_1, xdp->map_groups),
+        INSN_MOV(BPF_REG_2, BPF_REG_10),
+        INSN_ADD_IMM(BPF_REG_2, -8),
+        INSN_CALL(BPF_FUNC_map_lookup_elem),
+        INSN_JEQ_PASS(BPF_REG_0, 0),
+        /* redirect to the socket on the receiving queue or pass */
+        INSN_LD_MAP(BPF_REG_1, xdp->map_xsks),
+        INSN_LDX(BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index)),
+        INSN_MOV_IMM(BPF_REG_3, XDP_PASS),
+        INSN_CALL(BPF_FUNC_redirect_map),
+        INSN_EXIT(),
+        /* pass */
+        INSN_MOV_IMM(BPF_REG_0, XDP_PASS),
+        INSN_EXIT(),
+    };
+
+    const int count = sizeof(insns) / sizeof(insns[0]);
+    const int pass = count - 2;
+    for(int i = 0; i < count; ++i)
+    {
+        if(insns[i].off == JMP_PASS && BPF_CLASS(insns[i].code) == BPF_JMP)
+            insns[i].off = pass - i - 1;
+    }
+
+    static char log_buf[4096];
+    static const char license[] = "GPL";
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)insns;
+    attr.insn_cnt = count;
+    attr.license = (uint64_t)(uintptr_t)license;
+    attr.log_buf = (uint64_t)(uintptr_t)log_buf;
+    attr.log_size = sizeof(log_buf);
+    attr.log_level = 1;
+
+    log_buf[0] = '\0';
+    const int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if(fd == -1)
+        asc_log_error(MSG("failed to load XDP program [%s] %s"), strerror(errno), log_buf);
+
+    return fd;
+}
+
+/*
+ * oooo   oooo ooooooooooo ooooooooooo ooooo       ooooo oooo   oooo oooo   oooo
+ *  8888o  88   888    88  88  888  88  888         888   8888o  88   888  o88
+ *  88 888o88   888ooo8        888      888         888   88 888o88   888888
+ *  88   8888   888    oo      888      888      o  888   88   8888   888  88o
+ * o88o    88  o888ooo8888    o888o    o888ooooo88 o888o o88o    88  o888o o888o
+ *
+ */
+
+static bool xdp_link_set(udp_xdp_t *xdp, int prog)
+{
+    struct
+    {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+        char attrbuf[64];
+    } req;
+    memset(&req, 0, sizeof(req));
+
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nh.nlmsg_type = RTM_SETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.nh.nlmsg_seq = 1;
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index = xdp->ifindex;
+
+    struct rtattr *nest = (struct rtattr *)((uint8_t *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+    nest->rta_type = NLA_F_NESTED | IFLA_XDP;
+    nest->rta_len = RTA_LENGTH(0);
+
+    struct rtattr *rta = (struct rtattr *)((uint8_t *)nest + nest->rta_len);
+    rta->rta_type = IFLA_XDP_FD;
+    rta->rta_len = RTA_LENGTH(sizeof(int));
+    memcpy(RTA_DATA(rta), &prog, sizeof(int));
+    nest->rta_len += RTA_ALIGN(rta->rta_len);
+
+    uint32_t flags = xdp->flags;
+    if(prog != -1)
+        flags |= XDP_FLAGS_UPDATE_IF_NOEXIST;
+
+    rta = (struct rtattr *)((uint8_t *)nest + nest->rta_len);
+    rta->rta_type = IFLA_XDP_FLAGS;
+    rta->rta_len = RTA_LENGTH(sizeof(uint32_t));
+    memcpy(RTA_DATA(rta), &flags, sizeof(uint32_t));
+    nest->rta_len += RTA_ALIGN(rta->rta_len);
+
+    req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + nest->rta_len;
+
+    const int sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if(sock == -1)
+    {
+        asc_log_error(MSG("failed to open netlink socket [%s]"), strerror(errno));
+        return false;
+    }
+
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+
+    int error = 0;
+    if(sendto(sock, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) == -1)
+        error = errno;
+    else
+    {
+        uint8_t buffer[1024];
+        const ssize_t len = recv(sock, buffer, sizeof(buffer), 0);
+        const struct nlmsghdr *nh = (const struct nlmsghdr *)buffer;
+        if(len < 0)
+            error = errno;
+        else if(NLMSG_OK(nh, (size_t)len) && nh->nlmsg_type == NLMSG_ERROR)
+            error = -((const struct nlmsgerr *)NLMSG_DATA(nh))->error;
+    }
+    close(sock);
+
+    if(error != 0)
+    {
+        asc_log_error(MSG("failed to %s XDP program [%s]")
+                      , (prog != -1) ? "attach" : "detach", strerror(error));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ *  oooooooo8   ooooooo     oooooooo8 oooo   oooo ooooooooooo ooooooooooo
+ * 888        o888   888o o888     88  888  o88    888    88  88  888  88
+ *  888oooooo 888     888 888          888888      888ooo8        888
+ *         888 888o   o888 888o     oo  888  88o   888    oo      888
+ * o88oooo888    88ooo88    888oooo88  o888o o888o o888ooo8888    o888o
+ *
+ */
+
+/* number of the receiving queues. 1 if channels are not reported by the driver */
+static int xdp_queue_count(udp_xdp_t *xdp)
+{
+    struct ethtool_channels channels;
+    memset(&channels, 0, sizeof(channels));
+    channels.cmd = ETHTOOL_GCHANNELS;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    memcpy(ifr.ifr_name, xdp->ifname, sizeof(xdp->ifname));
+    ifr.ifr_data = (void *)&channels;
+
+    const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock == -1)
+        return 1;
+    const int r = ioctl(sock, SIOCETHTOOL, &ifr);
+    close(sock);
+
+    if(r == -1)
+        return 1;
+
+    const int count = (int)(channels.combined_count + channels.rx_count);
+    return (count > 0) ? count : 1;
+}
+
+static bool xdp_ring_map(  xdp_queue_t *q, xdp_ring_t *ring
+                         , const struct xdp_ring_offset *off, size_t entry_size
+                         , uint32_t size, off_t pgoff)
+{
+    ring->map_size = off->desc + size * entry_size;
+    ring->map = mmap(  NULL, ring->map_size, PROT_READ | PROT_WRITE
+                     , MAP_SHARED | MAP_POPULATE, q->fd, pgoff);
+    if(ring->map == MAP_FAILED)
+    {
+        ring->map = NULL;
+        return false;
+    }
+
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+    ring->ring = (uint8_t *)ring->map + off->desc;
+    ring->mask = size - 1;
+    return true;
+}
+
+static bool xdp_socket_open(udp_xdp_t *xdp, xdp_queue_t *q)
+{
+    q->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if(q->fd == -1)
+    {
+        asc_log_error(MSG("queue %d: failed to open AF_XDP socket [%s]")
+                      , q->queue, strerror(errno));
+        return false;
+    }
+
+    q->umem_size = XDP_FRAME_SIZE * q->frame_count;
+    q->umem = (uint8_t *)mmap(  NULL, q->umem_size, PROT_READ | PROT_WRITE
+                              , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(q->umem == MAP_FAILED)
+    {
+        q->umem = NULL;
+        asc_log_error(MSG("queue %d: failed to allocate UMEM [%s]"), q->queue, strerror(errno));
+        return false;
+    }
+
+    struct xdp_umem_reg mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = (uint64_t)(uintptr_t)q->umem;
+    mr.len = q->umem_size;
+    mr.chunk_size = XDP_FRAME_SIZE;
+
+    const int fill_size = q->frame_count;
+    const int completion_size = XDP_COMPLETION_SIZE;
+    const int rx_size = q->frame_count / 2;
+
+    if(  setsockopt(q->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) == -1
+       || setsockopt(q->fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(int)) == -1
+       || setsockopt(  q->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING
+                     , &completion_size, sizeof(int)) == -1
+       || setsockopt(q->fd, SOL_XDP, XDP_RX_RING, &rx_size, sizeof(int)) == -1)
+    {
+        asc_log_error(MSG("queue %d: failed to register UMEM [%s]"), q->queue, strerror(errno));
+        return false;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if(getsockopt(q->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1)
+    {
+        asc_log_error(MSG("queue %d: failed to get ring offsets [%s]"), q->queue, strerror(errno));
+        return false;
+    }
+
+    if(  !xdp_ring_map(  q, &q->fill, &off.fr, sizeof(uint64_t), fill_size
+                       , XDP_UMEM_PGOFF_FILL_RING)
+       || !xdp_ring_map(  q, &q->rx, &off.rx, sizeof(struct xdp_desc), rx_size
+                        , XDP_PGOFF_RX_RING))
+    {
+        asc_log_error(MSG("queue %d: failed to map rings [%s]"), q->queue, strerror(errno));
+        return false;
+    }
+
+    /* all frames are owned by the kernel */
+    uint64_t *fill = (uint64_t *)q->fill.ring;
+    for(uint32_t i = 0; i < q->frame_count; ++i)
+        fill[i] = i * XDP_FRAME_SIZE;
+    __atomic_store_n(q->fill.producer, q->frame_count, __ATOMIC_RELEASE);
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xdp->ifindex;
+    sxdp.sxdp_queue_id = q->queue;
+    if(xdp->flags & XDP_FLAGS_SKB_MODE)
+        sxdp.sxdp_flags = XDP_COPY;
+
+    if(bind(q->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == -1)
+    {
+        asc_log_error(MSG("queue %d: failed to bind AF_XDP socket [%s]")
+                      , q->queue, strerror(errno));
+        return false;
+    }
+
+    const uint32_t key = q->queue;
+    const uint32_t value = q->fd;
+    if(xdp_map_update(xdp->map_xsks, &key, &value) == -1)
+    {
+        asc_log_error(MSG("queue %d: failed to register AF_XDP socket [%s]")
+                      , q->queue, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * oooooooooo  ooooooooooo      o      ooooooooo
+ *  888    888  888    88      888      888    88o
+ *  888oooo88   888ooo8       8  88     888    888
+ *  888  88o    888    oo    8oooo88    888    888
+ * o888o  88o8 o888ooo8888 o88o  o888o o888ooo88
+ *
+ */
+
+static uint32_t member_hash(uint32_t addr, uint32_t port)
+{
+    return ((ntohl(addr) ^ (ntohs(port) << 16)) * 2654435761U);
+}
+
+static void table_rebuild(udp_xdp_t *xdp)
+{
+    uint32_t size = 16;
+    while(size < (uint32_t)xdp->member_count * 2)
+        size *= 2;
+
+    if(xdp->table_mask + 1 != size)
+    {
+        free(xdp->table);
+        xdp->table = (int *)malloc(size * sizeof(int));
+        xdp->table_mask = size - 1;
+    }
+    memset(xdp->table, 0, size * sizeof(int));
+
+    for(int i = 0; i < xdp->member_count; ++i)
+    {
+        const xdp_key_t *key = &xdp->member_list[i].key;
+        uint32_t slot = member_hash(key->addr, key->port) & xdp->table_mask;
+        while(xdp->table[slot] != 0)
+            slot = (slot + 1) & xdp->table_mask;
+        xdp->table[slot] = i + 1;
+    }
+}
+
+static xdp_member_t * member_find(udp_xdp_t *xdp, uint32_t addr, uint32_t port)
+{
+    uint32_t slot = member_hash(addr, port) & xdp->table_mask;
+    while(xdp->table[slot] != 0)
+    {
+        xdp_member_t *member = &xdp->member_list[xdp->table[slot] - 1];
+        if(member->key.addr == addr && member->key.port == port)
+            return member;
+        slot = (slot + 1) & xdp->table_mask;
+    }
+    return NULL;
+}
+
+static void xdp_destroy(udp_xdp_t *xdp);
+
+static void on_read(void *arg)
+{
+    xdp_queue_t *q = (xdp_queue_t *)arg;
+    udp_xdp_t *xdp = q->xdp;
+
+    uint32_t rx_cons = *q->rx.consumer;
+    const uint32_t rx_prod = __atomic_load_n(q->rx.producer, __ATOMIC_ACQUIRE);
+    if(rx_cons == rx_prod)
+        return;
+
+    uint32_t fill_prod = *q->fill.producer;
+    const struct xdp_desc *desc_list = (const struct xdp_desc *)q->rx.ring;
+    uint64_t *fill = (uint64_t *)q->fill.ring;
+
+    xdp->is_busy = true;
+
+    for(; rx_cons != rx_prod; ++rx_cons)
+    {
+        const struct xdp_desc *desc = &desc_list[rx_cons & q->rx.mask];
+        const uint8_t *frame = &q->umem[desc->addr];
+
+        if(!xdp->is_closed && desc->len >= XDP_HEADER_SIZE)
+        {
+            uint32_t saddr;
+            uint32_t addr;
+            uint16_t port;
+            memcpy(&saddr, &frame[14 + 12], sizeof(saddr));
+            memcpy(&addr, &frame[14 + 16], sizeof(addr));
+            memcpy(&port, &frame[14 + 20 + 2], sizeof(port));
+
+            const size_t udp_size = (frame[14 + 20 + 4] << 8) | frame[14 + 20 + 5];
+            size_t size = desc->len - XDP_HEADER_SIZE;
+            if(udp_size >= 8 && udp_size - 8 < size)
+                size = udp_size - 8;
+
+            /* program redirects the group from any sender */
+            const xdp_member_t *member = member_find(xdp, addr, port);
+            if(member && (member->source_addr == 0 || member->source_addr == saddr))
+                member->callback(member->arg, &frame[XDP_HEADER_SIZE], size, 0);
+        }
+
+        fill[fill_prod & q->fill.mask] = desc->addr - (desc->addr % XDP_FRAME_SIZE);
+        ++fill_prod;
+    }
+
+    __atomic_store_n(q->rx.consumer, rx_cons, __ATOMIC_RELEASE);
+    __atomic_store_n(q->fill.producer, fill_prod, __ATOMIC_RELEASE);
+
+    /* end of the batch */
+    for(int i = 0; i < xdp->member_count && !xdp->is_closed; ++i)
+    {
+        const xdp_member_t *member = &xdp->member_list[i];
+        member->callback(member->arg, NULL, 0, 0);
+    }
+
+    xdp->is_busy = false;
+
+    if(xdp->is_closed)
+        xdp_destroy(xdp);
+}
+
+static void xdp_destroy(udp_xdp_t *xdp)
+{
+    if(xdp_list)
+    {
+        asc_list_remove_item(xdp_list, xdp);
+        if(asc_list_size(xdp_list) == 0)
+        {
+            asc_list_destroy(xdp_list);
+            xdp_list = NULL;
+        }
+    }
+
+    if(xdp->is_attached)
+        xdp_link_set(xdp, -1);
+
+    for(int i = 0; i < xdp->queue_count; ++i)
+    {
+        xdp_queue_t *q = &xdp->queue_list[i];
+
+        if(q->event)
+            asc_event_close(q->event);
+
+        if(q->fd > 0)
+            close(q->fd);
+
+        if(q->rx.map)
+            munmap(q->rx.map, q->rx.map_size);
+        if(q->fill.map)
+            munmap(q->fill.map, q->fill.map_size);
+        if(q->umem)
+            munmap(q->umem, q->umem_size);
+    }
+
+    if(xdp->prog > 0)
+        close(xdp->prog);
+    if(xdp->map_groups > 0)
+        close(xdp->map_groups);
+    if(xdp->map_xsks > 0)
+        close(xdp->map_xsks);
+
+    if(xdp->sock)
+        asc_socket_close(xdp->sock);
+
+    free(xdp->localaddr);
+    free(xdp->queue_list);
+    free(xdp->member_list);
+    free(xdp->table);
+    free(xdp);
+}
+
+static udp_xdp_t * xdp_open(const char *ifname, bool is_native, const char *localaddr)
+{
+    udp_xdp_t *xdp = (udp_xdp_t *)calloc(1, sizeof(udp_xdp_t));
+    snprintf(xdp->ifname, sizeof(xdp->ifname), "%s", ifname);
+    xdp->flags = (is_native) ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    xdp->localaddr = (localaddr) ? strdup(localaddr) : NULL;
+    xdp->prog = -1;
+    xdp->map_xsks = -1;
+    xdp->map_groups = -1;
+
+    do
+    {
+        xdp->ifindex = if_nametoindex(ifname);
+        if(xdp->ifindex == 0)
+        {
+            asc_log_error(MSG("interface is not found"));
+            break;
+        }
+
+        const int queue_count = xdp_queue_count(xdp);
+        if(queue_count > XDP_QUEUES_MAX)
+        {
+            asc_log_error(MSG("too many receiving queues: %d"), queue_count);
+            break;
+        }
+
+        xdp->map_xsks = xdp_map_create(  BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t)
+                                       , sizeof(uint32_t), XDP_QUEUES_MAX);
+        xdp->map_groups = xdp_map_create(  BPF_MAP_TYPE_HASH, sizeof(xdp_key_t)
+                                         , sizeof(uint32_t), XDP_GROUPS_MAX);
+        if(xdp->map_xsks == -1 || xdp->map_groups == -1)
+        {
+            asc_log_error(MSG("failed to create BPF map [%s]"), strerror(errno));
+            break;
+        }
+
+        xdp->prog = xdp_prog_load(xdp);
+        if(xdp->prog == -1)
+            break;
+
+        uint32_t frame_count = XDP_FRAME_COUNT;
+        while(frame_count > XDP_FRAME_COUNT_MIN && frame_count * queue_count > XDP_FRAME_COUNT * 4)
+            frame_count /= 2;
+
+        xdp->queue_list = (xdp_queue_t *)calloc(queue_count, sizeof(xdp_queue_t));
+        for(; xdp->queue_count < queue_count; ++xdp->queue_count)
+        {
+            xdp_queue_t *q = &xdp->queue_list[xdp->queue_count];
+            q->xdp = xdp;
+            q->queue = xdp->queue_count;
+            q->fd = -1;
+            q->frame_count = frame_count;
+            if(!xdp_socket_open(xdp, q))
+                break;
+        }
+        if(xdp->queue_count != queue_count)
+        {
+            /* socket of the failed queue is released by xdp_destroy() */
+            ++xdp->queue_count;
+            break;
+        }
+
+        if(!xdp_link_set(xdp, xdp->prog))
+            break;
+        xdp->is_attached = true;
+
+        xdp->sock = asc_socket_open_udp4(xdp);
+
+        for(int i = 0; i < xdp->queue_count; ++i)
+        {
+            xdp_queue_t *q = &xdp->queue_list[i];
+            q->event = asc_event_init(q->fd, q);
+            asc_event_set_on_read(q->event, on_read);
+        }
+
+        table_rebuild(xdp);
+
+        if(!xdp_list)
+            xdp_list = asc_list_init();
+        asc_list_insert_tail(xdp_list, xdp);
+
+        asc_log_info(MSG("attached in %s mode on %d queues")
+                     , (is_native) ? "native" : "generic", xdp->queue_count);
+        return xdp;
+    } while(0);
+
+    xdp_destroy(xdp);
+    return NULL;
+}
+
+udp_xdp_t * udp_xdp_attach(  const char *ifname, bool is_native
+                           , const char *localaddr, const char *addr, int port
+                           , const char *source
+                           , udp_datagram_callback_t callback, void *arg)
+{
+    const uint32_t group = inet_addr(addr);
+    if(group == INADDR_NONE)
+        return NULL;
+
+    const uint32_t source_addr = (source) ? inet_addr(source) : 0;
+    if(source_addr == INADDR_NONE)
+        return NULL;
+
+    udp_xdp_t *xdp = NULL;
+    if(xdp_list)
+    {
+        asc_list_for(xdp_list)
+        {
+            udp_xdp_t *item = (udp_xdp_t *)asc_list_data(xdp_list);
+            if(!item->is_closed && !strcmp(item->ifname, ifname))
+            {
+                xdp = item;
+                break;
+            }
+        }
+    }
+
+    if(!xdp)
+    {
+        xdp = xdp_open(ifname, is_native, localaddr);
+        if(!xdp)
+            return NULL;
+    }
+
+    xdp_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.addr = group;
+    key.port = htons(port);
+
+    if(member_find(xdp, key.addr, key.port))
+    {
+        asc_log_error(MSG("group %s:%d is already in use"), addr, port);
+        return NULL;
+    }
+
+    const uint32_t value = 1;
+    if(xdp_map_update(xdp->map_groups, &key, &value) == -1)
+    {
+        asc_log_error(MSG("failed to add group %s:%d [%s]"), addr, port, strerror(errno));
+        if(xdp->member_count == 0)
+            xdp_destroy(xdp);
+        return NULL;
+    }
+
+    if(IN_MULTICAST(ntohl(group)))
+        asc_socket_multicast_add_membership(xdp->sock, addr, xdp->localaddr, source);
+
+    if(xdp->member_count == xdp->member_size)
+    {
+        xdp->member_size = (xdp->member_size > 0) ? xdp->member_size * 2 : 16;
+        xdp->member_list = (xdp_member_t *)realloc(
+            xdp->member_list, xdp->member_size * sizeof(xdp_member_t));
+    }
+
+    xdp_member_t *member = &xdp->member_list[xdp->member_count];
+    ++xdp->member_count;
+    member->key = key;
+    member->addr_str = addr;
+    member->source = source;
+    member->source_addr = source_addr;
+    member->callback = callback;
+    member->arg = arg;
+
+    table_rebuild(xdp);
+
+    return xdp;
+}
+
+void udp_xdp_detach(udp_xdp_t *xdp, void *arg)
+{
+    for(int i = 0; i < xdp->member_count; ++i)
+    {
+        xdp_member_t *member = &xdp->member_list[i];
+        if(member->arg != arg)
+            continue;
+
+        xdp_map_delete(xdp->map_groups, &member->key);
+        if(IN_MULTICAST(ntohl(member->key.addr)))
+        {
+            asc_socket_multicast_drop_membership(  xdp->sock, member->addr_str
+                                                 , xdp->localaddr, member->source);
+        }
+
+        --xdp->member_count;
+        if(i != xdp->member_count)
+            *member = xdp->member_list[xdp->member_count];
+        break;
+    }
+
+    table_rebuild(xdp);
+
+    if(xdp->member_count > 0)
+        return;
+
+    if(xdp->is_busy)
+        xdp->is_closed = true;
+    else
+        xdp_destroy(xdp);
+}
+
+bool udp_xdp_get_stats(udp_xdp_t *xdp, asc_socket_stats_t *stats)
+{
+    for(int i = 0; i < xdp->queue_count; ++i)
+    {
+        const xdp_queue_t *q = &xdp->queue_list[i];
+
+        struct xdp_statistics xs;
+        socklen_t optlen = sizeof(xs);
+        memset(&xs, 0, sizeof(xs));
+        if(getsockopt(q->fd, SOL_XDP, XDP_STATISTICS, &xs, &optlen) == -1)
+            return false;
+
+        const uint32_t rx_prod = __atomic_load_n(q->rx.producer, __ATOMIC_ACQUIRE);
+        const uint32_t rx_queue = rx_prod - *q->rx.consumer;
+
+        stats->rx_queue += rx_queue * XDP_FRAME_SIZE;
+        stats->rcvbuf += (q->rx.mask + 1) * XDP_FRAME_SIZE;
+        stats->rmem += rx_queue * XDP_FRAME_SIZE;
+        stats->drops += xs.rx_dropped + xs.rx_ring_full + xs.rx_invalid_descs;
+    }
+    return true;
+}
+
+#endif /* HAVE_XDP */
@@ -172,7 +172,7 @@ function start_analyze(instance, addr)
             astra.exit()
         end
 
-    elseif conf.format == "http" then
+    elseif conf.format == "http" or conf.format == "https" then
         conf.on_error = function(code, message)
             astra.exit()
         end
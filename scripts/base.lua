@@ -390,6 +390,13 @@ init_input_module.udp = function(conf)
             socket_size = conf.socket_size,
             renew = conf.renew,
             rtp = conf.rtp,
+            reorder = conf.reorder,
+            fec = conf.fec,
+            source = conf.source,
+            shared = conf.shared,
+            threads = conf.threads,
+            xdp = conf.xdp,
+            xdp_native = conf.xdp_native,
         })
     end
 
@@ -445,7 +452,7 @@ http_user_agent = "Astra"
 http_input_instance_list = {}
 
 init_input_module.http = function(conf)
-    local instance_id = conf.host .. ":" .. conf.port .. conf.path
+    local instance_id = conf.format .. "://" .. conf.host .. ":" .. conf.port .. conf.path
     local instance = http_input_instance_list[instance_id]
 
     if not instance then
@@ -465,6 +472,12 @@ init_input_module.http = function(conf)
             sync = conf.sync,
             timeout = conf.timeout,
             sctp = conf.sctp,
+            tls = (conf.format == "https"),
+            tls_verify = conf.tls_verify,
+            tls_ca = conf.tls_ca,
+            reconnect = conf.reconnect,
+            reconnect_max = conf.reconnect_max,
+            reconnect_timeout = conf.reconnect_timeout,
             headers = {
                 "User-Agent: " .. http_user_agent,
                 "Host: " .. conf.host .. ":" .. conf.port,
@@ -516,9 +529,10 @@ init_input_module.http = function(conf)
                     http_conf.host = o.host
                     http_conf.port = o.port
                     http_conf.path = o.path
+                    http_conf.tls = (o.format == "https")
                     http_conf.headers[2] = "Host: " .. o.host .. ":" .. o.port
 
-                    log.info("[" .. conf.name .. "] Redirect to http://" .. o.host .. ":" .. o.port .. o.path)
+                    log.info("[" .. conf.name .. "] Redirect to " .. o.format .. "://" .. o.host .. ":" .. o.port .. o.path)
                     instance.request = http_request(http_conf)
                 else
                     instance.on_error("HTTP Error: Redirect failed")
@@ -560,6 +574,9 @@ kill_input_module.http = function(module)
     end
 end
 
+init_input_module.https = init_input_module.http
+kill_input_module.https = kill_input_module.http
+
 -- ooooo         ooooooooo  ooooo  oooo oooooooooo
 --  888           888    88o 888    88   888    888
 --  888 ooooooooo 888    888  888  88    888oooo88
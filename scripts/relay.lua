@@ -49,6 +49,7 @@ function xproxy_init_client(server, client, request, path)
     end
 
     client_list[client_id] = {
+        server = server,
         client = client,
         addr = request.addr,
         path = path,
@@ -81,11 +82,30 @@ function render_stat_html()
     for client_id, client_stat in pairs(client_list) do
         local dt = ct - client_stat.st
         local uptime = string.format("%02d:%02d", (dt / 3600), (dt / 60) % 60)
+
+        -- stats are available while the stream is sent by http_upstream
+        local stats = client_stat.server:data(client_stat.client).stats
+        local bitrate, lag, rtt, retrans, skip = "-", "-", "-", "-", "-"
+        if stats then
+            bitrate = string.format("%d", stats.bitrate)
+            lag = string.format("%d", stats.lag / 1024)
+            if stats.rtt then
+                rtt = string.format("%.1f", stats.rtt)
+                retrans = string.format("%d", stats.retrans)
+            end
+            skip = string.format("%d", stats.skip)
+        end
+
         table_content = table_content .. "<tr>" ..
                         "<td>" .. i .. "</td>" ..
                         "<td>" .. client_stat.addr .. "</td>" ..
                         "<td>" .. client_stat.path .. "</td>" ..
                         "<td>" .. uptime .. "</td>" ..
+                        "<td>" .. bitrate .. "</td>" ..
+                        "<td>" .. lag .. "</td>" ..
+                        "<td>" .. rtt .. "</td>" ..
+                        "<td>" .. retrans .. "</td>" ..
+                        "<td>" .. skip .. "</td>" ..
                         "<td><a href=\"/stat/?close=" .. client_id .. "\">Disconnect</a></td>" ..
                         "</tr>\r\n"
         i = i + 1
@@ -99,7 +119,7 @@ function render_stat_html()
     <title>Astra Relay : Statistics</title>
     <style type="text/css">
 body { font-family: 'Helvetica Neue', Helvetica, Arial, sans-serif; color: #333333; }
-table { width: 600px; margin: auto; }
+table { width: 900px; margin: auto; }
 .brand { text-align: left; font-size: 18px; line-height: 20px; }
 .version { text-align: right; font-size: 14px; line-height: 20px; color: #888; }
     </style>
@@ -120,6 +140,11 @@ table { width: 600px; margin: auto; }
                 <th>IP</th>
                 <th>Source</th>
                 <th>Uptime</th>
+                <th>Kbit/s</th>
+                <th>Lag, Kb</th>
+                <th>RTT, ms</th>
+                <th>Retrans</th>
+                <th>Skips</th>
                 <th></th>
             </tr>
         </thead>
@@ -352,6 +377,12 @@ relay_allow_http = true
 
 relay_stat_pass = nil
 
+relay_max_clients = nil
+relay_max_clients_ip = nil
+relay_max_bitrate = nil
+relay_max_cpu = nil
+relay_max_lag = nil
+
 relay_script = nil
 
 function on_sighup()
@@ -367,6 +398,11 @@ options_usage = [[
     --no-udp            disable direct access the to UDP/RTP source
     --no-http           disable direct access the to HTTP source
     --pass              basic authentication for statistics. login:password
+    --max-clients       maximum number of the clients
+    --max-clients-ip    maximum number of the clients from one IP address
+    --max-bitrate       egress limit in Mbit/s
+    --max-cpu           main thread CPU limit in percent
+    --max-lag           event loop lag limit in milliseconds
     FILE                full path to the Lua-script
 ]]
 
@@ -416,6 +452,26 @@ options = {
         relay_stat_pass = "Basic " .. base64.encode(argv[idx + 1])
         return 1
     end,
+    ["--max-clients"] = function(idx)
+        relay_max_clients = tonumber(argv[idx + 1])
+        return 1
+    end,
+    ["--max-clients-ip"] = function(idx)
+        relay_max_clients_ip = tonumber(argv[idx + 1])
+        return 1
+    end,
+    ["--max-bitrate"] = function(idx)
+        relay_max_bitrate = tonumber(argv[idx + 1])
+        return 1
+    end,
+    ["--max-cpu"] = function(idx)
+        relay_max_cpu = tonumber(argv[idx + 1])
+        return 1
+    end,
+    ["--max-lag"] = function(idx)
+        relay_max_lag = tonumber(argv[idx + 1])
+        return 1
+    end,
     ["*"] = function(idx)
         relay_script = argv[idx]
         if utils.stat(relay_script).type ~= 'file' then
@@ -462,6 +518,11 @@ function main()
         addr = relay_addr,
         port = relay_port,
         server_name = "Astra Relay",
-        route = route
+        route = route,
+        max_clients = relay_max_clients,
+        max_clients_ip = relay_max_clients_ip,
+        max_bitrate = relay_max_bitrate,
+        max_cpu = relay_max_cpu,
+        max_lag = relay_max_lag,
     })
 end
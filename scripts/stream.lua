@@ -289,6 +289,36 @@ end
 -- 888o   o888           888    88   888    888 888
 --   88ooo88              888oo88   o888ooo88  o888o
 
+-- destinations from the URL: udp://239.0.0.1:1234#destinations=239.0.0.2:1234,239.0.0.3
+function parse_destinations(name, destinations)
+    if destinations == nil or type(destinations) == "table" then
+        return destinations
+    end
+
+    if type(destinations) ~= "string" then
+        log.error("[" .. name .. "] option 'destinations': list or string required")
+        return nil
+    end
+
+    local list = {}
+    for _, item in ipairs(destinations:split(",")) do
+        local d = {}
+        local b = item:find(":")
+        if b then
+            d.addr = item:sub(1, b - 1)
+            d.port = tonumber(item:sub(b + 1))
+            if not d.port then
+                log.error("[" .. name .. "] option 'destinations': wrong port: " .. item)
+                return nil
+            end
+        else
+            d.addr = item
+        end
+        table.insert(list, d)
+    end
+    return list
+end
+
 init_output_module.udp = function(channel_data, output_id)
     local output_data = channel_data.output[output_id]
     local localaddr = output_data.config.localaddr
@@ -306,6 +336,10 @@ init_output_module.udp = function(channel_data, output_id)
         rtp = (output_data.config.format == "rtp"),
         sync = output_data.config.sync,
         cbr = output_data.config.cbr,
+        fec_columns = output_data.config.fec_columns,
+        fec_rows = output_data.config.fec_rows,
+        destinations = parse_destinations(output_data.config.name,
+                                          output_data.config.destinations),
     })
 end
 
@@ -438,12 +472,27 @@ init_output_module.http = function(channel_data, output_id)
     local instance = http_output_instance_list[instance_id]
 
     if not instance then
+        if output_data.config.format == "https" and not output_data.config.tls_cert then
+            log.error("[" .. output_data.config.name .. "] option 'tls_cert' is required")
+            astra.abort()
+        end
+
         instance = http_server({
             addr = output_data.config.host,
             port = output_data.config.port,
             sctp = output_data.config.sctp,
+            tls_cert = output_data.config.tls_cert,
+            tls_key = output_data.config.tls_key,
+            max_clients = output_data.config.max_clients,
+            max_clients_ip = output_data.config.max_clients_ip,
+            max_bitrate = output_data.config.max_bitrate,
             route = {
-                { "/*", http_upstream({ callback = http_output_on_request }) },
+                { "/*", http_upstream({
+                    callback = http_output_on_request,
+                    shared = output_data.config.shared,
+                    splice = output_data.config.splice,
+                    slow_client = output_data.config.slow_client,
+                }) },
             },
             channel_list = {},
         })
@@ -487,6 +536,14 @@ kill_output_module.http = function(channel_data, output_id)
     output_data.channel_data = nil
 end
 
+init_output_module.https = function(channel_data, output_id)
+    init_output_module.http(channel_data, output_id)
+end
+
+kill_output_module.https = function(channel_data, output_id)
+    kill_output_module.http(channel_data, output_id)
+end
+
 --   ooooooo            oooo   oooo oooooooooo
 -- o888   888o           8888o  88   888    888
 -- 888     888 ooooooooo 88 888o88   888oooo88
@@ -681,7 +738,7 @@ function make_channel(channel_config)
         channel_data.clients = 1
     else
         for _, o in pairs(channel_data.output) do
-            if o.config.format ~= "http" or o.config.keep_active == true then
+            if (o.config.format ~= "http" and o.config.format ~= "https") or o.config.keep_active == true then
                 channel_data.clients = channel_data.clients + 1
             end
         end